@@ -46,7 +46,9 @@
  * @short_description: debugging support functions
  *
  * In addition to a simple debug output system, we have two distinct
- * profiling mechanisms for timing sections of code.
+ * profiling mechanisms for timing sections of code: #RBProfiler, which
+ * reports elapsed time through the debug output, and profile points,
+ * which are recorded as trace spans (see #rb-trace).
  */
 
 static void log_handler (const char *domain,
@@ -392,74 +394,17 @@ rb_profiler_free (RBProfiler *profiler)
 	g_free (profiler);
 }
 
-/* Profiling */
-
-static int profile_indent;
-
-static void
-profile_add_indent (int indent)
-{
-	profile_indent += indent;
-	if (profile_indent < 0) {
-		g_error ("You screwed up your indentation");
-	}
-}
-
 /**
  * rb_profile_start:
- * @msg: profile point message
+ * @msg: profile point message (must be a static string)
  *
- * Records a start point for profiling.
- * This profile mechanism operates by issuing file access
- * requests with filenames indicating the profile points.
- * Use 'strace -e access' to gather this information.
+ * Records a start point for profiling.  This begins a trace span
+ * (see #rb_trace_begin).
  */
 
 /**
  * rb_profile_end:
- * @msg: profile point message
+ * @msg: profile point message (must be a static string)
  *
  * Records an end point for profiling.  See @rb_profile_start.
  */
-
-/**
- * _rb_profile_log:
- * @func: call site function name
- * @file: call site file name
- * @line: call site line number
- * @indent: indent level for output
- * @msg1: message part 1
- * @msg2: message part 2
- *
- * Issues a file access request with a constructed filename.
- * Run rhythmbox under 'strace -ttt -e access' to show these profile
- * points.
- */
-void
-_rb_profile_log (const char *func,
-		 const char *file,
-		 int         line,
-		 int	     indent,
-		 const char *msg1,
-		 const char *msg2)
-{
-	char *str;
-
-	if (indent < 0) {
-		profile_add_indent (indent);
-	}
-
-	if (profile_indent == 0) {
-		str = g_strdup_printf ("MARK: [%s %s %d] %s %s", file, func, line, msg1 ? msg1 : "", msg2 ? msg2 : "");
-	} else {
-		str = g_strdup_printf ("MARK: %*c [%s %s %d] %s %s", profile_indent - 1, ' ', file, func, line, msg1 ? msg1 : "", msg2 ? msg2 : "");
-	}
-
-	access (str, F_OK);
-
-	g_free (str);
-
-	if (indent > 0) {
-		profile_add_indent (indent);
-	}
-}
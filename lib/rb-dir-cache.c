@@ -0,0 +1,337 @@
+/*
+ *  Copyright (C) 2011 the Rhythmbox authors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "rb-dir-cache.h"
+#include "rb-debug.h"
+
+/**
+ * SECTION:rb-dir-cache
+ * @short_description: persistent cache of directory modification times
+ *
+ * Records the modification time, number of children and subdirectory names
+ * of each directory visited while walking a directory tree.  When the
+ * tree is walked again, a directory whose modification time has not changed
+ * cannot have gained or lost any files, so only its subdirectories need to
+ * be visited.
+ *
+ * The cache is stored as a text file with one line per directory.  Directories
+ * that are not looked up or updated between loading and saving the cache are
+ * dropped when it is saved, as are directories that have been invalidated.
+ *
+ * All functions other than rb_dir_cache_new and rb_dir_cache_free may be
+ * called from any thread.
+ */
+
+typedef struct {
+	GTimeVal mtime;
+	guint child_count;
+	char **subdirs;
+	gboolean seen;
+} RBDirCacheEntry;
+
+struct _RBDirCache {
+	char *filename;
+	GMutex *lock;
+	GHashTable *dirs;
+	GHashTable *invalid;
+	gboolean dirty;
+};
+
+static void
+_entry_free (RBDirCacheEntry *entry)
+{
+	g_strfreev (entry->subdirs);
+	g_free (entry);
+}
+
+static void
+_load_line (RBDirCache *cache, const char *line)
+{
+	RBDirCacheEntry *entry;
+	char **bits;
+	int count;
+	int i;
+
+	bits = g_strsplit (line, "\t", -1);
+	count = g_strv_length (bits);
+	if (count < 4) {
+		g_strfreev (bits);
+		return;
+	}
+
+	entry = g_new0 (RBDirCacheEntry, 1);
+	entry->mtime.tv_sec = strtol (bits[1], NULL, 10);
+	entry->mtime.tv_usec = strtol (bits[2], NULL, 10);
+	entry->child_count = strtoul (bits[3], NULL, 10);
+	entry->subdirs = g_new0 (char *, count - 3);
+	for (i = 4; i < count; i++) {
+		entry->subdirs[i - 4] = g_uri_unescape_string (bits[i], NULL);
+	}
+
+	g_hash_table_replace (cache->dirs, g_strdup (bits[0]), entry);
+	g_strfreev (bits);
+}
+
+/**
+ * rb_dir_cache_new:
+ * @filename: path of the file to store the cache in
+ *
+ * Creates a directory cache, loading any existing contents from @filename.
+ *
+ * Return value: the new #RBDirCache
+ */
+RBDirCache *
+rb_dir_cache_new (const char *filename)
+{
+	RBDirCache *cache;
+	char *contents;
+	GError *error = NULL;
+
+	cache = g_new0 (RBDirCache, 1);
+	cache->filename = g_strdup (filename);
+	cache->lock = g_mutex_new ();
+	cache->dirs = g_hash_table_new_full (g_str_hash,
+					     g_str_equal,
+					     g_free,
+					     (GDestroyNotify) _entry_free);
+	cache->invalid = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	if (g_file_get_contents (filename, &contents, NULL, &error)) {
+		char **lines;
+		int i;
+
+		lines = g_strsplit (contents, "\n", -1);
+		for (i = 0; lines[i] != NULL; i++) {
+			_load_line (cache, lines[i]);
+		}
+		g_strfreev (lines);
+		g_free (contents);
+
+		rb_debug ("loaded %d directories from %s", g_hash_table_size (cache->dirs), filename);
+	} else {
+		rb_debug ("unable to load directory cache: %s", error->message);
+		g_clear_error (&error);
+	}
+
+	return cache;
+}
+
+/**
+ * rb_dir_cache_free:
+ * @cache: a #RBDirCache
+ *
+ * Frees the cache without saving it.
+ */
+void
+rb_dir_cache_free (RBDirCache *cache)
+{
+	g_hash_table_destroy (cache->dirs);
+	g_hash_table_destroy (cache->invalid);
+	g_mutex_free (cache->lock);
+	g_free (cache->filename);
+	g_free (cache);
+}
+
+static void
+_save_entry (const char *uri, RBDirCacheEntry *entry, GString *str)
+{
+	int i;
+
+	if (entry->seen == FALSE)
+		return;
+
+	g_string_append_printf (str, "%s\t%ld\t%ld\t%u",
+				uri,
+				entry->mtime.tv_sec,
+				entry->mtime.tv_usec,
+				entry->child_count);
+	for (i = 0; entry->subdirs[i] != NULL; i++) {
+		char *escaped;
+
+		escaped = g_uri_escape_string (entry->subdirs[i], NULL, FALSE);
+		g_string_append_c (str, '\t');
+		g_string_append (str, escaped);
+		g_free (escaped);
+	}
+	g_string_append_c (str, '\n');
+}
+
+static gboolean
+_remove_unseen (const char *uri, RBDirCacheEntry *entry, GHashTable *invalid)
+{
+	return (entry->seen == FALSE || g_hash_table_lookup (invalid, uri) != NULL);
+}
+
+/**
+ * rb_dir_cache_save:
+ * @cache: a #RBDirCache
+ * @error: returns error information
+ *
+ * Writes the cache to its file, if anything has changed since it was
+ * loaded.  Directories that have not been looked up or updated since
+ * the cache was loaded, and directories invalidated since it was last
+ * saved, are dropped.
+ *
+ * Return value: %TRUE if successful
+ */
+gboolean
+rb_dir_cache_save (RBDirCache *cache, GError **error)
+{
+	GString *str;
+	gboolean ret;
+	guint size;
+
+	g_mutex_lock (cache->lock);
+	size = g_hash_table_size (cache->dirs);
+	g_hash_table_foreach_remove (cache->dirs, (GHRFunc) _remove_unseen, cache->invalid);
+	g_hash_table_remove_all (cache->invalid);
+	if (size != g_hash_table_size (cache->dirs)) {
+		cache->dirty = TRUE;
+	}
+
+	if (cache->dirty == FALSE) {
+		g_mutex_unlock (cache->lock);
+		return TRUE;
+	}
+
+	str = g_string_new (NULL);
+	g_hash_table_foreach (cache->dirs, (GHFunc) _save_entry, str);
+	cache->dirty = FALSE;
+	g_mutex_unlock (cache->lock);
+
+	rb_debug ("saving directory cache to %s", cache->filename);
+	ret = g_file_set_contents (cache->filename, str->str, str->len, error);
+	g_string_free (str, TRUE);
+	return ret;
+}
+
+/**
+ * rb_dir_cache_lookup:
+ * @cache: a #RBDirCache
+ * @uri: URI of the directory
+ * @mtime: current modification time of the directory
+ * @child_count: returns the number of children the directory had
+ *
+ * Checks whether the directory is unchanged since it was last recorded
+ * in the cache.
+ *
+ * Return value: the names of the subdirectories of the directory if
+ * it is unchanged, otherwise NULL.  Free with g_strfreev.
+ */
+char **
+rb_dir_cache_lookup (RBDirCache *cache, const char *uri, const GTimeVal *mtime, guint *child_count)
+{
+	RBDirCacheEntry *entry;
+	char **subdirs = NULL;
+
+	g_mutex_lock (cache->lock);
+	entry = g_hash_table_lookup (cache->dirs, uri);
+	if (entry != NULL &&
+	    entry->mtime.tv_sec == mtime->tv_sec &&
+	    entry->mtime.tv_usec == mtime->tv_usec) {
+		entry->seen = TRUE;
+		subdirs = g_strdupv (entry->subdirs);
+		if (child_count != NULL) {
+			*child_count = entry->child_count;
+		}
+	}
+	g_mutex_unlock (cache->lock);
+
+	return subdirs;
+}
+
+/**
+ * rb_dir_cache_update:
+ * @cache: a #RBDirCache
+ * @uri: URI of the directory
+ * @mtime: modification time of the directory, read before listing its contents
+ * @child_count: number of children of the directory
+ * @subdirs: names of the subdirectories of the directory
+ *
+ * Records the current state of a directory in the cache.
+ *
+ * Directories modified within the last couple of seconds are not recorded,
+ * as further changes may be made without changing the modification time
+ * on file systems with coarse timestamps.
+ */
+void
+rb_dir_cache_update (RBDirCache *cache, const char *uri, const GTimeVal *mtime, guint child_count, char **subdirs)
+{
+	RBDirCacheEntry *entry;
+	GTimeVal now;
+
+	g_get_current_time (&now);
+
+	g_mutex_lock (cache->lock);
+	if (mtime->tv_sec >= now.tv_sec - 2) {
+		if (g_hash_table_remove (cache->dirs, uri)) {
+			cache->dirty = TRUE;
+		}
+		g_mutex_unlock (cache->lock);
+		return;
+	}
+
+	entry = g_new0 (RBDirCacheEntry, 1);
+	entry->mtime = *mtime;
+	entry->child_count = child_count;
+	if (subdirs != NULL) {
+		entry->subdirs = g_strdupv (subdirs);
+	} else {
+		entry->subdirs = g_new0 (char *, 1);
+	}
+	entry->seen = TRUE;
+	g_hash_table_replace (cache->dirs, g_strdup (uri), entry);
+	cache->dirty = TRUE;
+	g_mutex_unlock (cache->lock);
+}
+
+/**
+ * rb_dir_cache_invalidate:
+ * @cache: a #RBDirCache
+ * @uri: URI of the directory
+ *
+ * Marks a directory to be removed from the cache when it is next saved,
+ * so it will be listed again next time.  This can be used when processing
+ * of some of the files in the directory is not yet complete.
+ *
+ * The directory is only removed when the cache is saved, so this
+ * also applies if the directory is updated after it is invalidated,
+ * which happens when the files in it are processed while it's still
+ * being walked.
+ */
+void
+rb_dir_cache_invalidate (RBDirCache *cache, const char *uri)
+{
+	g_mutex_lock (cache->lock);
+	g_hash_table_insert (cache->invalid, g_strdup (uri), GINT_TO_POINTER (1));
+	g_mutex_unlock (cache->lock);
+}
@@ -752,19 +752,149 @@ rb_uri_make_hidden (const char *uri)
 	return ret;
 }
 
+/* number of threads used to walk directory trees asynchronously */
+#define RECURSE_WORKER_COUNT	4
+
+/* number of results passed to the main thread at a time */
+#define RECURSE_BATCH_SIZE	128
+
+static const char *recurse_attributes =
+	G_FILE_ATTRIBUTE_STANDARD_NAME ","
+	G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+	G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN ","
+	G_FILE_ATTRIBUTE_ID_FILE ","
+	G_FILE_ATTRIBUTE_UNIX_DEVICE ","
+	G_FILE_ATTRIBUTE_UNIX_INODE ","
+	G_FILE_ATTRIBUTE_ACCESS_CAN_READ;
+
+/* files that have already been visited, to avoid symlink loops */
+typedef struct {
+	GMutex *lock;
+	GHashTable *inodes;
+	GHashTable *ids;
+} RBUriRecurseHandled;
+
+typedef struct {
+	guint32 device;
+	guint64 inode;
+} RBUriRecurseInode;
+
+typedef struct {
+	GFile *file;
+	gboolean dir;
+} RBUriRecurseResult;
+
+typedef struct _RBUriRecurseWalker RBUriRecurseWalker;
+
+typedef struct {
+	RBUriRecurseWalker *walker;
+	int index;
+	GThread *thread;
+
+	GMutex *lock;
+	GQueue *dirs;
+
+	GArray *batch;
+} RBUriRecurseWorker;
+
 typedef struct {
 	char *uri;
 	GCancellable *cancel;
+	RBDirCache *cache;
 	RBUriRecurseFunc func;
 	gpointer user_data;
 	GDestroyNotify data_destroy;
 
 	GMutex *results_lock;
 	guint results_idle_id;
-	GList *file_results;
-	GList *dir_results;
+	GQueue *batches;
 } RBUriHandleRecursivelyAsyncData;
 
+struct _RBUriRecurseWalker {
+	RBUriHandleRecursivelyAsyncData *data;
+	RBUriRecurseHandled handled;
+	RBUriRecurseWorker workers[RECURSE_WORKER_COUNT];
+
+	/* number of directories queued or being enumerated */
+	GMutex *pending_lock;
+	GCond *pending_cond;
+	int pending;
+};
+
+static guint
+_inode_hash (gconstpointer v)
+{
+	const RBUriRecurseInode *i = v;
+	return (guint) (i->inode ^ (i->inode >> 32)) ^ i->device;
+}
+
+static gboolean
+_inode_equal (gconstpointer a, gconstpointer b)
+{
+	const RBUriRecurseInode *ia = a;
+	const RBUriRecurseInode *ib = b;
+	return (ia->inode == ib->inode && ia->device == ib->device);
+}
+
+static void
+_handled_init (RBUriRecurseHandled *handled, gboolean threaded)
+{
+	handled->lock = threaded ? g_mutex_new () : NULL;
+	handled->inodes = g_hash_table_new_full (_inode_hash, _inode_equal, g_free, NULL);
+	handled->ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
+
+static void
+_handled_destroy (RBUriRecurseHandled *handled)
+{
+	if (handled->lock != NULL) {
+		g_mutex_free (handled->lock);
+	}
+	g_hash_table_destroy (handled->inodes);
+	g_hash_table_destroy (handled->ids);
+}
+
+/* returns TRUE if the file has already been visited, otherwise marks it visited */
+static gboolean
+_handled_check (RBUriRecurseHandled *handled, GFileInfo *info)
+{
+	gboolean ret = FALSE;
+
+	if (handled->lock != NULL)
+		g_mutex_lock (handled->lock);
+
+	/* local files can be identified by device and inode, which
+	 * is much cheaper than the file ID string.
+	 */
+	if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_INODE)) {
+		RBUriRecurseInode key;
+
+		key.device = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_DEVICE);
+		key.inode = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE);
+		if (g_hash_table_lookup (handled->inodes, &key) != NULL) {
+			ret = TRUE;
+		} else {
+			g_hash_table_insert (handled->inodes, g_memdup (&key, sizeof (key)), GINT_TO_POINTER (1));
+		}
+	} else {
+		const char *file_id;
+
+		file_id = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILE);
+		if (file_id == NULL) {
+			/* have to hope for the best, I guess */
+		} else if (g_hash_table_lookup (handled->ids, file_id) != NULL) {
+			ret = TRUE;
+		} else {
+			g_hash_table_insert (handled->ids, g_strdup (file_id), GINT_TO_POINTER (1));
+		}
+	}
+
+	if (handled->lock != NULL)
+		g_mutex_unlock (handled->lock);
+
+	return ret;
+}
+
 static gboolean
 _should_process (GFileInfo *info)
 {
@@ -782,47 +912,70 @@ _should_process (GFileInfo *info)
 	return TRUE;
 }
 
+static gboolean
+_is_directory (GFileInfo *info)
+{
+	switch (g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_STANDARD_TYPE)) {
+	case G_FILE_TYPE_DIRECTORY:
+	case G_FILE_TYPE_MOUNTABLE:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/*
+ * Opens an enumerator for the directory.  If @dir turns out to be a
+ * single file, returns NULL and sets @is_file if it should be processed.
+ */
+static GFileEnumerator *
+_enumerate_dir (GFile *dir, GCancellable *cancel, gboolean *is_file)
+{
+	GFileEnumerator *files;
+	GFileInfo *info;
+	GError *error = NULL;
+	char *where;
+
+	*is_file = FALSE;
+	files = g_file_enumerate_children (dir, recurse_attributes, G_FILE_QUERY_INFO_NONE, cancel, &error);
+	if (error == NULL)
+		return files;
+
+	/* handle the case where we're given a single file to process */
+	if (error->code == G_IO_ERROR_NOT_DIRECTORY) {
+		g_clear_error (&error);
+		info = g_file_query_info (dir, recurse_attributes, G_FILE_QUERY_INFO_NONE, cancel, &error);
+		if (error == NULL) {
+			*is_file = _should_process (info);
+			g_object_unref (info);
+			return NULL;
+		}
+	}
+
+	where = g_file_get_uri (dir);
+	rb_debug ("error enumerating %s: %s", where, error->message);
+	g_free (where);
+	g_error_free (error);
+	return NULL;
+}
+
 static void
 _uri_handle_recurse (GFile *dir,
 		     GCancellable *cancel,
-		     GHashTable *handled,
+		     RBUriRecurseHandled *handled,
 		     RBUriRecurseFunc func,
 		     gpointer user_data)
 {
 	GFileEnumerator *files;
 	GFileInfo *info;
 	GError *error = NULL;
-	GFileType file_type;
-	const char *file_id;
-	gboolean file_handled;
-	const char *attributes = 
-		G_FILE_ATTRIBUTE_STANDARD_NAME ","
-		G_FILE_ATTRIBUTE_STANDARD_TYPE ","
-		G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN ","
-		G_FILE_ATTRIBUTE_ID_FILE ","
-		G_FILE_ATTRIBUTE_ACCESS_CAN_READ;
-
-	files = g_file_enumerate_children (dir, attributes, G_FILE_QUERY_INFO_NONE, cancel, &error);
-	if (error != NULL) {
-		char *where;
+	gboolean is_file;
 
-		/* handle the case where we're given a single file to process */
-		if (error->code == G_IO_ERROR_NOT_DIRECTORY) {
-			g_clear_error (&error);
-			info = g_file_query_info (dir, attributes, G_FILE_QUERY_INFO_NONE, cancel, &error);
-			if (error == NULL) {
-				if (_should_process (info)) {
-					(func) (dir, FALSE, user_data);
-				}
-				g_object_unref (info);
-				return;
-			}
+	files = _enumerate_dir (dir, cancel, &is_file);
+	if (files == NULL) {
+		if (is_file) {
+			(func) (dir, FALSE, user_data);
 		}
-
-		where = g_file_get_uri (dir);
-		rb_debug ("error enumerating %s: %s", where, error->message);
-		g_free (where);
-		g_error_free (error);
 		return;
 	}
 
@@ -835,6 +988,7 @@ _uri_handle_recurse (GFile *dir,
 		info = g_file_enumerator_next_file (files, cancel, &error);
 		if (error != NULL) {
 			rb_debug ("error enumerating files: %s", error->message);
+			g_clear_error (&error);
 			break;
 		} else if (info == NULL) {
 			break;
@@ -845,32 +999,9 @@ _uri_handle_recurse (GFile *dir,
 			continue;
 		}
 
-		/* already handled? */
-		file_id = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILE);
-		if (file_id == NULL) {
-			/* have to hope for the best, I guess */
-			file_handled = FALSE;
-		} else if (g_hash_table_lookup (handled, file_id) != NULL) {
-			file_handled = TRUE;
-		} else {
-			file_handled = FALSE;
-			g_hash_table_insert (handled, g_strdup (file_id), GINT_TO_POINTER (1));
-		}
-
-		/* type? */
-		file_type = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_STANDARD_TYPE);
-		switch (file_type) {
-		case G_FILE_TYPE_DIRECTORY:
-		case G_FILE_TYPE_MOUNTABLE:
-			is_dir = TRUE;
-			break;
-		
-		default:
-			is_dir = FALSE;
-			break;
-		}
+		if (_handled_check (handled, info) == FALSE) {
+			is_dir = _is_directory (info);
 
-		if (file_handled == FALSE) {
 			child = g_file_get_child (dir, g_file_info_get_name (info));
 			ret = (func) (child, is_dir, user_data);
 
@@ -906,43 +1037,52 @@ rb_uri_handle_recursively (const char *uri,
 			   gpointer user_data)
 {
 	GFile *file;
-	GHashTable *handled;
+	RBUriRecurseHandled handled;
 
 	file = g_file_new_for_uri (uri);
-	handled = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	_handled_init (&handled, FALSE);
 
-	_uri_handle_recurse (file, cancel, handled, func, user_data);
+	_uri_handle_recurse (file, cancel, &handled, func, user_data);
 
-	g_hash_table_destroy (handled);
+	_handled_destroy (&handled);
 	g_object_unref (file);
 }
 
+static void
+_free_result_batch (GArray *batch)
+{
+	guint i;
+
+	for (i = 0; i < batch->len; i++) {
+		g_object_unref (g_array_index (batch, RBUriRecurseResult, i).file);
+	}
+	g_array_free (batch, TRUE);
+}
 
 /* runs in main thread */
 static gboolean
 _recurse_async_idle_cb (RBUriHandleRecursivelyAsyncData *data)
 {
-	GList *ul, *dl;
+	GQueue *batches;
+	GArray *batch;
 
 	g_mutex_lock (data->results_lock);
+	batches = data->batches;
+	data->batches = g_queue_new ();
+	data->results_idle_id = 0;
+	g_mutex_unlock (data->results_lock);
 
-	for (ul = data->file_results, dl = data->dir_results;
-	     ul != NULL;
-	     ul = g_list_next (ul), dl = g_list_next (dl)) {
-		g_assert (dl != NULL);
+	while ((batch = g_queue_pop_head (batches)) != NULL) {
+		guint i;
 
-		data->func (G_FILE (ul->data), (GPOINTER_TO_INT (dl->data) == 1), data->user_data);
-		g_object_unref (ul->data);
+		for (i = 0; i < batch->len; i++) {
+			RBUriRecurseResult *result = &g_array_index (batch, RBUriRecurseResult, i);
+			data->func (result->file, result->dir, data->user_data);
+		}
+		_free_result_batch (batch);
 	}
-	g_assert (dl == NULL);
-
-	g_list_free (data->file_results);
-	data->file_results = NULL;
-	g_list_free (data->dir_results);
-	data->dir_results = NULL;
+	g_queue_free (batches);
 
-	data->results_idle_id = 0;
-	g_mutex_unlock (data->results_lock);
 	return FALSE;
 }
 
@@ -950,22 +1090,12 @@ _recurse_async_idle_cb (RBUriHandleRecursivelyAsyncData *data)
 static gboolean
 _recurse_async_data_free (RBUriHandleRecursivelyAsyncData *data)
 {
-	GList *i;
-
 	if (data->results_idle_id) {
 		g_source_remove (data->results_idle_id);
-		_recurse_async_idle_cb (data); /* process last results */
-	}
-
-	for (i = data->file_results; i != NULL; i = i->next) {
-		GFile *file = G_FILE (i->data);
-		g_object_unref (file);
 	}
+	_recurse_async_idle_cb (data); /* process last results */
 
-	g_list_free (data->file_results);
-	data->file_results = NULL;
-	g_list_free (data->dir_results);
-	data->dir_results = NULL;
+	g_queue_free (data->batches);
 
 	if (data->data_destroy != NULL) {
 		(data->data_destroy) (data->user_data);
@@ -976,32 +1106,337 @@ _recurse_async_data_free (RBUriHandleRecursivelyAsyncData *data)
 
 	g_free (data->uri);
 	g_mutex_free (data->results_lock);
+	g_free (data);
 	return FALSE;
 }
 
-/* runs in worker thread */
-static gboolean
-_recurse_async_cb (GFile *file, gboolean dir, RBUriHandleRecursivelyAsyncData *data)
+/* runs in worker threads */
+static void
+_recurse_flush_batch (RBUriRecurseWorker *worker)
 {
-	g_mutex_lock (data->results_lock);
+	RBUriHandleRecursivelyAsyncData *data = worker->walker->data;
+
+	if (worker->batch->len == 0)
+		return;
 
-	data->file_results = g_list_prepend (data->file_results, g_object_ref (file));
-	data->dir_results = g_list_prepend (data->dir_results, GINT_TO_POINTER (dir ? 1 : 0));
+	g_mutex_lock (data->results_lock);
+	g_queue_push_tail (data->batches, worker->batch);
 	if (data->results_idle_id == 0) {
-		g_idle_add ((GSourceFunc)_recurse_async_idle_cb, data);
+		data->results_idle_id = g_idle_add ((GSourceFunc)_recurse_async_idle_cb, data);
 	}
-
 	g_mutex_unlock (data->results_lock);
+
+	worker->batch = g_array_sized_new (FALSE, FALSE, sizeof (RBUriRecurseResult), RECURSE_BATCH_SIZE);
+}
+
+static void
+_recurse_add_result (RBUriRecurseWorker *worker, GFile *file, gboolean dir)
+{
+	RBUriRecurseResult result;
+
+	result.file = g_object_ref (file);
+	result.dir = dir;
+	g_array_append_val (worker->batch, result);
+
+	if (worker->batch->len >= RECURSE_BATCH_SIZE)
+		_recurse_flush_batch (worker);
+}
+
+static void
+_recurse_push_dir (RBUriRecurseWorker *worker, GFile *dir)
+{
+	RBUriRecurseWalker *walker = worker->walker;
+
+	/* count it before anyone can take it, so the walk can't
+	 * appear to be finished while it's in the queue.
+	 */
+	g_mutex_lock (walker->pending_lock);
+	walker->pending++;
+	g_mutex_unlock (walker->pending_lock);
+
+	g_mutex_lock (worker->lock);
+	g_queue_push_tail (worker->dirs, g_object_ref (dir));
+	g_mutex_unlock (worker->lock);
+
+	g_cond_signal (walker->pending_cond);
+}
+
+static GFile *
+_recurse_next_dir (RBUriRecurseWorker *worker)
+{
+	RBUriRecurseWalker *walker = worker->walker;
+	GFile *dir;
+	int i;
+
+	while (TRUE) {
+		/* take the most recently found directory from our own queue */
+		g_mutex_lock (worker->lock);
+		dir = g_queue_pop_tail (worker->dirs);
+		g_mutex_unlock (worker->lock);
+		if (dir != NULL)
+			return dir;
+
+		/* otherwise, steal the oldest directory from another worker,
+		 * which is likely to be the root of a large subtree.
+		 */
+		for (i = 1; i < RECURSE_WORKER_COUNT; i++) {
+			RBUriRecurseWorker *victim;
+
+			victim = &walker->workers[(worker->index + i) % RECURSE_WORKER_COUNT];
+			g_mutex_lock (victim->lock);
+			dir = g_queue_pop_head (victim->dirs);
+			g_mutex_unlock (victim->lock);
+			if (dir != NULL)
+				return dir;
+		}
+
+		/* nothing to do right now, so pass on what we've got */
+		_recurse_flush_batch (worker);
+
+		g_mutex_lock (walker->pending_lock);
+		if (walker->pending == 0) {
+			g_mutex_unlock (walker->pending_lock);
+			return NULL;
+		} else {
+			GTimeVal timeout;
+
+			g_get_current_time (&timeout);
+			g_time_val_add (&timeout, G_USEC_PER_SEC / 100);
+			g_cond_timed_wait (walker->pending_cond, walker->pending_lock, &timeout);
+		}
+		g_mutex_unlock (walker->pending_lock);
+	}
+}
+
+static void
+_recurse_child_dir (RBUriRecurseWorker *worker, GFile *child)
+{
+	_recurse_add_result (worker, child, TRUE);
+	_recurse_push_dir (worker, child);
+}
+
+/*
+ * Visits the subdirectories of a directory that hasn't changed since it
+ * was recorded in the directory cache, skipping the files in it.
+ */
+static void
+_recurse_cached (RBUriRecurseWorker *worker, GFile *dir, char **subdirs)
+{
+	RBUriHandleRecursivelyAsyncData *data = worker->walker->data;
+	int i;
+
+	for (i = 0; subdirs[i] != NULL; i++) {
+		GFile *child;
+		GFileInfo *info;
+
+		child = g_file_get_child (dir, subdirs[i]);
+		info = g_file_query_info (child, recurse_attributes, G_FILE_QUERY_INFO_NONE, data->cancel, NULL);
+		if (info != NULL) {
+			if (_should_process (info) &&
+			    _is_directory (info) &&
+			    _handled_check (&worker->walker->handled, info) == FALSE) {
+				_recurse_child_dir (worker, child);
+			}
+			g_object_unref (info);
+		}
+		g_object_unref (child);
+	}
+}
+
+static gboolean
+_get_dir_mtime (GFile *dir, GCancellable *cancel, GTimeVal *mtime)
+{
+	GFileInfo *info;
+
+	info = g_file_query_info (dir,
+				  G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+				  G_FILE_QUERY_INFO_NONE,
+				  cancel,
+				  NULL);
+	if (info == NULL)
+		return FALSE;
+
+	if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) == FALSE) {
+		g_object_unref (info);
+		return FALSE;
+	}
+
+	g_file_info_get_modification_time (info, mtime);
+	g_object_unref (info);
 	return TRUE;
 }
 
+static void
+_recurse_enumerate (RBUriRecurseWorker *worker, GFile *dir)
+{
+	RBUriHandleRecursivelyAsyncData *data = worker->walker->data;
+	GFileEnumerator *files;
+	GFileInfo *info;
+	GError *error = NULL;
+	gboolean is_file;
+	char *uri = NULL;
+	GTimeVal mtime;
+	GPtrArray *subdirs = NULL;
+	guint child_count = 0;
+
+	if (data->cancel != NULL && g_cancellable_is_cancelled (data->cancel))
+		return;
+
+	/* the modification time has to be read before the directory is listed,
+	 * so anything added while we're listing it will be found next time.
+	 */
+	if (data->cache != NULL && _get_dir_mtime (dir, data->cancel, &mtime)) {
+		char **cached;
+
+		uri = g_file_get_uri (dir);
+		cached = rb_dir_cache_lookup (data->cache, uri, &mtime, &child_count);
+		if (cached != NULL) {
+			rb_debug ("%s is unchanged (%u children)", uri, child_count);
+			_recurse_cached (worker, dir, cached);
+			g_strfreev (cached);
+			g_free (uri);
+			return;
+		}
+		subdirs = g_ptr_array_new ();
+	}
+
+	files = _enumerate_dir (dir, data->cancel, &is_file);
+	if (files == NULL) {
+		if (is_file) {
+			_recurse_add_result (worker, dir, FALSE);
+		}
+		if (subdirs != NULL) {
+			g_ptr_array_free (subdirs, TRUE);
+		}
+		g_free (uri);
+		return;
+	}
+
+	while (1) {
+		GFile *child;
+		gboolean is_dir;
+
+		info = g_file_enumerator_next_file (files, data->cancel, &error);
+		if (error != NULL) {
+			rb_debug ("error enumerating files: %s", error->message);
+			g_clear_error (&error);
+			/* don't record a partial listing */
+			if (subdirs != NULL) {
+				g_ptr_array_foreach (subdirs, (GFunc) g_free, NULL);
+				g_ptr_array_free (subdirs, TRUE);
+				subdirs = NULL;
+			}
+			break;
+		} else if (info == NULL) {
+			break;
+		}
+
+		child_count++;
+		if (_should_process (info)) {
+			is_dir = _is_directory (info);
+			if (is_dir && subdirs != NULL) {
+				g_ptr_array_add (subdirs, g_strdup (g_file_info_get_name (info)));
+			}
+
+			if (_handled_check (&worker->walker->handled, info) == FALSE) {
+				child = g_file_get_child (dir, g_file_info_get_name (info));
+				if (is_dir) {
+					_recurse_child_dir (worker, child);
+				} else {
+					_recurse_add_result (worker, child, FALSE);
+				}
+				g_object_unref (child);
+			}
+		}
+
+		g_object_unref (info);
+	}
+
+	g_object_unref (files);
+
+	if (subdirs != NULL) {
+		g_ptr_array_add (subdirs, NULL);
+		rb_dir_cache_update (data->cache, uri, &mtime, child_count, (char **) subdirs->pdata);
+		g_ptr_array_foreach (subdirs, (GFunc) g_free, NULL);
+		g_ptr_array_free (subdirs, TRUE);
+	}
+	g_free (uri);
+}
+
+static gpointer
+_recurse_worker_main (RBUriRecurseWorker *worker)
+{
+	RBUriRecurseWalker *walker = worker->walker;
+	GFile *dir;
+
+	while ((dir = _recurse_next_dir (worker)) != NULL) {
+		_recurse_enumerate (worker, dir);
+		g_object_unref (dir);
+
+		g_mutex_lock (walker->pending_lock);
+		walker->pending--;
+		if (walker->pending == 0) {
+			g_cond_broadcast (walker->pending_cond);
+		}
+		g_mutex_unlock (walker->pending_lock);
+	}
+
+	_recurse_flush_batch (worker);
+	return NULL;
+}
+
 static gpointer
 _recurse_async_func (RBUriHandleRecursivelyAsyncData *data)
 {
-	rb_uri_handle_recursively (data->uri,
-				   data->cancel,
-				   (RBUriRecurseFunc) _recurse_async_cb,
-				   data);
+	RBUriRecurseWalker walker;
+	GFile *root;
+	int i;
+
+	walker.data = data;
+	walker.pending = 0;
+	walker.pending_lock = g_mutex_new ();
+	walker.pending_cond = g_cond_new ();
+	_handled_init (&walker.handled, TRUE);
+
+	for (i = 0; i < RECURSE_WORKER_COUNT; i++) {
+		RBUriRecurseWorker *worker = &walker.workers[i];
+
+		worker->walker = &walker;
+		worker->index = i;
+		worker->thread = NULL;
+		worker->lock = g_mutex_new ();
+		worker->dirs = g_queue_new ();
+		worker->batch = g_array_sized_new (FALSE, FALSE, sizeof (RBUriRecurseResult), RECURSE_BATCH_SIZE);
+	}
+
+	root = g_file_new_for_uri (data->uri);
+	_recurse_push_dir (&walker.workers[0], root);
+	g_object_unref (root);
+
+	/* this thread acts as the first worker */
+	for (i = 1; i < RECURSE_WORKER_COUNT; i++) {
+		walker.workers[i].thread = g_thread_create ((GThreadFunc) _recurse_worker_main,
+							    &walker.workers[i],
+							    TRUE,
+							    NULL);
+	}
+	_recurse_worker_main (&walker.workers[0]);
+
+	for (i = 0; i < RECURSE_WORKER_COUNT; i++) {
+		RBUriRecurseWorker *worker = &walker.workers[i];
+
+		if (worker->thread != NULL) {
+			g_thread_join (worker->thread);
+		}
+		g_assert (g_queue_is_empty (worker->dirs));
+		g_queue_free (worker->dirs);
+		g_mutex_free (worker->lock);
+		_free_result_batch (worker->batch);
+	}
+
+	_handled_destroy (&walker.handled);
+	g_cond_free (walker.pending_cond);
+	g_mutex_free (walker.pending_lock);
 
 	g_idle_add ((GSourceFunc)_recurse_async_data_free, data);
 	return NULL;
@@ -1019,8 +1454,9 @@ _recurse_async_func (RBUriHandleRecursivelyAsyncData *data)
  * by @uri, or if @uri identifies a file, calls it once
  * with that.
  *
- * Directory recursion happens on a separate thread, but the callbacks
- * are called on the main thread.
+ * Directory recursion happens on several separate threads, which take
+ * subdirectories from each other as they run out of work.  The callbacks
+ * are called on the main thread, in batches, in no particular order.
  *
  * If non-NULL, @destroy_data will be called once all files have been
  * processed, or when the operation is cancelled.
@@ -1031,6 +1467,34 @@ rb_uri_handle_recursively_async (const char *uri,
 			         RBUriRecurseFunc func,
 			         gpointer user_data,
 				 GDestroyNotify data_destroy)
+{
+	rb_uri_handle_recursively_cached_async (uri, cancel, NULL, func, user_data, data_destroy);
+}
+
+/**
+ * rb_uri_handle_recursively_cached_async:
+ * @uri: the URI to visit
+ * @cancel: a #GCancellable to allow cancellation
+ * @cache: an optional #RBDirCache
+ * @func: callback function
+ * @user_data: data to pass to callback
+ * @data_destroy: function to call to free @user_data
+ *
+ * Like #rb_uri_handle_recursively_async, except that directories
+ * that have not been modified since they were recorded in @cache
+ * are not listed.  @func is still called for their subdirectories,
+ * but not for the files in them.  @cache is updated with any
+ * directories that have changed.
+ *
+ * The caller must keep @cache alive until @data_destroy is called.
+ */
+void
+rb_uri_handle_recursively_cached_async (const char *uri,
+					GCancellable *cancel,
+					RBDirCache *cache,
+					RBUriRecurseFunc func,
+					gpointer user_data,
+					GDestroyNotify data_destroy)
 {
 	RBUriHandleRecursivelyAsyncData *data = g_new0 (RBUriHandleRecursivelyAsyncData, 1);
 	
@@ -1039,9 +1503,11 @@ rb_uri_handle_recursively_async (const char *uri,
 	if (cancel != NULL) {
 		data->cancel = g_object_ref (cancel);
 	}
+	data->cache = cache;
 	data->data_destroy = data_destroy;
 
 	data->results_lock = g_mutex_new ();
+	data->batches = g_queue_new ();
 	data->func = func;
 	data->user_data = user_data;
 
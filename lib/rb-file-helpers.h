@@ -31,6 +31,8 @@
 #include <glib.h>
 #include <gio/gio.h>
 
+#include <lib/rb-dir-cache.h>
+
 G_BEGIN_DECLS
 
 const char *	rb_file			(const char *filename);
@@ -79,6 +81,13 @@ void		rb_uri_handle_recursively_async(const char *uri,
 						gpointer user_data,
 						GDestroyNotify data_destroy);
 
+void		rb_uri_handle_recursively_cached_async (const char *uri,
+							GCancellable *cancel,
+							RBDirCache *cache,
+							RBUriRecurseFunc func,
+							gpointer user_data,
+							GDestroyNotify data_destroy);
+
 char*		rb_uri_append_path	(const char *uri,
 					 const char *path);
 char*		rb_uri_append_uri	(const char *uri,
@@ -0,0 +1,333 @@
+/*
+ *  Copyright (C) 2011 the Rhythmbox authors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+
+#include "rb-text-store.h"
+#include "rb-debug.h"
+
+/**
+ * SECTION:rb-text-store
+ * @short_description: file-backed storage for long strings
+ *
+ * Holds strings in a temporary file rather than in memory, for text
+ * that is rarely looked at, such as podcast descriptions.  Each string
+ * is identified by a 64 bit key encoding its position and length in
+ * the file, so callers don't need to keep anything else in memory to
+ * find it again.
+ *
+ * The file is removed as soon as it is created, so it does not outlive
+ * the process.  Space freed by removing strings is reused for strings
+ * added later, and space freed at the end of the file is given back by
+ * truncating it.
+ *
+ * All functions other than rb_text_store_new and rb_text_store_free may be
+ * called from any thread.
+ */
+
+/* keys hold the length in the low bits and the offset above it */
+#define LENGTH_BITS	24
+#define MAX_LENGTH	((G_GUINT64_CONSTANT (1) << LENGTH_BITS) - 1)
+#define MAX_OFFSET	((G_GUINT64_CONSTANT (1) << (64 - LENGTH_BITS)) - 1)
+
+typedef struct {
+	guint64 offset;
+	guint64 length;
+} FreeRange;
+
+struct _RBTextStore {
+	int fd;
+	guint64 size;
+	GList *free_ranges;		/* sorted by offset, never adjacent */
+	GMutex *lock;
+};
+
+static void
+free_range_add (RBTextStore *store, guint64 offset, guint64 length)
+{
+	GList *l;
+	GList *prev = NULL;
+	FreeRange *range;
+
+	for (l = store->free_ranges; l != NULL; l = l->next) {
+		range = l->data;
+		if (range->offset > offset)
+			break;
+		prev = l;
+	}
+
+	/* merge with the range before and after if they touch */
+	if (prev != NULL) {
+		range = prev->data;
+		if (range->offset + range->length == offset) {
+			range->length += length;
+			if (l != NULL && offset + length == ((FreeRange *)l->data)->offset) {
+				range->length += ((FreeRange *)l->data)->length;
+				g_slice_free (FreeRange, l->data);
+				store->free_ranges = g_list_delete_link (store->free_ranges, l);
+			}
+			return;
+		}
+	}
+	if (l != NULL) {
+		range = l->data;
+		if (offset + length == range->offset) {
+			range->offset = offset;
+			range->length += length;
+			return;
+		}
+	}
+
+	range = g_slice_new0 (FreeRange);
+	range->offset = offset;
+	range->length = length;
+	if (l != NULL) {
+		store->free_ranges = g_list_insert_before (store->free_ranges, l, range);
+	} else {
+		store->free_ranges = g_list_append (store->free_ranges, range);
+	}
+}
+
+static gboolean
+free_range_take (RBTextStore *store, guint64 length, guint64 *offset)
+{
+	GList *l;
+
+	for (l = store->free_ranges; l != NULL; l = l->next) {
+		FreeRange *range = l->data;
+		if (range->length < length)
+			continue;
+
+		*offset = range->offset;
+		range->offset += length;
+		range->length -= length;
+		if (range->length == 0) {
+			g_slice_free (FreeRange, range);
+			store->free_ranges = g_list_delete_link (store->free_ranges, l);
+		}
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * rb_text_store_new:
+ * @dir: directory to create the store file in
+ * @error: returns error information
+ *
+ * Creates a new, empty text store.
+ *
+ * Return value: the new #RBTextStore, or NULL if the file could not be created
+ */
+RBTextStore *
+rb_text_store_new (const char *dir, GError **error)
+{
+	RBTextStore *store;
+	char *filename;
+	int fd;
+
+	filename = g_build_filename (dir, "text-store-XXXXXX", NULL);
+	fd = g_mkstemp (filename);
+	if (fd == -1) {
+		int err = errno;
+		g_set_error (error,
+			     G_FILE_ERROR,
+			     g_file_error_from_errno (err),
+			     "Unable to create %s: %s",
+			     filename,
+			     g_strerror (err));
+		g_free (filename);
+		return NULL;
+	}
+	g_unlink (filename);
+	rb_debug ("created text store in %s", dir);
+	g_free (filename);
+
+	store = g_new0 (RBTextStore, 1);
+	store->fd = fd;
+	store->lock = g_mutex_new ();
+	return store;
+}
+
+/**
+ * rb_text_store_free:
+ * @store: a #RBTextStore
+ *
+ * Frees the store, discarding its contents.
+ */
+void
+rb_text_store_free (RBTextStore *store)
+{
+	GList *l;
+
+	close (store->fd);
+	for (l = store->free_ranges; l != NULL; l = l->next) {
+		g_slice_free (FreeRange, l->data);
+	}
+	g_list_free (store->free_ranges);
+	g_mutex_free (store->lock);
+	g_free (store);
+}
+
+/**
+ * rb_text_store_add:
+ * @store: a #RBTextStore
+ * @text: the string to store
+ *
+ * Adds a string to the store, reusing space left by removed strings
+ * where possible.  Empty strings, very long strings and strings that
+ * can't be written to the file are not stored.
+ *
+ * Return value: the key for the string, or 0 if it was not stored
+ */
+guint64
+rb_text_store_add (RBTextStore *store, const char *text)
+{
+	guint64 offset;
+	gsize length;
+	gsize done = 0;
+	gboolean reused;
+
+	length = strlen (text);
+	if (length == 0 || length > MAX_LENGTH)
+		return 0;
+
+	g_mutex_lock (store->lock);
+	reused = free_range_take (store, length, &offset);
+	if (reused == FALSE) {
+		offset = store->size;
+		if (offset + length > MAX_OFFSET) {
+			g_mutex_unlock (store->lock);
+			return 0;
+		}
+	}
+
+	while (done < length) {
+		ssize_t r;
+
+		r = pwrite (store->fd, text + done, length - done, offset + done);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			rb_debug ("unable to write to text store: %s", g_strerror (errno));
+			if (reused)
+				free_range_add (store, offset, length);
+			g_mutex_unlock (store->lock);
+			return 0;
+		}
+		done += r;
+	}
+	if (reused == FALSE)
+		store->size += length;
+	g_mutex_unlock (store->lock);
+
+	return (offset << LENGTH_BITS) | length;
+}
+
+/**
+ * rb_text_store_get:
+ * @store: a #RBTextStore
+ * @key: the key returned when the string was added
+ *
+ * Reads a string back from the store.
+ *
+ * Return value: the string, or NULL if it could not be read.  Free with g_free.
+ */
+char *
+rb_text_store_get (RBTextStore *store, guint64 key)
+{
+	guint64 offset;
+	gsize length;
+	gsize done = 0;
+	char *text;
+
+	offset = key >> LENGTH_BITS;
+	length = key & MAX_LENGTH;
+
+	text = g_malloc (length + 1);
+	while (done < length) {
+		ssize_t r;
+
+		r = pread (store->fd, text + done, length - done, offset + done);
+		if (r <= 0) {
+			if (r < 0 && errno == EINTR)
+				continue;
+			rb_debug ("unable to read from text store: %s", r < 0 ? g_strerror (errno) : "end of file");
+			g_free (text);
+			return NULL;
+		}
+		done += r;
+	}
+	text[length] = '\0';
+
+	return text;
+}
+
+/**
+ * rb_text_store_remove:
+ * @store: a #RBTextStore
+ * @key: the key returned when the string was added
+ *
+ * Removes a string from the store, so its space can be reused.  The key
+ * must not be used again afterwards.
+ */
+void
+rb_text_store_remove (RBTextStore *store, guint64 key)
+{
+	guint64 offset;
+	gsize length;
+	FreeRange *last;
+	GList *l;
+
+	offset = key >> LENGTH_BITS;
+	length = key & MAX_LENGTH;
+	if (length == 0)
+		return;
+
+	g_mutex_lock (store->lock);
+	free_range_add (store, offset, length);
+
+	/* free space at the end of the file doesn't need to be kept */
+	l = g_list_last (store->free_ranges);
+	last = l->data;
+	if (last->offset + last->length == store->size) {
+		store->size = last->offset;
+		g_slice_free (FreeRange, last);
+		store->free_ranges = g_list_delete_link (store->free_ranges, l);
+
+		if (ftruncate (store->fd, store->size) < 0) {
+			rb_debug ("unable to truncate text store: %s", g_strerror (errno));
+		}
+	}
+	g_mutex_unlock (store->lock);
+}
@@ -0,0 +1,323 @@
+/*
+ *  Copyright (C) 2011 the Rhythmbox authors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+#include "config.h"
+
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+
+#include "rb-trace.h"
+#include "rb-debug.h"
+
+/**
+ * SECTION:rb-trace
+ * @short_description: lightweight tracing of nested spans
+ *
+ * Records the start and end times of spans of code (see #rb_trace_begin and
+ * #rb_trace_end) into a fixed size ring buffer belonging to the calling thread,
+ * so recording an event never takes a lock.  The buffers can be written out in
+ * the Chrome trace event JSON format, which can be loaded into chrome://tracing
+ * or Perfetto, by calling #rb_trace_dump or by sending the process SIGUSR2.
+ *
+ * Span names must be static strings, as only the pointer is recorded.
+ *
+ * Buffers belonging to threads that have exited are handed on to new threads,
+ * so a thread ID in the trace identifies a buffer rather than a single thread.
+ */
+
+/* number of events kept per thread; must be a power of two */
+#define RB_TRACE_BUFFER_SIZE	4096
+
+typedef struct {
+	gint64 time;
+	const char *name;
+	char phase;
+} RBTraceEvent;
+
+typedef struct {
+	guint tid;
+	gboolean in_use;
+	volatile gint head;
+	volatile gint wrapped;
+	RBTraceEvent events[RB_TRACE_BUFFER_SIZE];
+} RBTraceBuffer;
+
+static GStaticMutex trace_lock = G_STATIC_MUTEX_INIT;
+static GStaticPrivate trace_buffer_key = G_STATIC_PRIVATE_INIT;
+static GList *trace_buffers = NULL;
+static guint trace_next_tid = 1;
+static gint64 trace_start_time = 0;
+static int trace_signal_pipe[2] = { -1, -1 };
+
+static gint64
+current_time (void)
+{
+	GTimeVal now;
+
+	g_get_current_time (&now);
+	return ((gint64) now.tv_sec * G_USEC_PER_SEC) + now.tv_usec;
+}
+
+static void
+release_buffer (RBTraceBuffer *buffer)
+{
+	g_static_mutex_lock (&trace_lock);
+	buffer->in_use = FALSE;
+	g_static_mutex_unlock (&trace_lock);
+}
+
+static RBTraceBuffer *
+get_buffer (void)
+{
+	RBTraceBuffer *buffer;
+	GList *l;
+
+	buffer = g_static_private_get (&trace_buffer_key);
+	if (buffer != NULL)
+		return buffer;
+
+	g_static_mutex_lock (&trace_lock);
+	for (l = trace_buffers; l != NULL; l = l->next) {
+		RBTraceBuffer *b = l->data;
+		if (b->in_use == FALSE) {
+			buffer = b;
+			break;
+		}
+	}
+
+	if (trace_start_time == 0) {
+		trace_start_time = current_time ();
+	}
+
+	if (buffer == NULL) {
+		buffer = g_new0 (RBTraceBuffer, 1);
+		buffer->tid = trace_next_tid++;
+		trace_buffers = g_list_append (trace_buffers, buffer);
+	}
+	buffer->in_use = TRUE;
+	g_static_mutex_unlock (&trace_lock);
+
+	g_static_private_set (&trace_buffer_key, buffer, (GDestroyNotify) release_buffer);
+	return buffer;
+}
+
+static void
+record_event (const char *name, char phase)
+{
+	RBTraceBuffer *buffer;
+	RBTraceEvent *event;
+	gint head;
+
+	buffer = get_buffer ();
+	head = buffer->head;
+
+	event = &buffer->events[head];
+	event->time = current_time ();
+	event->name = name;
+	event->phase = phase;
+
+	head = (head + 1) & (RB_TRACE_BUFFER_SIZE - 1);
+	if (head == 0) {
+		g_atomic_int_set (&buffer->wrapped, TRUE);
+	}
+	g_atomic_int_set (&buffer->head, head);
+}
+
+/**
+ * rb_trace_begin:
+ * @name: name of the span (must be a static string)
+ *
+ * Records the start of a span in the calling thread.  Spans may be nested,
+ * but must be ended in the reverse order to that in which they were begun.
+ */
+void
+rb_trace_begin (const char *name)
+{
+	record_event (name, 'B');
+}
+
+/**
+ * rb_trace_end:
+ * @name: name of the span (must be a static string)
+ *
+ * Records the end of a span in the calling thread.
+ */
+void
+rb_trace_end (const char *name)
+{
+	record_event (name, 'E');
+}
+
+/**
+ * rb_trace_instant:
+ * @name: name of the event (must be a static string)
+ *
+ * Records an event with no duration in the calling thread.
+ */
+void
+rb_trace_instant (const char *name)
+{
+	record_event (name, 'i');
+}
+
+static void
+append_event (GString *str, guint tid, RBTraceEvent *event, gboolean *first)
+{
+	const char *p;
+
+	if (event->name == NULL)
+		return;
+
+	g_string_append (str, *first ? "\n" : ",\n");
+	*first = FALSE;
+
+	g_string_append (str, "{\"name\":\"");
+	for (p = event->name; *p != '\0'; p++) {
+		if (*p == '"' || *p == '\\') {
+			g_string_append_c (str, '\\');
+			g_string_append_c (str, *p);
+		} else if ((guchar) *p < 0x20) {
+			g_string_append_printf (str, "\\u%04x", *p);
+		} else {
+			g_string_append_c (str, *p);
+		}
+	}
+	g_string_append_printf (str,
+				"\",\"cat\":\"rhythmbox\",\"ph\":\"%c\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%u%s}",
+				event->phase,
+				event->time - trace_start_time,
+				getpid (),
+				tid,
+				event->phase == 'i' ? ",\"s\":\"t\"" : "");
+}
+
+/**
+ * rb_trace_dump:
+ * @filename: file to write the trace to
+ * @error: returns error information
+ *
+ * Writes the events currently held in all threads' trace buffers to
+ * @filename in the Chrome trace event format.  Events recorded while
+ * the dump is in progress may be missing or incomplete.
+ *
+ * Return value: %TRUE if successful
+ */
+gboolean
+rb_trace_dump (const char *filename, GError **error)
+{
+	GString *str;
+	GList *l;
+	gboolean first = TRUE;
+	gboolean ret;
+
+	str = g_string_new ("{\"traceEvents\":[");
+
+	g_static_mutex_lock (&trace_lock);
+	for (l = trace_buffers; l != NULL; l = l->next) {
+		RBTraceBuffer *buffer = l->data;
+		gint head;
+		gint i;
+
+		head = g_atomic_int_get (&buffer->head);
+		if (g_atomic_int_get (&buffer->wrapped)) {
+			for (i = head; i < RB_TRACE_BUFFER_SIZE; i++) {
+				append_event (str, buffer->tid, &buffer->events[i], &first);
+			}
+		}
+		for (i = 0; i < head; i++) {
+			append_event (str, buffer->tid, &buffer->events[i], &first);
+		}
+	}
+	g_static_mutex_unlock (&trace_lock);
+
+	g_string_append (str, "\n]}\n");
+
+	rb_debug ("writing trace to %s", filename);
+	ret = g_file_set_contents (filename, str->str, str->len, error);
+	g_string_free (str, TRUE);
+	return ret;
+}
+
+static void
+trace_signal_handler (int signum)
+{
+	char c = 0;
+
+	/* only async-signal-safe calls here; the dump happens in the main loop */
+	if (write (trace_signal_pipe[1], &c, 1) < 0) {
+		/* nothing useful we can do */
+	}
+}
+
+static gboolean
+trace_signal_cb (GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+	char buf[16];
+	char *filename;
+	char *name;
+	GError *error = NULL;
+
+	if (read (trace_signal_pipe[0], buf, sizeof (buf)) <= 0)
+		return TRUE;
+
+	name = g_strdup_printf ("rhythmbox-trace-%d.json", getpid ());
+	filename = g_build_filename (g_get_tmp_dir (), name, NULL);
+	if (rb_trace_dump (filename, &error) == FALSE) {
+		g_warning ("Unable to write trace to %s: %s", filename, error->message);
+		g_clear_error (&error);
+	} else {
+		g_message ("Trace written to %s", filename);
+	}
+	g_free (filename);
+	g_free (name);
+	return TRUE;
+}
+
+/**
+ * rb_trace_init:
+ *
+ * Installs a SIGUSR2 handler that writes the trace to a file in the
+ * temporary directory.  Events are recorded whether this has been
+ * called or not.
+ */
+void
+rb_trace_init (void)
+{
+	GIOChannel *channel;
+
+	if (pipe (trace_signal_pipe) != 0) {
+		g_warning ("Unable to create pipe for trace signal handler");
+		return;
+	}
+
+	channel = g_io_channel_unix_new (trace_signal_pipe[0]);
+	g_io_add_watch (channel, G_IO_IN, trace_signal_cb, NULL);
+	g_io_channel_unref (channel);
+
+	signal (SIGUSR2, trace_signal_handler);
+}
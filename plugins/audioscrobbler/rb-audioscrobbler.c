@@ -35,6 +35,7 @@
 #include <errno.h>
 
 #include <string.h>
+#include <stdlib.h>
 #include <time.h>
 
 #include <glib.h>
@@ -63,6 +64,8 @@
 
 #define MAX_QUEUE_SIZE 1000
 #define MAX_SUBMIT_SIZE	50
+/* rewrite the queue file once this many submitted entries have built up in it */
+#define QUEUE_LOG_COMPACT_SIZE	200
 #define INITIAL_HANDSHAKE_DELAY 60
 #define MAX_HANDSHAKE_DELAY 120*60
 
@@ -102,8 +105,11 @@ struct _RBAudioscrobblerPrivate
 	gboolean handshake;
 	time_t handshake_next;
 
-	/* Only write the queue to a file if it has been changed */
-	gboolean queue_changed;
+	/* Queue file, appended to as entries are queued and submitted */
+	GOutputStream *queue_log;
+	guint queue_log_removed;
+	/* queue file needs to be rewritten once the current submission finishes */
+	gboolean queue_dirty;
 
 	/* Authentication cookie + authentication info */
 	gchar *sessionid;
@@ -133,6 +139,9 @@ struct _RBAudioscrobblerPrivate
 
 static gboolean	     rb_audioscrobbler_load_queue (RBAudioscrobbler *audioscrobbler);
 static int	     rb_audioscrobbler_save_queue (RBAudioscrobbler *audioscrobbler);
+static void	     rb_audioscrobbler_log_entry (RBAudioscrobbler *audioscrobbler, AudioscrobblerEntry *entry);
+static void	     rb_audioscrobbler_log_removal (RBAudioscrobbler *audioscrobbler, guint count);
+static void	     rb_audioscrobbler_maybe_compact_queue (RBAudioscrobbler *audioscrobbler);
 static void	     rb_audioscrobbler_print_queue (RBAudioscrobbler *audioscrobbler, gboolean submission);
 static void	     rb_audioscrobbler_free_queue_entries (RBAudioscrobbler *audioscrobbler, GQueue **queue);
 
@@ -402,8 +411,15 @@ rb_audioscrobbler_finalize (GObject *object)
 
 	audioscrobbler = RB_AUDIOSCROBBLER (object);
 
-	/* Save any remaining entries */
-	rb_audioscrobbler_save_queue (audioscrobbler);
+	/* Drop submitted entries from the queue file */
+	if (audioscrobbler->priv->queue_log_removed > 0 || audioscrobbler->priv->queue_dirty) {
+		rb_audioscrobbler_save_queue (audioscrobbler);
+	}
+	if (audioscrobbler->priv->queue_log != NULL) {
+		g_output_stream_close (audioscrobbler->priv->queue_log, NULL, NULL);
+		g_object_unref (audioscrobbler->priv->queue_log);
+		audioscrobbler->priv->queue_log = NULL;
+	}
 
 	g_free (audioscrobbler->priv->sessionid);
 	g_free (audioscrobbler->priv->username);
@@ -610,12 +626,23 @@ rb_audioscrobbler_add_to_queue (RBAudioscrobbler *audioscrobbler,
 		rb_debug ("queue limit reached.  dropping oldest entry.");
 		oldest = g_queue_pop_head (audioscrobbler->priv->queue);
 		rb_audioscrobbler_entry_free (oldest);
+
+		/* the oldest entry is only at the start of the queue file
+		 * if nothing is being submitted
+		 */
+		if (g_queue_is_empty (audioscrobbler->priv->submission) == FALSE) {
+			g_queue_push_tail (audioscrobbler->priv->queue, entry);
+			audioscrobbler->priv->queue_dirty = TRUE;
+			return;
+		}
+		rb_audioscrobbler_log_removal (audioscrobbler, 1);
 	} else {
 		audioscrobbler->priv->queue_count++;
 	}
 
 	g_queue_push_tail (audioscrobbler->priv->queue, entry);
-	audioscrobbler->priv->queue_changed = TRUE;
+	rb_audioscrobbler_log_entry (audioscrobbler, entry);
+	rb_audioscrobbler_maybe_compact_queue (audioscrobbler);
 }
 
 static void
@@ -671,13 +698,14 @@ rb_audioscrobbler_timeout_cb (RBAudioscrobbler *audioscrobbler)
 		rb_audioscrobbler_nowplaying (audioscrobbler, audioscrobbler->priv->currently_playing);
 	}
 
-	/* if there's something in the queue, submit it if we can, save it otherwise */
-	if (!g_queue_is_empty(audioscrobbler->priv->queue)) {
-		if (audioscrobbler->priv->handshake) {
-			rb_audioscrobbler_submit_queue (audioscrobbler);
-		} else {
-			rb_audioscrobbler_save_queue (audioscrobbler);
-		}
+	/* if there's something in the queue, submit it if we can.
+	 * the queue file is updated as entries are added, so there's nothing
+	 * to save otherwise.
+	 */
+	if (!g_queue_is_empty (audioscrobbler->priv->queue) &&
+	    g_queue_is_empty (audioscrobbler->priv->submission) &&
+	    audioscrobbler->priv->handshake) {
+		rb_audioscrobbler_submit_queue (audioscrobbler);
 	}
 	return TRUE;
 }
@@ -936,37 +964,36 @@ rb_audioscrobbler_build_post_data (RBAudioscrobbler *audioscrobbler)
 {
 	g_return_val_if_fail (!g_queue_is_empty (audioscrobbler->priv->queue), NULL);
 
-	gchar *post_data = g_strdup_printf ("s=%s", audioscrobbler->priv->sessionid);
+	GString *post_data = g_string_new (NULL);
 	int i = 0;
+
+	g_string_append_printf (post_data, "s=%s", audioscrobbler->priv->sessionid);
 	do {
 		AudioscrobblerEntry *entry;
 		AudioscrobblerEncodedEntry *encoded;
-		gchar *new;
 
 		/* remove first queue entry */
 		entry = g_queue_pop_head (audioscrobbler->priv->queue);
 		encoded = rb_audioscrobbler_entry_encode (entry);
-		new = g_strdup_printf ("%s&a[%d]=%s&t[%d]=%s&b[%d]=%s&m[%d]=%s&l[%d]=%d&i[%d]=%s&o[%d]=%s&n[%d]=%s&r[%d]=",
-				       post_data,
-				       i, encoded->artist,
-				       i, encoded->title,
-				       i, encoded->album,
-				       i, encoded->mbid,
-				       i, encoded->length,
-				       i, encoded->timestamp,
-				       i, encoded->source,
-				       i, encoded->track,
-				       i);
+		g_string_append_printf (post_data,
+					"&a[%d]=%s&t[%d]=%s&b[%d]=%s&m[%d]=%s&l[%d]=%d&i[%d]=%s&o[%d]=%s&n[%d]=%s&r[%d]=",
+					i, encoded->artist,
+					i, encoded->title,
+					i, encoded->album,
+					i, encoded->mbid,
+					i, encoded->length,
+					i, encoded->timestamp,
+					i, encoded->source,
+					i, encoded->track,
+					i);
 		rb_audioscrobbler_encoded_entry_free (encoded);
-		g_free (post_data);
-		post_data = new;
 
 		/* add to submission list */
 		g_queue_push_tail (audioscrobbler->priv->submission, entry);
 		i++;
 	} while ((!g_queue_is_empty (audioscrobbler->priv->queue)) && (i < MAX_SUBMIT_SIZE));
-	
-	return post_data;
+
+	return g_string_free (post_data, FALSE);
 }
 
 static void
@@ -1009,9 +1036,11 @@ rb_audioscrobbler_submit_queue_cb (SoupSession *session, SoupMessage *msg, gpoin
 
 	if (audioscrobbler->priv->status == STATUS_OK) {
 		rb_debug ("Queue submitted successfully");
+		rb_audioscrobbler_log_removal (audioscrobbler,
+					       g_queue_get_length (audioscrobbler->priv->submission));
 		rb_audioscrobbler_free_queue_entries (audioscrobbler, &audioscrobbler->priv->submission);
 		audioscrobbler->priv->submission = g_queue_new ();
-		rb_audioscrobbler_save_queue (audioscrobbler);
+		rb_audioscrobbler_maybe_compact_queue (audioscrobbler);
 
 		audioscrobbler->priv->submit_count += audioscrobbler->priv->queue_count;
 		audioscrobbler->priv->queue_count = 0;
@@ -1027,8 +1056,7 @@ rb_audioscrobbler_submit_queue_cb (SoupSession *session, SoupMessage *msg, gpoin
 		g_assert (g_queue_is_empty (audioscrobbler->priv->queue));
 		g_queue_free (audioscrobbler->priv->queue);
 		audioscrobbler->priv->queue = audioscrobbler->priv->submission;
-		audioscrobbler->priv->submission = g_queue_new ();;
-		rb_audioscrobbler_save_queue (audioscrobbler);
+		audioscrobbler->priv->submission = g_queue_new ();
 
 		rb_audioscrobbler_print_queue (audioscrobbler, FALSE);
 
@@ -1045,7 +1073,20 @@ rb_audioscrobbler_submit_queue_cb (SoupSession *session, SoupMessage *msg, gpoin
 		}
 	}
 
+	/* entries were dropped from the queue while it was being submitted */
+	if (audioscrobbler->priv->queue_dirty) {
+		rb_audioscrobbler_save_queue (audioscrobbler);
+	}
+
 	rb_audioscrobbler_statistics_changed (audioscrobbler);
+
+	/* send the next batch straight away if the queue is backed up */
+	if (audioscrobbler->priv->status == STATUS_OK &&
+	    !g_queue_is_empty (audioscrobbler->priv->queue)) {
+		rb_debug ("%d entries left to submit", g_queue_get_length (audioscrobbler->priv->queue));
+		rb_audioscrobbler_submit_queue (audioscrobbler);
+	}
+
 	g_idle_add ((GSourceFunc) idle_unref_cb, audioscrobbler);
 }
 
@@ -1093,6 +1134,24 @@ rb_audioscrobbler_song_changed_cb (RBShellPlayer *player,
 
 
 /* Queue functions: */
+static char *
+rb_audioscrobbler_get_queue_path (RBAudioscrobbler *audioscrobbler)
+{
+	return g_build_filename (rb_user_data_dir (),
+				 "audioscrobbler",
+				 "submission-queues",
+				 rb_audioscrobbler_service_get_name (audioscrobbler->priv->service),
+				 audioscrobbler->priv->username,
+				 NULL);
+}
+
+/*
+ * The queue file is a log.  Each queued entry is appended to it as a line
+ * as written by rb_audioscrobbler_entry_save_to_string, and each time entries
+ * are removed from the start of the queue, a line consisting of '-' followed
+ * by the number of entries removed is appended.  Once enough entries have been
+ * removed, the file is rewritten to contain only the entries still queued.
+ */
 static gboolean
 rb_audioscrobbler_load_queue (RBAudioscrobbler *audioscrobbler)
 {
@@ -1105,12 +1164,7 @@ rb_audioscrobbler_load_queue (RBAudioscrobbler *audioscrobbler)
 	gsize size;
 
 	/* we don't really care about errors enough to report them here */
-	pathname = g_build_filename (rb_user_data_dir (),
-	                             "audioscrobbler",
-	                             "submission-queues",
-	                             rb_audioscrobbler_service_get_name (audioscrobbler->priv->service),
-	                             audioscrobbler->priv->username,
-	                             NULL);
+	pathname = rb_audioscrobbler_get_queue_path (audioscrobbler);
 	file = g_file_new_for_path (pathname);
 	rb_debug ("loading Audioscrobbler queue from \"%s\"", pathname);
 	g_free (pathname);
@@ -1118,8 +1172,10 @@ rb_audioscrobbler_load_queue (RBAudioscrobbler *audioscrobbler)
 	if (g_file_load_contents (file, NULL, &data, &size, NULL, &error) == FALSE) {
 		rb_debug ("unable to load audioscrobbler queue: %s", error->message);
 		g_error_free (error);
+		g_object_unref (file);
 		return FALSE;
 	}
+	g_object_unref (file);
 
 	start = data;
 	while (start < (data + size)) {
@@ -1131,49 +1187,160 @@ rb_audioscrobbler_load_queue (RBAudioscrobbler *audioscrobbler)
 			break;
 		*end = 0;
 
-		entry = rb_audioscrobbler_entry_load_from_string (start);
-		if (entry) {
-			g_queue_push_tail (audioscrobbler->priv->queue,
-					   entry);
-			audioscrobbler->priv->queue_count++;
+		if (start[0] == '-') {
+			guint count;
+
+			count = strtoul (start + 1, NULL, 10);
+			audioscrobbler->priv->queue_log_removed += count;
+			while (count > 0 && !g_queue_is_empty (audioscrobbler->priv->queue)) {
+				entry = g_queue_pop_head (audioscrobbler->priv->queue);
+				rb_audioscrobbler_entry_free (entry);
+				audioscrobbler->priv->queue_count--;
+				count--;
+			}
+		} else {
+			entry = rb_audioscrobbler_entry_load_from_string (start);
+			if (entry) {
+				g_queue_push_tail (audioscrobbler->priv->queue,
+						   entry);
+				audioscrobbler->priv->queue_count++;
+			}
 		}
 
 		start = end + 1;
 	}
-
 	g_free (data);
+
+	if (audioscrobbler->priv->queue_log_removed > 0) {
+		rb_audioscrobbler_save_queue (audioscrobbler);
+	}
 	return TRUE;
 }
 
 static gboolean
-rb_audioscrobbler_save_queue (RBAudioscrobbler *audioscrobbler)
+rb_audioscrobbler_open_queue_log (RBAudioscrobbler *audioscrobbler)
 {
 	char *pathname;
 	char *uri;
 	GFile *file;
 	GError *error = NULL;
-	GList *l;
-	GString *str;
 
-	if (!audioscrobbler->priv->queue_changed) {
+	if (audioscrobbler->priv->queue_log != NULL) {
 		return TRUE;
 	}
 
+	pathname = rb_audioscrobbler_get_queue_path (audioscrobbler);
+	uri = g_filename_to_uri (pathname, NULL, NULL);
+	rb_uri_create_parent_dirs (uri, NULL);
+	g_free (uri);
+
+	file = g_file_new_for_path (pathname);
+	g_free (pathname);
+
+	audioscrobbler->priv->queue_log = G_OUTPUT_STREAM (g_file_append_to (file, G_FILE_CREATE_NONE, NULL, &error));
+	g_object_unref (file);
+	if (error != NULL) {
+		rb_debug ("unable to open audioscrobbler queue: %s", error->message);
+		g_error_free (error);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+rb_audioscrobbler_write_queue_log (RBAudioscrobbler *audioscrobbler, GString *str)
+{
+	GError *error = NULL;
+
+	if (rb_audioscrobbler_open_queue_log (audioscrobbler) == FALSE) {
+		return;
+	}
+
+	g_output_stream_write_all (audioscrobbler->priv->queue_log,
+				   str->str, str->len,
+				   NULL, NULL, &error);
+	if (error != NULL) {
+		rb_debug ("error writing audioscrobbler queue: %s", error->message);
+		g_error_free (error);
+
+		/* try rewriting the whole thing next time */
+		g_object_unref (audioscrobbler->priv->queue_log);
+		audioscrobbler->priv->queue_log = NULL;
+		audioscrobbler->priv->queue_log_removed = QUEUE_LOG_COMPACT_SIZE;
+	}
+}
+
+static void
+rb_audioscrobbler_log_entry (RBAudioscrobbler *audioscrobbler, AudioscrobblerEntry *entry)
+{
+	GString *str;
+
+	str = g_string_new (NULL);
+	rb_audioscrobbler_entry_save_to_string (str, entry);
+	rb_audioscrobbler_write_queue_log (audioscrobbler, str);
+	g_string_free (str, TRUE);
+}
+
+static void
+rb_audioscrobbler_log_removal (RBAudioscrobbler *audioscrobbler, guint count)
+{
+	GString *str;
+
+	if (count == 0) {
+		return;
+	}
+
+	str = g_string_new (NULL);
+	g_string_append_printf (str, "-%u\n", count);
+	rb_audioscrobbler_write_queue_log (audioscrobbler, str);
+	g_string_free (str, TRUE);
+
+	audioscrobbler->priv->queue_log_removed += count;
+}
+
+static void
+rb_audioscrobbler_maybe_compact_queue (RBAudioscrobbler *audioscrobbler)
+{
+	if (audioscrobbler->priv->queue_log_removed == 0) {
+		return;
+	}
+
+	/* rewriting an empty queue is cheap, so do that whenever we can */
+	if (audioscrobbler->priv->queue_log_removed >= QUEUE_LOG_COMPACT_SIZE ||
+	    (g_queue_is_empty (audioscrobbler->priv->queue) &&
+	     g_queue_is_empty (audioscrobbler->priv->submission))) {
+		rb_audioscrobbler_save_queue (audioscrobbler);
+	}
+}
+
+static gboolean
+rb_audioscrobbler_save_queue (RBAudioscrobbler *audioscrobbler)
+{
+	char *pathname;
+	char *uri;
+	GFile *file;
+	GError *error = NULL;
+	GList *l;
+	GString *str;
+
+	/* entries being submitted come first, as they haven't been acknowledged yet */
 	str = g_string_new ("");
+	for (l = audioscrobbler->priv->submission->head; l != NULL; l = g_list_next (l)) {
+		rb_audioscrobbler_entry_save_to_string (str, (AudioscrobblerEntry *) l->data);
+	}
 	for (l = audioscrobbler->priv->queue->head; l != NULL; l = g_list_next (l)) {
-		AudioscrobblerEntry *entry;
+		rb_audioscrobbler_entry_save_to_string (str, (AudioscrobblerEntry *) l->data);
+	}
 
-		entry = (AudioscrobblerEntry *) l->data;
-		rb_audioscrobbler_entry_save_to_string (str, entry);
+	/* the log stream would keep appending to the old file */
+	if (audioscrobbler->priv->queue_log != NULL) {
+		g_output_stream_close (audioscrobbler->priv->queue_log, NULL, NULL);
+		g_object_unref (audioscrobbler->priv->queue_log);
+		audioscrobbler->priv->queue_log = NULL;
 	}
 
 	/* we don't really care about errors enough to report them here */
-	pathname = g_build_filename (rb_user_data_dir (),
-	                             "audioscrobbler",
-	                             "submission-queues",
-	                             rb_audioscrobbler_service_get_name (audioscrobbler->priv->service),
-	                             audioscrobbler->priv->username,
-	                             NULL);
+	pathname = rb_audioscrobbler_get_queue_path (audioscrobbler);
 	rb_debug ("Saving Audioscrobbler queue to \"%s\"", pathname);
 
 	uri = g_filename_to_uri (pathname, NULL, NULL);
@@ -1193,9 +1360,11 @@ rb_audioscrobbler_save_queue (RBAudioscrobbler *audioscrobbler)
 				 NULL,
 				 &error);
 	g_string_free (str, TRUE);
+	g_object_unref (file);
 
 	if (error == NULL) {
-		audioscrobbler->priv->queue_changed = FALSE;
+		audioscrobbler->priv->queue_log_removed = 0;
+		audioscrobbler->priv->queue_dirty = FALSE;
 		return TRUE;
 	} else {
 		rb_debug ("error saving audioscrobbler queue: %s",
@@ -1235,8 +1404,6 @@ rb_audioscrobbler_free_queue_entries (RBAudioscrobbler *audioscrobbler, GQueue *
 	g_queue_foreach (*queue, (GFunc) rb_audioscrobbler_entry_free, NULL);
 	g_queue_free (*queue);
 	*queue = NULL;
-
-	audioscrobbler->priv->queue_changed = TRUE;
 }
 
 static void
@@ -75,6 +75,16 @@ share_name_get_mapping (GValue *value, GVariant *variant, gpointer data)
 	return TRUE;
 }
 
+static void
+db_revision_changed_cb (GObject *db, GParamSpec *pspec, DAAPShare *daap_share)
+{
+	guint revision;
+
+	/* lets clients waiting for updates know there's something new */
+	g_object_get (db, "revision", &revision, NULL);
+	g_object_set (daap_share, "revision-number", revision, NULL);
+}
+
 static void
 create_share (RBShell *shell)
 {
@@ -109,6 +119,8 @@ create_share (RBShell *shell)
 	}
 
 	share = daap_share_new (name, password, db, container_db, NULL);
+	g_signal_connect_object (db, "notify::revision", G_CALLBACK (db_revision_changed_cb), share, 0);
+	db_revision_changed_cb (G_OBJECT (db), NULL, share);
 
 	g_settings_bind_with_mapping (settings, "share-name",
 				      share, "name",
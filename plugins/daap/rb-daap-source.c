@@ -579,6 +579,7 @@ rb_daap_source_connection_cb (DMAPConnection   *connection,
 {
 	RBDAAPSource *daap_source = RB_DAAP_SOURCE (source);
 	RBShell *shell = NULL;
+	DMAPDb *db;
 	GSList *playlists;
 	GSList *l;
 	RhythmDBEntryType *entry_type;
@@ -599,6 +600,13 @@ rb_daap_source_connection_cb (DMAPConnection   *connection,
 		return;
 	}
 
+	/* add any tracks still waiting to go into the database, so the
+	 * playlists can find them.
+	 */
+	g_object_get (connection, "db", &db, NULL);
+	rb_rhythmdb_dmap_db_adapter_flush (RB_RHYTHMDB_DMAP_DB_ADAPTER (db));
+	g_object_unref (db);
+
 	g_object_get (daap_source,
 		      "shell", &shell,
 		      "entry-type", &entry_type,
@@ -639,6 +647,8 @@ rb_daap_source_selected (RBDisplayPage *page)
 	char *name = NULL;
 	RhythmDBEntryType *entry_type;
 
+	RB_DISPLAY_PAGE_CLASS (rb_daap_source_parent_class)->selected (page);
+
 	if (daap_source->priv->connection != NULL) {
 		return;
 	}
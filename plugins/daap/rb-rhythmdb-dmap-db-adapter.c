@@ -32,6 +32,7 @@
 #endif
 
 #include "rhythmdb.h"
+#include "rb-debug.h"
 #include "rb-rhythmdb-dmap-db-adapter.h"
 #include "rb-daap-record.h"
 
@@ -41,25 +42,94 @@
 struct RBRhythmDBDMAPDbAdapterPrivate {
 	RhythmDB *db;
 	RhythmDBEntryType *entry_type;
+
+	/* entry ID -> RBDAAPRecord, so records aren't rebuilt for every request */
+	GHashTable *records;
+	guint revision;
+
+	/* entries for records received from the share, not yet added to the database */
+	GMutex *pending_lock;
+	GList *pending;
+	guint pending_count;
+	GHashTable *pending_locations;
+};
+
+/* number of records to collect before adding them to the database */
+#define PENDING_BATCH_SIZE	500
+
+enum {
+	PROP_0,
+	PROP_REVISION
 };
 
 typedef struct ForeachAdapterData {
+	RBRhythmDBDMAPDbAdapter *adapter;
 	gpointer data;
 	GHFunc func;
 } ForeachAdapterData;
 
+/**
+ * rb_rhythmdb_dmap_db_adapter_flush:
+ * @adapter: a #RBRhythmDBDMAPDbAdapter
+ *
+ * Adds entries for records received from the share to the database.
+ * Records are collected and added in batches, as adding each one
+ * individually makes connecting to large shares very slow.
+ */
+void
+rb_rhythmdb_dmap_db_adapter_flush (RBRhythmDBDMAPDbAdapter *adapter)
+{
+	GList *pending;
+	GList *added;
+
+	g_mutex_lock (adapter->priv->pending_lock);
+	pending = g_list_reverse (adapter->priv->pending);
+	adapter->priv->pending = NULL;
+	adapter->priv->pending_count = 0;
+	g_hash_table_remove_all (adapter->priv->pending_locations);
+	g_mutex_unlock (adapter->priv->pending_lock);
+
+	if (pending == NULL) {
+		return;
+	}
+
+	added = rhythmdb_entry_insert_batch (adapter->priv->db, pending);
+	g_list_free (added);
+	g_list_free (pending);
+
+	rhythmdb_commit (adapter->priv->db);
+}
+
+static DMAPRecord *
+get_record (RBRhythmDBDMAPDbAdapter *adapter, RhythmDBEntry *entry)
+{
+	DMAPRecord *record;
+	gulong id;
+
+	id = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_ENTRY_ID);
+	record = g_hash_table_lookup (adapter->priv->records, GUINT_TO_POINTER (id));
+	if (record == NULL) {
+		record = DMAP_RECORD (rb_daap_record_new (entry));
+		g_hash_table_insert (adapter->priv->records, GUINT_TO_POINTER (id), record);
+	}
+	return record;
+}
+
 static DMAPRecord *
 rb_rhythmdb_dmap_db_adapter_lookup_by_id (const DMAPDb *db, guint id)
 {
+	RBRhythmDBDMAPDbAdapter *adapter = RB_RHYTHMDB_DMAP_DB_ADAPTER (db);
 	RhythmDBEntry *entry;
 
-	g_assert (RB_RHYTHMDB_DMAP_DB_ADAPTER (db)->priv->db != NULL);
+	g_assert (adapter->priv->db != NULL);
 
-	entry = rhythmdb_entry_lookup_by_id (
-			RB_RHYTHMDB_DMAP_DB_ADAPTER (db)->priv->db,
-			id);
+	rb_rhythmdb_dmap_db_adapter_flush (adapter);
+	entry = rhythmdb_entry_lookup_by_id (adapter->priv->db, id);
+	if (entry == NULL) {
+		return NULL;
+	}
 
-	return DMAP_RECORD (rb_daap_record_new (entry));
+	return g_object_ref (get_record (adapter, entry));
 }
 
 static void
@@ -71,13 +141,11 @@ foreach_adapter (RhythmDBEntry *entry, gpointer data)
 	
 	id = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_ENTRY_ID);
 	foreach_adapter_data = data;
-	record = DMAP_RECORD (rb_daap_record_new (entry));
+	record = get_record (foreach_adapter_data->adapter, entry);
 
 	foreach_adapter_data->func (GUINT_TO_POINTER (id),
 				    record,
 				    foreach_adapter_data->data);
-
-	g_object_unref (record);
 }
 
 static void
@@ -89,7 +157,10 @@ rb_rhythmdb_dmap_db_adapter_foreach	(const DMAPDb *db,
 
 	g_assert (RB_RHYTHMDB_DMAP_DB_ADAPTER (db)->priv->db != NULL);
 
+	rb_rhythmdb_dmap_db_adapter_flush (RB_RHYTHMDB_DMAP_DB_ADAPTER (db));
+
 	foreach_adapter_data = g_new (ForeachAdapterData, 1);
+	foreach_adapter_data->adapter = RB_RHYTHMDB_DMAP_DB_ADAPTER (db);
 	foreach_adapter_data->data = data;
 	foreach_adapter_data->func = func;
 
@@ -105,6 +176,7 @@ static gint64
 rb_rhythmdb_dmap_db_adapter_count (const DMAPDb *db)
 {
 	g_assert (RB_RHYTHMDB_DMAP_DB_ADAPTER (db)->priv->db != NULL);
+	rb_rhythmdb_dmap_db_adapter_flush (RB_RHYTHMDB_DMAP_DB_ADAPTER (db));
 	return rhythmdb_entry_count_by_type (
 			RB_RHYTHMDB_DMAP_DB_ADAPTER (db)->priv->db,
 			RB_RHYTHMDB_DMAP_DB_ADAPTER (db)->priv->entry_type);
@@ -148,6 +220,9 @@ rb_rhythmdb_dmap_db_adapter_add (DMAPDb *db, DMAPRecord *record)
 	gint bitrate = 0;
 	GValue value = { 0, };
 	RhythmDBEntry *entry = NULL;
+	gulong id;
+	gboolean flush;
+	gboolean duplicate;
 	RBRhythmDBDMAPDbAdapterPrivate *priv = RB_RHYTHMDB_DMAP_DB_ADAPTER (db)->priv;
 
 	g_assert (priv->db != NULL);
@@ -167,7 +242,24 @@ rb_rhythmdb_dmap_db_adapter_add (DMAPDb *db, DMAPRecord *record)
                      "songgenre", &genre,
 		      NULL);
 
-	entry = rhythmdb_entry_new (priv->db, priv->entry_type, uri);
+	/* entries for locations that are already in the database, or waiting
+	 * to be added, wouldn't be added, so they don't get an ID.
+	 */
+	entry = rhythmdb_entry_lookup_by_location (priv->db, uri);
+	if (entry != NULL) {
+		rb_debug ("daap track %s is already in the database", uri);
+		return 0;
+	}
+
+	g_mutex_lock (priv->pending_lock);
+	duplicate = (g_hash_table_lookup (priv->pending_locations, uri) != NULL);
+	g_mutex_unlock (priv->pending_lock);
+	if (duplicate) {
+		rb_debug ("daap track %s is already waiting to be added", uri);
+		return 0;
+	}
+
+	entry = rhythmdb_entry_new_pending (priv->db, priv->entry_type, uri);
 
 	if (entry == NULL) {
 		g_warning ("cannot create entry for daap track %s", uri);
@@ -231,20 +323,192 @@ rb_rhythmdb_dmap_db_adapter_add (DMAPDb *db, DMAPRecord *record)
 	/* genre */
 	entry_set_string_prop (priv->db, entry, RHYTHMDB_PROP_GENRE, genre);
 
-	rhythmdb_commit (priv->db);
+	/* the entry ID is assigned when the entry is created, so it's valid
+	 * before the entry is added to the database.
+	 */
+	id = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_ENTRY_ID);
+
+	g_mutex_lock (priv->pending_lock);
+	if (g_hash_table_lookup (priv->pending_locations, uri) != NULL) {
+		g_mutex_unlock (priv->pending_lock);
+		rhythmdb_entry_unref (entry);
+		return 0;
+	}
+	g_hash_table_insert (priv->pending_locations,
+			     (gpointer) rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION),
+			     entry);
+	priv->pending = g_list_prepend (priv->pending, entry);
+	flush = (++priv->pending_count >= PENDING_BATCH_SIZE);
+	g_mutex_unlock (priv->pending_lock);
+
+	if (flush) {
+		rb_rhythmdb_dmap_db_adapter_flush (RB_RHYTHMDB_DMAP_DB_ADAPTER (db));
+	}
+
+	return id;
+}
+
+static void
+bump_revision (RBRhythmDBDMAPDbAdapter *adapter)
+{
+	adapter->priv->revision++;
+	g_object_notify (G_OBJECT (adapter), "revision");
+}
+
+static void
+entry_added_cb (RhythmDB *db, RhythmDBEntry *entry, RBRhythmDBDMAPDbAdapter *adapter)
+{
+	if (rhythmdb_entry_get_entry_type (entry) == adapter->priv->entry_type) {
+		bump_revision (adapter);
+	}
+}
+
+/* properties stored in the records shared over DAAP */
+static gboolean
+is_shared_property (RhythmDBPropType prop)
+{
+	switch (prop) {
+	case RHYTHMDB_PROP_FILE_SIZE:
+	case RHYTHMDB_PROP_LOCATION:
+	case RHYTHMDB_PROP_TITLE:
+	case RHYTHMDB_PROP_ARTIST:
+	case RHYTHMDB_PROP_ALBUM:
+	case RHYTHMDB_PROP_GENRE:
+	case RHYTHMDB_PROP_TRACK_NUMBER:
+	case RHYTHMDB_PROP_DURATION:
+	case RHYTHMDB_PROP_RATING:
+	case RHYTHMDB_PROP_YEAR:
+	case RHYTHMDB_PROP_FIRST_SEEN:
+	case RHYTHMDB_PROP_MTIME:
+	case RHYTHMDB_PROP_DISC_NUMBER:
+	case RHYTHMDB_PROP_BITRATE:
+	case RHYTHMDB_PROP_HIDDEN:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static void
+entry_changed_cb (RhythmDB *db, RhythmDBEntry *entry, GValueArray *changes, RBRhythmDBDMAPDbAdapter *adapter)
+{
+	gulong id;
+
+	if (rhythmdb_entry_get_entry_type (entry) != adapter->priv->entry_type)
+		return;
+
+	/* play counts and such don't affect the shared records */
+	if (changes != NULL) {
+		gboolean shared = FALSE;
+		int i;
+
+		for (i = 0; i < changes->n_values; i++) {
+			RhythmDBEntryChange *change;
+
+			change = g_value_get_boxed (g_value_array_get_nth (changes, i));
+			if (is_shared_property (change->prop)) {
+				shared = TRUE;
+				break;
+			}
+		}
+
+		if (shared == FALSE)
+			return;
+	}
+
+	id = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_ENTRY_ID);
+	g_hash_table_remove (adapter->priv->records, GUINT_TO_POINTER (id));
+	bump_revision (adapter);
+}
 
-	return rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_ENTRY_ID);
+static void
+entry_deleted_cb (RhythmDB *db, RhythmDBEntry *entry, RBRhythmDBDMAPDbAdapter *adapter)
+{
+	entry_changed_cb (db, entry, NULL, adapter);
 }
 
 static void
 rb_rhythmdb_dmap_db_adapter_init (RBRhythmDBDMAPDbAdapter *db)
 {
 	db->priv = RB_RHYTHMDB_DMAP_DB_ADAPTER_GET_PRIVATE (db);
+	db->priv->records = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_object_unref);
+	db->priv->revision = 1;
+	db->priv->pending_lock = g_mutex_new ();
+	db->priv->pending_locations = g_hash_table_new (g_str_hash, g_str_equal);
+}
+
+static void
+rb_rhythmdb_dmap_db_adapter_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *pspec)
+{
+	RBRhythmDBDMAPDbAdapter *adapter = RB_RHYTHMDB_DMAP_DB_ADAPTER (object);
+
+	switch (prop_id) {
+	case PROP_REVISION:
+		g_value_set_uint (value, adapter->priv->revision);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+rb_rhythmdb_dmap_db_adapter_dispose (GObject *object)
+{
+	RBRhythmDBDMAPDbAdapter *adapter = RB_RHYTHMDB_DMAP_DB_ADAPTER (object);
+
+	/* anything not added yet belongs to a connection that has gone away */
+	g_hash_table_remove_all (adapter->priv->pending_locations);
+	g_list_foreach (adapter->priv->pending, (GFunc) rhythmdb_entry_unref, NULL);
+	g_list_free (adapter->priv->pending);
+	adapter->priv->pending = NULL;
+	adapter->priv->pending_count = 0;
+
+	if (adapter->priv->db != NULL) {
+		g_signal_handlers_disconnect_by_func (adapter->priv->db, entry_added_cb, adapter);
+		g_signal_handlers_disconnect_by_func (adapter->priv->db, entry_changed_cb, adapter);
+		g_signal_handlers_disconnect_by_func (adapter->priv->db, entry_deleted_cb, adapter);
+		adapter->priv->db = NULL;
+	}
+
+	G_OBJECT_CLASS (rb_rhythmdb_dmap_db_adapter_parent_class)->dispose (object);
+}
+
+static void
+rb_rhythmdb_dmap_db_adapter_finalize (GObject *object)
+{
+	RBRhythmDBDMAPDbAdapter *adapter = RB_RHYTHMDB_DMAP_DB_ADAPTER (object);
+
+	g_hash_table_destroy (adapter->priv->records);
+	g_hash_table_destroy (adapter->priv->pending_locations);
+	g_mutex_free (adapter->priv->pending_lock);
+
+	G_OBJECT_CLASS (rb_rhythmdb_dmap_db_adapter_parent_class)->finalize (object);
 }
 
 static void
 rb_rhythmdb_dmap_db_adapter_class_init (RBRhythmDBDMAPDbAdapterClass *klass)
 {
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->get_property = rb_rhythmdb_dmap_db_adapter_get_property;
+	object_class->dispose = rb_rhythmdb_dmap_db_adapter_dispose;
+	object_class->finalize = rb_rhythmdb_dmap_db_adapter_finalize;
+
+	/**
+	 * RBRhythmDBDMAPDbAdapter:revision:
+	 *
+	 * Database revision number, incremented whenever a shared entry
+	 * is added, changed or deleted.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_REVISION,
+					 g_param_spec_uint ("revision",
+							    "revision",
+							    "database revision number",
+							    1, G_MAXUINT, 1,
+							    G_PARAM_READABLE));
+
 	g_type_class_add_private (klass, sizeof (RBRhythmDBDMAPDbAdapterPrivate));
 }
 
@@ -284,6 +548,10 @@ rb_rhythmdb_dmap_db_adapter_new (RhythmDB *rdb, RhythmDBEntryType *entry_type)
 	db->priv->db = rdb;
 	db->priv->entry_type = entry_type;
 
+	g_signal_connect_object (rdb, "entry-added", G_CALLBACK (entry_added_cb), db, 0);
+	g_signal_connect_object (rdb, "entry-changed", G_CALLBACK (entry_changed_cb), db, 0);
+	g_signal_connect_object (rdb, "entry-deleted", G_CALLBACK (entry_deleted_cb), db, 0);
+
 	return db;
 }
 
@@ -55,6 +55,7 @@ typedef struct {
 
 RBRhythmDBDMAPDbAdapter *rb_rhythmdb_dmap_db_adapter_new (RhythmDB *db, RhythmDBEntryType *entry_type);
 GType rb_rhythmdb_dmap_db_adapter_get_type (void);
+void rb_rhythmdb_dmap_db_adapter_flush (RBRhythmDBDMAPDbAdapter *adapter);
 
 void _rb_rhythmdb_dmap_db_adapter_register_type (GTypeModule *module);
 
@@ -38,6 +38,7 @@
 
 #include <lib/rb-util.h>
 #include <lib/rb-debug.h>
+#include <rhythmdb/rhythmdb-query-result-list.h>
 #include <plugins/rb-plugin-macros.h>
 #include <shell/rb-shell.h>
 #include <shell/rb-shell-player.h>
@@ -64,6 +65,9 @@
 #define RB_MEDIASERVER2_ENTRY_SUBTREE	RB_MEDIASERVER2_PREFIX "Entry"
 #define RB_MEDIASERVER2_ENTRY_PREFIX	RB_MEDIASERVER2_ENTRY_SUBTREE "/"
 
+/* maximum number of entries to keep property values for */
+#define ENTRY_PROPERTY_CACHE_SIZE	5000
+
 typedef struct
 {
 	PeasExtensionBase parent;
@@ -87,6 +91,12 @@ typedef struct
 	GSettings *settings;
 	RhythmDB *db;
 	RBDisplayPageModel *display_page_model;
+
+	/* RhythmDBEntry -> (property name -> GVariant) */
+	GHashTable *entry_properties;
+
+	/* searches waiting for query results */
+	GList *searches;
 } RBMediaServer2Plugin;
 
 typedef struct
@@ -301,6 +311,506 @@ get_entry_property_value (RhythmDBEntry *entry, const char *property_name)
 	return NULL;
 }
 
+/* returns a reference owned by the cache */
+static GVariant *
+get_cached_entry_property_value (RBMediaServer2Plugin *plugin, RhythmDBEntry *entry, const char *property_name)
+{
+	GHashTable *properties;
+	GVariant *v;
+
+	properties = g_hash_table_lookup (plugin->entry_properties, entry);
+	if (properties == NULL) {
+		if (g_hash_table_size (plugin->entry_properties) >= ENTRY_PROPERTY_CACHE_SIZE) {
+			rb_debug ("entry property cache full, flushing");
+			g_hash_table_remove_all (plugin->entry_properties);
+		}
+
+		properties = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+		g_hash_table_insert (plugin->entry_properties, rhythmdb_entry_ref (entry), properties);
+	} else {
+		v = g_hash_table_lookup (properties, property_name);
+		if (v != NULL) {
+			return v;
+		}
+	}
+
+	v = get_entry_property_value (entry, property_name);
+	if (v != NULL) {
+		g_variant_ref_sink (v);
+		g_hash_table_insert (properties, g_strdup (property_name), v);
+	}
+	return v;
+}
+
+static void
+entry_changed_cb (RhythmDB *db, RhythmDBEntry *entry, GValueArray *changes, RBMediaServer2Plugin *plugin)
+{
+	g_hash_table_remove (plugin->entry_properties, entry);
+}
+
+static void
+entry_deleted_cb (RhythmDB *db, RhythmDBEntry *entry, RBMediaServer2Plugin *plugin)
+{
+	g_hash_table_remove (plugin->entry_properties, entry);
+}
+
+static void
+add_entry_to_list (RBMediaServer2Plugin *plugin, GVariantBuilder *list, RhythmDBEntry *entry, char **filter)
+{
+	GVariantBuilder *eb;
+	int i;
+
+	eb = g_variant_builder_new (G_VARIANT_TYPE ("a{sv}"));
+	for (i = 0; filter[i] != NULL; i++) {
+		GVariant *v;
+		v = get_cached_entry_property_value (plugin, entry, filter[i]);
+		if (v != NULL) {
+			g_variant_builder_add (eb, "{sv}", filter[i], v);
+		}
+	}
+
+	g_variant_builder_add (list, "a{sv}", eb);
+	g_variant_builder_unref (eb);
+}
+
+static char **
+get_entry_filter (char **filter)
+{
+	if (rb_str_in_strv ("*", (const char **)filter)) {
+		g_strfreev (filter);
+		filter = g_strdupv ((char **)all_entry_properties);
+	}
+	return filter;
+}
+
+/* searching */
+
+/*
+ * Search queries use the UPnP ContentDirectory search syntax, for example:
+ *   Type derivedfrom "audio" and (Artist contains "foo" or Album contains "foo")
+ * These are converted to RhythmDB queries, so they can be evaluated
+ * the same way as any other query.
+ */
+
+typedef struct {
+	const char *property;
+	RhythmDBPropType prop;
+	RhythmDBPropType folded_prop;
+} SearchPropertyMap;
+
+static const SearchPropertyMap search_properties[] = {
+	{ "DisplayName", RHYTHMDB_PROP_TITLE, RHYTHMDB_PROP_TITLE_FOLDED },
+	{ "Artist", RHYTHMDB_PROP_ARTIST, RHYTHMDB_PROP_ARTIST_FOLDED },
+	{ "Album", RHYTHMDB_PROP_ALBUM, RHYTHMDB_PROP_ALBUM_FOLDED },
+	{ "Genre", RHYTHMDB_PROP_GENRE, RHYTHMDB_PROP_GENRE_FOLDED },
+	{ "MIMEType", RHYTHMDB_PROP_MIMETYPE, RHYTHMDB_PROP_MIMETYPE },
+};
+
+typedef struct {
+	RhythmDB *db;
+	const char *pos;
+} SearchParser;
+
+static gboolean parse_search_expression (SearchParser *parser, GPtrArray *query);
+
+static void
+skip_space (SearchParser *parser)
+{
+	while (g_ascii_isspace (*parser->pos))
+		parser->pos++;
+}
+
+static char *
+next_search_token (SearchParser *parser)
+{
+	const char *start;
+
+	skip_space (parser);
+	start = parser->pos;
+
+	if (*start == '\0') {
+		return NULL;
+	} else if (*start == '(' || *start == ')') {
+		parser->pos++;
+	} else if (*start == '"') {
+		GString *str;
+
+		/* quoted string, with backslash escapes */
+		str = g_string_new (NULL);
+		parser->pos++;
+		while (*parser->pos != '\0' && *parser->pos != '"') {
+			if (*parser->pos == '\\' && parser->pos[1] != '\0') {
+				parser->pos++;
+			}
+			g_string_append_c (str, *parser->pos);
+			parser->pos++;
+		}
+		if (*parser->pos == '\0') {
+			g_string_free (str, TRUE);
+			return NULL;
+		}
+		parser->pos++;
+		return g_string_free (str, FALSE);
+	} else if (strchr ("=!<>", *start) != NULL) {
+		while (*parser->pos != '\0' && strchr ("=!<>", *parser->pos) != NULL)
+			parser->pos++;
+	} else {
+		while (*parser->pos != '\0' &&
+		       g_ascii_isspace (*parser->pos) == FALSE &&
+		       strchr ("()=!<>\"", *parser->pos) == NULL)
+			parser->pos++;
+	}
+
+	return g_strndup (start, parser->pos - start);
+}
+
+static gboolean
+peek_search_token (SearchParser *parser, const char *token)
+{
+	const char *save = parser->pos;
+	char *t;
+	gboolean ret;
+
+	t = next_search_token (parser);
+	ret = (t != NULL && g_ascii_strcasecmp (t, token) == 0);
+	g_free (t);
+	if (ret == FALSE)
+		parser->pos = save;
+	return ret;
+}
+
+static void
+append_never_matches (SearchParser *parser, GPtrArray *query)
+{
+	rhythmdb_query_append (parser->db,
+			       query,
+			       RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_IGNORE,
+			       RHYTHMDB_QUERY_END);
+}
+
+static gboolean
+parse_search_term (SearchParser *parser, GPtrArray *query)
+{
+	const SearchPropertyMap *map = NULL;
+	char *property;
+	char *op = NULL;
+	char *value = NULL;
+	gboolean ret = FALSE;
+	int i;
+
+	if (peek_search_token (parser, "(")) {
+		GPtrArray *subquery;
+
+		subquery = g_ptr_array_new ();
+		if (parse_search_expression (parser, subquery) && peek_search_token (parser, ")")) {
+			rhythmdb_query_append (parser->db, query, RHYTHMDB_QUERY_SUBQUERY, subquery, RHYTHMDB_QUERY_END);
+			ret = TRUE;
+		}
+		rhythmdb_query_free (subquery);
+		return ret;
+	}
+
+	property = next_search_token (parser);
+	op = next_search_token (parser);
+	value = next_search_token (parser);
+	if (property == NULL || op == NULL || value == NULL) {
+		goto out;
+	}
+
+	if (g_ascii_strcasecmp (op, "exists") == 0) {
+		/* everything we know about always exists */
+		if (g_ascii_strcasecmp (value, "true") != 0) {
+			append_never_matches (parser, query);
+		}
+		ret = TRUE;
+		goto out;
+	}
+
+	if (g_strcmp0 (property, "Type") == 0) {
+		/* all items are audio */
+		if ((g_strcmp0 (op, "=") == 0 && g_strcmp0 (value, "audio") == 0) ||
+		    (g_ascii_strcasecmp (op, "derivedfrom") == 0 && g_str_has_prefix (value, "audio"))) {
+			ret = TRUE;
+		} else if (g_strcmp0 (op, "=") == 0 || g_ascii_strcasecmp (op, "derivedfrom") == 0) {
+			append_never_matches (parser, query);
+			ret = TRUE;
+		}
+		goto out;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (search_properties); i++) {
+		if (g_strcmp0 (property, search_properties[i].property) == 0) {
+			map = &search_properties[i];
+			break;
+		}
+	}
+	if (map == NULL) {
+		rb_debug ("can't search on property %s", property);
+		goto out;
+	}
+
+	if (g_strcmp0 (op, "=") == 0) {
+		rhythmdb_query_append (parser->db, query,
+				       RHYTHMDB_QUERY_PROP_EQUALS, map->prop, value,
+				       RHYTHMDB_QUERY_END);
+		ret = TRUE;
+	} else if (g_strcmp0 (op, "!=") == 0) {
+		rhythmdb_query_append (parser->db, query,
+				       RHYTHMDB_QUERY_PROP_NOT_EQUAL, map->prop, value,
+				       RHYTHMDB_QUERY_END);
+		ret = TRUE;
+	} else {
+		RhythmDBQueryType type;
+		char *folded;
+
+		if (g_ascii_strcasecmp (op, "contains") == 0) {
+			type = RHYTHMDB_QUERY_PROP_LIKE;
+		} else if (g_ascii_strcasecmp (op, "doesNotContain") == 0) {
+			type = RHYTHMDB_QUERY_PROP_NOT_LIKE;
+		} else if (g_ascii_strcasecmp (op, "startsWith") == 0) {
+			type = RHYTHMDB_QUERY_PROP_PREFIX;
+		} else {
+			rb_debug ("unsupported search operator %s", op);
+			goto out;
+		}
+
+		folded = rb_search_fold (value);
+		rhythmdb_query_append (parser->db, query,
+				       type, map->folded_prop, folded,
+				       RHYTHMDB_QUERY_END);
+		g_free (folded);
+		ret = TRUE;
+	}
+
+out:
+	g_free (property);
+	g_free (op);
+	g_free (value);
+	return ret;
+}
+
+static gboolean
+parse_search_expression (SearchParser *parser, GPtrArray *query)
+{
+	while (TRUE) {
+		if (parse_search_term (parser, query) == FALSE)
+			return FALSE;
+
+		/* 'and' binds more tightly than 'or', as disjunctions do in rhythmdb queries */
+		if (peek_search_token (parser, "and")) {
+			continue;
+		} else if (peek_search_token (parser, "or")) {
+			rhythmdb_query_append (parser->db, query, RHYTHMDB_QUERY_DISJUNCTION, RHYTHMDB_QUERY_END);
+		} else {
+			return TRUE;
+		}
+	}
+}
+
+static GPtrArray *
+parse_search_query (RhythmDB *db, const char *search)
+{
+	SearchParser parser;
+	GPtrArray *query;
+
+	parser.db = db;
+	parser.pos = search;
+
+	query = g_ptr_array_new ();
+	skip_space (&parser);
+	if (*parser.pos == '\0' || g_strcmp0 (parser.pos, "*") == 0) {
+		/* matches everything */
+		return query;
+	}
+
+	if (parse_search_expression (&parser, query) == FALSE) {
+		rhythmdb_query_free (query);
+		return NULL;
+	}
+
+	skip_space (&parser);
+	if (*parser.pos != '\0') {
+		rhythmdb_query_free (query);
+		return NULL;
+	}
+
+	return query;
+}
+
+typedef struct {
+	RBMediaServer2Plugin *plugin;
+	GDBusMethodInvocation *invocation;
+	RhythmDBQueryResultList *results;
+	RhythmDBQueryModel *model;
+	guint list_offset;
+	guint list_max;
+	char **filter;
+} SearchData;
+
+typedef struct {
+	int index;
+	RhythmDBEntry *entry;
+} ModelPosition;
+
+static void search_complete_cb (RhythmDBQueryResultList *results, SearchData *data);
+
+static void
+search_data_free (SearchData *data)
+{
+	g_signal_handlers_disconnect_by_func (data->results, search_complete_cb, data);
+	g_object_unref (data->results);
+	if (data->model != NULL) {
+		g_object_unref (data->model);
+	}
+	g_object_unref (data->plugin);
+	g_strfreev (data->filter);
+	g_free (data);
+}
+
+static int
+compare_model_positions (const ModelPosition *a, const ModelPosition *b)
+{
+	return a->index - b->index;
+}
+
+/* picks out the search results that are in a source's model, in the order they appear there */
+static GList *
+filter_model_entries (RhythmDBQueryModel *model, GList *entries)
+{
+	GArray *positions;
+	GList *matches = NULL;
+	GtkTreeIter iter;
+	int i;
+
+	positions = g_array_new (FALSE, FALSE, sizeof (ModelPosition));
+	for (; entries != NULL; entries = entries->next) {
+		ModelPosition pos;
+		GtkTreePath *path;
+
+		if (rhythmdb_query_model_entry_to_iter (model, entries->data, &iter) == FALSE) {
+			continue;
+		}
+
+		path = gtk_tree_model_get_path (GTK_TREE_MODEL (model), &iter);
+		pos.index = gtk_tree_path_get_indices (path)[0];
+		pos.entry = entries->data;
+		gtk_tree_path_free (path);
+		g_array_append_val (positions, pos);
+	}
+
+	g_array_sort (positions, (GCompareFunc) compare_model_positions);
+	for (i = positions->len - 1; i >= 0; i--) {
+		matches = g_list_prepend (matches, g_array_index (positions, ModelPosition, i).entry);
+	}
+	g_array_free (positions, TRUE);
+	return matches;
+}
+
+static void
+search_complete_cb (RhythmDBQueryResultList *results, SearchData *data)
+{
+	GVariantBuilder *list;
+	guint count = 0;
+	GList *entries;
+	GList *l;
+
+	entries = rhythmdb_query_result_list_get_results (results);
+	if (data->model != NULL) {
+		entries = filter_model_entries (data->model, entries);
+	}
+
+	list = g_variant_builder_new (G_VARIANT_TYPE ("aa{sv}"));
+	for (l = entries; l != NULL; l = l->next) {
+		if (data->list_max > 0 && count == data->list_max) {
+			break;
+		}
+		if (data->list_offset > 0) {
+			data->list_offset--;
+			continue;
+		}
+		add_entry_to_list (data->plugin, list, l->data, data->filter);
+		count++;
+	}
+	rb_debug ("returned %d search results", count);
+	g_dbus_method_invocation_return_value (data->invocation, g_variant_new ("(aa{sv})", list));
+	g_variant_builder_unref (list);
+
+	if (data->model != NULL) {
+		g_list_free (entries);
+	}
+
+	data->plugin->searches = g_list_remove (data->plugin->searches, data);
+	search_data_free (data);
+}
+
+/*
+ * Runs a search in the database's query thread and replies once it's done.
+ * If a model is given, only entries in it are returned, otherwise the
+ * search covers all songs in the library.
+ */
+static void
+start_search (RBMediaServer2Plugin *plugin,
+	      GVariant *parameters,
+	      GDBusMethodInvocation *invocation,
+	      RhythmDBQueryModel *model)
+{
+	SearchData *data;
+	GPtrArray *search;
+	GPtrArray *query;
+	const char *search_text;
+	guint list_offset;
+	guint list_max;
+	char **filter;
+
+	g_variant_get (parameters, "(&suu^as)", &search_text, &list_offset, &list_max, &filter);
+	rb_debug ("searching for '%s' - offset %d, max %d", search_text, list_offset, list_max);
+
+	search = parse_search_query (plugin->db, search_text);
+	if (search == NULL) {
+		g_dbus_method_invocation_return_error (invocation,
+						       G_DBUS_ERROR,
+						       G_DBUS_ERROR_INVALID_ARGS,
+						       "Unsupported search query: %s",
+						       search_text);
+		g_strfreev (filter);
+		return;
+	}
+
+	data = g_new0 (SearchData, 1);
+	data->plugin = g_object_ref (plugin);
+	data->invocation = invocation;
+	data->list_offset = list_offset;
+	data->list_max = list_max;
+	data->filter = get_entry_filter (filter);
+
+	if (model != NULL) {
+		data->model = g_object_ref (model);
+		query = rhythmdb_query_copy (search);
+	} else {
+		query = rhythmdb_query_parse (plugin->db,
+					      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_SONG,
+					      RHYTHMDB_QUERY_SUBQUERY, search,
+					      RHYTHMDB_QUERY_END);
+	}
+
+	/* keep track of the search so it can be answered if the plugin is deactivated first */
+	plugin->searches = g_list_prepend (plugin->searches, data);
+
+	data->results = rhythmdb_query_result_list_new ();
+	g_signal_connect (data->results, "complete", G_CALLBACK (search_complete_cb), data);
+	rhythmdb_do_full_query_async_parsed (plugin->db, RHYTHMDB_QUERY_RESULTS (data->results), query);
+
+	rhythmdb_query_free (query);
+	rhythmdb_query_free (search);
+}
+
+/* searches the whole library, for the root and category containers */
+static void
+search_library (RBMediaServer2Plugin *plugin, GVariant *parameters, GDBusMethodInvocation *invocation)
+{
+	start_search (plugin, parameters, invocation, NULL);
+}
+
 static GVariant *
 get_entry_property (GDBusConnection *connection,
 		    const char *sender,
@@ -477,18 +987,13 @@ source_method_call (GDBusConnection *connection,
 
 		g_variant_get (parameters, "(uu^as)", &list_offset, &list_max, &filter);
 		list = g_variant_builder_new (G_VARIANT_TYPE ("aa{sv}"));
+		filter = get_entry_filter (filter);
 
-		if (rb_str_in_strv ("*", (const char **)filter)) {
-			g_strfreev (filter);
-			filter = g_strdupv ((char **)all_entry_properties);
-		}
-
+		/* the query model can find the first row we want without walking the rows before it */
 		model = GTK_TREE_MODEL (source_data->base_query_model);
-		if (gtk_tree_model_get_iter_first (model, &iter)) {
+		if (gtk_tree_model_iter_nth_child (model, &iter, NULL, list_offset)) {
 			do {
 				RhythmDBEntry *entry;
-				GVariantBuilder *eb;
-				int i;
 				if (list_max > 0 && count == list_max) {
 					break;
 				}
@@ -498,21 +1003,8 @@ source_method_call (GDBusConnection *connection,
 					continue;
 				}
 
-				if (list_offset > 0) {
-					list_offset--;
-					continue;
-				}
-
-				eb = g_variant_builder_new (G_VARIANT_TYPE ("a{sv}"));
-				for (i = 0; filter[i] != NULL; i++) {
-					GVariant *v;
-					v = get_entry_property_value (entry, filter[i]);
-					if (v != NULL) {
-						g_variant_builder_add (eb, "{sv}", filter[i], v);
-					}
-				}
-
-				g_variant_builder_add (list, "a{sv}", eb);
+				add_entry_to_list (source_data->plugin, list, entry, filter);
+				rhythmdb_entry_unref (entry);
 				count++;
 
 			} while (gtk_tree_model_iter_next (model, &iter));
@@ -526,7 +1018,22 @@ source_method_call (GDBusConnection *connection,
 		g_dbus_method_invocation_return_value (invocation, g_variant_new ("(aa{sv})", list));
 		g_variant_builder_unref (list);
 	} else if (g_strcmp0 (method_name, "SearchObjects") == 0) {
-		g_dbus_method_invocation_return_value (invocation, NULL);
+		rb_debug ("searching %s", object_path);
+		start_search (source_data->plugin, parameters, invocation, source_data->base_query_model);
+	} else {
+						add_entry_to_list (plugin, list, entry, filter);
+						count++;
+					}
+				}
+				rhythmdb_entry_unref (entry);
+
+			} while (gtk_tree_model_iter_next (model, &iter));
+		}
+		g_dbus_method_invocation_return_value (invocation, g_variant_new ("(aa{sv})", list));
+		g_variant_builder_unref (list);
+
+		rhythmdb_query_free (query);
+		g_strfreev (filter);
 	} else {
 		g_dbus_method_invocation_return_error (invocation,
 						       G_DBUS_ERROR,
@@ -1026,8 +1533,7 @@ category_container_method_call (GDBusConnection *connection,
 			g_variant_builder_unref (list);
 			g_strfreev ((char **)filter);
 		} else if (g_strcmp0 (method_name, "SearchObjects") == 0) {
-			rb_debug ("search not supported");
-			g_dbus_method_invocation_return_value (invocation, NULL);
+			search_library (data->plugin, parameters, invocation);
 		}
 	} else {
 		g_dbus_method_invocation_return_error (invocation,
@@ -1222,8 +1728,7 @@ root_method_call (GDBusConnection *connection,
 			g_variant_builder_unref (list);
 			g_strfreev ((char **)filter);
 		} else if (g_strcmp0 (method_name, "SearchObjects") == 0) {
-			rb_debug ("search not supported");
-			g_dbus_method_invocation_return_value (invocation, NULL);
+			search_library (plugin, parameters, invocation);
 		}
 	} else {
 		g_dbus_method_invocation_return_error (invocation,
@@ -1426,6 +1931,13 @@ impl_activate (PeasActivatable *bplugin)
 
 	plugin->settings = g_settings_new ("org.gnome.rhythmbox.sharing");
 
+	plugin->entry_properties = g_hash_table_new_full (g_direct_hash,
+							  g_direct_equal,
+							  (GDestroyNotify) rhythmdb_entry_unref,
+							  (GDestroyNotify) g_hash_table_destroy);
+	g_signal_connect_object (plugin->db, "entry-changed", G_CALLBACK (entry_changed_cb), plugin, 0);
+	g_signal_connect_object (plugin->db, "entry-deleted", G_CALLBACK (entry_deleted_cb), plugin, 0);
+
 	plugin->node_info = g_dbus_node_info_new_for_xml (media_server2_spec, &error);
 	if (error != NULL) {
 		g_warning ("Unable to parse MediaServer2 spec: %s", error->message);
@@ -1533,11 +2045,30 @@ impl_deactivate	(PeasActivatable *bplugin)
 		plugin->display_page_model = NULL;
 	}
 
+	/* answer any searches still waiting for results */
+	for (l = plugin->searches; l != NULL; l = l->next) {
+		SearchData *data = l->data;
+		g_dbus_method_invocation_return_error (data->invocation,
+						       G_DBUS_ERROR,
+						       G_DBUS_ERROR_FAILED,
+						       "Search cancelled");
+		search_data_free (data);
+	}
+	g_list_free (plugin->searches);
+	plugin->searches = NULL;
+
 	if (plugin->db != NULL) {
+		g_signal_handlers_disconnect_by_func (plugin->db, entry_changed_cb, plugin);
+		g_signal_handlers_disconnect_by_func (plugin->db, entry_deleted_cb, plugin);
 		g_object_unref (plugin->db);
 		plugin->db = NULL;
 	}
 
+	if (plugin->entry_properties != NULL) {
+		g_hash_table_destroy (plugin->entry_properties);
+		plugin->entry_properties = NULL;
+	}
+
 	if (plugin->name_own_id > 0) {
 		g_bus_unown_name (plugin->name_own_id);
 		plugin->name_own_id = 0;
@@ -123,8 +123,6 @@ typedef struct
 	gboolean needs_shuffle_db;
 	RBIpodStaticPlaylistSource *podcast_pl;
 
-	guint load_idle_id;
-
 	GHashTable *artwork_request_map;
 	guint artwork_notify_id;
 
@@ -319,11 +317,6 @@ rb_ipod_source_dispose (GObject *object)
 		priv->entry_map = NULL;
  	}
 
-	if (priv->load_idle_id != 0) {
-		g_source_remove (priv->load_idle_id);
-		priv->load_idle_id = 0;
-	}
-
 	if (priv->artwork_request_map) {
 		g_hash_table_destroy (priv->artwork_request_map);
 		priv->artwork_request_map = NULL;
@@ -764,34 +757,28 @@ static void add_offline_played_entry (RBiPodSource *source,
 	g_queue_push_tail (priv->offline_plays, played_entry);
 }
 
-static void
-add_ipod_song_to_db (RBiPodSource *source, RhythmDB *db, Itdb_Track *song)
+/* this doesn't touch the source's private data, so it can be called from
+ * the thread that loads the iPod's songs.
+ */
+static RhythmDBEntry *
+create_ipod_song_entry (RBiPodSource *source, RhythmDB *db, const char *mount_path, Itdb_Track *song)
 {
 	RhythmDBEntry *entry;
 	RhythmDBEntryType *entry_type;
-	RBiPodSourcePrivate *priv = IPOD_SOURCE_GET_PRIVATE (source);
 	char *pc_path;
-	const char *mount_path;
-
-	/* Set URI */
-	g_object_get (source, "entry-type", &entry_type, NULL);
-	mount_path = rb_ipod_db_get_mount_path (priv->ipod_db);
-	pc_path = ipod_path_to_uri (mount_path, song->ipod_path);
-	entry = rhythmdb_entry_new (RHYTHMDB (db), entry_type, pc_path);
-	g_object_unref (entry_type);
-
-	if (entry == NULL) {
-		rb_debug ("cannot create entry %s", pc_path);
-		g_free (pc_path);
-		return;
-	}
 
 	if ((song->mediatype != ITDB_MEDIATYPE_AUDIO)
 	    && (song->mediatype != ITDB_MEDIATYPE_PODCAST)) {
 		rb_debug ("iPod track is neither an audio track nor a podcast, skipping");
-		return;
+		return NULL;
 	}
 
+	/* Set URI */
+	g_object_get (source, "entry-type", &entry_type, NULL);
+	pc_path = ipod_path_to_uri (mount_path, song->ipod_path);
+	entry = rhythmdb_entry_new_pending (RHYTHMDB (db), entry_type, pc_path);
+	g_object_unref (entry_type);
+
 	rb_debug ("Adding %s from iPod", pc_path);
 	g_free (pc_path);
 
@@ -954,16 +941,65 @@ add_ipod_song_to_db (RBiPodSource *source, RhythmDB *db, Itdb_Track *song)
 	entry_set_string_prop (RHYTHMDB (db), entry,
 			       RHYTHMDB_PROP_GENRE, song->genre);
 
-	g_hash_table_insert (priv->entry_map, entry, song);
+	return entry;
+}
 
-	if (song->recent_playcount != 0) {
-		add_offline_played_entry (source, entry,
-					  song->recent_playcount);
+/* entries and songs are parallel lists */
+static void
+add_ipod_entries_to_db (RBiPodSource *source, RhythmDB *db, GList *entries, GList *songs)
+{
+	RBiPodSourcePrivate *priv = IPOD_SOURCE_GET_PRIVATE (source);
+	GList *added;
+	GList *a;
+	GList *e;
+	GList *s;
+
+	added = rhythmdb_entry_insert_batch (db, entries);
+
+	/* entries with the same location as an existing entry are dropped */
+	a = added;
+	for (e = entries, s = songs; e != NULL && a != NULL; e = e->next, s = s->next) {
+		Itdb_Track *song = s->data;
+		RhythmDBEntry *entry = e->data;
+
+		if (entry != a->data) {
+			rb_debug ("cannot create entry for %s", song->ipod_path);
+			continue;
+		}
+		a = a->next;
+
+		g_hash_table_insert (priv->entry_map, entry, song);
+
+		if (song->recent_playcount != 0) {
+			add_offline_played_entry (source, entry,
+						  song->recent_playcount);
+		}
 	}
+	g_list_free (added);
 
 	rhythmdb_commit (RHYTHMDB (db));
 }
 
+static void
+add_ipod_song_to_db (RBiPodSource *source, RhythmDB *db, Itdb_Track *song)
+{
+	RBiPodSourcePrivate *priv = IPOD_SOURCE_GET_PRIVATE (source);
+	RhythmDBEntry *entry;
+	GList *entries;
+	GList *songs;
+
+	entry = create_ipod_song_entry (source, db, rb_ipod_db_get_mount_path (priv->ipod_db), song);
+	if (entry == NULL) {
+		return;
+	}
+
+	entries = g_list_prepend (NULL, entry);
+	songs = g_list_prepend (NULL, song);
+	add_ipod_entries_to_db (source, db, entries, songs);
+	g_list_free (entries);
+	g_list_free (songs);
+}
+
 static RhythmDB *
 get_db_for_source (RBiPodSource *source)
 {
@@ -1158,23 +1194,46 @@ rb_ipod_source_entry_changed_cb (RhythmDB *db,
 	}
 }
 
+typedef struct {
+	RBiPodSource *source;
+	RhythmDB *db;
+	RbIpodDb *ipod_db;
+	GList *tracks;
+	GList *entries;
+	GList *songs;
+} LoadSongsData;
+
+static void
+load_songs_data_free (LoadSongsData *data)
+{
+	g_list_foreach (data->entries, (GFunc) rhythmdb_entry_unref, NULL);
+	g_list_free (data->entries);
+	g_list_free (data->songs);
+	g_list_free (data->tracks);
+	g_object_unref (data->ipod_db);
+	g_object_unref (data->db);
+	g_object_unref (data->source);
+	g_free (data);
+}
+
 static gboolean
-load_ipod_db_idle_cb (RBiPodSource *source)
+load_ipod_db_idle_cb (LoadSongsData *data)
 {
-	RhythmDB *db;
- 	GList *it;
+	RBiPodSource *source = data->source;
+	RhythmDB *db = data->db;
 	RBiPodSourcePrivate *priv = IPOD_SOURCE_GET_PRIVATE (source);
 
-	GDK_THREADS_ENTER ();
+	if (priv->ipod_db != data->ipod_db) {
+		/* source has been disposed */
+		load_songs_data_free (data);
+		return FALSE;
+	}
 
-	db = get_db_for_source (source);
+	GDK_THREADS_ENTER ();
 
-	g_assert (db != NULL);
- 	for (it = rb_ipod_db_get_tracks (priv->ipod_db);
-	     it != NULL;
-	     it = it->next) {
-		add_ipod_song_to_db (source, db, (Itdb_Track *)it->data);
-	}
+	add_ipod_entries_to_db (source, db, data->entries, data->songs);
+	g_list_free (data->entries);
+	data->entries = NULL;
 
 	load_ipod_playlists (source);
 	send_offline_plays_notification (source);
@@ -1183,13 +1242,39 @@ load_ipod_db_idle_cb (RBiPodSource *source)
 				G_CALLBACK (rb_ipod_source_entry_changed_cb),
 				source, 0);
 
-	g_object_unref (db);
-
 	GDK_THREADS_LEAVE ();
-	priv->load_idle_id = 0;
+	load_songs_data_free (data);
 	return FALSE;
 }
 
+/* builds entries for all the songs on the iPod, which takes a while for large
+ * databases, then adds them to the database together on the main thread.
+ */
+static gpointer
+load_songs_thread (LoadSongsData *data)
+{
+	const char *mount_path;
+	GList *it;
+
+	mount_path = rb_ipod_db_get_mount_path (data->ipod_db);
+	for (it = data->tracks; it != NULL; it = it->next) {
+		RhythmDBEntry *entry;
+
+		entry = create_ipod_song_entry (data->source, data->db, mount_path, (Itdb_Track *)it->data);
+		if (entry != NULL) {
+			data->entries = g_list_prepend (data->entries, entry);
+			data->songs = g_list_prepend (data->songs, it->data);
+		}
+	}
+
+	data->entries = g_list_reverse (data->entries);
+	data->songs = g_list_reverse (data->songs);
+	rb_debug ("built %d entries for iPod songs", g_list_length (data->entries));
+
+	g_idle_add ((GSourceFunc) load_ipod_db_idle_cb, data);
+	return NULL;
+}
+
 static void
 rb_ipod_load_songs (RBiPodSource *source)
 {
@@ -1201,6 +1286,7 @@ rb_ipod_load_songs (RBiPodSource *source)
 	priv->entry_map = g_hash_table_new (g_direct_hash, g_direct_equal);
 
 	if ((priv->ipod_db != NULL) && (priv->entry_map != NULL)) {
+		LoadSongsData *data;
 		const char *name;
 		name = rb_ipod_db_get_ipod_name (priv->ipod_db);
 		if (name) {
@@ -1211,7 +1297,16 @@ rb_ipod_load_songs (RBiPodSource *source)
                 g_signal_connect (G_OBJECT (source), "notify::name",
 		  	          (GCallback)rb_ipod_source_name_changed_cb,
                                   NULL);
-		priv->load_idle_id = g_idle_add ((GSourceFunc)load_ipod_db_idle_cb, source);
+
+		/* nothing changes the track list until the songs are loaded,
+		 * so the thread can work from a copy of it.
+		 */
+		data = g_new0 (LoadSongsData, 1);
+		data->source = g_object_ref (source);
+		data->db = get_db_for_source (source);
+		data->ipod_db = g_object_ref (priv->ipod_db);
+		data->tracks = g_list_copy (rb_ipod_db_get_tracks (priv->ipod_db));
+		g_thread_create ((GThreadFunc) load_songs_thread, data, FALSE, NULL);
 	}
 	g_object_unref (mount);
 }
@@ -95,7 +95,7 @@ static void impl_eject (RBRemovableMediaSource *source);
 static gboolean impl_can_eject (RBRemovableMediaSource *source);
 
 static void mtp_device_open_cb (LIBMTP_mtpdevice_t *device, RBMtpSource *source);
-static void mtp_tracklist_cb (LIBMTP_track_t *tracks, RBMtpSource *source);
+static void mtp_tracklist_cb (LIBMTP_track_t *tracks, gboolean from_snapshot, RBMtpSource *source);
 static RhythmDB * get_db_for_source (RBMtpSource *source);
 static void artwork_notify_cb (RhythmDB *db,
 			       RhythmDBEntry *entry,
@@ -134,6 +134,10 @@ typedef struct
 	RBMtpThread *device_thread;
 	LIBMTP_raw_device_t raw_device;
 	GHashTable *entry_map;
+	GHashTable *listed_entries;	/* entries from the last track list read from the device */
+	GHashTable *deleted_tracks;	/* item IDs of tracks deleted while reconcile_pending is set */
+	gboolean track_list_loaded;
+	gboolean reconcile_pending;	/* track list came from a snapshot, device's list still to come */
 	GHashTable *artwork_request_map;
 	GHashTable *track_transfer_map;
 #if defined(HAVE_GUDEV)
@@ -266,6 +270,8 @@ rb_mtp_source_init (RBMtpSource *source)
 						 g_direct_equal,
 						 NULL,
 						 (GDestroyNotify) LIBMTP_destroy_track_t);
+	priv->listed_entries = g_hash_table_new (g_direct_hash, g_direct_equal);
+	priv->deleted_tracks = g_hash_table_new (g_direct_hash, g_direct_equal);
 	priv->artwork_request_map = g_hash_table_new (g_direct_hash, g_direct_equal);
 
 	priv->track_transfer_map = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
@@ -520,6 +526,8 @@ rb_mtp_source_finalize (GObject *object)
 	RBMtpSourcePrivate *priv = MTP_SOURCE_GET_PRIVATE (object);
 
 	g_hash_table_destroy (priv->entry_map);
+	g_hash_table_destroy (priv->listed_entries);
+	g_hash_table_destroy (priv->deleted_tracks);
 	g_hash_table_destroy (priv->artwork_request_map);
 	g_hash_table_destroy (priv->track_transfer_map);		/* probably need to destroy the tracks too.. */
 
@@ -633,90 +641,41 @@ entry_set_string_prop (RhythmDB *db,
 	g_value_unset (&value);
 }
 
-static RhythmDBEntry *
-add_mtp_track_to_db (RBMtpSource *source,
-		     RhythmDB *db,
-		     LIBMTP_track_t *track)
+static char *
+mtp_track_uri (LIBMTP_track_t *track)
 {
-	RhythmDBEntry *entry = NULL;
-	RhythmDBEntryType *entry_type;
-	RBMtpSourcePrivate *priv = MTP_SOURCE_GET_PRIVATE (source);
-	char *name = NULL;
-
-	/* ignore everything except audio (allow audio/video types too, since they're probably pretty common) */
-	if (!(LIBMTP_FILETYPE_IS_AUDIO (track->filetype) || LIBMTP_FILETYPE_IS_AUDIOVIDEO (track->filetype))) {
-		rb_debug ("ignoring non-audio item %d (filetype %s)",
-			  track->item_id,
-			  LIBMTP_Get_Filetype_Description (track->filetype));
-		return NULL;
-	}
-
-	/* Set URI */
-	g_object_get (G_OBJECT (source), "entry-type", &entry_type, NULL);
-	name = g_strdup_printf ("xrbmtp://%i/%s", track->item_id, track->filename);
-	entry = rhythmdb_entry_new (RHYTHMDB (db), entry_type, name);
-	g_free (name);
-        g_object_unref (entry_type);
+	return g_strdup_printf ("xrbmtp://%i/%s", track->item_id, track->filename);
+}
 
-	if (entry == NULL) {
-		rb_debug ("cannot create entry %i", track->item_id);
-		g_object_unref (G_OBJECT (db));
-		return NULL;
-	}
+static void
+set_entry_from_mtp_track (RhythmDB *db,
+			  RhythmDBEntry *entry,
+			  LIBMTP_track_t *track)
+{
+	GValue value = {0, };
 
-	/* Set track number */
-	if (track->tracknumber != 0) {
-		GValue value = {0, };
-		g_value_init (&value, G_TYPE_ULONG);
-		g_value_set_ulong (&value, track->tracknumber);
-		rhythmdb_entry_set (RHYTHMDB (db), entry,
-				    RHYTHMDB_PROP_TRACK_NUMBER,
-				    &value);
-		g_value_unset (&value);
-	}
+	/* numeric properties are set even when they're 0, so values
+	 * from an outdated snapshot of the device are replaced.
+	 */
+	g_value_init (&value, G_TYPE_ULONG);
+	g_value_set_ulong (&value, track->tracknumber);
+	rhythmdb_entry_set (RHYTHMDB (db), entry, RHYTHMDB_PROP_TRACK_NUMBER, &value);
+	g_value_set_ulong (&value, track->duration/1000);
+	rhythmdb_entry_set (RHYTHMDB (db), entry, RHYTHMDB_PROP_DURATION, &value);
+	g_value_set_ulong (&value, track->usecount);
+	rhythmdb_entry_set (RHYTHMDB (db), entry, RHYTHMDB_PROP_PLAY_COUNT, &value);
+	g_value_unset (&value);
 
-	/* Set length */
-	if (track->duration != 0) {
-		GValue value = {0, };
-		g_value_init (&value, G_TYPE_ULONG);
-		g_value_set_ulong (&value, track->duration/1000);
-		rhythmdb_entry_set (RHYTHMDB (db), entry,
-				    RHYTHMDB_PROP_DURATION,
-				    &value);
-		g_value_unset (&value);
-	}
+	g_value_init (&value, G_TYPE_UINT64);
+	g_value_set_uint64 (&value, track->filesize);
+	rhythmdb_entry_set (RHYTHMDB (db), entry, RHYTHMDB_PROP_FILE_SIZE, &value);
+	g_value_unset (&value);
 
-	/* Set file size */
-	if (track->filesize != 0) {
-		GValue value = {0, };
-		g_value_init (&value, G_TYPE_UINT64);
-		g_value_set_uint64 (&value, track->filesize);
-		rhythmdb_entry_set (RHYTHMDB (db), entry,
-				    RHYTHMDB_PROP_FILE_SIZE,
-				    &value);
-		g_value_unset (&value);
-	}
+	g_value_init (&value, G_TYPE_DOUBLE);
+	g_value_set_double (&value, track->rating/20);
+	rhythmdb_entry_set (RHYTHMDB (db), entry, RHYTHMDB_PROP_RATING, &value);
+	g_value_unset (&value);
 
-	/* Set playcount */
-	if (track->usecount != 0) {
-		GValue value = {0, };
-		g_value_init (&value, G_TYPE_ULONG);
-		g_value_set_ulong (&value, track->usecount);
-		rhythmdb_entry_set (RHYTHMDB (db), entry,
-					       RHYTHMDB_PROP_PLAY_COUNT,
-					       &value);
-		g_value_unset (&value);
-	}
-	/* Set rating */
-	if (track->rating != 0) {
-		GValue value = {0, };
-		g_value_init (&value, G_TYPE_DOUBLE);
-		g_value_set_double (&value, track->rating/20);
-		rhythmdb_entry_set (RHYTHMDB (db), entry,
-					       RHYTHMDB_PROP_RATING,
-					       &value);
-		g_value_unset (&value);
-	}
 	/* Set release date */
 	if (track->date != NULL && track->date[0] != '\0') {
 		GTimeVal tv;
@@ -738,10 +697,100 @@ add_mtp_track_to_db (RBMtpSource *source,
 	entry_set_string_prop (RHYTHMDB (db), entry, RHYTHMDB_PROP_ARTIST, track->artist);
 	entry_set_string_prop (RHYTHMDB (db), entry, RHYTHMDB_PROP_ALBUM, track->album);
 	entry_set_string_prop (RHYTHMDB (db), entry, RHYTHMDB_PROP_GENRE, track->genre);
+}
+
+static RhythmDBEntry *
+create_mtp_track_entry (RBMtpSource *source,
+			RhythmDB *db,
+			LIBMTP_track_t *track)
+{
+	RhythmDBEntry *entry = NULL;
+	RhythmDBEntryType *entry_type;
+	char *name = NULL;
+
+	/* ignore everything except audio (allow audio/video types too, since they're probably pretty common) */
+	if (!(LIBMTP_FILETYPE_IS_AUDIO (track->filetype) || LIBMTP_FILETYPE_IS_AUDIOVIDEO (track->filetype))) {
+		rb_debug ("ignoring non-audio item %d (filetype %s)",
+			  track->item_id,
+			  LIBMTP_Get_Filetype_Description (track->filetype));
+		return NULL;
+	}
+
+	/* Set URI */
+	g_object_get (G_OBJECT (source), "entry-type", &entry_type, NULL);
+	name = mtp_track_uri (track);
+	entry = rhythmdb_entry_new_pending (RHYTHMDB (db), entry_type, name);
+	g_free (name);
+        g_object_unref (entry_type);
+
+	set_entry_from_mtp_track (db, entry, track);
+
+	return entry;
+}
+
+/* entries and tracks are parallel lists; returns the entries that were added.
+ * listed indicates whether the tracks come from the device's track list.
+ * the tracks are owned by the entry map afterwards, or destroyed if their
+ * entries weren't added.
+ */
+static GList *
+add_mtp_entries_to_db (RBMtpSource *source,
+		       RhythmDB *db,
+		       GList *entries,
+		       GList *tracks,
+		       gboolean listed)
+{
+	RBMtpSourcePrivate *priv = MTP_SOURCE_GET_PRIVATE (source);
+	GList *added;
+	GList *a;
+	GList *e;
+	GList *t;
+
+	added = rhythmdb_entry_insert_batch (db, entries);
+
+	/* entries with the same location as an existing entry are dropped */
+	a = added;
+	for (e = entries, t = tracks; e != NULL; e = e->next, t = t->next) {
+		if (a != NULL && e->data == a->data) {
+			g_hash_table_insert (priv->entry_map, e->data, t->data);
+			if (listed) {
+				g_hash_table_insert (priv->listed_entries, e->data, NULL);
+			}
+			a = a->next;
+		} else {
+			rb_debug ("cannot create entry %i", ((LIBMTP_track_t *)t->data)->item_id);
+			LIBMTP_destroy_track_t (t->data);
+		}
+	}
+
+	rhythmdb_commit (db);
+	return added;
+}
+
+static RhythmDBEntry *
+add_mtp_track_to_db (RBMtpSource *source,
+		     RhythmDB *db,
+		     LIBMTP_track_t *track)
+{
+	RhythmDBEntry *entry;
+	GList *entries;
+	GList *tracks;
+	GList *added;
 
-	g_hash_table_insert (priv->entry_map, entry, track);
-	rhythmdb_commit (RHYTHMDB (db));
+	entry = create_mtp_track_entry (source, db, track);
+	if (entry == NULL) {
+		LIBMTP_destroy_track_t (track);
+		return NULL;
+	}
 
+	entries = g_list_prepend (NULL, entry);
+	tracks = g_list_prepend (NULL, track);
+	added = add_mtp_entries_to_db (source, db, entries, tracks, FALSE);
+	g_list_free (entries);
+	g_list_free (tracks);
+
+	entry = (added != NULL) ? added->data : NULL;
+	g_list_free (added);
 	return entry;
 }
 
@@ -949,17 +998,148 @@ mtp_device_open_cb (LIBMTP_mtpdevice_t *device, RBMtpSource *source)
 	rb_mtp_thread_get_track_list (priv->device_thread, (RBMtpTrackListCallback) mtp_tracklist_cb, g_object_ref (source), g_object_unref);
 }
 
+typedef struct {
+	RBMtpSource *source;
+	LIBMTP_track_t *tracks;
+} TrackListData;
+
+/* replaces the entries from the previous track list, which may have come from a
+ * snapshot of the device's contents, with those from a new one.
+ */
+static gboolean
+reconcile_tracklist_idle (TrackListData *data)
+{
+	RBMtpSourcePrivate *priv = MTP_SOURCE_GET_PRIVATE (data->source);
+	RhythmDB *db;
+	GHashTable *unseen;
+	GHashTableIter iter;
+	gpointer entry_ptr;
+	LIBMTP_track_t *track;
+	LIBMTP_track_t *next;
+	GList *entries = NULL;
+	GList *entry_tracks = NULL;
+
+	if (priv->device_thread == NULL) {
+		/* source has been disposed */
+		for (track = data->tracks; track != NULL; track = next) {
+			next = track->next;
+			LIBMTP_destroy_track_t (track);
+		}
+		g_object_unref (data->source);
+		g_free (data);
+		return FALSE;
+	}
+
+	db = get_db_for_source (data->source);
+
+	unseen = priv->listed_entries;
+	priv->listed_entries = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+	for (track = data->tracks; track != NULL; track = next) {
+		RhythmDBEntry *entry;
+		char *uri;
+
+		next = track->next;
+
+		/* tracks deleted while the device was being listed are still in the list */
+		if (g_hash_table_lookup (priv->deleted_tracks, GUINT_TO_POINTER (track->item_id)) != NULL) {
+			rb_debug ("ignoring deleted track %u", track->item_id);
+			LIBMTP_destroy_track_t (track);
+			continue;
+		}
+
+		uri = mtp_track_uri (track);
+		entry = rhythmdb_entry_lookup_by_location (db, uri);
+		g_free (uri);
+
+		if (entry != NULL && g_hash_table_lookup (priv->entry_map, entry) != NULL) {
+			/* this frees the previous track */
+			g_hash_table_insert (priv->entry_map, entry, track);
+			g_hash_table_insert (priv->listed_entries, entry, NULL);
+			g_hash_table_remove (unseen, entry);
+			set_entry_from_mtp_track (db, entry, track);
+			continue;
+		}
+
+		entry = create_mtp_track_entry (data->source, db, track);
+		if (entry != NULL) {
+			entries = g_list_prepend (entries, entry);
+			entry_tracks = g_list_prepend (entry_tracks, track);
+		} else {
+			LIBMTP_destroy_track_t (track);
+		}
+	}
+
+	/* anything left is no longer on the device */
+	g_hash_table_iter_init (&iter, unseen);
+	while (g_hash_table_iter_next (&iter, &entry_ptr, NULL)) {
+		rb_debug ("track %s is no longer on the device",
+			  rhythmdb_entry_get_string (entry_ptr, RHYTHMDB_PROP_LOCATION));
+		g_hash_table_remove (priv->entry_map, entry_ptr);
+		rhythmdb_entry_delete (db, entry_ptr);
+	}
+	g_hash_table_destroy (unseen);
+	g_hash_table_remove_all (priv->deleted_tracks);
+	priv->reconcile_pending = FALSE;
+
+	entries = g_list_reverse (entries);
+	entry_tracks = g_list_reverse (entry_tracks);
+	g_list_free (add_mtp_entries_to_db (data->source, db, entries, entry_tracks, TRUE));
+	g_list_free (entries);
+	g_list_free (entry_tracks);
+
+	g_object_unref (db);
+	g_object_unref (data->source);
+	g_free (data);
+	return FALSE;
+}
+
 static void
-mtp_tracklist_cb (LIBMTP_track_t *tracks, RBMtpSource *source)
+mtp_tracklist_cb (LIBMTP_track_t *tracks, gboolean from_snapshot, RBMtpSource *source)
 {
+	RBMtpSourcePrivate *priv = MTP_SOURCE_GET_PRIVATE (source);
 	RhythmDB *db = NULL;
 	LIBMTP_track_t *track;
+	LIBMTP_track_t *next;
+	GList *entries = NULL;
+	GList *entry_tracks = NULL;
+
+	/* if the first track list came from a snapshot, the device's actual
+	 * track list follows.  by then the entries may be in use, so the
+	 * differences are applied on the main thread.
+	 */
+	if (priv->track_list_loaded) {
+		TrackListData *data;
 
-	/* add tracks to database */
+		data = g_new0 (TrackListData, 1);
+		data->source = g_object_ref (source);
+		data->tracks = tracks;
+		g_idle_add ((GSourceFunc) reconcile_tracklist_idle, data);
+		return;
+	}
+	priv->track_list_loaded = TRUE;
+	priv->reconcile_pending = from_snapshot;
+
+	/* build entries for all the tracks, then add them to the database together */
 	db = get_db_for_source (source);
-	for (track = tracks; track != NULL; track = track->next) {
-		add_mtp_track_to_db (source, db, track);
+	for (track = tracks; track != NULL; track = next) {
+		RhythmDBEntry *entry;
+
+		next = track->next;
+		entry = create_mtp_track_entry (source, db, track);
+		if (entry != NULL) {
+			entries = g_list_prepend (entries, entry);
+			entry_tracks = g_list_prepend (entry_tracks, track);
+		} else {
+			LIBMTP_destroy_track_t (track);
+		}
 	}
+
+	entries = g_list_reverse (entries);
+	entry_tracks = g_list_reverse (entry_tracks);
+	g_list_free (add_mtp_entries_to_db (source, db, entries, entry_tracks, TRUE));
+	g_list_free (entries);
+	g_list_free (entry_tracks);
 	g_object_unref (db);
 }
 
@@ -1111,9 +1291,15 @@ impl_track_added (RBRemovableMediaSource *source,
 	g_hash_table_remove (priv->track_transfer_map, dest);
 
 	db = get_db_for_source (RB_MTP_SOURCE (source));
-	/* entry_map takes ownership of the track here */
+	/* entry_map takes ownership of the track here, or it's destroyed
+	 * if an entry for it couldn't be added.
+	 */
 	mtp_entry = add_mtp_track_to_db (RB_MTP_SOURCE (source), db, track);
 	g_object_unref (db);
+	if (mtp_entry == NULL) {
+		queue_free_space_update (RB_MTP_SOURCE (source));
+		return FALSE;
+	}
 
 	if (strcmp (track->album, _("Unknown")) != 0) {
 		rb_mtp_thread_add_to_album (priv->device_thread, track, track->album);
@@ -1509,11 +1695,19 @@ impl_delete_entries	(RBMediaPlayerSource *source,
 		}
 		rb_mtp_thread_delete_track (priv->device_thread, track);
 
+		/* only needed until the device's track list replaces the snapshot */
+		if (priv->reconcile_pending) {
+			g_hash_table_insert (priv->deleted_tracks,
+					     GUINT_TO_POINTER (track->item_id),
+					     GINT_TO_POINTER (1));
+		}
+
 		g_hash_table_insert (cb_data->check_folders,
 				     GUINT_TO_POINTER (track->parent_id),
 				     GINT_TO_POINTER (1));
 
 		g_hash_table_remove (priv->entry_map, entry);
+		g_hash_table_remove (priv->listed_entries, entry);
 		rhythmdb_entry_delete (db, entry);
 	}
 
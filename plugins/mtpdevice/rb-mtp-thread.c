@@ -28,6 +28,7 @@
 #include <config.h>
 
 #include <string.h>
+#include <stdlib.h>
 
 #include <glib.h>
 #include <glib/gi18n.h>
@@ -70,6 +71,7 @@ typedef struct {
 	GdkPixbuf *image;
 	char *name;
 	char **path;
+	gboolean refresh;
 
 	gpointer callback;
 	gpointer user_data;
@@ -91,7 +93,7 @@ task_name (RBMtpThreadTask *task)
 	case REMOVE_FROM_ALBUM:	return g_strdup_printf ("remove track %u from album %s", task->track_id, task->album);
 	case SET_ALBUM_IMAGE:	return g_strdup_printf ("set image for album %s", task->album);
 
-	case GET_TRACK_LIST:	return g_strdup ("get track list");
+	case GET_TRACK_LIST:	return g_strdup (task->refresh ? "refresh track list" : "get track list");
 	case DELETE_TRACK:	return g_strdup_printf ("delete track %u", task->track_id);
 	case UPLOAD_TRACK:	return g_strdup_printf ("upload track from %s", task->filename);
 	case DOWNLOAD_TRACK:	return g_strdup_printf ("download track %u to %s",
@@ -389,6 +391,217 @@ set_album_image (RBMtpThread *thread, RBMtpThreadTask *task)
 	LIBMTP_destroy_filesampledata_t (albumart);
 }
 
+/*
+ * Listing the tracks on a device can take a long time, so a snapshot of the
+ * track list is kept in the user cache directory, keyed by the device's serial
+ * number.  The first line of the snapshot records the capacity and free space
+ * (in bytes and objects) of each of the device's storage areas, so we can tell
+ * whether tracks are likely to have been added or removed since it was saved.
+ * The remaining lines hold the fields of each track that we use.
+ *
+ * Play counts and ratings can change without affecting the free space, so
+ * even when the snapshot looks current, the tracks are listed again once
+ * the thread has run out of other tasks, and the source reconciles the two.
+ * When the snapshot is out of date, the tracks are listed straight away.
+ */
+
+static char *
+get_snapshot_path (LIBMTP_mtpdevice_t *device)
+{
+	char *serial;
+	char *escaped;
+	char *dir;
+	char *filename;
+	char *path;
+
+	serial = LIBMTP_Get_Serialnumber (device);
+	if (serial == NULL || serial[0] == '\0') {
+		g_free (serial);
+		return NULL;
+	}
+
+	escaped = g_uri_escape_string (serial, NULL, FALSE);
+	dir = g_build_filename (rb_user_cache_dir (), "mtp", NULL);
+	g_mkdir_with_parents (dir, 0700);
+	filename = g_strdup_printf ("device-%s.tracks", escaped);
+	path = g_build_filename (dir, filename, NULL);
+
+	g_free (filename);
+	g_free (dir);
+	g_free (escaped);
+	g_free (serial);
+	return path;
+}
+
+static char *
+get_device_state (RBMtpThread *thread)
+{
+	LIBMTP_devicestorage_t *storage;
+	GString *str;
+
+	if (LIBMTP_Get_Storage (thread->device, LIBMTP_STORAGE_SORTBY_NOTSORTED) != 0) {
+		rb_mtp_thread_report_errors (thread, FALSE);
+		return NULL;
+	}
+
+	str = g_string_new (NULL);
+	for (storage = thread->device->storage; storage != NULL; storage = storage->next) {
+		g_string_append_printf (str, "%u:%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT ";",
+					storage->id,
+					(guint64) storage->MaxCapacity,
+					(guint64) storage->FreeSpaceInBytes,
+					(guint64) storage->FreeSpaceInObjects);
+	}
+	return g_string_free (str, FALSE);
+}
+
+static void
+append_snapshot_string (GString *str, const char *value)
+{
+	g_string_append_c (str, '\t');
+	if (value != NULL) {
+		char *escaped;
+
+		escaped = g_uri_escape_string (value, NULL, FALSE);
+		g_string_append (str, escaped);
+		g_free (escaped);
+	}
+}
+
+static char *
+parse_snapshot_string (const char *value)
+{
+	if (value[0] == '\0')
+		return NULL;
+
+	return g_uri_unescape_string (value, NULL);
+}
+
+static void
+save_snapshot (const char *path, const char *state, LIBMTP_track_t *tracks)
+{
+	LIBMTP_track_t *track;
+	GString *str;
+	GError *error = NULL;
+
+	str = g_string_new (state);
+	g_string_append_c (str, '\n');
+	for (track = tracks; track != NULL; track = track->next) {
+		g_string_append_printf (str, "%u\t%u\t%u\t%d\t%u\t%u\t%" G_GUINT64_FORMAT "\t%u\t%u",
+					track->item_id,
+					track->parent_id,
+					track->storage_id,
+					track->filetype,
+					track->tracknumber,
+					track->duration,
+					(guint64) track->filesize,
+					track->usecount,
+					track->rating);
+		append_snapshot_string (str, track->filename);
+		append_snapshot_string (str, track->title);
+		append_snapshot_string (str, track->artist);
+		append_snapshot_string (str, track->album);
+		append_snapshot_string (str, track->genre);
+		append_snapshot_string (str, track->date);
+		g_string_append_c (str, '\n');
+	}
+
+	rb_debug ("saving track list snapshot to %s", path);
+	if (g_file_set_contents (path, str->str, str->len, &error) == FALSE) {
+		rb_debug ("unable to save track list snapshot: %s", error->message);
+		g_clear_error (&error);
+	}
+	g_string_free (str, TRUE);
+}
+
+static void
+update_snapshot_state (const char *path, const char *state)
+{
+	char *contents;
+	char *tracks;
+	char *updated;
+	GError *error = NULL;
+
+	if (g_file_get_contents (path, &contents, NULL, NULL) == FALSE) {
+		return;
+	}
+
+	tracks = strchr (contents, '\n');
+	if (tracks != NULL) {
+		updated = g_strconcat (state, tracks, NULL);
+		if (g_file_set_contents (path, updated, -1, &error) == FALSE) {
+			rb_debug ("unable to update track list snapshot: %s", error->message);
+			g_clear_error (&error);
+		}
+		g_free (updated);
+	}
+	g_free (contents);
+}
+
+static LIBMTP_track_t *
+load_snapshot (const char *path, const char *state, gboolean *current)
+{
+	LIBMTP_track_t *tracks = NULL;
+	LIBMTP_track_t *last = NULL;
+	char *contents;
+	char **lines;
+	int count = 0;
+	int i;
+
+	*current = FALSE;
+	if (g_file_get_contents (path, &contents, NULL, NULL) == FALSE) {
+		rb_debug ("no track list snapshot at %s", path);
+		return NULL;
+	}
+
+	lines = g_strsplit (contents, "\n", -1);
+	if (lines[0] != NULL && state != NULL) {
+		*current = (strcmp (lines[0], state) == 0);
+	}
+
+	for (i = 1; lines[0] != NULL && lines[i] != NULL; i++) {
+		LIBMTP_track_t *track;
+		char **bits;
+
+		bits = g_strsplit (lines[i], "\t", -1);
+		if (g_strv_length (bits) != 15) {
+			g_strfreev (bits);
+			continue;
+		}
+
+		track = LIBMTP_new_track_t ();
+		track->item_id = strtoul (bits[0], NULL, 10);
+		track->parent_id = strtoul (bits[1], NULL, 10);
+		track->storage_id = strtoul (bits[2], NULL, 10);
+		track->filetype = strtol (bits[3], NULL, 10);
+		track->tracknumber = strtoul (bits[4], NULL, 10);
+		track->duration = strtoul (bits[5], NULL, 10);
+		track->filesize = g_ascii_strtoull (bits[6], NULL, 10);
+		track->usecount = strtoul (bits[7], NULL, 10);
+		track->rating = strtoul (bits[8], NULL, 10);
+		track->filename = parse_snapshot_string (bits[9]);
+		track->title = parse_snapshot_string (bits[10]);
+		track->artist = parse_snapshot_string (bits[11]);
+		track->album = parse_snapshot_string (bits[12]);
+		track->genre = parse_snapshot_string (bits[13]);
+		track->date = parse_snapshot_string (bits[14]);
+		g_strfreev (bits);
+
+		if (last != NULL) {
+			last->next = track;
+		} else {
+			tracks = track;
+		}
+		last = track;
+		count++;
+	}
+	g_strfreev (lines);
+	g_free (contents);
+
+	rb_debug ("loaded %d tracks from snapshot %s (%s)", count, path, *current ? "current" : "out of date");
+	return tracks;
+}
+
 static void
 get_track_list (RBMtpThread *thread, RBMtpThreadTask *task)
 {
@@ -398,6 +611,34 @@ get_track_list (RBMtpThread *thread, RBMtpThreadTask *task)
 	LIBMTP_track_t *tracks = NULL;
 	LIBMTP_album_t *albums;
 	LIBMTP_album_t *album;
+	char *snapshot_path;
+	char *state;
+	gboolean current = FALSE;
+	gboolean shown_snapshot = task->refresh;
+	gboolean keep_snapshot = FALSE;
+
+	snapshot_path = get_snapshot_path (thread->device);
+	state = get_device_state (thread);
+
+	/* when refreshing a current snapshot, the albums have already been
+	 * loaded and don't need to be rebuilt.
+	 */
+	if (task->refresh) {
+		device_forgets_albums = FALSE;
+		goto list_tracks;
+	}
+
+	/* if we have a snapshot of the track list, let the source use it while
+	 * we get the real thing.
+	 */
+	if (snapshot_path != NULL) {
+		tracks = load_snapshot (snapshot_path, state, &current);
+		if (tracks != NULL) {
+			cb (tracks, TRUE, task->user_data);
+			tracks = NULL;
+			shown_snapshot = TRUE;
+		}
+	}
 
 	/* get all the albums */
 	albums = LIBMTP_Get_Album_List (thread->device);
@@ -424,8 +665,46 @@ get_track_list (RBMtpThread *thread, RBMtpThreadTask *task)
 		device_forgets_albums = FALSE;
 	}
 
+	/* if the snapshot is current, the source can carry on using it, and the
+	 * device is only listed once there's nothing else for it to do.  albums
+	 * that need rebuilding need the track list now, though.
+	 */
+	if (shown_snapshot && current && device_forgets_albums == FALSE) {
+		RBMtpThreadTask *refresh;
+
+		rb_debug ("snapshot is current, deferring track listing");
+		refresh = create_task (GET_TRACK_LIST);
+		refresh->refresh = TRUE;
+		refresh->callback = task->callback;
+		refresh->user_data = task->user_data;
+		refresh->destroy_data = task->destroy_data;
+		task->destroy_data = NULL;
+
+		if (thread->deferred_task != NULL) {
+			destroy_task (thread->deferred_task);
+		}
+		thread->deferred_task = refresh;
+
+		g_free (snapshot_path);
+		g_free (state);
+		return;
+	}
+	current = FALSE;
+
+list_tracks:
 	tracks = LIBMTP_Get_Tracklisting_With_Callback (thread->device, NULL, NULL);
+	if (LIBMTP_Get_Errorstack (thread->device) == NULL) {
+		if (snapshot_path != NULL && state != NULL) {
+			save_snapshot (snapshot_path, state, tracks);
+			current = TRUE;
+		}
+	} else if (tracks == NULL && shown_snapshot) {
+		/* keep using the snapshot rather than emptying the source */
+		rb_debug ("unable to list tracks, keeping tracks from snapshot");
+		keep_snapshot = TRUE;
+	}
 	rb_mtp_thread_report_errors (thread, FALSE);
+
 	if (tracks == NULL) {
 		rb_debug ("no tracks on the device");
 	} else if (device_forgets_albums) {
@@ -443,8 +722,10 @@ get_track_list (RBMtpThread *thread, RBMtpThreadTask *task)
 		rb_debug ("finished rebuilding albums");
 	}
 
-	cb (tracks, task->user_data);
-	/* the callback owns the tracklist */
+	if (keep_snapshot == FALSE) {
+		cb (tracks, FALSE, task->user_data);
+		/* the callback owns the tracklist */
+	}
 
 	if (device_forgets_albums) {
 		GHashTableIter iter;
@@ -477,7 +758,21 @@ get_track_list (RBMtpThread *thread, RBMtpThreadTask *task)
 		}
 
 		rb_debug ("finished updating albums on the device");
+
+		/* writing the albums changes the device's free space */
+		if (current && snapshot_path != NULL && state != NULL) {
+			char *new_state;
+
+			new_state = get_device_state (thread);
+			if (new_state != NULL && strcmp (new_state, state) != 0) {
+				update_snapshot_state (snapshot_path, new_state);
+			}
+			g_free (new_state);
+		}
 	}
+
+	g_free (snapshot_path);
+	g_free (state);
 }
 
 static void
@@ -690,7 +985,16 @@ task_thread (RBMtpThread *thread)
 	rb_debug ("MTP device worker thread starting");
 	while (quit == FALSE) {
 
-		task = g_async_queue_pop (queue);
+		/* run the deferred task when nothing else is waiting */
+		if (thread->deferred_task != NULL) {
+			task = g_async_queue_try_pop (queue);
+			if (task == NULL) {
+				task = thread->deferred_task;
+				thread->deferred_task = NULL;
+			}
+		} else {
+			task = g_async_queue_pop (queue);
+		}
 		quit = run_task (thread, task);
 		destroy_task (task);
 	}
@@ -700,6 +1004,10 @@ task_thread (RBMtpThread *thread)
 	/* clean up any queued tasks */
 	while ((task = g_async_queue_try_pop (queue)) != NULL)
 		destroy_task (task);
+	if (thread->deferred_task != NULL) {
+		destroy_task (thread->deferred_task);
+		thread->deferred_task = NULL;
+	}
 
 	g_async_queue_unref (queue);
 	return NULL;
@@ -775,6 +1083,11 @@ rb_mtp_thread_set_album_image (RBMtpThread *thread, const char *album, GdkPixbuf
 	queue_task (thread, task);
 }
 
+/* if there's a snapshot of the device's track list, the callback is called
+ * twice: first with the tracks from the snapshot (with from_snapshot set),
+ * then with the tracks actually on the device.  if the snapshot is current,
+ * the second call only happens once all other queued tasks have been run.
+ */
 void
 rb_mtp_thread_get_track_list (RBMtpThread *thread,
 			      RBMtpTrackListCallback callback,
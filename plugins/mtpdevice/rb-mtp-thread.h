@@ -70,6 +70,7 @@ typedef struct
 
 	GThread *thread;
 	GAsyncQueue *queue;
+	gpointer deferred_task;		/* run when the queue is empty; only used by the worker thread */
 } RBMtpThread;
 
 typedef struct
@@ -79,7 +80,7 @@ typedef struct
 
 /* callback types */
 typedef void (*RBMtpOpenCallback) (LIBMTP_mtpdevice_t *device, gpointer user_data);
-typedef void (*RBMtpTrackListCallback) (LIBMTP_track_t *tracklist, gpointer user_data);
+typedef void (*RBMtpTrackListCallback) (LIBMTP_track_t *tracklist, gboolean from_snapshot, gpointer user_data);
 typedef void (*RBMtpUploadCallback) (LIBMTP_track_t *track, GError *error, gpointer user_data);
 typedef void (*RBMtpDownloadCallback) (uint32_t track_id, const char *filename, GError *error, gpointer user_data);
 typedef void (*RBMtpThreadCallback) (LIBMTP_mtpdevice_t *device, gpointer user_data);
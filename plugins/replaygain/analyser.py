@@ -0,0 +1,445 @@
+# -*- Mode: python; coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*-
+#
+# Copyright (C) 2011 the Rhythmbox authors
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2, or (at your option)
+# any later version.
+#
+# The Rhythmbox authors hereby grant permission for non-GPL compatible
+# GStreamer plugins to be used and distributed together with GStreamer
+# and Rhythmbox. This permission is above and beyond the permissions granted
+# by the GPL license by which Rhythmbox is covered. If you modify this code
+# you may extend this exception to your version of the code, but you are not
+# obligated to do so. If you do not wish to do so, delete this exception
+# statement from your version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+#
+
+import os
+
+import gobject
+import gst
+
+import rb
+from gi.repository import RB
+from gi.repository import Gio
+
+# how long to wait after activation before looking for tracks to analyse,
+# so we don't compete with the rest of startup
+STARTUP_DELAY = 30
+
+# how long to wait after tracks are added before looking for new work
+RESCAN_DELAY = 10
+
+# markers used in the results file for tracks we couldn't or didn't need to analyse
+RESULT_TAGGED = "tagged"
+RESULT_FAILED = "failed"
+
+
+class AnalysisResult(object):
+	def __init__(self, mtime, status=None):
+		self.mtime = mtime
+		self.status = status
+		self.track_gain = None
+		self.track_peak = None
+		self.album_gain = None
+		self.album_peak = None
+
+	def to_line(self, uri):
+		if self.status is not None:
+			fields = [self.status]
+		else:
+			fields = [self.format_value(v) for v in (self.track_gain, self.track_peak, self.album_gain, self.album_peak)]
+		return "%s\t%d\t%s\n" % (uri, self.mtime, "\t".join(fields))
+
+	@staticmethod
+	def format_value(v):
+		if v is None:
+			return "-"
+		return "%f" % v
+
+	@staticmethod
+	def from_line(line):
+		bits = line.rstrip("\n").split("\t")
+		if len(bits) not in (3, 6):
+			return (None, None)
+		try:
+			result = AnalysisResult(long(bits[1]))
+			if len(bits) == 3:
+				result.status = bits[2]
+			else:
+				values = [(b != "-") and float(b) or None for b in bits[2:]]
+				(result.track_gain, result.track_peak, result.album_gain, result.album_peak) = values
+		except ValueError:
+			return (None, None)
+		return (bits[0], result)
+
+
+class AnalysisJob(object):
+	"""
+	Analyses the tracks of one album in sequence through a single rganalysis
+	element, so it can calculate album gain as well as track gain.
+	"""
+	def __init__(self, analyser, tracks):
+		self.analyser = analyser
+		self.tracks = tracks
+		self.current = 0
+		self.pending = {}
+
+		self.pipeline = gst.Pipeline()
+		bus = self.pipeline.get_bus()
+		bus.add_signal_watch()
+		bus.connect("message::tag", self.tag_cb)
+		bus.connect("message::async-done", self.async_done_cb)
+		bus.connect("message::eos", self.eos_cb)
+		bus.connect("message::error", self.error_cb)
+
+		self.decode = gst.element_factory_make("uridecodebin")
+		self.decode.connect("pad-added", self.pad_added_cb)
+		convert = gst.element_factory_make("audioconvert")
+		resample = gst.element_factory_make("audioresample")
+		self.rganalysis = gst.element_factory_make("rganalysis")
+		# leave tracks that already have replaygain tags alone
+		self.rganalysis.props.forced = False
+		self.rganalysis.props.num_tracks = len(tracks)
+		sink = gst.element_factory_make("fakesink")
+		sink.props.sync = False
+
+		self.pipeline.add(self.decode, convert, resample, self.rganalysis, sink)
+		gst.element_link_many(convert, resample, self.rganalysis, sink)
+		self.sinkpad = convert.get_pad("sink")
+
+	def start(self):
+		(uri, mtime) = self.tracks[self.current]
+		self.pending[uri] = AnalysisResult(mtime)
+		self.decode.props.uri = uri
+
+		# preroll first, so tracks that already have replaygain tags
+		# can be skipped without decoding them
+		self.probing = True
+		self.tagged = False
+		self.pipeline.set_state(gst.STATE_PAUSED)
+
+	def next_track(self):
+		self.current += 1
+		if self.current == len(self.tracks):
+			self.analyser.job_done(self, self.pending)
+			return
+
+		# rganalysis keeps its album state across READY
+		self.pipeline.set_state(gst.STATE_READY)
+		self.start()
+
+	def stop(self):
+		self.pipeline.set_state(gst.STATE_NULL)
+		self.pipeline.get_bus().remove_signal_watch()
+		self.pipeline = None
+
+	def pad_added_cb(self, decodebin, pad):
+		if self.sinkpad.is_linked():
+			return
+
+		caps = pad.get_caps()
+		if caps[0].get_name() in ('audio/x-raw-float', 'audio/x-raw-int'):
+			pad.link(self.sinkpad)
+
+	def tag_cb(self, bus, message):
+		taglist = message.parse_tag()
+		keys = taglist.keys()
+		if self.probing:
+			if gst.TAG_TRACK_GAIN in keys:
+				self.tagged = True
+			return
+
+		if message.src != self.rganalysis:
+			return
+
+		(uri, mtime) = self.tracks[self.current]
+		result = self.pending[uri]
+		if gst.TAG_TRACK_GAIN in keys:
+			result.track_gain = taglist[gst.TAG_TRACK_GAIN]
+		if gst.TAG_TRACK_PEAK in keys:
+			result.track_peak = taglist[gst.TAG_TRACK_PEAK]
+
+		# album tags are posted with the last track of the album
+		if gst.TAG_ALBUM_GAIN in keys and gst.TAG_ALBUM_PEAK in keys:
+			for r in self.pending.values():
+				r.album_gain = taglist[gst.TAG_ALBUM_GAIN]
+				r.album_peak = taglist[gst.TAG_ALBUM_PEAK]
+
+	def async_done_cb(self, bus, message):
+		if self.probing is False:
+			return
+		self.probing = False
+
+		(uri, mtime) = self.tracks[self.current]
+		if self.tagged:
+			print "%s already has replaygain tags" % uri
+			self.pending[uri].status = RESULT_TAGGED
+
+			# the track won't reach the end of the analysis, so it no
+			# longer counts towards the album
+			self.rganalysis.props.num_tracks = max(self.rganalysis.props.num_tracks - 1, 0)
+			self.next_track()
+			return
+
+		print "analysing %s (%d of %d)" % (uri, self.current + 1, len(self.tracks))
+		self.pipeline.set_state(gst.STATE_PLAYING)
+
+	def eos_cb(self, bus, message):
+		(uri, mtime) = self.tracks[self.current]
+		if self.pending[uri].track_gain is None:
+			# rganalysis skips tracks that already have gain tags
+			self.pending[uri].status = RESULT_TAGGED
+
+		self.next_track()
+
+	def error_cb(self, bus, message):
+		(uri, mtime) = self.tracks[self.current]
+		error = message.parse_error()
+		print "unable to analyse %s: %s" % (uri, error[1])
+		self.pending[uri].status = RESULT_FAILED
+
+		# album gain can't be calculated without this track, but we can still
+		# analyse the rest of the album
+		self.analyser.job_done(self, self.pending, self.tracks[self.current+1:])
+
+
+class ReplayGainAnalyser(object):
+	"""
+	Calculates track and album gain in the background for tracks that don't
+	have replaygain tags, so the player can apply them without rewriting files.
+	Results are kept in a file in the user cache directory, so analysis picks up
+	where it left off on the next run.
+	"""
+	def __init__(self, shell):
+		self.shell_player = shell.props.shell_player
+		self.db = shell.props.db
+		self.settings = Gio.Settings("org.gnome.rhythmbox.plugins.replaygain")
+
+		self.results = {}
+		self.queue = []
+		self.queued = set()
+		self.jobs = []
+		self.scan_id = 0
+
+		# tracks in each album, found by the first scan, and tracks
+		# added since then
+		self.song_type = self.db.entry_type_get_by_name("song")
+		self.scanned = False
+		self.albums = {}
+		self.added = []
+
+		if gst.element_factory_find("rganalysis") is None:
+			print "rganalysis element not available, not analysing tracks"
+			self.results_file = None
+			return
+
+		folder = os.path.join(RB.user_cache_dir(), "replaygain")
+		if os.path.exists(folder) is False:
+			os.makedirs(folder)
+		self.results_path = os.path.join(folder, "analysis")
+		self.load_results()
+		self.results_file = open(self.results_path, "a")
+
+		self.settings_id = self.settings.connect("changed::analysis-jobs", self.start_jobs)
+		self.playing_id = self.shell_player.connect("playing-changed", self.start_jobs)
+		self.added_id = self.db.connect("entry-added", self.entry_added_cb)
+		self.schedule_scan(STARTUP_DELAY)
+
+	def deactivate(self):
+		if self.results_file is None:
+			return
+
+		if self.scan_id != 0:
+			gobject.source_remove(self.scan_id)
+			self.scan_id = 0
+
+		self.settings.disconnect(self.settings_id)
+		self.shell_player.disconnect(self.playing_id)
+		self.db.disconnect(self.added_id)
+		for job in self.jobs:
+			job.stop()
+		self.jobs = []
+		self.queue = []
+		self.added = []
+
+		self.results_file.close()
+		self.results_file = None
+		self.save_results()
+
+	def load_results(self):
+		try:
+			f = open(self.results_path, "r")
+		except IOError:
+			return
+
+		# later lines replace earlier ones for the same track
+		for line in f:
+			(uri, result) = AnalysisResult.from_line(line)
+			if uri is not None:
+				self.results[uri] = result
+		f.close()
+		print "loaded %d replaygain analysis results" % len(self.results)
+
+	def save_results(self):
+		# rewrite the file without superseded lines
+		tmp = self.results_path + ".tmp"
+		f = open(tmp, "w")
+		for (uri, result) in self.results.items():
+			f.write(result.to_line(uri))
+		f.close()
+		os.rename(tmp, self.results_path)
+
+	def get_gain(self, uri, album_mode):
+		"""
+		Returns the analysed gain for a track, or None if it hasn't been
+		analysed.  Album gain is used if requested and available.
+		"""
+		result = self.results.get(uri)
+		if result is None or result.status is not None:
+			return None
+		if album_mode and result.album_gain is not None:
+			return result.album_gain
+		return result.track_gain
+
+
+	def needs_analysis(self, uri, mtime):
+		if uri.startswith("file://") is False:
+			return False
+		result = self.results.get(uri)
+		return result is None or result.mtime != mtime
+
+	def schedule_scan(self, delay):
+		if self.scan_id == 0:
+			self.scan_id = gobject.timeout_add_seconds(delay, self.scan_cb)
+
+	def entry_added_cb(self, db, entry):
+		# the first scan finds everything added before it runs
+		if self.scanned is False or entry.get_entry_type() != self.song_type:
+			return
+
+		self.added.append(entry)
+		self.schedule_scan(RESCAN_DELAY)
+
+	def album_key(self, entry):
+		artist = entry.get_string(RB.RhythmDBPropType.ALBUM_ARTIST) or entry.get_string(RB.RhythmDBPropType.ARTIST)
+		album = entry.get_string(RB.RhythmDBPropType.ALBUM)
+		if album in ("", _("Unknown")):
+			return entry.get_string(RB.RhythmDBPropType.LOCATION)
+		return (artist, album)
+
+	def queue_album(self, tracks):
+		# analyse whole albums if any track needs analysis, as album gain
+		# depends on all of the album's tracks
+		if True not in [self.needs_analysis(uri, mtime) for (uri, mtime) in tracks]:
+			return False
+
+		tracks = [(uri, mtime) for (uri, mtime) in tracks if uri.startswith("file://")]
+		self.queue.append(tracks)
+		self.queued.update([uri for (uri, mtime) in tracks])
+		return True
+
+	def scan_cb(self):
+		self.scan_id = 0
+		if self.scanned:
+			self.scan_added()
+			return False
+
+		def collect(entry, data):
+			if entry.get_boolean(RB.RhythmDBPropType.HIDDEN):
+				return
+			uri = entry.get_string(RB.RhythmDBPropType.LOCATION)
+			mtime = entry.get_ulong(RB.RhythmDBPropType.MTIME)
+			self.albums.setdefault(self.album_key(entry), []).append((uri, mtime))
+
+		self.db.entry_foreach_by_type(self.song_type, collect, None)
+		self.scanned = True
+
+		queued = 0
+		for tracks in self.albums.values():
+			tracks = [(uri, mtime) for (uri, mtime) in tracks if uri not in self.queued]
+			if self.queue_album(tracks):
+				queued += 1
+
+		print "%d albums queued for replaygain analysis" % queued
+		self.start_jobs()
+		return False
+
+	def scan_added(self):
+		# only look at the albums the added tracks belong to
+		changed = set()
+		for entry in self.added:
+			if entry.get_boolean(RB.RhythmDBPropType.HIDDEN):
+				continue
+			uri = entry.get_string(RB.RhythmDBPropType.LOCATION)
+			mtime = entry.get_ulong(RB.RhythmDBPropType.MTIME)
+			key = self.album_key(entry)
+			tracks = [(u, m) for (u, m) in self.albums.get(key, []) if u != uri]
+			tracks.append((uri, mtime))
+			self.albums[key] = tracks
+			changed.add(key)
+		self.added = []
+
+		queued = 0
+		for key in changed:
+			tracks = []
+			for (uri, mtime) in self.albums[key]:
+				if uri in self.queued:
+					continue
+				# tracks may have been removed or changed since they were found
+				entry = self.db.entry_lookup_by_location(uri)
+				if entry is None or entry.get_boolean(RB.RhythmDBPropType.HIDDEN):
+					continue
+				tracks.append((uri, entry.get_ulong(RB.RhythmDBPropType.MTIME)))
+
+			if self.queue_album(tracks):
+				queued += 1
+
+		print "%d albums with added tracks queued for replaygain analysis" % queued
+		self.start_jobs()
+
+	def start_jobs(self, *args):
+		# only use one job while something is playing, to leave room for playback
+		max_jobs = self.settings['analysis-jobs']
+		if self.shell_player.props.playing:
+			max_jobs = min(max_jobs, 1)
+
+		# stop the most recently started jobs if there are too many now,
+		# and analyse their albums again from the start later
+		while len(self.jobs) > max_jobs:
+			job = self.jobs.pop()
+			job.stop()
+			self.queue.insert(0, job.tracks)
+
+		while len(self.jobs) < max_jobs and len(self.queue) > 0:
+			job = AnalysisJob(self, self.queue.pop(0))
+			self.jobs.append(job)
+			job.start()
+
+	def job_done(self, job, results, remaining=[]):
+		job.stop()
+		self.jobs.remove(job)
+
+		for (uri, result) in results.items():
+			self.results[uri] = result
+			self.results_file.write(result.to_line(uri))
+			self.queued.discard(uri)
+		self.results_file.flush()
+
+		if len(remaining) > 0:
+			self.queue.insert(0, remaining)
+
+		# start the next job from an idle handler so the bus handler for
+		# this one can return first
+		gobject.idle_add(self.start_jobs, priority=gobject.PRIORITY_LOW)
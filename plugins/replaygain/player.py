@@ -37,7 +37,7 @@ import config
 EPSILON = 0.001
 
 class ReplayGainPlayer(object):
-	def __init__(self, shell):
+	def __init__(self, shell, analyser):
 		# make sure the replaygain elements are available
 		missing = []
 		required = ("rgvolume", "rglimiter")
@@ -50,6 +50,7 @@ class ReplayGainPlayer(object):
 			RB.error_dialog(shell.props.window, _("ReplayGain GStreamer plugins not available"), msg)
 			raise Exception(msg)
 
+		self.analyser = analyser
 		self.shell_player = shell.props.shell_player
 		self.player = self.shell_player.props.player
 		self.settings = Gio.Settings("org.gnome.rhythmbox.plugins.replaygain")
@@ -58,6 +59,7 @@ class ReplayGainPlayer(object):
 
 		self.previous_gain = []
 		self.fallback_gain = 0.0
+		self.current_uri = None
 		self.resetting_rgvolume = False
 
 		# we use different means to hook into the playback pipeline depending on
@@ -75,9 +77,10 @@ class ReplayGainPlayer(object):
 		self.deactivate_backend()
 		self.player = None
 		self.shell_player = None
+		self.analyser = None
 
 
-	def set_rgvolume(self, rgvolume):
+	def set_rgvolume(self, rgvolume, uri):
 		# set preamp level
 		preamp = self.settings['preamp']
 		rgvolume.props.pre_amp = preamp
@@ -86,13 +89,21 @@ class ReplayGainPlayer(object):
 		# there may eventually be a 'guess' mode here that tries to figure out
 		# what to do based on the upcoming tracks
 		mode = self.settings['mode']
-		if mode == config.REPLAYGAIN_MODE_ALBUM:
+		album_mode = (mode == config.REPLAYGAIN_MODE_ALBUM)
+		if album_mode:
 			rgvolume.props.album_mode = 1
 		else:
 			rgvolume.props.album_mode = 0
 
-		# set calculated fallback gain
-		rgvolume.props.fallback_gain = self.fallback_gain
+		# use the analysed gain for untagged tracks if we have it,
+		# otherwise the calculated fallback gain
+		gain = None
+		if uri is not None:
+			gain = self.analyser.get_gain(uri, album_mode)
+		if gain is not None:
+			rgvolume.props.fallback_gain = gain
+		else:
+			rgvolume.props.fallback_gain = self.fallback_gain
 
 		print "updated rgvolume settings: preamp %f, album-mode %s, fallback gain %f" % (
 			rgvolume.props.pre_amp, str(rgvolume.props.album_mode), rgvolume.props.fallback_gain)
@@ -138,7 +149,7 @@ class ReplayGainPlayer(object):
 
 	def rgvolume_reset_done(self, pad, blocked, rgvolume):
 		print "rgvolume reset done"
-		self.set_rgvolume(rgvolume)
+		self.set_rgvolume(rgvolume, self.current_uri)
 
 	def rgvolume_blocked_cb(self, pad, blocked, rgvolume):
 		print "bouncing rgvolume state to reset tags"
@@ -153,7 +164,9 @@ class ReplayGainPlayer(object):
 		if entry is None:
 			return
 
-		if self.got_replaygain is False:
+		self.current_uri = entry.get_string(RB.RhythmDBPropType.LOCATION)
+		analysed = self.analyser.get_gain(self.current_uri, False) is not None
+		if self.got_replaygain is False or analysed:
 			print "blocking rgvolume to reset it"
 			pad = self.rgvolume.get_static_pad("sink").get_peer()
 			pad.set_blocked_async(True, self.rgvolume_blocked_cb, self.rgvolume)
@@ -215,7 +228,7 @@ class ReplayGainPlayer(object):
 		print "creating rgvolume instance for stream %s" % uri
 		rgvolume = gst.element_factory_make("rgvolume")
 		rgvolume.connect("notify::target-gain", self.xfade_target_gain_cb)
-		self.set_rgvolume(rgvolume)
+		self.set_rgvolume(rgvolume, uri)
 		return [rgvolume]
 
 	def limiter_changed_cb(self, settings, key):
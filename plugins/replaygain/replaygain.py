@@ -31,6 +31,7 @@ from gi.repository import RB
 
 from config import ReplayGainConfig
 from player import ReplayGainPlayer
+from analyser import ReplayGainAnalyser
 
 class ReplayGainPlugin(GObject.Object, Peas.Activatable):
 	__gtype_name__ = 'ReplayGainPlugin'
@@ -41,9 +42,12 @@ class ReplayGainPlugin(GObject.Object, Peas.Activatable):
 		self.config_dialog = None
 
 	def do_activate (self):
-		self.player = ReplayGainPlayer(self.object)
+		self.analyser = ReplayGainAnalyser(self.object)
+		self.player = ReplayGainPlayer(self.object, self.analyser)
 
 	def do_deactivate (self):
 		self.config_dialog = None
 		self.player.deactivate()
 		self.player = None
+		self.analyser.deactivate()
+		self.analyser = None
@@ -85,6 +85,7 @@ static void
 podcast_data_destroy (RhythmDBEntryType *entry_type, RhythmDBEntry *entry)
 {
 	RhythmDBPodcastFields *podcast = RHYTHMDB_ENTRY_GET_TYPE_DATA (entry, RhythmDBPodcastFields);
+	rhythmdb_entry_free_podcast_text (entry);
 	rb_refstring_unref (podcast->description);
 	rb_refstring_unref (podcast->subtitle);
 	rb_refstring_unref (podcast->summary);
@@ -157,6 +157,8 @@ start_download_cb (RBPodcastManager *pd,
 	g_object_unref (shell);
 
 	g_free (podcast_name);
+
+	rb_display_page_notify_status_changed (RB_DISPLAY_PAGE (source));
 }
 
 static void
@@ -174,6 +176,17 @@ finish_download_cb (RBPodcastManager *pd,
 	g_object_unref (shell);
 
 	g_free (podcast_name);
+
+	rb_display_page_notify_status_changed (RB_DISPLAY_PAGE (source));
+}
+
+static void
+download_status_changed_cb (RBPodcastManager *pd,
+			    RhythmDBEntry *entry,
+			    gulong value,
+			    RBPodcastMainSource *source)
+{
+	rb_display_page_notify_status_changed (RB_DISPLAY_PAGE (source));
 }
 
 static void
@@ -356,6 +369,11 @@ impl_constructed (GObject *object)
 				G_CALLBACK (finish_download_cb),
 				source, 0);
 
+	g_signal_connect_object (podcast_mgr,
+				"status_changed",
+				G_CALLBACK (download_status_changed_cb),
+				source, 0);
+
 	g_signal_connect_object (podcast_mgr,
 				"feed_updates_available",
 				G_CALLBACK (feed_updates_available_cb),
@@ -378,6 +396,28 @@ impl_constructed (GObject *object)
 	}
 }
 
+static void
+impl_get_status (RBDisplayPage *page, char **text, char **progress_text, float *progress)
+{
+	RBPodcastManager *podcast_mgr;
+	guint active;
+	guint queued;
+	float download_progress;
+
+	RB_DISPLAY_PAGE_CLASS (rb_podcast_main_source_parent_class)->get_status (page, text, progress_text, progress);
+
+	g_object_get (page, "podcast-manager", &podcast_mgr, NULL);
+	if (rb_podcast_manager_get_download_progress (podcast_mgr, &active, &queued, &download_progress)) {
+		g_free (*progress_text);
+		*progress_text = g_strdup_printf (ngettext ("Downloading %d episode",
+							    "Downloading %d episodes",
+							    active + queued),
+						  active + queued);
+		*progress = download_progress;
+	}
+	g_object_unref (podcast_mgr);
+}
+
 static void
 impl_dispose (GObject *object)
 {
@@ -411,6 +451,7 @@ rb_podcast_main_source_class_init (RBPodcastMainSourceClass *klass)
 	object_class->constructed = impl_constructed;
 
 	page_class->get_config_widget = impl_get_config_widget;
+	page_class->get_status = impl_get_status;
 
 	source_class->impl_want_uri = impl_want_uri;
 	source_class->impl_add_uri = impl_add_uri;
@@ -51,6 +51,20 @@
 #include "rb-util.h"
 #include "rb-missing-plugins.h"
 
+/* maximum number of feeds to update at the same time */
+#define PODCAST_UPDATE_THREADS		4
+
+/* maximum number of simultaneous downloads from a single host */
+#define PODCAST_HOST_DOWNLOADS		2
+
+/* maximum number of new posts to insert from a feed in one idle callback */
+#define PODCAST_INSERT_BATCH_SIZE	50
+
+/* number of consecutive posts older than the last update of a feed to read
+ * before assuming the rest of the feed is already in the database
+ */
+#define PODCAST_KNOWN_POSTS_BEFORE_STOP	3
+
 enum
 {
 	PROP_0,
@@ -67,6 +81,22 @@ enum
 	LAST_SIGNAL
 };
 
+/* state of a feed update while its posts are inserted in batches */
+typedef struct
+{
+	RBPodcastManager *pd;
+	RBPodcastChannel *channel;
+	RhythmDBEntry *feed_entry;
+	const char *title;
+	GHashTable *existing_locations;
+	GList *next_post;
+	GList *download_entries;
+	gulong last_post;
+	gulong new_last_post;
+	gboolean updated;
+	gboolean cancelled;
+} RBPodcastFeedUpdate;
+
 /* passed from feed parsing threads back to main thread */
 typedef struct
 {
@@ -74,14 +104,24 @@ typedef struct
 	RBPodcastChannel 	*channel;
 	RBPodcastManager	*pd;
 	gboolean		 automatic;
+	RBPodcastFeedUpdate	*update;
 } RBPodcastManagerParseResult;
 
+/* used while parsing a feed to stop at posts we already have */
+typedef struct
+{
+	gulong last_post;
+	guint64 prev_pub_date;
+	guint old_posts;
+} RBPodcastParseCutoff;
+
 typedef struct
 {
 	RBPodcastManager *pd;
 
 	RhythmDBEntry *entry;
 	char *query_string;
+	char *host;
 
 	GFile *source;
 	GFile *destination;
@@ -89,7 +129,8 @@ typedef struct
 	GFileOutputStream *out_stream;
 
 	guint64 download_offset;
-	guint64 download_size;
+	guint64 download_size;		/* protected by progress_lock */
+	guint64 downloaded;		/* protected by progress_lock */
 	guint progress;
 
 	GCancellable *cancel;
@@ -102,19 +143,28 @@ typedef struct
 	char *url;
 	gboolean automatic;
 	gboolean existing_feed;
+	char *etag;
+	char *last_modified;
+	gulong last_post;
 } RBPodcastThreadInfo;
 
 struct RBPodcastManagerPrivate
 {
 	RhythmDB *db;
 	GList *download_list;
-	RBPodcastManagerInfo *active_download;
+	GList *active_downloads;
+	GMutex *progress_lock;
 	guint source_sync;
 	guint next_file_id;
 	gboolean shutdown;
 
 	GSettings *settings;
 	GFile *timestamp_file;
+
+	GThreadPool *update_pool;
+	GKeyFile *feed_validators;
+	char *feed_validators_path;
+	guint save_validators_id;
 };
 
 #define RB_PODCAST_MANAGER_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), RB_TYPE_PODCAST_MANAGER, RBPodcastManagerPrivate))
@@ -151,13 +201,18 @@ static void rb_podcast_manager_save_metadata		(RBPodcastManager *pd,
 static void rb_podcast_manager_db_entry_added_cb 	(RBPodcastManager *pd,
 							 RhythmDBEntry *entry);
 static gboolean rb_podcast_manager_next_file 		(RBPodcastManager * pd);
-static void rb_podcast_manager_insert_feed 		(RBPodcastManager *pd, RBPodcastChannel *data);
+static RBPodcastFeedUpdate *rb_podcast_manager_begin_feed_update (RBPodcastManager *pd,
+							 RBPodcastChannel *data);
+static gboolean rb_podcast_manager_insert_posts		(RBPodcastFeedUpdate *update);
+static void rb_podcast_manager_finish_feed_update	(RBPodcastFeedUpdate *update);
+static void rb_podcast_manager_feed_update_free		(RBPodcastFeedUpdate *update);
 static gboolean rb_podcast_manager_handle_feed_error	(RBPodcastManager *mgr,
 							 const char *url,
 							 GError *error,
 							 gboolean emit);
 
-static gpointer rb_podcast_manager_thread_parse_feed	(RBPodcastThreadInfo *info);
+static void rb_podcast_manager_thread_parse_feed	(RBPodcastThreadInfo *info,
+							 gpointer unused);
 static void podcast_settings_changed_cb			(GSettings *settings,
 							 const char *key,
 							 RBPodcastManager *mgr);
@@ -168,6 +223,7 @@ static gpointer podcast_download_thread			(RBPodcastManagerInfo *data);
 static gboolean end_job					(RBPodcastManagerInfo *data);
 static void cancel_job					(RBPodcastManagerInfo *pd);
 static void rb_podcast_manager_start_update_timer 	(RBPodcastManager *pd);
+static gboolean save_feed_validators			(RBPodcastManager *pd);
 
 G_DEFINE_TYPE (RBPodcastManager, rb_podcast_manager, G_TYPE_OBJECT)
 
@@ -258,7 +314,7 @@ rb_podcast_manager_init (RBPodcastManager *pd)
 
 	pd->priv->source_sync = 0;
 	pd->priv->db = NULL;
-
+	pd->priv->progress_lock = g_mutex_new ();
 }
 
 static void
@@ -287,6 +343,20 @@ rb_podcast_manager_constructed (GObject *object)
 		g_object_unref (st);
 	}
 
+	/* cache validators from the last update of each feed */
+	pd->priv->feed_validators_path = g_build_filename (rb_user_data_dir (), "podcast-feeds", NULL);
+	pd->priv->feed_validators = g_key_file_new ();
+	g_key_file_load_from_file (pd->priv->feed_validators,
+				   pd->priv->feed_validators_path,
+				   G_KEY_FILE_NONE,
+				   NULL);
+
+	pd->priv->update_pool = g_thread_pool_new ((GFunc) rb_podcast_manager_thread_parse_feed,
+						   NULL,
+						   PODCAST_UPDATE_THREADS,
+						   FALSE,
+						   NULL);
+
 	rb_podcast_manager_start_update_timer (pd);
 }
 
@@ -310,6 +380,23 @@ rb_podcast_manager_dispose (GObject *object)
 		pd->priv->source_sync = 0;
 	}
 
+	if (pd->priv->save_validators_id != 0) {
+		g_source_remove (pd->priv->save_validators_id);
+		pd->priv->save_validators_id = 0;
+		save_feed_validators (pd);
+	}
+
+	if (pd->priv->update_pool != NULL) {
+		/* queued updates are skipped once we're shutting down, so
+		 * this only waits for feeds that are already being fetched.
+		 * each update holds a reference on the manager, so if this is
+		 * running on an update thread, it's the last one.
+		 */
+		pd->priv->shutdown = TRUE;
+		g_thread_pool_free (pd->priv->update_pool, FALSE, rb_is_main_thread ());
+		pd->priv->update_pool = NULL;
+	}
+
 	if (pd->priv->db != NULL) {
 		g_object_unref (pd->priv->db);
 		pd->priv->db = NULL;
@@ -344,6 +431,14 @@ rb_podcast_manager_finalize (GObject *object)
 		g_list_free (pd->priv->download_list);
 	}
 
+	if (pd->priv->feed_validators != NULL) {
+		g_key_file_free (pd->priv->feed_validators);
+	}
+	g_free (pd->priv->feed_validators_path);
+
+	g_list_free (pd->priv->active_downloads);
+	g_mutex_free (pd->priv->progress_lock);
+
 	G_OBJECT_CLASS (rb_podcast_manager_parent_class)->finalize (object);
 }
 
@@ -526,6 +621,62 @@ rb_podcast_manager_entry_in_download_queue (RBPodcastManager *pd, RhythmDBEntry
 	return FALSE;
 }
 
+/**
+ * rb_podcast_manager_get_download_progress:
+ * @pd: the #RBPodcastManager
+ * @active: returns the number of downloads in progress
+ * @queued: returns the number of downloads waiting to start
+ * @progress: returns the combined progress of the active downloads
+ *
+ * Returns the aggregated progress of all podcast downloads.
+ * If the total size of any active download isn't known, @progress
+ * is set to -1.
+ *
+ * Return value: %TRUE if any downloads are active or queued
+ */
+gboolean
+rb_podcast_manager_get_download_progress (RBPodcastManager *pd,
+					  guint *active,
+					  guint *queued,
+					  float *progress)
+{
+	guint64 downloaded = 0;
+	guint64 total = 0;
+	gboolean known_size = TRUE;
+	guint n_active;
+	guint n_queued;
+	GList *l;
+
+	g_assert (rb_is_main_thread ());
+
+	n_active = g_list_length (pd->priv->active_downloads);
+	n_queued = g_list_length (pd->priv->download_list) - n_active;
+
+	g_mutex_lock (pd->priv->progress_lock);
+	for (l = pd->priv->active_downloads; l != NULL; l = l->next) {
+		RBPodcastManagerInfo *data = l->data;
+
+		if (data->download_size == 0)
+			known_size = FALSE;
+		downloaded += data->downloaded;
+		total += data->download_size;
+	}
+	g_mutex_unlock (pd->priv->progress_lock);
+
+	if (active != NULL)
+		*active = n_active;
+	if (queued != NULL)
+		*queued = n_queued;
+	if (progress != NULL) {
+		if (known_size && total > 0)
+			*progress = (float)((double) downloaded / (double) total);
+		else
+			*progress = -1.0f;
+	}
+
+	return (n_active + n_queued) > 0;
+}
+
 static void
 rb_podcast_manager_start_update_timer (RBPodcastManager *pd)
 {
@@ -693,40 +844,46 @@ download_error (RBPodcastManagerInfo *data, GError *error)
 	}
 }
 
-static gboolean
-rb_podcast_manager_next_file (RBPodcastManager * pd)
+static char *
+get_download_host (const char *location)
 {
-	const char *location;
-	RBPodcastManagerInfo *data;
-	char *query_string;
-	GList *d;
+	const char *start;
+	const char *end;
 
-	g_assert (rb_is_main_thread ());
+	start = strstr (location, "://");
+	if (start == NULL)
+		return g_strdup ("");
 
-	rb_debug ("looking for something to download");
+	start += strlen ("://");
+	end = strchr (start, '/');
+	if (end == NULL)
+		return g_strdup (start);
 
-	GDK_THREADS_ENTER ();
+	return g_strndup (start, end - start);
+}
 
-	pd->priv->next_file_id = 0;
+static guint
+count_host_downloads (RBPodcastManager *pd, const char *host)
+{
+	GList *l;
+	guint count = 0;
 
-	if (pd->priv->active_download != NULL) {
-		rb_debug ("already downloading something");
-		GDK_THREADS_LEAVE ();
-		return FALSE;
+	for (l = pd->priv->active_downloads; l != NULL; l = l->next) {
+		RBPodcastManagerInfo *data = l->data;
+		if (g_strcmp0 (data->host, host) == 0)
+			count++;
 	}
 
-	d = g_list_first (pd->priv->download_list);
-	if (d == NULL) {
-		rb_debug ("download queue is empty");
-		GDK_THREADS_LEAVE ();
-		return FALSE;
-	}
+	return count;
+}
 
-	data = (RBPodcastManagerInfo *) d->data;
-	g_assert (data != NULL);
-	g_assert (data->entry != NULL);
+static void
+start_download (RBPodcastManager *pd, RBPodcastManagerInfo *data)
+{
+	const char *location;
+	char *query_string;
 
-	pd->priv->active_download = data;
+	pd->priv->active_downloads = g_list_prepend (pd->priv->active_downloads, data);
 
 	location = get_remote_location (data->entry);
 	rb_debug ("processing %s", location);
@@ -741,12 +898,64 @@ rb_podcast_manager_next_file (RBPodcastManager * pd)
 	}
 
 	data->source = g_file_new_for_uri (location);
+	data->cancel = g_cancellable_new ();
 
 	g_file_read_async (data->source,
 	                   0,
 	                   data->cancel,
 	                   (GAsyncReadyCallback) read_file_cb,
 	                   data);
+}
+
+static gboolean
+rb_podcast_manager_next_file (RBPodcastManager * pd)
+{
+	RBPodcastManagerInfo *data;
+	GList *d;
+	GList *next;
+	int max_downloads;
+
+	g_assert (rb_is_main_thread ());
+
+	rb_debug ("looking for something to download");
+
+	GDK_THREADS_ENTER ();
+
+	pd->priv->next_file_id = 0;
+
+	if (pd->priv->download_list == NULL) {
+		rb_debug ("download queue is empty");
+		GDK_THREADS_LEAVE ();
+		return FALSE;
+	}
+
+	max_downloads = MAX (g_settings_get_int (pd->priv->settings, PODCAST_MAX_DOWNLOADS_KEY), 1);
+
+	for (d = pd->priv->download_list; d != NULL; d = next) {
+		next = d->next;
+
+		if (g_list_length (pd->priv->active_downloads) >= max_downloads) {
+			rb_debug ("already downloading %d things", max_downloads);
+			break;
+		}
+
+		data = (RBPodcastManagerInfo *) d->data;
+		g_assert (data != NULL);
+		g_assert (data->entry != NULL);
+
+		if (g_list_find (pd->priv->active_downloads, data) != NULL)
+			continue;
+
+		if (data->host == NULL)
+			data->host = get_download_host (get_remote_location (data->entry));
+
+		if (count_host_downloads (pd, data->host) >= PODCAST_HOST_DOWNLOADS) {
+			rb_debug ("already downloading %d things from %s", PODCAST_HOST_DOWNLOADS, data->host);
+			continue;
+		}
+
+		start_download (pd, data);
+	}
 
 	GDK_THREADS_LEAVE ();
 	return FALSE;
@@ -841,7 +1050,9 @@ download_podcast (GFileInfo *src_info, RBPodcastManagerInfo *data)
 	char *conf_dir_uri;
 
 	if (src_info != NULL) {
+		g_mutex_lock (data->pd->priv->progress_lock);
 		data->download_size = g_file_info_get_attribute_uint64 (src_info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
+		g_mutex_unlock (data->pd->priv->progress_lock);
 
 		local_file_name = g_file_info_get_attribute_as_string (src_info, G_FILE_ATTRIBUTE_STANDARD_COPY_NAME);
 		if (local_file_name == NULL) {
@@ -954,7 +1165,15 @@ download_podcast (GFileInfo *src_info, RBPodcastManagerInfo *data)
 				  local_size, data->download_size);
 			data->download_offset = local_size;
 		} else {
-			rb_debug ("replacing local file as it's larger than the download");
+			/* if we don't know how big the file is, we can't tell whether
+			 * it's complete, and resuming a complete file fails, so
+			 * download it again.
+			 */
+			if (data->download_size == 0) {
+				rb_debug ("replacing local file as the size of the download is unknown");
+			} else {
+				rb_debug ("replacing local file as it's larger than the download");
+			}
 			g_file_delete (data->destination, NULL, &error);
 			if (error != NULL) {
 				g_warning ("Removing existing download: %s", error->message);
@@ -972,7 +1191,6 @@ download_podcast (GFileInfo *src_info, RBPodcastManagerInfo *data)
 		       0, data->entry);
 	GDK_THREADS_LEAVE ();
 
-	data->cancel = g_cancellable_new ();
 	data->thread = g_thread_create ((GThreadFunc) podcast_download_thread,
 					data,
 					TRUE,
@@ -991,11 +1209,9 @@ rb_podcast_manager_abort_download (RBPodcastManagerInfo *data)
 	g_assert (rb_is_main_thread ());
 
 	mgr->priv->download_list = g_list_remove (mgr->priv->download_list, data);
+	mgr->priv->active_downloads = g_list_remove (mgr->priv->active_downloads, data);
 	download_info_free (data);
 
-	if (mgr->priv->active_download == data)
-		mgr->priv->active_download = NULL;
-
 	if (mgr->priv->next_file_id == 0) {
 		mgr->priv->next_file_id =
 			g_idle_add ((GSourceFunc) rb_podcast_manager_next_file, mgr);
@@ -1050,15 +1266,67 @@ rb_podcast_manager_subscribe_feed (RBPodcastManager *pd, const char *url, gboole
 	info->automatic = automatic;
 	info->existing_feed = existing_feed;
 
-	g_thread_create ((GThreadFunc) rb_podcast_manager_thread_parse_feed,
-			 info, FALSE, NULL);
+	/* OPML imports call this from an update thread; the validators
+	 * are only touched on the main thread.
+	 */
+	if (existing_feed && rb_is_main_thread ()) {
+		info->etag = g_key_file_get_string (pd->priv->feed_validators, feed_url, "etag", NULL);
+		info->last_modified = g_key_file_get_string (pd->priv->feed_validators, feed_url, "last-modified", NULL);
+
+		/* automatic updates stop reading the feed once they reach posts
+		 * from the last update.  updates requested by the user read the
+		 * whole feed, so posts that have been removed from it get culled.
+		 */
+		if (automatic) {
+			info->last_post = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_POST_TIME);
+		}
+	}
+
+	g_thread_pool_push (pd->priv->update_pool, info, NULL);
 
 	return TRUE;
 }
 
+static gboolean
+save_feed_validators (RBPodcastManager *pd)
+{
+	GError *error = NULL;
+	char *data;
+	gsize length;
+
+	pd->priv->save_validators_id = 0;
+
+	data = g_key_file_to_data (pd->priv->feed_validators, &length, NULL);
+	g_file_set_contents (pd->priv->feed_validators_path, data, length, &error);
+	if (error != NULL) {
+		rb_debug ("unable to save podcast feed validators: %s", error->message);
+		g_clear_error (&error);
+	}
+	g_free (data);
+
+	return FALSE;
+}
+
+static void
+store_feed_validators (RBPodcastManager *pd, RBPodcastChannel *channel)
+{
+	if (channel->etag != NULL) {
+		g_key_file_set_string (pd->priv->feed_validators, channel->url, "etag", channel->etag);
+	}
+	if (channel->last_modified != NULL) {
+		g_key_file_set_string (pd->priv->feed_validators, channel->url, "last-modified", channel->last_modified);
+	}
+
+	if (pd->priv->save_validators_id == 0) {
+		pd->priv->save_validators_id = g_idle_add ((GSourceFunc) save_feed_validators, pd);
+	}
+}
+
 static void
 rb_podcast_manager_free_parse_result (RBPodcastManagerParseResult *result)
 {
+	if (result->update != NULL)
+		rb_podcast_manager_feed_update_free (result->update);
 	rb_podcast_parse_channel_free (result->channel);
 	g_object_unref (result->pd);
 	g_clear_error (&result->error);
@@ -1069,6 +1337,7 @@ static gboolean
 rb_podcast_manager_parse_complete_cb (RBPodcastManagerParseResult *result)
 {
 	gboolean add_feed = TRUE;
+	gboolean more = FALSE;
 
 	GDK_THREADS_ENTER ();
 	if (result->pd->priv->shutdown) {
@@ -1076,6 +1345,40 @@ rb_podcast_manager_parse_complete_cb (RBPodcastManagerParseResult *result)
 		return FALSE;
 	}
 
+	/* insert the next batch of posts from the feed */
+	if (result->update != NULL) {
+		more = rb_podcast_manager_insert_posts (result->update);
+		if (more == FALSE) {
+			rb_podcast_manager_finish_feed_update (result->update);
+		}
+		GDK_THREADS_LEAVE ();
+		return more;
+	}
+
+	if (result->channel->not_modified) {
+		RhythmDBEntry *entry;
+
+		rb_debug ("podcast feed %s is unchanged", result->channel->url);
+
+		/* the feed was fetched successfully, so clear any error left
+		 * over from an earlier update.
+		 */
+		entry = rhythmdb_entry_lookup_by_location (result->pd->priv->db, (const char *) result->channel->url);
+		if (entry != NULL &&
+		    rhythmdb_entry_get_entry_type (entry) == RHYTHMDB_ENTRY_TYPE_PODCAST_FEED &&
+		    rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_PLAYBACK_ERROR) != NULL) {
+			GValue v = {0,};
+
+			g_value_init (&v, G_TYPE_STRING);
+			g_value_set_string (&v, NULL);
+			rhythmdb_entry_set (result->pd->priv->db, entry, RHYTHMDB_PROP_PLAYBACK_ERROR, &v);
+			g_value_unset (&v);
+			rhythmdb_commit (result->pd->priv->db);
+		}
+		GDK_THREADS_LEAVE ();
+		return FALSE;
+	}
+
 	if (result->error) {
 		if (rb_podcast_manager_handle_feed_error (result->pd,
 							  (char *)result->channel->url,
@@ -1086,11 +1389,21 @@ rb_podcast_manager_parse_complete_cb (RBPodcastManagerParseResult *result)
 	}
 
 	if (add_feed) {
-		rb_podcast_manager_insert_feed (result->pd, result->channel);
+		result->update = rb_podcast_manager_begin_feed_update (result->pd, result->channel);
+		if (result->update != NULL) {
+			more = rb_podcast_manager_insert_posts (result->update);
+			if (more == FALSE) {
+				rb_podcast_manager_finish_feed_update (result->update);
+			}
+		}
+	}
+
+	if (result->error == NULL) {
+		store_feed_validators (result->pd, result->channel);
 	}
 
 	GDK_THREADS_LEAVE ();
-	return FALSE;
+	return more;
 }
 
 static gboolean
@@ -1117,19 +1430,61 @@ confirm_bad_mime_type (const char *url)
 	return result;
 }
 
-static gpointer
-rb_podcast_manager_thread_parse_feed (RBPodcastThreadInfo *info)
+static gboolean
+stop_at_known_posts (RBPodcastChannel *channel, RBPodcastItem *item, RBPodcastParseCutoff *cutoff)
+{
+	/* we can only tell where the known posts start in feeds
+	 * that list the newest posts first.
+	 */
+	if (item->pub_date == 0 ||
+	    (cutoff->prev_pub_date != 0 && item->pub_date > cutoff->prev_pub_date)) {
+		rb_debug ("posts in feed %s are not in date order", channel->url);
+		channel->item_func = NULL;
+		return TRUE;
+	}
+	cutoff->prev_pub_date = item->pub_date;
+
+	if (item->pub_date < cutoff->last_post) {
+		cutoff->old_posts++;
+		if (cutoff->old_posts >= PODCAST_KNOWN_POSTS_BEFORE_STOP)
+			return FALSE;
+	} else {
+		cutoff->old_posts = 0;
+	}
+	return TRUE;
+}
+
+static void
+rb_podcast_manager_thread_parse_feed (RBPodcastThreadInfo *info, gpointer unused)
 {
 	RBPodcastChannel *feed = g_new0 (RBPodcastChannel, 1);
 	gboolean retry = FALSE;
 	gboolean existing_feed;
 	RBPodcastManagerParseResult *result;
+	RBPodcastParseCutoff cutoff = {0,};
 
 	result = g_new0 (RBPodcastManagerParseResult, 1);
 	result->channel = feed;
 	result->pd = info->pd;		/* adopts our reference */
 	result->automatic = info->automatic;
 
+	feed->etag = info->etag;		/* adopts our copies */
+	feed->last_modified = info->last_modified;
+
+	if (info->last_post != 0) {
+		cutoff.last_post = info->last_post;
+		feed->item_func = (RBPodcastParseItemFunc) stop_at_known_posts;
+		feed->item_data = &cutoff;
+	}
+
+	if (info->pd->priv->shutdown) {
+		rb_debug ("not updating feed %s; shutting down", info->url);
+		rb_podcast_manager_free_parse_result (result);
+		g_free (info->url);
+		g_free (info);
+		return;
+	}
+
 	existing_feed = info->existing_feed;
 	do {
 		retry = FALSE;
@@ -1144,20 +1499,23 @@ rb_podcast_manager_thread_parse_feed (RBPodcastThreadInfo *info)
 				 * if so, set the 'existing feed' flag, which causes
 				 * the mime type check to be skipped next time.
 				 */
-				if (confirm_bad_mime_type (info->url)) {
+				if (info->pd->priv->shutdown == FALSE &&
+				    confirm_bad_mime_type (info->url)) {
 					existing_feed = TRUE;
 					retry = TRUE;
 				}
 			}
 		}
 	} while (retry);
+	feed->item_func = NULL;
+	feed->item_data = NULL;
 
 	if (feed->is_opml) {
 		GList *l;
 
 		rb_debug ("Loading OPML feeds from %s", info->url);
 
-		for (l = feed->posts; l != NULL; l = l->next) {
+		for (l = feed->posts; l != NULL && info->pd->priv->shutdown == FALSE; l = l->next) {
 			RBPodcastItem *item = l->data;
 			/* assume the feeds don't already exist */
 			rb_podcast_manager_subscribe_feed (info->pd, item->url, FALSE);
@@ -1173,7 +1531,6 @@ rb_podcast_manager_thread_parse_feed (RBPodcastThreadInfo *info)
 
 	g_free (info->url);
 	g_free (info);
-	return NULL;
 }
 
 RhythmDBEntry *
@@ -1451,6 +1808,8 @@ download_info_free (RBPodcastManagerInfo *data)
 		data->query_string = NULL;
 	}
 
+	g_free (data->host);
+
 	if (data->entry) {
 		rhythmdb_entry_unref (data->entry);
 	}
@@ -1466,6 +1825,10 @@ download_progress (RBPodcastManagerInfo *data, guint64 downloaded, guint64 total
 	if (downloaded > 0 && total > 0)
 		local_progress = (100 * downloaded) / total;
 
+	g_mutex_lock (data->pd->priv->progress_lock);
+	data->downloaded = downloaded;
+	g_mutex_unlock (data->pd->priv->progress_lock);
+
 	if (local_progress != data->progress) {
 		GValue val = {0,};
 
@@ -1587,23 +1950,34 @@ podcast_download_thread (RBPodcastManagerInfo *data)
 			rb_debug ("stream info query failed: %s", error->message);
 			g_clear_error (&error);
 		} else {
+			g_mutex_lock (data->pd->priv->progress_lock);
 			data->download_size = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
+			g_mutex_unlock (data->pd->priv->progress_lock);
 			rb_debug ("got file size from stream: %" G_GINT64_FORMAT, data->download_size);
 			g_object_unref (info);
 		}
 	}
 
-	/* open local file */
-	if (data->out_stream == NULL) {
+	/* open local file.  if we couldn't resume a partial download,
+	 * the existing file needs to be replaced.
+	 */
+	if (data->out_stream == NULL && data->download_offset != 0) {
+		data->out_stream = g_file_replace (data->destination,
+						   NULL,
+						   FALSE,
+						   G_FILE_CREATE_NONE,
+						   data->cancel,
+						   &error);
+	} else if (data->out_stream == NULL) {
 		data->out_stream = g_file_create (data->destination,
 						  G_FILE_CREATE_NONE,
 						  data->cancel,
 						  &error);
-		if (error != NULL) {
-			download_error (data, error);
-			g_error_free (error);
-			return NULL;
-		}
+	}
+	if (error != NULL) {
+		download_error (data, error);
+		g_error_free (error);
+		return NULL;
 	}
 
 	/* loop, copying from input stream to output stream */
@@ -1671,8 +2045,8 @@ end_job	(RBPodcastManagerInfo *data)
 		       0, data->entry);
 	GDK_THREADS_LEAVE ();
 
-	g_assert (pd->priv->active_download == data);
-	pd->priv->active_download = NULL;
+	g_assert (g_list_find (pd->priv->active_downloads, data) != NULL);
+	pd->priv->active_downloads = g_list_remove (pd->priv->active_downloads, data);
 
 	download_info_free (data);
 
@@ -1689,8 +2063,8 @@ cancel_job (RBPodcastManagerInfo *data)
 	g_assert (rb_is_main_thread ());
 	rb_debug ("cancelling download of %s", get_remote_location (data->entry));
 
-	/* is this the active download? */
-	if (data == data->pd->priv->active_download) {
+	/* is this one of the active downloads? */
+	if (g_list_find (data->pd->priv->active_downloads, data) != NULL) {
 		g_cancellable_cancel (data->cancel);
 
 		/* download data will be cleaned up after next progress callback */
@@ -1773,6 +2147,11 @@ rb_podcast_manager_remove_feed (RBPodcastManager *pd, const char *url, gboolean
 	/* now delete the feed */
 	rhythmdb_entry_delete (pd->priv->db, entry);
 	rhythmdb_commit (pd->priv->db);
+
+	if (g_key_file_remove_group (pd->priv->feed_validators, url, NULL) &&
+	    pd->priv->save_validators_id == 0) {
+		pd->priv->save_validators_id = g_idle_add ((GSourceFunc) save_feed_validators, pd);
+	}
 	return TRUE;
 }
 
@@ -1845,30 +2224,34 @@ podcast_settings_changed_cb (GSettings *settings, const char *key, RBPodcastMana
 /* this bit really wants to die */
 
 static gboolean
-remove_if_not_downloaded (GtkTreeModel *model,
-			  GtkTreePath *path,
-			  GtkTreeIter *iter,
-			  GList **remove)
+index_existing_entry (GtkTreeModel *model,
+		      GtkTreePath *path,
+		      GtkTreeIter *iter,
+		      GHashTable *locations)
 {
 	RhythmDBEntry *entry;
 
-	entry = rhythmdb_query_model_iter_to_entry (RHYTHMDB_QUERY_MODEL (model),
-						    iter);
+	entry = rhythmdb_query_model_iter_to_entry (RHYTHMDB_QUERY_MODEL (model), iter);
 	if (entry != NULL) {
-		if (rb_podcast_manager_entry_downloaded (entry) == FALSE) {
-			rb_debug ("entry %s is no longer present in the feed and has not been downloaded",
-				  get_remote_location (entry));
-			*remove = g_list_prepend (*remove, entry);
-		} else {
-			rhythmdb_entry_unref (entry);
-		}
+		/* the index adopts the reference */
+		g_hash_table_insert (locations, g_strdup (get_remote_location (entry)), entry);
 	}
 
 	return FALSE;
 }
 
 static void
-rb_podcast_manager_insert_feed (RBPodcastManager *pd, RBPodcastChannel *data)
+rb_podcast_manager_feed_update_free (RBPodcastFeedUpdate *update)
+{
+	if (update->existing_locations != NULL)
+		g_hash_table_destroy (update->existing_locations);
+	g_list_free (update->download_entries);
+	rhythmdb_entry_unref (update->feed_entry);
+	g_free (update);
+}
+
+static RBPodcastFeedUpdate *
+rb_podcast_manager_begin_feed_update (RBPodcastManager *pd, RBPodcastChannel *data)
 {
 	GValue description_val = { 0, };
 	GValue title_val = { 0, };
@@ -1877,40 +2260,40 @@ rb_podcast_manager_insert_feed (RBPodcastManager *pd, RBPodcastChannel *data)
 	GValue image_val = { 0, };
 	GValue author_val = { 0, };
 	GValue status_val = { 0, };
-	GValue last_post_val = { 0, };
-	GValue last_update_val = { 0, };
 	GValue error_val = { 0, };
-	gulong last_post = 0;
-	gulong new_last_post;
-	const char *title;
-	GList *download_entries = NULL;
-	gboolean new_feed, updated, download_last;
 	RhythmDB *db = pd->priv->db;
-	RhythmDBQueryModel *existing_entries = NULL;
-
+	RBPodcastFeedUpdate *update;
+	RhythmDBQueryModel *existing_entries;
 	RhythmDBEntry *entry;
 
-	GList *lst_songs;
-
-	new_feed = TRUE;
+	update = g_new0 (RBPodcastFeedUpdate, 1);
+	update->pd = pd;
+	update->channel = data;
 
 	/* processing podcast head */
 	entry = rhythmdb_entry_lookup_by_location (db, (gchar *)data->url);
 	if (entry) {
-		if (rhythmdb_entry_get_entry_type (entry) != RHYTHMDB_ENTRY_TYPE_PODCAST_FEED)
-			return;
+		if (rhythmdb_entry_get_entry_type (entry) != RHYTHMDB_ENTRY_TYPE_PODCAST_FEED) {
+			g_free (update);
+			return NULL;
+		}
 
 		rb_debug ("Podcast feed entry for %s found", data->url);
 		g_value_init (&status_val, G_TYPE_ULONG);
 		g_value_set_ulong (&status_val, 1);
 		rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_STATUS, &status_val);
 		g_value_unset (&status_val);
-		last_post = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_POST_TIME);
-		new_feed = FALSE;
+		update->last_post = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_POST_TIME);
 
-		/* find all the existing entries in this feed, so we can cull those
-		 * that haven't been downloaded and are no longer present in the feed.
+		/* index the existing entries in this feed by remote location, so
+		 * posts we've already seen can be skipped without looking at each one,
+		 * and we can cull those that haven't been downloaded and are no longer
+		 * present in the feed.
 		 */
+		update->existing_locations = g_hash_table_new_full (g_str_hash,
+								    g_str_equal,
+								    g_free,
+								    (GDestroyNotify) rhythmdb_entry_unref);
 		existing_entries = rhythmdb_query_model_new_empty (db);
 		g_object_set (existing_entries, "show-hidden", TRUE, NULL);
 		rhythmdb_do_full_query (db, RHYTHMDB_QUERY_RESULTS (existing_entries),
@@ -1921,28 +2304,35 @@ rb_podcast_manager_insert_feed (RBPodcastManager *pd, RBPodcastChannel *data)
 					  RHYTHMDB_PROP_SUBTITLE,
 					  data->url,
 					RHYTHMDB_QUERY_END);
+		gtk_tree_model_foreach (GTK_TREE_MODEL (existing_entries),
+					(GtkTreeModelForeachFunc) index_existing_entry,
+					update->existing_locations);
+		g_object_unref (existing_entries);
 	} else {
 		rb_debug ("Adding podcast feed: %s", data->url);
 		entry = rhythmdb_entry_new (db,
 					    RHYTHMDB_ENTRY_TYPE_PODCAST_FEED,
 				    	    (gchar *) data->url);
-		if (entry == NULL)
-			return;
+		if (entry == NULL) {
+			g_free (update);
+			return NULL;
+		}
 
 		g_value_init (&status_val, G_TYPE_ULONG);
 		g_value_set_ulong (&status_val, 1);
 		rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_STATUS, &status_val);
 		g_value_unset (&status_val);
 	}
+	update->feed_entry = rhythmdb_entry_ref (entry);
 
 	/* if the feed does not contain a title, use the URL instead */
 	g_value_init (&title_val, G_TYPE_STRING);
 	if (data->title == NULL || strlen ((gchar *)data->title) == 0) {
 		g_value_set_string (&title_val, (gchar *) data->url);
-		title = data->url;
+		update->title = data->url;
 	} else {
 		g_value_set_string (&title_val, (gchar *) data->title);
-		title = data->title;
+		update->title = data->title;
 	}
 	rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_TITLE, &title_val);
 	g_value_unset (&title_val);
@@ -1989,43 +2379,46 @@ rb_podcast_manager_insert_feed (RBPodcastManager *pd, RBPodcastChannel *data)
 	rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_PLAYBACK_ERROR, &error_val);
 	g_value_unset (&error_val);
 
-	/* insert episodes */
-	new_last_post = last_post;
+	rhythmdb_commit (db);
 
-	updated = FALSE;
-	download_last = (g_settings_get_enum (pd->priv->settings, PODCAST_DOWNLOAD_INTERVAL) != PODCAST_INTERVAL_MANUAL);
-	for (lst_songs = data->posts; lst_songs != NULL; lst_songs = g_list_next (lst_songs)) {
-		RBPodcastItem *item = (RBPodcastItem *) lst_songs->data;
+	update->new_last_post = update->last_post;
+	update->next_post = data->posts;
+	return update;
+}
+
+/* inserts the next batch of episodes, returning TRUE if there are more to insert */
+static gboolean
+rb_podcast_manager_insert_posts (RBPodcastFeedUpdate *update)
+{
+	RhythmDB *db = update->pd->priv->db;
+	RBPodcastChannel *data = update->channel;
+	guint count = 0;
+
+	/* give up if the feed was removed since the last batch */
+	if (rhythmdb_entry_lookup_by_location (db, data->url) != update->feed_entry) {
+		rb_debug ("podcast feed %s was removed while being updated", data->url);
+		update->cancelled = TRUE;
+		return FALSE;
+	}
+
+	while (update->next_post != NULL && count < PODCAST_INSERT_BATCH_SIZE) {
+		RBPodcastItem *item = (RBPodcastItem *) update->next_post->data;
 		RhythmDBEntry *post_entry;
 
-		if (existing_entries != NULL) {
-			GtkTreeIter iter;
-			RhythmDBEntry *entry = NULL;
-
-			/* look for an existing entry with this remote location */
-			if (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (existing_entries), &iter)) {
-				do {
-					entry = rhythmdb_query_model_iter_to_entry (existing_entries, &iter);
-					if (strcmp (get_remote_location (entry), item->url) == 0) {
-						rhythmdb_entry_unref (entry);
-						break;
-					}
-					rhythmdb_entry_unref (entry);
-					entry = NULL;
-
-				} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (existing_entries), &iter));
-			}
+		update->next_post = g_list_next (update->next_post);
 
-			if (entry != NULL) {
-				/* mark this entry as still being available */
-				rhythmdb_query_model_remove_entry (existing_entries, entry);
-			}
+		if (update->existing_locations != NULL &&
+		    g_hash_table_remove (update->existing_locations, item->url)) {
+			/* this entry is still available;
+			 * there's nothing else to do for it.
+			 */
+			continue;
 		}
 
-
+		count++;
 		post_entry =
 		    rb_podcast_manager_add_post (db,
-			    title,
+			    update->title,
 			    (gchar *) item->title,
 			    (gchar *) data->url,
 			    (gchar *) (item->author ? item->author : data->author),
@@ -2036,25 +2429,44 @@ rb_podcast_manager_insert_feed (RBPodcastManager *pd, RBPodcastChannel *data)
 			    item->filesize);
 
 		if (post_entry)
-			updated = TRUE;
+			update->updated = TRUE;
 
-                if (post_entry && item->pub_date >= new_last_post) {
-			if (item->pub_date > new_last_post) {
-				g_list_free (download_entries);
-				download_entries = NULL;
+                if (post_entry && item->pub_date >= update->new_last_post) {
+			if (item->pub_date > update->new_last_post) {
+				g_list_free (update->download_entries);
+				update->download_entries = NULL;
 			}
-			download_entries = g_list_prepend (download_entries, post_entry);
-			new_last_post = item->pub_date;
+			update->download_entries = g_list_prepend (update->download_entries, post_entry);
+			update->new_last_post = item->pub_date;
                 }
 	}
 
-	if (download_last) {
+	if (count > 0)
+		rhythmdb_commit (db);
+
+	return (update->next_post != NULL);
+}
+
+static void
+rb_podcast_manager_finish_feed_update (RBPodcastFeedUpdate *update)
+{
+	RBPodcastManager *pd = update->pd;
+	RBPodcastChannel *data = update->channel;
+	RhythmDB *db = pd->priv->db;
+	RhythmDBEntry *entry = update->feed_entry;
+	GValue last_post_val = { 0, };
+	GValue last_update_val = { 0, };
+
+	if (update->cancelled)
+		return;
+
+	if (g_settings_get_enum (pd->priv->settings, PODCAST_DOWNLOAD_INTERVAL) != PODCAST_INTERVAL_MANUAL) {
 		GValue status = {0,};
 		GList *t;
 
 		g_value_init (&status, G_TYPE_ULONG);
 		g_value_set_ulong (&status, RHYTHMDB_PODCAST_STATUS_WAITING);
-		for (t = download_entries; t != NULL; t = g_list_next (t)) {
+		for (t = update->download_entries; t != NULL; t = g_list_next (t)) {
 			rhythmdb_entry_set (db,
 					    (RhythmDBEntry*) t->data,
 					    RHYTHMDB_PROP_STATUS,
@@ -2062,47 +2474,45 @@ rb_podcast_manager_insert_feed (RBPodcastManager *pd, RBPodcastChannel *data)
 		}
 		g_value_unset (&status);
 	}
-	g_list_free (download_entries);
 
-	if (updated)
+	if (update->updated)
 		g_signal_emit (pd, rb_podcast_manager_signals[FEED_UPDATES_AVAILABLE],
 			       0, entry);
 
-	if (data->pub_date > new_last_post)
-		new_last_post = data->pub_date;
+	if (data->pub_date > update->new_last_post)
+		update->new_last_post = data->pub_date;
 
 	g_value_init (&last_post_val, G_TYPE_ULONG);
-	g_value_set_ulong (&last_post_val, new_last_post);
-
-	if (new_feed)
-		rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_POST_TIME, &last_post_val);
-	else
-		rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_POST_TIME, &last_post_val);
+	g_value_set_ulong (&last_post_val, update->new_last_post);
+	rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_POST_TIME, &last_post_val);
 	g_value_unset (&last_post_val);
 
 	g_value_init (&last_update_val, G_TYPE_ULONG);
 	g_value_set_ulong (&last_update_val, time(NULL));
-
-	if (new_feed)
-		rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_LAST_SEEN, &last_update_val);
-	else
-		rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_LAST_SEEN, &last_update_val);
+	rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_LAST_SEEN, &last_update_val);
 	g_value_unset (&last_update_val);
 
-	if (existing_entries != NULL) {
-		GList *remove = NULL;
-		GList *i;
+	/* if we stopped reading the feed at posts we already had, we can't
+	 * tell which of the older posts are no longer in the feed.
+	 */
+	if (update->existing_locations != NULL && data->truncated == FALSE) {
+		GHashTableIter iter;
+		RhythmDBEntry *post;
 
 		/* look for expired entries to remove */
-		gtk_tree_model_foreach (GTK_TREE_MODEL (existing_entries),
-					(GtkTreeModelForeachFunc) remove_if_not_downloaded,
-					&remove);
-		for (i = remove; i != NULL; i = i->next) {
-			rhythmdb_entry_delete (db, (RhythmDBEntry *)i->data);
-		}
-		g_list_free (remove);
+		g_hash_table_iter_init (&iter, update->existing_locations);
+		while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &post)) {
+			const char *location;
 
-		g_object_unref (existing_entries);
+			location = rhythmdb_entry_get_string (post, RHYTHMDB_PROP_LOCATION);
+			if (rhythmdb_entry_lookup_by_location (db, location) != post ||
+			    rb_podcast_manager_entry_downloaded (post))
+				continue;
+
+			rb_debug ("entry %s is no longer present in the feed and has not been downloaded",
+				  get_remote_location (post));
+			rhythmdb_entry_delete (db, post);
+		}
 	}
 
 	rhythmdb_commit (db);
@@ -91,6 +91,10 @@ RhythmDBEntry *         rb_podcast_manager_add_post  	  	(RhythmDB *db,
 
 gboolean		rb_podcast_manager_entry_downloaded	(RhythmDBEntry *entry);
 gboolean		rb_podcast_manager_entry_in_download_queue (RBPodcastManager *pd, RhythmDBEntry *entry);
+gboolean		rb_podcast_manager_get_download_progress (RBPodcastManager *pd,
+								  guint *active,
+								  guint *queued,
+								  float *progress);
 
 
 G_END_DECLS
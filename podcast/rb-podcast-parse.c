@@ -29,12 +29,16 @@
 #include "config.h"
 
 #include <string.h>
+#include <unistd.h>
 
 #include <totem-pl-parser.h>
 #include <glib/gi18n.h>
 #include <gio/gio.h>
 #include <glib.h>
 #include <glib/gprintf.h>
+#include <glib/gstdio.h>
+#include <libsoup/soup.h>
+#include <libsoup/soup-gnome.h>
 
 #include "rb-debug.h"
 #include "rb-podcast-parse.h"
@@ -129,6 +133,10 @@ entry_parsed (TotemPlParser *parser,
 	RBPodcastItem *item;
 	char *scheme = NULL;
 
+	/* the parser can't be stopped, but we can ignore the rest of the feed */
+	if (channel->truncated)
+		return;
+
 	item = g_new0 (RBPodcastItem, 1);
 	g_hash_table_foreach (metadata, (GHFunc) entry_metadata_foreach, item);
 
@@ -145,9 +153,100 @@ entry_parsed (TotemPlParser *parser,
 	}
 	g_free (scheme);
 
+	if (channel->item_func != NULL &&
+	    channel->item_func (channel, item, channel->item_data) == FALSE) {
+		rb_debug ("ignoring the rest of feed %s from %s", channel->url, item->url);
+		channel->truncated = TRUE;
+		rb_podcast_parse_item_free (item);
+		return;
+	}
+
 	channel->posts = g_list_prepend (channel->posts, item);
 }
 
+static void
+update_validator (char **validator, SoupMessageHeaders *headers, const char *name)
+{
+	const char *value;
+
+	value = soup_message_headers_get_one (headers, name);
+	if (value != NULL) {
+		g_free (*validator);
+		*validator = g_strdup (value);
+	}
+}
+
+/*
+ * Fetches an existing feed using the cache validators from the last update.
+ * Returns TRUE if the request succeeded, in which case either
+ * data->not_modified is set or *body_file names a temporary file holding
+ * the new feed contents.  Returns FALSE if the caller should fall back to
+ * letting totem-pl-parser fetch the feed itself.
+ */
+static gboolean
+fetch_feed_conditional (RBPodcastChannel *data, char **body_file)
+{
+	SoupSession *session;
+	SoupMessage *msg;
+	GError *error = NULL;
+	gboolean ret = FALSE;
+	int fd;
+
+	msg = soup_message_new (SOUP_METHOD_GET, data->url);
+	if (msg == NULL) {
+		rb_debug ("unable to create conditional request for %s", data->url);
+		return FALSE;
+	}
+
+	if (data->etag != NULL) {
+		soup_message_headers_append (msg->request_headers, "If-None-Match", data->etag);
+	}
+	if (data->last_modified != NULL) {
+		soup_message_headers_append (msg->request_headers, "If-Modified-Since", data->last_modified);
+	}
+
+	session = soup_session_sync_new_with_options (SOUP_SESSION_ADD_FEATURE_BY_TYPE, SOUP_TYPE_GNOME_FEATURES_2_26,
+						      NULL);
+	soup_session_send_message (session, msg);
+
+	if (msg->status_code == SOUP_STATUS_NOT_MODIFIED) {
+		rb_debug ("feed %s has not been modified", data->url);
+		data->not_modified = TRUE;
+		ret = TRUE;
+	} else if (SOUP_STATUS_IS_SUCCESSFUL (msg->status_code)) {
+		update_validator (&data->etag, msg->response_headers, "ETag");
+		update_validator (&data->last_modified, msg->response_headers, "Last-Modified");
+
+		fd = g_file_open_tmp ("rb-podcast-XXXXXX.xml", body_file, &error);
+		if (fd != -1) {
+			close (fd);
+			g_file_set_contents (*body_file,
+					     msg->response_body->data,
+					     msg->response_body->length,
+					     &error);
+		}
+
+		if (error != NULL) {
+			rb_debug ("unable to store feed contents for %s: %s", data->url, error->message);
+			g_clear_error (&error);
+			if (*body_file != NULL) {
+				g_unlink (*body_file);
+				g_free (*body_file);
+				*body_file = NULL;
+			}
+		} else {
+			ret = TRUE;
+		}
+	} else {
+		rb_debug ("conditional request for %s failed: %d %s",
+			  data->url, msg->status_code, msg->reason_phrase);
+	}
+
+	g_object_unref (msg);
+	g_object_unref (session);
+	return ret;
+}
+
 gboolean
 rb_podcast_parse_load_feed (RBPodcastChannel *data,
 			    const char *file_name,
@@ -157,6 +256,8 @@ rb_podcast_parse_load_feed (RBPodcastChannel *data,
 	GFile *file;
 	GFileInfo *fileinfo;
 	TotemPlParser *plparser;
+	TotemPlParserResult result;
+	char *body_file = NULL;
 
 	data->url = g_strdup (file_name);
 
@@ -209,13 +310,35 @@ rb_podcast_parse_load_feed (RBPodcastChannel *data,
 		g_free (content_type);
 	}
 
+	/* for feeds we've already loaded, make a conditional request so
+	 * unchanged feeds don't get downloaded and parsed again.
+	 */
+	if (existing_feed &&
+	    (g_str_has_prefix (file_name, "http://") || g_str_has_prefix (file_name, "https://"))) {
+		if (fetch_feed_conditional (data, &body_file) && data->not_modified) {
+			return TRUE;
+		}
+	}
+
 	plparser = totem_pl_parser_new ();
 	g_object_set (plparser, "recurse", FALSE, "force", TRUE, NULL);
 	g_signal_connect (G_OBJECT (plparser), "entry-parsed", G_CALLBACK (entry_parsed), data);
 	g_signal_connect (G_OBJECT (plparser), "playlist-started", G_CALLBACK (playlist_started), data);
 	g_signal_connect (G_OBJECT (plparser), "playlist-ended", G_CALLBACK (playlist_ended), data);
 
-	if (totem_pl_parser_parse (plparser, file_name, FALSE) != TOTEM_PL_PARSER_RESULT_SUCCESS) {
+	if (body_file != NULL) {
+		char *body_uri;
+
+		body_uri = g_filename_to_uri (body_file, NULL, NULL);
+		result = totem_pl_parser_parse_with_base (plparser, body_uri, file_name, FALSE);
+		g_unlink (body_file);
+		g_free (body_file);
+		g_free (body_uri);
+	} else {
+		result = totem_pl_parser_parse (plparser, file_name, FALSE);
+	}
+
+	if (result != TOTEM_PL_PARSER_RESULT_SUCCESS) {
 		rb_debug ("Parsing %s as a Podcast failed", file_name);
 		g_set_error (error,
 			     RB_PODCAST_PARSE_ERROR,
@@ -227,9 +350,9 @@ rb_podcast_parse_load_feed (RBPodcastChannel *data,
 	g_object_unref (plparser);
 
 	/* treat empty feeds, or feeds that don't contain any downloadable items, as
-	 * an error.
+	 * an error.  a feed we stopped reading before its first item isn't empty.
 	 */
-	if (data->posts == NULL) {
+	if (data->posts == NULL && data->truncated == FALSE) {
 		rb_debug ("Parsing %s as a podcast succeeded, but the feed contains no downloadable items", file_name);
 		g_set_error (error,
 			     RB_PODCAST_PARSE_ERROR,
@@ -259,6 +382,8 @@ rb_podcast_parse_channel_free (RBPodcastChannel *data)
 	g_free (data->contact);
 	g_free (data->img);
 	g_free (data->copyright);
+	g_free (data->etag);
+	g_free (data->last_modified);
 
 	g_free (data);
 	data = NULL;
@@ -52,7 +52,13 @@ typedef struct
 	guint64 filesize;
 } RBPodcastItem;
 
-typedef struct
+typedef struct _RBPodcastChannel RBPodcastChannel;
+
+typedef gboolean (*RBPodcastParseItemFunc) (RBPodcastChannel *channel,
+					    RBPodcastItem *item,
+					    gpointer data);
+
+struct _RBPodcastChannel
 {
 	char* url;
 	char* title;
@@ -66,8 +72,23 @@ typedef struct
 
     	gboolean is_opml;
 
+	/* HTTP cache validators; set before loading an existing feed
+	 * to make a conditional request, updated from the response.
+	 */
+	char *etag;
+	char *last_modified;
+	gboolean not_modified;
+
+	/* if set, called for each item as it is parsed, before it is
+	 * added to the post list.  returning FALSE discards the item and
+	 * the rest of the feed, and sets 'truncated'.
+	 */
+	RBPodcastParseItemFunc item_func;
+	gpointer item_data;
+	gboolean truncated;
+
 	GList *posts;
-} RBPodcastChannel;
+};
 
 gboolean rb_podcast_parse_load_feed	(RBPodcastChannel *data,
 					 const char *url,
@@ -34,6 +34,7 @@
 #define PODCAST_DOWNLOAD_DIR_KEY		"download-location"
 #define PODCAST_DOWNLOAD_INTERVAL		"download-interval"
 #define PODCAST_PANED_POSITION			"paned-position"
+#define PODCAST_MAX_DOWNLOADS_KEY		"max-downloads"
 
 typedef enum {
 	PODCAST_INTERVAL_HOURLY = 0,
@@ -78,6 +78,7 @@ static gboolean print_volume = FALSE;
 static gboolean mute = FALSE;
 static gboolean unmute = FALSE;
 static gdouble set_rating = -1.0;
+static gboolean print_db_metrics = FALSE;
 
 static gchar **other_stuff = NULL;
 
@@ -120,6 +121,8 @@ static GOptionEntry args[] = {
 	{ "unmute", 0, 0, G_OPTION_ARG_NONE, &unmute, N_("Unmute playback"), NULL },
 	{ "set-rating", 0, 0, G_OPTION_ARG_DOUBLE, &set_rating, N_("Set the rating of the current song"), NULL },
 
+	{ "print-db-metrics", 0, 0, G_OPTION_ARG_NONE, &print_db_metrics, N_("Print database queue lengths and latencies"), NULL },
+
 	{ G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &other_stuff, NULL, NULL },
 
 	{ NULL }
@@ -673,7 +676,7 @@ main (int argc, char **argv)
 	    clear_queue ||
 	    play_uri || other_stuff ||
 	    play || do_pause || play_pause || stop ||
-	    print_playing || print_playing_format || notify ||
+	    print_playing || print_playing_format || notify || print_db_metrics ||
 	    (set_volume > -0.01) || volume_up || volume_down || print_volume || mute || unmute || (set_rating > -0.01))
 		no_present = TRUE;
 
@@ -839,6 +842,17 @@ main (int argc, char **argv)
 		rate_song (shell_proxy, player_proxy, set_rating);
 	}
 
+	/* 10. print database metrics */
+	if (print_db_metrics) {
+		char *metrics = NULL;
+
+		org_gnome_Rhythmbox_Shell_get_database_metrics (shell_proxy, &metrics, &error);
+		annoy (&error);
+		if (metrics != NULL)
+			g_print ("%s", metrics);
+		g_free (metrics);
+	}
+
 	g_object_unref (shell_proxy);
 	g_object_unref (player_proxy);
 	g_option_context_free (context);
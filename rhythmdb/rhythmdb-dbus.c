@@ -28,10 +28,19 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <gio/gio.h>
+#include <libxml/parser.h>
 
 #include "rhythmdb.h"
 #include "rhythmdb-private.h"
+#include "rhythmdb-query-result-list.h"
+#include "rb-debug.h"
+#include "rb-util.h"
+
+/* number of entries to send in each QueryResults signal if the caller doesn't say */
+#define RHYTHMDB_DBUS_QUERY_CHUNK_SIZE	250
 
 static const char *RHYTHMDB_OBJECT_PATH = "/org/gnome/Rhythmbox/RhythmDB";
 static const char *RHYTHMDB_INTERFACE_NAME = "org.gnome.Rhythmbox.RhythmDB";
@@ -47,9 +56,60 @@ static const char *rhythmdb_dbus_spec =
 "      <arg name='uri' type='s'/>"
 "      <arg name='properties' type='a{sv}'/>"
 "    </method>"
+"    <method name='GetEntriesProperties'>"
+"      <arg name='uris' type='as'/>"
+"      <arg name='properties' type='as'/>"
+"      <arg name='entries' type='a{sa{sv}}' direction='out'/>"
+"    </method>"
+"    <method name='SetEntriesProperties'>"
+"      <arg name='entries' type='a{sa{sv}}'/>"
+"      <arg name='missing' type='as' direction='out'/>"
+"    </method>"
+"    <method name='Query'>"
+"      <arg name='query' type='s'/>"
+"      <arg name='properties' type='as'/>"
+"      <arg name='chunk_size' type='u'/>"
+"      <arg name='query_id' type='u' direction='out'/>"
+"    </method>"
+"    <method name='CancelQuery'>"
+"      <arg name='query_id' type='u'/>"
+"    </method>"
+"    <method name='GetMetrics'>"
+"      <arg name='metrics' type='a{sv}' direction='out'/>"
+"    </method>"
+"    <method name='ResetMetrics'/>"
+"    <signal name='QueryResults'>"
+"      <arg name='query_id' type='u'/>"
+"      <arg name='entries' type='a{sa{sv}}'/>"
+"    </signal>"
+"    <signal name='QueryComplete'>"
+"      <arg name='query_id' type='u'/>"
+"    </signal>"
 "  </interface>"
 "</node>";
 
+/* a set of properties to return for each entry, resolved once per call.
+ * property IDs of -1 refer to extra metadata.
+ */
+typedef struct {
+	GArray *propids;
+	char **names;
+} RhythmDBDBusProperties;
+
+typedef struct {
+	RhythmDB *db;
+	GDBusConnection *connection;
+	char *sender;
+	guint id;
+	RhythmDBDBusProperties *props;
+	guint chunk_size;
+
+	RhythmDBQueryResultList *results;
+	guint complete_id;
+	GList *next;
+	guint idle_id;
+} RhythmDBDBusQuery;
+
 static void
 return_entry_not_found (GDBusMethodInvocation *invocation, const char *uri)
 {
@@ -60,6 +120,334 @@ return_entry_not_found (GDBusMethodInvocation *invocation, const char *uri)
 					       uri);
 }
 
+static GVariant *
+value_to_variant (const GValue *value)
+{
+	switch (G_VALUE_TYPE (value)) {
+	case G_TYPE_STRING:
+		return g_variant_new_string (g_value_get_string (value) ? g_value_get_string (value) : "");
+	case G_TYPE_ULONG:
+		return g_variant_new_uint32 (g_value_get_ulong (value));
+	case G_TYPE_UINT64:
+		return g_variant_new_uint64 (g_value_get_uint64 (value));
+	case G_TYPE_BOOLEAN:
+		return g_variant_new_boolean (g_value_get_boolean (value));
+	case G_TYPE_DOUBLE:
+		return g_variant_new_double (g_value_get_double (value));
+	default:
+		return NULL;
+	}
+}
+
+static gboolean
+is_marshallable_property (RhythmDB *db, RhythmDBPropType propid)
+{
+	switch (rhythmdb_get_property_type (db, propid)) {
+	case G_TYPE_STRING:
+	case G_TYPE_BOOLEAN:
+	case G_TYPE_ULONG:
+	case G_TYPE_UINT64:
+	case G_TYPE_DOUBLE:
+		break;
+	default:
+		return FALSE;
+	}
+
+	/* skip deprecated properties */
+	switch (propid) {
+	case RHYTHMDB_PROP_TRACK_GAIN:
+	case RHYTHMDB_PROP_TRACK_PEAK:
+	case RHYTHMDB_PROP_ALBUM_GAIN:
+	case RHYTHMDB_PROP_ALBUM_PEAK:
+		return FALSE;
+	default:
+		return TRUE;
+	}
+}
+
+static RhythmDBDBusProperties *
+resolve_properties (RhythmDB *db, const char **names)
+{
+	RhythmDBDBusProperties *props;
+	int i;
+
+	props = g_new0 (RhythmDBDBusProperties, 1);
+	props->propids = g_array_new (FALSE, FALSE, sizeof (int));
+
+	if (names == NULL || names[0] == NULL) {
+		/* all core properties */
+		props->names = g_new0 (char *, RHYTHMDB_NUM_PROPERTIES + 1);
+		for (i = 0; i < RHYTHMDB_NUM_PROPERTIES; i++) {
+			if (is_marshallable_property (db, i) == FALSE)
+				continue;
+
+			props->names[props->propids->len] = g_strdup ((const char *)rhythmdb_nice_elt_name_from_propid (db, i));
+			g_array_append_val (props->propids, i);
+		}
+		return props;
+	}
+
+	props->names = g_strdupv ((char **)names);
+	for (i = 0; names[i] != NULL; i++) {
+		int propid;
+
+		propid = rhythmdb_propid_from_nice_elt_name (db, (const xmlChar *)names[i]);
+		if (propid != -1 && is_marshallable_property (db, propid) == FALSE) {
+			propid = -1;
+		}
+		g_array_append_val (props->propids, propid);
+	}
+	return props;
+}
+
+static void
+free_properties (RhythmDBDBusProperties *props)
+{
+	g_array_free (props->propids, TRUE);
+	g_strfreev (props->names);
+	g_free (props);
+}
+
+static GVariant *
+project_entry (RhythmDB *db, RhythmDBEntry *entry, RhythmDBDBusProperties *props)
+{
+	GVariantBuilder builder;
+	guint i;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	for (i = 0; i < props->propids->len; i++) {
+		int propid;
+		GValue value = {0,};
+		GValue *extra;
+		GVariant *v;
+
+		propid = g_array_index (props->propids, int, i);
+		if (propid == -1) {
+			extra = rhythmdb_entry_request_extra_metadata (db, entry, props->names[i]);
+			if (extra == NULL)
+				continue;
+
+			v = value_to_variant (extra);
+			g_value_unset (extra);
+			g_free (extra);
+		} else {
+			g_value_init (&value, rhythmdb_get_property_type (db, propid));
+			rhythmdb_entry_get (db, entry, propid, &value);
+			v = value_to_variant (&value);
+			g_value_unset (&value);
+		}
+
+		if (v != NULL) {
+			g_variant_builder_add (&builder, "{sv}", props->names[i], v);
+		}
+	}
+
+	return g_variant_builder_end (&builder);
+}
+
+static void
+set_entry_properties (RhythmDB *db, RhythmDBEntry *entry, GVariant *properties)
+{
+	GVariantIter iter;
+	const char *name;
+	GVariant *value;
+
+	g_variant_iter_init (&iter, properties);
+	while (g_variant_iter_loop (&iter, "{&sv}", &name, &value)) {
+		RhythmDBPropType propid;
+		GValue v = {0,};
+
+		propid = rhythmdb_propid_from_nice_elt_name (db, (xmlChar *)name);
+		if (propid == -1) {
+			/* can't really bail out and return an error at this point */
+			g_warning ("RhythmDB property %s doesn't exist", name);
+			continue;
+		}
+
+		if (g_variant_is_of_type (value, G_VARIANT_TYPE_STRING)) {
+			g_value_init (&v, G_TYPE_STRING);
+			g_value_set_string (&v, g_variant_get_string (value, NULL));
+		} else if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32)) {
+			g_value_init (&v, G_TYPE_ULONG);
+			g_value_set_ulong (&v, g_variant_get_uint32 (value));
+		} else if (g_variant_is_of_type (value, G_VARIANT_TYPE_DOUBLE)) {
+			g_value_init (&v, G_TYPE_DOUBLE);
+			g_value_set_double (&v, g_variant_get_double (value));
+		} else {
+			/* again, can't bail out */
+			g_warning ("Can't convert variant type %s to rhythmdb property",
+				   g_variant_get_type_string (value));
+			continue;
+		}
+
+		rhythmdb_entry_set (db, entry, propid, &v);
+		g_value_unset (&v);
+	}
+}
+
+static void
+free_query (RhythmDBDBusQuery *query)
+{
+	if (query->idle_id != 0) {
+		g_source_remove (query->idle_id);
+	}
+	if (query->complete_id != 0) {
+		g_signal_handler_disconnect (query->results, query->complete_id);
+	}
+	g_object_unref (query->results);
+	free_properties (query->props);
+	g_object_unref (query->connection);
+	g_free (query->sender);
+	g_free (query);
+}
+
+static void
+finish_query (RhythmDBDBusQuery *query)
+{
+	query->db->priv->dbus_queries = g_list_remove (query->db->priv->dbus_queries, query);
+	free_query (query);
+}
+
+static gboolean
+send_query_results_cb (RhythmDBDBusQuery *query)
+{
+	GVariantBuilder builder;
+	GError *error = NULL;
+	guint count;
+
+	if (query->next == NULL) {
+		rb_debug ("query %u complete", query->id);
+		g_dbus_connection_emit_signal (query->connection,
+					       query->sender,
+					       RHYTHMDB_OBJECT_PATH,
+					       RHYTHMDB_INTERFACE_NAME,
+					       "QueryComplete",
+					       g_variant_new ("(u)", query->id),
+					       NULL);
+		query->idle_id = 0;
+		finish_query (query);
+		return FALSE;
+	}
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sa{sv}}"));
+	for (count = 0; count < query->chunk_size && query->next != NULL; count++) {
+		RhythmDBEntry *entry = query->next->data;
+
+		g_variant_builder_add (&builder, "{s@a{sv}}",
+				       rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION),
+				       project_entry (query->db, entry, query->props));
+		query->next = query->next->next;
+	}
+
+	if (g_dbus_connection_emit_signal (query->connection,
+					   query->sender,
+					   RHYTHMDB_OBJECT_PATH,
+					   RHYTHMDB_INTERFACE_NAME,
+					   "QueryResults",
+					   g_variant_new ("(ua{sa{sv}})", query->id, &builder),
+					   &error) == FALSE) {
+		rb_debug ("unable to send results for query %u: %s", query->id, error->message);
+		g_clear_error (&error);
+		query->idle_id = 0;
+		finish_query (query);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+query_complete_cb (RhythmDBQueryResultList *results, RhythmDBDBusQuery *query)
+{
+	g_signal_handler_disconnect (query->results, query->complete_id);
+	query->complete_id = 0;
+
+	query->next = rhythmdb_query_result_list_get_results (results);
+	query->idle_id = g_idle_add ((GSourceFunc) send_query_results_cb, query);
+}
+
+static RhythmDBQuery *
+parse_query (RhythmDB *db, const char *str)
+{
+	RhythmDBQuery *query = NULL;
+	xmlDocPtr doc;
+	xmlNodePtr root;
+
+	doc = xmlParseMemory (str, strlen (str));
+	if (doc == NULL)
+		return NULL;
+
+	root = xmlDocGetRootElement (doc);
+	if (root != NULL && xmlStrcmp (root->name, (const xmlChar *)"conjunction") == 0) {
+		query = rhythmdb_query_deserialize (db, root);
+	}
+	xmlFreeDoc (doc);
+	return query;
+}
+
+static void
+start_query (RhythmDB *db,
+	     GDBusConnection *connection,
+	     const char *sender,
+	     GDBusMethodInvocation *invocation,
+	     GVariant *parameters)
+{
+	RhythmDBDBusQuery *query;
+	RhythmDBQuery *parsed;
+	const char *str;
+	const char **props;
+	guint chunk_size;
+
+	g_variant_get (parameters, "(&s^a&su)", &str, &props, &chunk_size);
+
+	parsed = parse_query (db, str);
+	if (parsed == NULL) {
+		g_dbus_method_invocation_return_error (invocation,
+						       G_DBUS_ERROR,
+						       G_DBUS_ERROR_INVALID_ARGS,
+						       "Unable to parse query");
+		g_free (props);
+		return;
+	}
+
+	query = g_new0 (RhythmDBDBusQuery, 1);
+	query->db = db;
+	query->connection = g_object_ref (connection);
+	query->sender = g_strdup (sender);
+	query->id = ++db->priv->dbus_query_serial;
+	query->props = resolve_properties (db, props);
+	query->chunk_size = chunk_size ? chunk_size : RHYTHMDB_DBUS_QUERY_CHUNK_SIZE;
+	g_free (props);
+
+	query->results = rhythmdb_query_result_list_new ();
+	query->complete_id = g_signal_connect (query->results,
+					       "complete",
+					       G_CALLBACK (query_complete_cb),
+					       query);
+	db->priv->dbus_queries = g_list_prepend (db->priv->dbus_queries, query);
+
+	rb_debug ("starting query %u for %s", query->id, sender);
+	g_dbus_method_invocation_return_value (invocation, g_variant_new ("(u)", query->id));
+
+	rhythmdb_do_full_query_async_parsed (db, RHYTHMDB_QUERY_RESULTS (query->results), parsed);
+	rhythmdb_query_free (parsed);
+}
+
+static void
+cancel_query (RhythmDB *db, const char *sender, guint id)
+{
+	GList *l;
+
+	for (l = db->priv->dbus_queries; l != NULL; l = l->next) {
+		RhythmDBDBusQuery *query = l->data;
+		if (query->id == id && g_strcmp0 (query->sender, sender) == 0) {
+			rb_debug ("cancelling query %u", id);
+			finish_query (query);
+			return;
+		}
+	}
+}
+
 static void
 rhythmdb_method_call (GDBusConnection *connection,
 		      const char *sender,
@@ -107,19 +495,12 @@ rhythmdb_method_call (GDBusConnection *connection,
 		g_hash_table_iter_init (&iter, prop_hash);
 		builder = g_variant_builder_new (G_VARIANT_TYPE ("a{sv}"));
 		while (g_hash_table_iter_next (&iter, &name_ptr, &value_ptr)) {
-			GValue *value;
 			GVariant *v;
 
-			value = value_ptr;
-			if (G_VALUE_HOLDS_STRING (value)) {
-				v = g_variant_new_string (g_value_get_string (value));
-			} else if (G_VALUE_HOLDS_ULONG (value)) {
-				v = g_variant_new_uint32 (g_value_get_ulong (value));
-			} else if (G_VALUE_HOLDS_DOUBLE (value)) {
-				v = g_variant_new_double (g_value_get_double (value));
-			} else {
-				g_assert_not_reached ();
-			}
+			v = value_to_variant (value_ptr);
+			if (v == NULL)
+				continue;
+
 			g_variant_builder_add (builder,
 					       "{sv}",
 					       (const char *)name_ptr,
@@ -133,55 +514,92 @@ rhythmdb_method_call (GDBusConnection *connection,
 			g_variant_builder_add (builder, "{sv}", "", g_variant_new_string (""));
 		}
 
-		g_dbus_method_invocation_return_value (invocation, g_variant_builder_end (builder));
+		g_dbus_method_invocation_return_value (invocation, g_variant_new ("(a{sv})", builder));
 		g_variant_builder_unref (builder);
 
 	} else if (g_strcmp0 (method_name, "SetEntryProperties") == 0) {
 		GVariant *properties;
-		GVariantIter iter;
-		const char *name;
-		GVariant *value;
 
 		g_variant_get (parameters, "(&s@a{sv})", &uri, &properties);
 
 		entry = rhythmdb_entry_lookup_by_location (db, uri);
 		if (entry == NULL) {
+			g_variant_unref (properties);
 			return_entry_not_found (invocation, uri);
 			return;
 		}
 
-		/* set properties on entry, commit, etc. */
-		g_variant_iter_init (&iter, properties);
-		while (g_variant_iter_loop (&iter, "{&sv}", &name, &value)) {
-			RhythmDBPropType propid;
-			GValue v = {0,};
-
-			propid = rhythmdb_propid_from_nice_elt_name (db, (xmlChar *)name);
-			if (propid == -1) {
-				/* can't really bail out and return an error at this point */
-				g_warning ("RhythmDB property %s doesn't exist", name);
+		set_entry_properties (db, entry, properties);
+		g_variant_unref (properties);
+		rhythmdb_commit (db);
+		g_dbus_method_invocation_return_value (invocation, NULL);
+
+	} else if (g_strcmp0 (method_name, "GetEntriesProperties") == 0) {
+		RhythmDBDBusProperties *props;
+		GVariantBuilder builder;
+		const char **uris;
+		const char **names;
+		int i;
+
+		g_variant_get (parameters, "(^a&s^a&s)", &uris, &names);
+		props = resolve_properties (db, names);
+
+		/* entries that don't exist are left out of the result */
+		g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sa{sv}}"));
+		for (i = 0; uris[i] != NULL; i++) {
+			entry = rhythmdb_entry_lookup_by_location (db, uris[i]);
+			if (entry == NULL)
 				continue;
-			}
 
-			if (g_variant_is_of_type (value, G_VARIANT_TYPE_STRING)) {
-				g_value_init (&v, G_TYPE_STRING);
-				g_value_set_string (&v, g_variant_get_string (value, NULL));
-			} else if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32)) {
-				g_value_init (&v, G_TYPE_ULONG);
-				g_value_set_ulong (&v, g_variant_get_uint32 (value));
-			} else if (g_variant_is_of_type (value, G_VARIANT_TYPE_DOUBLE)) {
-				g_value_init (&v, G_TYPE_DOUBLE);
-				g_value_set_double (&v, g_variant_get_double (value));
-			} else {
-				/* again, can't bail out */
-				g_warning ("Can't convert variant type %s to rhythmdb property",
-					   g_variant_get_type_string (value));
+			g_variant_builder_add (&builder, "{s@a{sv}}",
+					       uris[i],
+					       project_entry (db, entry, props));
+		}
+		free_properties (props);
+		g_free (uris);
+		g_free (names);
+
+		g_dbus_method_invocation_return_value (invocation, g_variant_new ("(a{sa{sv}})", &builder));
+
+	} else if (g_strcmp0 (method_name, "SetEntriesProperties") == 0) {
+		GVariantBuilder missing;
+		GVariantIter *iter;
+		GVariant *properties;
+
+		g_variant_builder_init (&missing, G_VARIANT_TYPE ("as"));
+		g_variant_get (parameters, "(a{s@a{sv}})", &iter);
+		while (g_variant_iter_loop (iter, "{&s@a{sv}}", &uri, &properties)) {
+			entry = rhythmdb_entry_lookup_by_location (db, uri);
+			if (entry == NULL) {
+				g_variant_builder_add (&missing, "s", uri);
 				continue;
 			}
 
-			rhythmdb_entry_set (db, entry, propid, &v);
-			g_value_unset (&v);
+			set_entry_properties (db, entry, properties);
 		}
+		g_variant_iter_free (iter);
+
+		/* commit once for the whole batch */
+		rhythmdb_commit (db);
+		g_dbus_method_invocation_return_value (invocation, g_variant_new ("(as)", &missing));
+
+	} else if (g_strcmp0 (method_name, "Query") == 0) {
+		start_query (db, connection, sender, invocation, parameters);
+
+	} else if (g_strcmp0 (method_name, "CancelQuery") == 0) {
+		guint id;
+
+		g_variant_get (parameters, "(u)", &id);
+		cancel_query (db, sender, id);
+		g_dbus_method_invocation_return_value (invocation, NULL);
+
+	} else if (g_strcmp0 (method_name, "GetMetrics") == 0) {
+		g_dbus_method_invocation_return_value (invocation,
+						       g_variant_new ("(@a{sv})", rhythmdb_get_metrics (db)));
+
+	} else if (g_strcmp0 (method_name, "ResetMetrics") == 0) {
+		rhythmdb_reset_metrics (db);
+		g_dbus_method_invocation_return_value (invocation, NULL);
 
 	} else {
 		g_dbus_method_invocation_return_error (invocation,
@@ -192,7 +610,6 @@ rhythmdb_method_call (GDBusConnection *connection,
 						       method_name);
 	}
 }
-
 static GDBusInterfaceVTable rhythmdb_interface_vtable = {
 	(GDBusInterfaceMethodCallFunc) rhythmdb_method_call,
 	NULL,
@@ -238,6 +655,9 @@ rhythmdb_dbus_unregister (RhythmDB *db)
 		return;
 	}
 
+	rb_list_destroy_free (db->priv->dbus_queries, (GDestroyNotify) free_query);
+	db->priv->dbus_queries = NULL;
+
 	if (db->priv->dbus_object_id) {
 		g_dbus_connection_unregister_object (bus,
 						     db->priv->dbus_object_id);
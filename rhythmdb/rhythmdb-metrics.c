@@ -0,0 +1,292 @@
+/*
+ *  Copyright (C) 2011 the Rhythmbox authors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "rhythmdb.h"
+#include "rhythmdb-private.h"
+#include "rb-debug.h"
+
+/*
+ * Counters and latency histograms for the database's queues and threads.
+ * Latencies are recorded in microseconds into power-of-two buckets, the
+ * first of which holds everything below RHYTHMDB_LATENCY_BASE and the last
+ * of which holds everything that doesn't fit in the others.
+ */
+
+#define RHYTHMDB_LATENCY_BASE	16
+
+/* in the same order as RhythmDBLatencyType */
+static const char *latency_names[] = {
+	"event-stat",
+	"event-metadata-load",
+	"event-db-load",
+	"event-thread-exited",
+	"event-db-saved",
+	"event-query-complete",
+	"event-entry-set",
+	"commit",
+	"emit-signals",
+	"query"
+};
+
+/**
+ * rhythmdb_metrics_time: (skip)
+ *
+ * Returns the current time in microseconds, for use with
+ * #rhythmdb_record_latency.
+ *
+ * Return value: current time
+ */
+gint64
+rhythmdb_metrics_time (void)
+{
+	GTimeVal now;
+
+	g_get_current_time (&now);
+	return ((gint64) now.tv_sec * G_USEC_PER_SEC) + now.tv_usec;
+}
+
+/**
+ * rhythmdb_record_latency: (skip)
+ * @db: the #RhythmDB
+ * @type: the operation that was timed
+ * @start: time the operation started, from #rhythmdb_metrics_time
+ *
+ * Records the time taken by an operation.  This may be called from any thread.
+ */
+void
+rhythmdb_record_latency (RhythmDB *db, RhythmDBLatencyType type, gint64 start)
+{
+	RhythmDBLatency *latency;
+	guint64 elapsed;
+	int bucket;
+
+	elapsed = MAX (rhythmdb_metrics_time () - start, 0);
+	for (bucket = 0; bucket < RHYTHMDB_LATENCY_BUCKETS - 1; bucket++) {
+		if (elapsed < ((guint64) RHYTHMDB_LATENCY_BASE << bucket))
+			break;
+	}
+
+	g_mutex_lock (db->priv->metrics_mutex);
+	latency = &db->priv->latency[type];
+	latency->count++;
+	latency->total += elapsed;
+	latency->max = MAX (latency->max, elapsed);
+	latency->buckets[bucket]++;
+	g_mutex_unlock (db->priv->metrics_mutex);
+}
+
+/**
+ * rhythmdb_count_emitted: (skip)
+ * @db: the #RhythmDB
+ * @added: number of entry-added signals emitted
+ * @changed: number of entry-changed signals emitted
+ * @deleted: number of entry-deleted signals emitted
+ *
+ * Adds to the counts of entry signals emitted.
+ */
+void
+rhythmdb_count_emitted (RhythmDB *db, guint added, guint changed, guint deleted)
+{
+	g_mutex_lock (db->priv->metrics_mutex);
+	db->priv->entries_added_emitted += added;
+	db->priv->entries_changed_emitted += changed;
+	db->priv->entries_deleted_emitted += deleted;
+	g_mutex_unlock (db->priv->metrics_mutex);
+}
+
+static guint
+queue_length (GAsyncQueue *queue)
+{
+	/* negative lengths mean threads are waiting on an empty queue */
+	return MAX (g_async_queue_length (queue), 0);
+}
+
+/**
+ * rhythmdb_get_metrics:
+ * @db: the #RhythmDB
+ *
+ * Returns the current lengths of the database's work queues, the
+ * state of the query thread pool, the number of entry signals emitted
+ * and latency histograms for event processing, commits, entry signal
+ * emission and queries, as a dictionary (a{sv}).
+ *
+ * Each latency is a tuple of the number of operations timed, their total
+ * and maximum time in microseconds, and an array of counts for each
+ * histogram bucket.  The upper limit of each bucket is given by
+ * 'latency-bucket-limits'.
+ *
+ * Return value: (transfer full): a floating #GVariant holding the metrics
+ */
+GVariant *
+rhythmdb_get_metrics (RhythmDB *db)
+{
+	GVariantBuilder builder;
+	GVariantBuilder latencies;
+	GVariantBuilder limits;
+	guint sync_length;
+	int i;
+	int j;
+
+	g_mutex_lock (db->priv->sync_mutex);
+	sync_length = g_queue_get_length (db->priv->sync_queue) +
+		g_queue_get_length (db->priv->sync_urgent_queue);
+	g_mutex_unlock (db->priv->sync_mutex);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_add (&builder, "{sv}", "action-queue-length",
+			       g_variant_new_uint32 (queue_length (db->priv->action_queue)));
+	g_variant_builder_add (&builder, "{sv}", "event-queue-length",
+			       g_variant_new_uint32 (queue_length (db->priv->event_queue)));
+	g_variant_builder_add (&builder, "{sv}", "sync-queue-length",
+			       g_variant_new_uint32 (sync_length));
+	g_variant_builder_add (&builder, "{sv}", "query-threads",
+			       g_variant_new_uint32 (g_thread_pool_get_num_threads (db->priv->query_thread_pool)));
+	g_variant_builder_add (&builder, "{sv}", "queries-waiting",
+			       g_variant_new_uint32 (g_thread_pool_unprocessed (db->priv->query_thread_pool)));
+	g_variant_builder_add (&builder, "{sv}", "outstanding-threads",
+			       g_variant_new_int32 (g_atomic_int_get (&db->priv->outstanding_threads)));
+
+	g_variant_builder_init (&limits, G_VARIANT_TYPE ("at"));
+	for (i = 0; i < RHYTHMDB_LATENCY_BUCKETS - 1; i++) {
+		g_variant_builder_add (&limits, "t", (guint64) RHYTHMDB_LATENCY_BASE << i);
+	}
+	g_variant_builder_add (&limits, "t", G_MAXUINT64);
+	g_variant_builder_add (&builder, "{sv}", "latency-bucket-limits", g_variant_builder_end (&limits));
+
+	g_variant_builder_init (&latencies, G_VARIANT_TYPE ("a{s(tttat)}"));
+
+	g_mutex_lock (db->priv->metrics_mutex);
+	g_variant_builder_add (&builder, "{sv}", "entries-added",
+			       g_variant_new_uint64 (db->priv->entries_added_emitted));
+	g_variant_builder_add (&builder, "{sv}", "entries-changed",
+			       g_variant_new_uint64 (db->priv->entries_changed_emitted));
+	g_variant_builder_add (&builder, "{sv}", "entries-deleted",
+			       g_variant_new_uint64 (db->priv->entries_deleted_emitted));
+
+	for (i = 0; i < RHYTHMDB_NUM_LATENCIES; i++) {
+		RhythmDBLatency *latency = &db->priv->latency[i];
+		GVariantBuilder buckets;
+
+		g_variant_builder_init (&buckets, G_VARIANT_TYPE ("at"));
+		for (j = 0; j < RHYTHMDB_LATENCY_BUCKETS; j++) {
+			g_variant_builder_add (&buckets, "t", latency->buckets[j]);
+		}
+		g_variant_builder_add (&latencies, "{s(tttat)}",
+				       latency_names[i],
+				       latency->count,
+				       latency->total,
+				       latency->max,
+				       &buckets);
+	}
+	g_mutex_unlock (db->priv->metrics_mutex);
+
+	g_variant_builder_add (&builder, "{sv}", "latency", g_variant_builder_end (&latencies));
+	return g_variant_builder_end (&builder);
+}
+
+/**
+ * rhythmdb_reset_metrics:
+ * @db: the #RhythmDB
+ *
+ * Resets the entry signal counts and latency histograms.
+ */
+void
+rhythmdb_reset_metrics (RhythmDB *db)
+{
+	g_mutex_lock (db->priv->metrics_mutex);
+	memset (db->priv->latency, 0, sizeof (db->priv->latency));
+	db->priv->entries_added_emitted = 0;
+	db->priv->entries_changed_emitted = 0;
+	db->priv->entries_deleted_emitted = 0;
+	g_mutex_unlock (db->priv->metrics_mutex);
+}
+
+/**
+ * rhythmdb_get_metrics_report:
+ * @db: the #RhythmDB
+ *
+ * Formats the database metrics (see #rhythmdb_get_metrics) as text.
+ *
+ * Return value: (transfer full): metrics report
+ */
+char *
+rhythmdb_get_metrics_report (RhythmDB *db)
+{
+	GVariant *metrics;
+	GVariant *latencies = NULL;
+	GVariantIter iter;
+	GString *str;
+	const char *name;
+	GVariant *value;
+
+	metrics = g_variant_ref_sink (rhythmdb_get_metrics (db));
+	str = g_string_new (NULL);
+
+	g_variant_iter_init (&iter, metrics);
+	while (g_variant_iter_next (&iter, "{&sv}", &name, &value)) {
+		if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32)) {
+			g_string_append_printf (str, "%s: %u\n", name, g_variant_get_uint32 (value));
+		} else if (g_variant_is_of_type (value, G_VARIANT_TYPE_INT32)) {
+			g_string_append_printf (str, "%s: %d\n", name, g_variant_get_int32 (value));
+		} else if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT64)) {
+			g_string_append_printf (str, "%s: %" G_GUINT64_FORMAT "\n", name, g_variant_get_uint64 (value));
+		} else if (g_variant_is_of_type (value, G_VARIANT_TYPE ("a{s(tttat)}"))) {
+			latencies = g_variant_ref (value);
+		}
+		g_variant_unref (value);
+	}
+
+	g_string_append_printf (str, "\n%-22s %10s %12s %12s   histogram (<%dus, <%dus, ...)\n",
+				"latency", "count", "mean (us)", "max (us)",
+				RHYTHMDB_LATENCY_BASE, RHYTHMDB_LATENCY_BASE * 2);
+	g_variant_iter_init (&iter, latencies);
+	while (g_variant_iter_next (&iter, "{&s@(tttat)}", &name, &value)) {
+		guint64 count, total, max;
+		GVariantIter *buckets;
+		guint64 n;
+
+		g_variant_get (value, "(tttat)", &count, &total, &max, &buckets);
+		g_string_append_printf (str, "%-22s %10" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT "  ",
+					name, count, count ? total / count : 0, max);
+		while (g_variant_iter_next (buckets, "t", &n)) {
+			g_string_append_printf (str, " %" G_GUINT64_FORMAT, n);
+		}
+		g_string_append_c (str, '\n');
+		g_variant_iter_free (buckets);
+		g_variant_unref (value);
+	}
+	g_variant_unref (latencies);
+
+	g_variant_unref (metrics);
+	return g_string_free (str, FALSE);
+}
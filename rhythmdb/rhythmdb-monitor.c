@@ -29,6 +29,7 @@
 #include <config.h>
 
 #include <string.h>
+#include <stdlib.h>
 
 #include <glib.h>
 #include <glib-object.h>
@@ -48,6 +49,65 @@
 
 #define RHYTHMDB_FILE_MODIFY_PROCESS_TIME 2
 
+/* one slot per second, enough to hold a file for the full processing time */
+#define RHYTHMDB_CHANGE_WHEEL_SIZE	(RHYTHMDB_FILE_MODIFY_PROCESS_TIME + 2)
+
+/* maximum number of directories to use file monitors for */
+#define RHYTHMDB_MONITOR_BUDGET		8192
+
+/* interval between checks of directories without file monitors */
+#define RHYTHMDB_POLL_INTERVAL		120
+
+typedef struct {
+	GTimeVal mtime;
+	gboolean have_mtime;
+	glong added;
+	GHashTable *children;		/* names from the last listing, or NULL */
+} RhythmDBPolledDir;
+
+typedef struct {
+	GFile *file;
+	gboolean dir;
+	glong mtime;
+} RhythmDBPollResult;
+
+typedef struct {
+	RhythmDB *db;
+	GList *dirs;
+	GList *results;
+	GHashTable *first_listings;	/* dir uri -> names, for directories listed for the first time */
+	GList *deleted;
+} RhythmDBPollData;
+
+static void
+polled_dir_free (RhythmDBPolledDir *polled)
+{
+	if (polled->children != NULL) {
+		g_hash_table_unref (polled->children);
+	}
+	g_free (polled);
+}
+
+typedef struct {
+	RBRefString *dir;
+	guint slot;
+} RhythmDBChangedFile;
+
+static void
+changed_file_free (RhythmDBChangedFile *changed)
+{
+	rb_refstring_unref (changed->dir);
+	g_free (changed);
+}
+
+static GHashTable *
+changed_wheel_slot_new (void)
+{
+	return g_hash_table_new_full (rb_refstring_hash, rb_refstring_equal,
+				      (GDestroyNotify) rb_refstring_unref,
+				      (GDestroyNotify) g_hash_table_destroy);
+}
+
 static void rhythmdb_directory_change_cb (GFileMonitor *monitor,
 					  GFile *file,
 					  GFile *other_file,
@@ -60,18 +120,51 @@ static void rhythmdb_mount_removed_cb (GVolumeMonitor *monitor,
 				       GMount *mount,
 				       RhythmDB *db);
 
+static guint
+get_monitor_budget (void)
+{
+	char *contents;
+	guint budget = RHYTHMDB_MONITOR_BUDGET;
+
+	/* leave plenty of inotify watches for other applications */
+	if (g_file_get_contents ("/proc/sys/fs/inotify/max_user_watches", &contents, NULL, NULL)) {
+		guint max_watches;
+
+		max_watches = strtoul (contents, NULL, 10);
+		if (max_watches > 0) {
+			budget = MIN (budget, max_watches / 2);
+		}
+		g_free (contents);
+	}
+
+	return budget;
+}
+
 void
 rhythmdb_init_monitoring (RhythmDB *db)
 {
+	int i;
+
 	db->priv->monitor_mutex = g_mutex_new ();
 
 	db->priv->monitored_directories = g_hash_table_new_full (g_file_hash, (GEqualFunc) g_file_equal,
 								 (GDestroyNotify) g_object_unref,
 								 (GDestroyNotify)g_file_monitor_cancel);
 
+	db->priv->polled_directories = g_hash_table_new_full (g_file_hash, (GEqualFunc) g_file_equal,
+							      (GDestroyNotify) g_object_unref,
+							      (GDestroyNotify) polled_dir_free);
+
 	db->priv->changed_files = g_hash_table_new_full (rb_refstring_hash, rb_refstring_equal,
 							 (GDestroyNotify) rb_refstring_unref,
-							 NULL);
+							 (GDestroyNotify) changed_file_free);
+	db->priv->changed_wheel = g_new0 (GHashTable *, RHYTHMDB_CHANGE_WHEEL_SIZE);
+	for (i = 0; i < RHYTHMDB_CHANGE_WHEEL_SIZE; i++) {
+		db->priv->changed_wheel[i] = changed_wheel_slot_new ();
+	}
+
+	db->priv->monitor_budget = get_monitor_budget ();
+	rb_debug ("using file monitors for up to %u directories", db->priv->monitor_budget);
 
 	db->priv->volume_monitor = g_volume_monitor_get ();
 	g_signal_connect (G_OBJECT (db->priv->volume_monitor),
@@ -97,6 +190,11 @@ rhythmdb_dispose_monitoring (RhythmDB *db)
 		db->priv->changed_files_id = 0;
 	}
 
+	if (db->priv->poll_id != 0) {
+		g_source_remove (db->priv->poll_id);
+		db->priv->poll_id = 0;
+	}
+
 	if (db->priv->volume_monitor != NULL) {
 		g_object_unref (db->priv->volume_monitor);
 		db->priv->volume_monitor = NULL;
@@ -106,10 +204,21 @@ rhythmdb_dispose_monitoring (RhythmDB *db)
 void
 rhythmdb_finalize_monitoring (RhythmDB *db)
 {
+	int i;
+
 	rhythmdb_stop_monitoring (db);
 
 	g_hash_table_destroy (db->priv->monitored_directories);
+	g_hash_table_destroy (db->priv->polled_directories);
 	g_hash_table_destroy (db->priv->changed_files);
+	for (i = 0; i < RHYTHMDB_CHANGE_WHEEL_SIZE; i++) {
+		g_hash_table_destroy (db->priv->changed_wheel[i]);
+	}
+	g_free (db->priv->changed_wheel);
+
+	if (db->priv->library_dir_cache != NULL) {
+		rb_dir_cache_free (db->priv->library_dir_cache);
+	}
 
 	g_mutex_free (db->priv->monitor_mutex);
 }
@@ -117,9 +226,346 @@ rhythmdb_finalize_monitoring (RhythmDB *db)
 void
 rhythmdb_stop_monitoring (RhythmDB *db)
 {
+	g_mutex_lock (db->priv->monitor_mutex);
 	g_hash_table_foreach_remove (db->priv->monitored_directories,
 				     (GHRFunc) rb_true_function,
 				     db);
+	g_hash_table_foreach_remove (db->priv->polled_directories,
+				     (GHRFunc) rb_true_function,
+				     db);
+	g_mutex_unlock (db->priv->monitor_mutex);
+}
+
+static void
+free_poll_data (RhythmDBPollData *data)
+{
+	GList *l;
+
+	for (l = data->results; l != NULL; l = l->next) {
+		RhythmDBPollResult *result = l->data;
+		g_object_unref (result->file);
+		g_free (result);
+	}
+	g_list_free (data->results);
+	g_hash_table_destroy (data->first_listings);
+	rb_list_destroy_free (data->deleted, (GDestroyNotify) g_object_unref);
+	rb_list_destroy_free (data->dirs, (GDestroyNotify) g_object_unref);
+	g_object_unref (data->db);
+	g_free (data);
+}
+
+/* finds entries in directories listed for the first time that weren't
+ * found in the listing.  entry locations are escaped, but the listings
+ * hold the names as they are on disk.
+ */
+static void
+find_deleted_entry (RhythmDBEntry *entry, RhythmDBPollData *data)
+{
+	const char *uri;
+	const char *slash;
+
+	if (rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN))
+		return;
+
+	/* check the child of the closest listed parent directory, so
+	 * files in deleted subdirectories are found too.
+	 */
+	uri = rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION);
+	slash = strrchr (uri, '/');
+	while (slash != NULL && slash > uri) {
+		GHashTable *children;
+		char *dir;
+
+		dir = g_strndup (uri, slash - uri);
+		children = g_hash_table_lookup (data->first_listings, dir);
+		if (children != NULL) {
+			const char *end;
+			char *escaped;
+			char *name;
+
+			end = strchr (slash + 1, '/');
+			if (end != NULL) {
+				escaped = g_strndup (slash + 1, end - (slash + 1));
+			} else {
+				escaped = g_strdup (slash + 1);
+			}
+
+			name = g_uri_unescape_string (escaped, NULL);
+			if (name != NULL && g_hash_table_lookup (children, name) == NULL) {
+				data->deleted = g_list_prepend (data->deleted, g_file_new_for_uri (uri));
+			}
+			g_free (name);
+			g_free (escaped);
+			g_free (dir);
+			return;
+		}
+		g_free (dir);
+
+		do {
+			slash--;
+		} while (slash > uri && *slash != '/');
+	}
+}
+
+/* adds the children of a directory that are no longer there to the list
+ * of deleted files.  called with the monitor mutex held.
+ */
+static void
+add_deleted_children (RhythmDBPollData *data, GFile *dir, GHashTable *old_children, GHashTable *new_children)
+{
+	GHashTableIter iter;
+	gpointer name;
+
+	g_hash_table_iter_init (&iter, old_children);
+	while (g_hash_table_iter_next (&iter, &name, NULL)) {
+		if (new_children == NULL || g_hash_table_lookup (new_children, name) == NULL) {
+			data->deleted = g_list_prepend (data->deleted, g_file_get_child (dir, name));
+		}
+	}
+}
+
+/* runs in main thread */
+static gboolean
+poll_results_idle_cb (RhythmDBPollData *data)
+{
+	RhythmDB *db = data->db;
+	GList *l;
+
+	rb_debug ("processing %d results from polled directories", g_list_length (data->results));
+	for (l = data->results; l != NULL; l = l->next) {
+		RhythmDBPollResult *result = l->data;
+		RhythmDBEntry *entry;
+		gboolean known;
+		char *uri;
+
+		if (result->dir) {
+			g_mutex_lock (db->priv->monitor_mutex);
+			known = (g_hash_table_lookup (db->priv->monitored_directories, result->file) != NULL ||
+				 g_hash_table_lookup (db->priv->polled_directories, result->file) != NULL);
+			g_mutex_unlock (db->priv->monitor_mutex);
+
+			if (known == FALSE) {
+				rhythmdb_directory_change_cb (NULL, result->file, NULL, G_FILE_MONITOR_EVENT_CREATED, db);
+			}
+			continue;
+		}
+
+		uri = g_file_get_uri (result->file);
+		entry = rhythmdb_entry_lookup_by_location (db, uri);
+		if (entry == NULL) {
+			rhythmdb_directory_change_cb (NULL, result->file, NULL, G_FILE_MONITOR_EVENT_CREATED, db);
+		} else if (rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_MTIME) != result->mtime) {
+			rhythmdb_directory_change_cb (NULL, result->file, NULL, G_FILE_MONITOR_EVENT_CHANGED, db);
+		}
+		g_free (uri);
+	}
+
+	rb_debug ("found %d deleted files in polled directories", g_list_length (data->deleted));
+	for (l = data->deleted; l != NULL; l = l->next) {
+		rhythmdb_directory_change_cb (NULL, l->data, NULL, G_FILE_MONITOR_EVENT_DELETED, db);
+	}
+
+	db->priv->polling = FALSE;
+	free_poll_data (data);
+	return FALSE;
+}
+
+/* returns the names of the directory's children, and if report is set,
+ * adds the children to the results to be checked against the database.
+ */
+static GHashTable *
+poll_list_directory (RhythmDBPollData *data, GFile *dir, gboolean report)
+{
+	GFileEnumerator *files;
+	GFileInfo *info;
+	GHashTable *children;
+
+	files = g_file_enumerate_children (dir,
+					   G_FILE_ATTRIBUTE_STANDARD_NAME ","
+					   G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+					   G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN ","
+					   G_FILE_ATTRIBUTE_TIME_MODIFIED,
+					   G_FILE_QUERY_INFO_NONE,
+					   data->db->priv->exiting,
+					   NULL);
+	if (files == NULL)
+		return NULL;
+
+	children = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	while ((info = g_file_enumerator_next_file (files, data->db->priv->exiting, NULL)) != NULL) {
+		RhythmDBPollResult *result;
+
+		g_hash_table_insert (children, g_strdup (g_file_info_get_name (info)), GINT_TO_POINTER (1));
+		if (report && g_file_info_get_is_hidden (info) == FALSE) {
+			result = g_new0 (RhythmDBPollResult, 1);
+			result->file = g_file_get_child (dir, g_file_info_get_name (info));
+			result->dir = (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY);
+			result->mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+			data->results = g_list_prepend (data->results, result);
+		}
+		g_object_unref (info);
+	}
+	g_object_unref (files);
+	return children;
+}
+
+static gpointer
+poll_directories_thread (RhythmDBPollData *data)
+{
+	RhythmDB *db = data->db;
+	GList *l;
+	int changed = 0;
+
+	for (l = data->dirs; l != NULL; l = l->next) {
+		GFile *dir = l->data;
+		RhythmDBPolledDir *polled;
+		GFileInfo *info;
+		GTimeVal mtime;
+		GError *error = NULL;
+		gboolean is_changed = FALSE;
+		gboolean listed = FALSE;
+		GHashTable *children;
+
+		if (g_cancellable_is_cancelled (db->priv->exiting))
+			break;
+
+		info = g_file_query_info (dir, G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+					  G_FILE_QUERY_INFO_NONE, db->priv->exiting, &error);
+		if (info == NULL) {
+			/* stop polling directories that have been deleted;
+			 * everything that was in them is gone too.
+			 */
+			if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+				g_mutex_lock (db->priv->monitor_mutex);
+				polled = g_hash_table_lookup (db->priv->polled_directories, dir);
+				if (polled != NULL && polled->children != NULL) {
+					add_deleted_children (data, dir, polled->children, NULL);
+				}
+				g_hash_table_remove (db->priv->polled_directories, dir);
+				g_mutex_unlock (db->priv->monitor_mutex);
+			}
+			g_clear_error (&error);
+			continue;
+		}
+		g_file_info_get_modification_time (info, &mtime);
+		g_object_unref (info);
+
+		g_mutex_lock (db->priv->monitor_mutex);
+		polled = g_hash_table_lookup (db->priv->polled_directories, dir);
+		if (polled != NULL) {
+			if (polled->have_mtime) {
+				is_changed = (polled->mtime.tv_sec != mtime.tv_sec ||
+					      polled->mtime.tv_usec != mtime.tv_usec);
+			} else {
+				/* catch changes made after the directory was scanned */
+				is_changed = (mtime.tv_sec >= polled->added);
+			}
+			polled->mtime = mtime;
+			polled->have_mtime = TRUE;
+			listed = (polled->children != NULL);
+		}
+		g_mutex_unlock (db->priv->monitor_mutex);
+
+		/* unchanged directories are listed once, so there's
+		 * something to compare with when they do change.
+		 */
+		if (is_changed == FALSE && listed)
+			continue;
+
+		if (is_changed)
+			changed++;
+		children = poll_list_directory (data, dir, is_changed);
+		if (children == NULL)
+			continue;
+
+		/* files don't show up in the listing after they're deleted, so
+		 * compare it with the previous one.
+		 */
+		g_mutex_lock (db->priv->monitor_mutex);
+		polled = g_hash_table_lookup (db->priv->polled_directories, dir);
+		if (polled != NULL) {
+			if (polled->children != NULL) {
+				add_deleted_children (data, dir, polled->children, children);
+				g_hash_table_unref (polled->children);
+			} else if (is_changed) {
+				g_hash_table_insert (data->first_listings,
+						     g_file_get_uri (dir),
+						     g_hash_table_ref (children));
+			}
+			polled->children = children;
+		} else {
+			g_hash_table_unref (children);
+		}
+		g_mutex_unlock (db->priv->monitor_mutex);
+	}
+
+	/* directories that changed before they were first listed have nothing
+	 * to compare with, so look for entries in them that weren't listed.
+	 * this only happens for directories that changed before the first
+	 * poll after they were added.
+	 */
+	if (g_hash_table_size (data->first_listings) > 0) {
+		rhythmdb_entry_foreach_by_type (db, RHYTHMDB_ENTRY_TYPE_SONG, (GFunc) find_deleted_entry, data);
+	}
+
+	rb_debug ("polled %d directories, %d changed", g_list_length (data->dirs), changed);
+	g_idle_add ((GSourceFunc) poll_results_idle_cb, data);
+	return NULL;
+}
+
+static gboolean
+poll_directories_cb (RhythmDB *db)
+{
+	RhythmDBPollData *data;
+
+	if (db->priv->polling) {
+		return TRUE;
+	}
+
+	g_mutex_lock (db->priv->monitor_mutex);
+	if (g_hash_table_size (db->priv->polled_directories) == 0) {
+		db->priv->poll_id = 0;
+		g_mutex_unlock (db->priv->monitor_mutex);
+		return FALSE;
+	}
+
+	data = g_new0 (RhythmDBPollData, 1);
+	data->first_listings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_hash_table_unref);
+	data->dirs = g_hash_table_get_keys (db->priv->polled_directories);
+	g_list_foreach (data->dirs, (GFunc) g_object_ref, NULL);
+	g_mutex_unlock (db->priv->monitor_mutex);
+
+	data->db = g_object_ref (db);
+	db->priv->polling = TRUE;
+	g_thread_create ((GThreadFunc) poll_directories_thread, data, FALSE, NULL);
+	return TRUE;
+}
+
+/* called with the monitor mutex held */
+static void
+add_polled_directory (RhythmDB *db, GFile *directory)
+{
+	RhythmDBPolledDir *polled;
+	GTimeVal now;
+
+	if (g_hash_table_lookup (db->priv->polled_directories, directory) != NULL)
+		return;
+
+	/* the modification time is read on the first poll, so we don't
+	 * need to stat all the directories while scanning the library.
+	 */
+	g_get_current_time (&now);
+	polled = g_new0 (RhythmDBPolledDir, 1);
+	polled->added = now.tv_sec;
+	g_hash_table_insert (db->priv->polled_directories,
+			     g_object_ref (directory),
+			     polled);
+	if (db->priv->poll_id == 0) {
+		db->priv->poll_id = g_timeout_add_seconds (RHYTHMDB_POLL_INTERVAL,
+							   (GSourceFunc) poll_directories_cb,
+							   db);
+	}
 }
 
 static void
@@ -138,6 +584,15 @@ actually_add_monitor (RhythmDB *db, GFile *directory, GError **error)
 		return;
 	}
 
+	/* once we've used up our share of file monitors, check
+	 * the remaining directories for changes every so often.
+	 */
+	if (g_hash_table_size (db->priv->monitored_directories) >= db->priv->monitor_budget) {
+		add_polled_directory (db, directory);
+		g_mutex_unlock (db->priv->monitor_mutex);
+		return;
+	}
+
 	monitor = g_file_monitor_directory (directory, G_FILE_MONITOR_SEND_MOVED, db->priv->exiting, error);
 	if (monitor != NULL) {
 		g_signal_connect_object (G_OBJECT (monitor),
@@ -147,11 +602,46 @@ actually_add_monitor (RhythmDB *db, GFile *directory, GError **error)
 		g_hash_table_insert (db->priv->monitored_directories,
 				     g_object_ref (directory),
 				     monitor);
+	} else {
+		add_polled_directory (db, directory);
 	}
 
 	g_mutex_unlock (db->priv->monitor_mutex);
 }
 
+/* when a directory with a file monitor is deleted, the monitor
+ * can be used for one of the polled directories instead.
+ */
+static void
+forget_directory (RhythmDB *db, GFile *directory)
+{
+	GHashTableIter iter;
+	gpointer key;
+	GFile *promote = NULL;
+
+	g_mutex_lock (db->priv->monitor_mutex);
+	g_hash_table_remove (db->priv->polled_directories, directory);
+	if (g_hash_table_remove (db->priv->monitored_directories, directory)) {
+		g_hash_table_iter_init (&iter, db->priv->polled_directories);
+		if (g_hash_table_iter_next (&iter, &key, NULL)) {
+			promote = g_object_ref (key);
+			g_hash_table_iter_remove (&iter);
+		}
+	}
+	g_mutex_unlock (db->priv->monitor_mutex);
+
+	if (promote != NULL) {
+		char *uri;
+
+		uri = g_file_get_uri (promote);
+		rb_debug ("monitoring polled directory %s", uri);
+		g_free (uri);
+
+		actually_add_monitor (db, promote, NULL);
+		g_object_unref (promote);
+	}
+}
+
 static void
 monitor_entry_file (RhythmDBEntry *entry, RhythmDB *db)
 {
@@ -184,13 +674,63 @@ monitor_subdirectory (GFile *file, gboolean dir, RhythmDB *db)
 
 		entry = rhythmdb_entry_lookup_by_location (db, uri);
 		if (entry == NULL) {
+			GFile *parent;
+
 			rhythmdb_add_uri (db, uri);
+
+			/* the file won't be in the saved database until it's
+			 * been loaded, so the directory has to be listed again
+			 * next time.
+			 */
+			parent = g_file_get_parent (file);
+			if (parent != NULL) {
+				char *parent_uri;
+
+				parent_uri = g_file_get_uri (parent);
+				rb_dir_cache_invalidate (db->priv->library_dir_cache, parent_uri);
+				g_free (parent_uri);
+				g_object_unref (parent);
+			}
 		}
 	}
 	g_free (uri);
 	return TRUE;	
 }
 
+static void
+library_scan_done (RhythmDB *db)
+{
+	db->priv->library_scans--;
+	if (db->priv->library_scans == 0) {
+		GError *error = NULL;
+
+		rb_debug ("library scan complete");
+		if (db->priv->dry_run == FALSE &&
+		    rb_dir_cache_save (db->priv->library_dir_cache, &error) == FALSE) {
+			rb_debug ("unable to save library directory cache: %s", error->message);
+			g_clear_error (&error);
+		}
+	}
+	g_object_unref (db);
+}
+
+static RBDirCache *
+get_library_dir_cache (RhythmDB *db)
+{
+	if (db->priv->library_dir_cache == NULL) {
+		char *dir;
+		char *path;
+
+		/* keep it next to the database */
+		dir = g_path_get_dirname (db->priv->name);
+		path = g_build_filename (dir, "library-dirs", NULL);
+		db->priv->library_dir_cache = rb_dir_cache_new (path);
+		g_free (path);
+		g_free (dir);
+	}
+	return db->priv->library_dir_cache;
+}
+
 static void
 monitor_library_directory (const char *uri, RhythmDB *db)
 {
@@ -202,46 +742,82 @@ monitor_library_directory (const char *uri, RhythmDB *db)
 
 	rb_debug ("beginning monitor of the library directory %s", uri);
 	rhythmdb_monitor_uri_path (db, uri, NULL);
-	rb_uri_handle_recursively_async (uri,
-					 NULL,
-					 (RBUriRecurseFunc) monitor_subdirectory,
-					 g_object_ref (db),
-					 (GDestroyNotify)g_object_unref);
+
+	/* files in directories that haven't changed since the last scan
+	 * must already be in the database, so we only need to visit the
+	 * directories to set up monitors.
+	 */
+	db->priv->library_scans++;
+	rb_uri_handle_recursively_cached_async (uri,
+						NULL,
+						get_library_dir_cache (db),
+						(RBUriRecurseFunc) monitor_subdirectory,
+						g_object_ref (db),
+						(GDestroyNotify) library_scan_done);
 }
 
-static gboolean
-rhythmdb_check_changed_file (RBRefString *uri, gpointer data, RhythmDB *db)
+/*
+ * Changed files are held in a timer wheel with one slot per second, grouped
+ * by directory.  A file is processed once it has gone at least
+ * RHYTHMDB_FILE_MODIFY_PROCESS_TIME seconds without changing again, and
+ * all the files in a directory that settle at the same time are passed
+ * to the database together.
+ *
+ * no need for a mutex around any of this as it's only accessed from the main
+ * thread.  GFileMonitor's 'changed' signal is emitted from an idle handler,
+ * and we only process the wheel in a timeout callback.
+ */
+static void
+remove_changed_file (RhythmDB *db, RBRefString *uri)
 {
-	GTimeVal time;
-	glong time_sec = GPOINTER_TO_INT (data);
+	RhythmDBChangedFile *changed;
+	GHashTable *files;
 
-	g_get_current_time (&time);
-	if (time.tv_sec >= time_sec + RHYTHMDB_FILE_MODIFY_PROCESS_TIME) {
-		rb_debug ("adding newly located file %s", rb_refstring_get (uri));
-		rhythmdb_add_uri (db, rb_refstring_get (uri));
-		return TRUE;
+	changed = g_hash_table_lookup (db->priv->changed_files, uri);
+	if (changed == NULL)
+		return;
+
+	files = g_hash_table_lookup (db->priv->changed_wheel[changed->slot], changed->dir);
+	if (files != NULL) {
+		g_hash_table_remove (files, uri);
+		if (g_hash_table_size (files) == 0) {
+			g_hash_table_remove (db->priv->changed_wheel[changed->slot], changed->dir);
+		}
 	}
+	g_hash_table_remove (db->priv->changed_files, uri);
+}
+
+static void
+process_changed_directory (RBRefString *dir, GHashTable *files, RhythmDB *db)
+{
+	GList *uris;
+	GList *l;
 
-	rb_debug ("waiting to add newly located file %s", rb_refstring_get (uri));
+	uris = g_hash_table_get_keys (files);
+	rb_debug ("adding %d changed files in %s", g_list_length (uris), rb_refstring_get (dir));
+	for (l = uris; l != NULL; l = l->next) {
+		g_hash_table_remove (db->priv->changed_files, l->data);
+	}
 
-	return FALSE;
+	rhythmdb_add_uri_list (db, uris);
+	g_list_free (uris);
 }
 
 static gboolean
 rhythmdb_process_changed_files (RhythmDB *db)
 {
-	/*
-	 * no need for a mutex around the changed files map as it's only accessed
-	 * from the main thread.  GFileMonitor's 'changed' signal is emitted from an
-	 * idle handler, and we only process the map in a timeout callback.
-	 */
+	GHashTable *slot;
+
+	db->priv->changed_wheel_pos = (db->priv->changed_wheel_pos + 1) % RHYTHMDB_CHANGE_WHEEL_SIZE;
+	slot = db->priv->changed_wheel[db->priv->changed_wheel_pos];
+
+	g_hash_table_foreach (slot, (GHFunc) process_changed_directory, db);
+	g_hash_table_remove_all (slot);
+
 	if (g_hash_table_size (db->priv->changed_files) == 0) {
 		db->priv->changed_files_id = 0;
 		return FALSE;
 	}
-
-	g_hash_table_foreach_remove (db->priv->changed_files,
-				     (GHRFunc)rhythmdb_check_changed_file, db);
 	return TRUE;
 }
 
@@ -270,17 +846,43 @@ rhythmdb_start_monitoring (RhythmDB *db)
 static void
 add_changed_file (RhythmDB *db, const char *uri)
 {
-	GTimeVal time;
+	RhythmDBChangedFile *changed;
+	RBRefString *ref;
+	GHashTable *files;
+	const char *slash;
+	char *dir;
+
+	/* repeated changes to the same file just push it back */
+	ref = rb_refstring_new (uri);
+	remove_changed_file (db, ref);
+
+	slash = strrchr (uri, '/');
+	if (slash != NULL) {
+		dir = g_strndup (uri, slash - uri);
+	} else {
+		dir = g_strdup (uri);
+	}
+
+	changed = g_new0 (RhythmDBChangedFile, 1);
+	changed->dir = rb_refstring_new (dir);
+	changed->slot = (db->priv->changed_wheel_pos + RHYTHMDB_FILE_MODIFY_PROCESS_TIME + 1) % RHYTHMDB_CHANGE_WHEEL_SIZE;
+	g_free (dir);
+
+	files = g_hash_table_lookup (db->priv->changed_wheel[changed->slot], changed->dir);
+	if (files == NULL) {
+		files = g_hash_table_new_full (rb_refstring_hash, rb_refstring_equal,
+					       (GDestroyNotify) rb_refstring_unref,
+					       NULL);
+		g_hash_table_insert (db->priv->changed_wheel[changed->slot],
+				     rb_refstring_ref (changed->dir),
+				     files);
+	}
+	g_hash_table_insert (files, rb_refstring_ref (ref), GINT_TO_POINTER (1));
+	g_hash_table_insert (db->priv->changed_files, ref, changed);
 
-	g_get_current_time (&time);
-	g_hash_table_replace (db->priv->changed_files,
-			      rb_refstring_new (uri),
-			      GINT_TO_POINTER (time.tv_sec));
 	if (db->priv->changed_files_id == 0) {
 		db->priv->changed_files_id =
-			g_timeout_add_seconds (RHYTHMDB_FILE_MODIFY_PROCESS_TIME,
-					       (GSourceFunc) rhythmdb_process_changed_files,
-					       db);
+			g_timeout_add_seconds (1, (GSourceFunc) rhythmdb_process_changed_files, db);
 	}
 }
 
@@ -344,9 +946,11 @@ rhythmdb_directory_change_cb (GFileMonitor *monitor,
 		/* hmm.. */
 		break;
 	case G_FILE_MONITOR_EVENT_DELETED:
+		forget_directory (db, file);
+
 		entry = rhythmdb_entry_lookup_by_location (db, canon_uri);
 		if (entry != NULL) {
-			g_hash_table_remove (db->priv->changed_files, entry->location);
+			remove_changed_file (db, entry->location);
 			rhythmdb_entry_set_visibility (db, entry, FALSE);
 			rhythmdb_commit (db);
 		}
@@ -362,7 +966,7 @@ rhythmdb_directory_change_cb (GFileMonitor *monitor,
 			rb_debug ("file move target %s already exists in database", other_canon_uri);
 			entry = rhythmdb_entry_lookup_by_location (db, canon_uri);
 			if (entry != NULL) {
-				g_hash_table_remove (db->priv->changed_files, entry->location);
+				remove_changed_file (db, entry->location);
 				rhythmdb_entry_set_visibility (db, entry, FALSE);
 				rhythmdb_commit (db);
 			}
@@ -31,6 +31,7 @@
 #include <rhythmdb/rhythmdb.h>
 #include <rhythmdb/rb-refstring.h>
 #include <metadata/rb-metadata.h>
+#include <lib/rb-dir-cache.h>
 
 G_BEGIN_DECLS
 
@@ -42,6 +43,11 @@ typedef struct {
 	RBRefString *description;
 	RBRefString *subtitle;
 	RBRefString *summary;
+	/* long descriptions and summaries are kept in a text store until
+	 * they're needed; these are their keys, or 0 if they're in memory.
+	 */
+	guint64 description_key;
+	guint64 summary_key;
 	RBRefString *lang;
 	RBRefString *copyright;
 	RBRefString *image;
@@ -59,6 +65,7 @@ enum {
 	RHYTHMDB_ENTRY_LAST_PLAYED_DIRTY = 4,
 	RHYTHMDB_ENTRY_FIRST_SEEN_DIRTY = 8,
 	RHYTHMDB_ENTRY_LAST_SEEN_DIRTY = 16,
+	RHYTHMDB_ENTRY_PENDING = 32,
 
 	/* the backend can use the top 16 bits for private flags */
 	RHYTHMDB_ENTRY_PRIVATE_FLAG_BASE = 65536,
@@ -116,6 +123,30 @@ struct _RhythmDBEntry {
 	RBRefString *playback_error;
 };
 
+#define RHYTHMDB_LATENCY_BUCKETS	16
+
+typedef struct {
+	guint64 count;
+	guint64 total;
+	guint64 max;
+	guint64 buckets[RHYTHMDB_LATENCY_BUCKETS];
+} RhythmDBLatency;
+
+/* the event latencies are in the same order as the event types */
+typedef enum {
+	RHYTHMDB_LATENCY_EVENT_STAT,
+	RHYTHMDB_LATENCY_EVENT_METADATA_LOAD,
+	RHYTHMDB_LATENCY_EVENT_DB_LOAD,
+	RHYTHMDB_LATENCY_EVENT_THREAD_EXITED,
+	RHYTHMDB_LATENCY_EVENT_DB_SAVED,
+	RHYTHMDB_LATENCY_EVENT_QUERY_COMPLETE,
+	RHYTHMDB_LATENCY_EVENT_ENTRY_SET,
+	RHYTHMDB_LATENCY_COMMIT,
+	RHYTHMDB_LATENCY_EMIT_SIGNALS,
+	RHYTHMDB_LATENCY_QUERY,
+	RHYTHMDB_NUM_LATENCIES
+} RhythmDBLatencyType;
+
 struct _RhythmDBPrivate
 {
 	char *name;
@@ -144,12 +175,29 @@ struct _RhythmDBPrivate
 	int stat_thread_count;
 	int stat_thread_done;
 
+	GMutex *sync_mutex;
+	GCond *sync_cond;
+	GQueue *sync_queue;
+	GQueue *sync_urgent_queue;
+	GHashTable *sync_pending;
+	int sync_count;
+	int sync_done;
+	GTimer *sync_timer;
+
 	GVolumeMonitor *volume_monitor;
 	GHashTable *monitored_directories;
+	GHashTable *polled_directories;
+	guint monitor_budget;
+	guint poll_id;
+	gboolean polling;
 	GHashTable *changed_files;
+	GHashTable **changed_wheel;
+	guint changed_wheel_pos;
 	guint changed_files_id;
 	char **library_locations;
 	GMutex *monitor_mutex;
+	RBDirCache *library_dir_cache;
+	int library_scans;
 
 	gboolean dry_run;
 	gboolean no_update;
@@ -190,6 +238,18 @@ struct _RhythmDBPrivate
 	GSettings *settings;
 
 	guint dbus_object_id;
+	GList *dbus_queries;
+	guint dbus_query_serial;
+
+	GMutex *metrics_mutex;
+	RhythmDBLatency latency[RHYTHMDB_NUM_LATENCIES];
+	guint64 entries_added_emitted;
+	guint64 entries_changed_emitted;
+	guint64 entries_deleted_emitted;
+
+	GHashTable *query_predicates;
+	RhythmDBEntry *query_eval_entry;
+	gint query_eval_serial;
 };
 
 typedef struct
@@ -232,7 +292,10 @@ void rhythmdb_entry_set_internal (RhythmDB *db, RhythmDBEntry *entry,
 				  gboolean notify_if_inserted, guint propid,
 				  const GValue *value);
 void rhythmdb_entry_type_foreach (RhythmDB *db, GHFunc func, gpointer data);
+void rhythmdb_add_uri_list (RhythmDB *db, GList *uris);
 RhythmDBEntry *	rhythmdb_entry_lookup_by_location_refstring (RhythmDB *db, RBRefString *uri);
+char *rhythmdb_entry_dup_podcast_text (RhythmDBEntry *entry, RhythmDBPropType propid);
+void rhythmdb_entry_free_podcast_text (RhythmDBEntry *entry);
 
 /* from rhythmdb-monitor.c */
 void rhythmdb_init_monitoring (RhythmDB *db);
@@ -246,10 +309,18 @@ GList *rhythmdb_get_active_mounts (RhythmDB *db);
 /* from rhythmdb-query.c */
 GPtrArray *rhythmdb_query_parse_valist (RhythmDB *db, va_list args);
 void       rhythmdb_read_encoded_property (RhythmDB *db, const char *data, RhythmDBPropType propid, GValue *val);
+void       rhythmdb_query_cache_begin_entry (RhythmDB *db, RhythmDBEntry *entry);
+void       rhythmdb_query_cache_end_entry (RhythmDB *db);
+void       rhythmdb_query_cache_invalidate (RhythmDB *db);
 
 /* from rhythmdb-song-entry-types.c */
 void       rhythmdb_register_song_entry_types (RhythmDB *db);
 
+/* from rhythmdb-metrics.c */
+gint64 rhythmdb_metrics_time (void);
+void rhythmdb_record_latency (RhythmDB *db, RhythmDBLatencyType type, gint64 start);
+void rhythmdb_count_emitted (RhythmDB *db, guint added, guint changed, guint deleted);
+
 /* from rhythmdb-dbus.c */
 void rhythmdb_dbus_register (RhythmDB *db);
 void rhythmdb_dbus_unregister (RhythmDB *db);
@@ -79,8 +79,13 @@ static void rhythmdb_query_model_get_property (GObject *object,
 static void rhythmdb_query_model_do_insert (RhythmDBQueryModel *model,
 					    RhythmDBEntry *entry,
 					    gint index);
+static gboolean rhythmdb_query_model_insert_entry (RhythmDBQueryModel *model,
+						   RhythmDBEntry *entry,
+						   gint index);
 static void rhythmdb_query_model_entry_added_cb (RhythmDB *db, RhythmDBEntry *entry,
 						 RhythmDBQueryModel *model);
+static void rhythmdb_query_model_entries_added_cb (RhythmDB *db, GPtrArray *entries,
+						   RhythmDBQueryModel *model);
 static void rhythmdb_query_model_entry_changed_cb (RhythmDB *db, RhythmDBEntry *entry,
 						   GValueArray *changes, RhythmDBQueryModel *model);
 static void rhythmdb_query_model_entry_deleted_cb (RhythmDB *db, RhythmDBEntry *entry,
@@ -171,6 +176,7 @@ static int rhythmdb_query_model_child_index_to_base_index (RhythmDBQueryModel *m
 static gint _reverse_sorting_func (gpointer a, gpointer b, struct ReverseSortData *model);
 static gboolean rhythmdb_query_model_within_limit (RhythmDBQueryModel *model,
 						   RhythmDBEntry *entry);
+static void rhythmdb_query_model_update_limited_entries (RhythmDBQueryModel *model);
 static gboolean rhythmdb_query_model_reapply_query_cb (RhythmDBQueryModel *model);
 
 struct RhythmDBQueryModelUpdate
@@ -220,6 +226,7 @@ struct _RhythmDBQueryModelPrivate
 
 	GPtrArray *query;
 	GPtrArray *original_query;
+	RhythmDBQuerySubscription *subscription;
 
 	guint stamp;
 
@@ -241,6 +248,9 @@ struct _RhythmDBQueryModelPrivate
 	gboolean show_hidden;
 
 	gint query_reapply_timeout_id;
+
+	gboolean hibernating;
+	gboolean requery_needed;
 };
 
 #define RHYTHMDB_QUERY_MODEL_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), RHYTHMDB_TYPE_QUERY_MODEL, RhythmDBQueryModelPrivate))
@@ -552,11 +562,18 @@ rhythmdb_query_model_set_query_internal (RhythmDBQueryModel *model,
 
 	rhythmdb_query_free (model->priv->query);
 	rhythmdb_query_free (model->priv->original_query);
+	rhythmdb_query_unsubscribe (model->priv->subscription);
+	model->priv->subscription = NULL;
 
 	model->priv->query = rhythmdb_query_copy (query);
 	model->priv->original_query = rhythmdb_query_copy (model->priv->query);
 	rhythmdb_query_preprocess (model->priv->db, model->priv->query);
 
+	/* share evaluation of the query's criteria with other query models */
+	if (model->priv->query != NULL) {
+		model->priv->subscription = rhythmdb_query_subscribe (model->priv->db, model->priv->query);
+	}
+
 	/* if the query contains time-relative criteria, re-run it periodically.
 	 * currently it's just every minute, but perhaps it could be smarter.
 	 */
@@ -702,8 +719,8 @@ rhythmdb_query_model_constructed (GObject *object)
 	model = RHYTHMDB_QUERY_MODEL (object);
 
 	g_signal_connect_object (G_OBJECT (model->priv->db),
-				 "entry_added",
-				 G_CALLBACK (rhythmdb_query_model_entry_added_cb),
+				 "entries_added",
+				 G_CALLBACK (rhythmdb_query_model_entries_added_cb),
 				 model, 0);
 	g_signal_connect_object (G_OBJECT (model->priv->db),
 				 "entry_changed",
@@ -789,6 +806,7 @@ rhythmdb_query_model_finalize (GObject *object)
 		rhythmdb_query_free (model->priv->query);
 	if (model->priv->original_query)
 		rhythmdb_query_free (model->priv->original_query);
+	rhythmdb_query_unsubscribe (model->priv->subscription);
 
 	if (model->priv->sort_data_destroy && model->priv->sort_data)
 		model->priv->sort_data_destroy (model->priv->sort_data);
@@ -982,38 +1000,105 @@ rhythmdb_query_model_has_pending_changes (RhythmDBQueryModel *model)
 	return result;
 }
 
-static void
-rhythmdb_query_model_entry_added_cb (RhythmDB *db,
-				     RhythmDBEntry *entry,
-				     RhythmDBQueryModel *model)
+static gboolean
+rhythmdb_query_model_check_added_entry (RhythmDBQueryModel *model,
+					RhythmDBEntry *entry,
+					int *index)
 {
-	int index = -1;
 	gboolean insert = FALSE;
+
+	*index = -1;
 	if (!model->priv->show_hidden && rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN)) {
-		return;
+		return FALSE;
 	}
 
 	/* check if it's in the base model */
 	if (model->priv->base_model) {
 	       if (g_hash_table_lookup (model->priv->base_model->priv->reverse_map, entry) == NULL) {
-		       return;
+		       return FALSE;
 	       }
 	}
 
 	if (model->priv->query != NULL) {
-		insert = rhythmdb_evaluate_query (db, model->priv->query, entry);
+		if (model->priv->hibernating) {
+			/* find it when the model wakes up */
+			model->priv->requery_needed = TRUE;
+			return FALSE;
+		}
+		insert = rhythmdb_query_subscription_evaluate (model->priv->subscription, entry);
 	} else {
-		index = GPOINTER_TO_INT (g_hash_table_lookup (model->priv->hidden_entry_map, entry));
+		*index = GPOINTER_TO_INT (g_hash_table_lookup (model->priv->hidden_entry_map, entry));
 		insert = g_hash_table_remove (model->priv->hidden_entry_map, entry);
 		if (insert)
-			rb_debug ("adding unhidden entry at index %d", index);
+			rb_debug ("adding unhidden entry at index %d", *index);
 	}
 
-	if (insert) {
+	return insert;
+}
+
+static void
+rhythmdb_query_model_entry_added_cb (RhythmDB *db,
+				     RhythmDBEntry *entry,
+				     RhythmDBQueryModel *model)
+{
+	int index;
+
+	if (rhythmdb_query_model_check_added_entry (model, entry, &index)) {
 		rhythmdb_query_model_do_insert (model, entry, index);
 	}
 }
 
+static void
+rhythmdb_query_model_entries_added_cb (RhythmDB *db,
+				       GPtrArray *entries,
+				       RhythmDBQueryModel *model)
+{
+	gboolean inserted = FALSE;
+	guint i;
+
+	/* insert all the matching entries, then apply the limits once */
+	for (i = 0; i < entries->len; i++) {
+		RhythmDBEntry *entry = g_ptr_array_index (entries, i);
+		int index;
+
+		if (rhythmdb_query_model_check_added_entry (model, entry, &index)) {
+			inserted |= rhythmdb_query_model_insert_entry (model, entry, index);
+		}
+	}
+
+	if (inserted)
+		rhythmdb_query_model_update_limited_entries (model);
+}
+
+static gboolean
+rhythmdb_query_model_entry_may_match (RhythmDBQueryModel *model,
+				      RhythmDBEntry *entry,
+				      GValueArray *changes)
+{
+	int i;
+
+	/* an entry that didn't match the query before the change can only
+	 * match it now if the change affects one of the query's criteria.
+	 * entries that were limited out or excluded by the base model
+	 * can come back for other reasons.
+	 */
+	if (model->priv->query == NULL ||
+	    model->priv->base_model != NULL ||
+	    g_hash_table_lookup (model->priv->limited_reverse_map, entry) != NULL) {
+		return TRUE;
+	}
+
+	for (i = 0; i < changes->n_values; i++) {
+		GValue *v = g_value_array_get_nth (changes, i);
+		RhythmDBEntryChange *change = g_value_get_boxed (v);
+
+		if (change->prop == RHYTHMDB_PROP_HIDDEN)
+			return TRUE;
+	}
+
+	return rhythmdb_query_subscription_affected (model->priv->subscription, changes);
+}
+
 static void
 rhythmdb_query_model_entry_changed_cb (RhythmDB *db,
 				       RhythmDBEntry *entry,
@@ -1026,7 +1111,8 @@ rhythmdb_query_model_entry_changed_cb (RhythmDB *db,
 	hidden = (!model->priv->show_hidden && rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN));
 
 	if (g_hash_table_lookup (model->priv->reverse_map, entry) == NULL) {
-		if (hidden == FALSE) {
+		if (hidden == FALSE &&
+		    rhythmdb_query_model_entry_may_match (model, entry, changes)) {
 			/* the changed entry may now satisfy the query
 			 * so we test it */
 			rhythmdb_query_model_entry_added_cb (db, entry, model);
@@ -1109,7 +1195,7 @@ rhythmdb_query_model_entry_changed_cb (RhythmDB *db,
 	}
 
 	if (model->priv->query &&
-	    !rhythmdb_evaluate_query (db, model->priv->query, entry)) {
+	    !rhythmdb_query_subscription_evaluate (model->priv->subscription, entry)) {
 		rhythmdb_query_model_filter_out_entry (model, entry);
 		return;
 	}
@@ -1600,10 +1686,11 @@ rhythmdb_query_model_do_reorder (RhythmDBQueryModel *model,
 	return rhythmdb_query_model_emit_reorder (model, old_pos, new_pos);
 }
 
-static void
-rhythmdb_query_model_do_insert (RhythmDBQueryModel *model,
-				RhythmDBEntry *entry,
-				gint index)
+/* inserts an entry without applying the model's limits; returns FALSE if it was already there */
+static gboolean
+rhythmdb_query_model_insert_entry (RhythmDBQueryModel *model,
+				   RhythmDBEntry *entry,
+				   gint index)
 {
 	GSequenceIter *ptr;
 	GtkTreePath *path;
@@ -1613,7 +1700,7 @@ rhythmdb_query_model_do_insert (RhythmDBQueryModel *model,
 
 	/* we check again if the entry already exists in the hash table */
 	if (g_hash_table_lookup (model->priv->reverse_map, entry) != NULL)
-		return;
+		return FALSE;
 
 	/* take temporary ref */
 	rhythmdb_entry_ref (entry);
@@ -1637,8 +1724,16 @@ rhythmdb_query_model_do_insert (RhythmDBQueryModel *model,
 	gtk_tree_model_row_inserted (GTK_TREE_MODEL (model),
 				     path, &iter);
 	gtk_tree_path_free (path);
+	return TRUE;
+}
 
-	rhythmdb_query_model_update_limited_entries (model);
+static void
+rhythmdb_query_model_do_insert (RhythmDBQueryModel *model,
+				RhythmDBEntry *entry,
+				gint index)
+{
+	if (rhythmdb_query_model_insert_entry (model, entry, index))
+		rhythmdb_query_model_update_limited_entries (model);
 }
 
 static void
@@ -2659,7 +2754,7 @@ rhythmdb_query_model_base_row_inserted (GtkTreeModel *tree_model,
 	if (!model->priv->show_hidden && rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN))
 		goto out;
 
-	if (rhythmdb_evaluate_query (model->priv->db, model->priv->query, entry)) {
+	if (rhythmdb_query_subscription_evaluate (model->priv->subscription, entry)) {
 		/* find the closest previous entry that is in the filter model, and it it after that */
 		prev_entry = rhythmdb_query_model_get_previous_from_entry (base_model, entry);
 		while (prev_entry && g_hash_table_lookup (model->priv->reverse_map, prev_entry) == NULL) {
@@ -2835,6 +2930,40 @@ rhythmdb_query_model_reapply_query (RhythmDBQueryModel *model,
 		rhythmdb_query_model_update_limited_entries (model);
 }
 
+/**
+ * rhythmdb_query_model_hibernate:
+ * @model: a #RhythmDBQueryModel
+ * @hibernate: whether the model should hibernate
+ *
+ * Puts the model to sleep while nothing is looking at it, or wakes it up.
+ * While hibernating, entries that are not in the model are not checked
+ * against the query when they are added or changed, which is most of the
+ * work done by a query model on database changes.  Entries already in the
+ * model are still updated.  When the model wakes up, the query is run again
+ * before this returns if anything may have been missed, so the model's
+ * contents are complete as soon as it is awake.
+ *
+ * This has no effect on models without a query.
+ */
+void
+rhythmdb_query_model_hibernate (RhythmDBQueryModel *model, gboolean hibernate)
+{
+	if (model->priv->hibernating == hibernate)
+		return;
+
+	model->priv->hibernating = hibernate;
+	if (hibernate == FALSE && model->priv->requery_needed) {
+		rb_debug ("query model %p waking up, running query again", model);
+		model->priv->requery_needed = FALSE;
+		rhythmdb_query_model_reapply_query (model, FALSE);
+
+		/* whatever woke the model up is probably about to read it */
+		rhythmdb_do_full_query_parsed (model->priv->db,
+					       RHYTHMDB_QUERY_RESULTS (model),
+					       model->priv->original_query);
+	}
+}
+
 static gint
 _reverse_sorting_func (gpointer a,
 		       gpointer b,
@@ -3350,10 +3479,14 @@ static gboolean
 rhythmdb_query_model_reapply_query_cb (RhythmDBQueryModel *model)
 {
 	GDK_THREADS_ENTER ();
-	rhythmdb_query_model_reapply_query (model, FALSE);
-	rhythmdb_do_full_query_async_parsed (model->priv->db,
-					     RHYTHMDB_QUERY_RESULTS (model),
-					     model->priv->original_query);
+	if (model->priv->hibernating) {
+		model->priv->requery_needed = TRUE;
+	} else {
+		rhythmdb_query_model_reapply_query (model, FALSE);
+		rhythmdb_do_full_query_async_parsed (model->priv->db,
+						     RHYTHMDB_QUERY_RESULTS (model),
+						     model->priv->original_query);
+	}
 	GDK_THREADS_LEAVE ();
 	return TRUE;
 }
@@ -1042,6 +1042,400 @@ rhythmdb_query_to_string (RhythmDB *db, GPtrArray *query)
 	return g_string_free (buf, FALSE);
 }
 
+/*
+ * query subscriptions
+ *
+ * Query models re-evaluate their queries for every entry change signal.
+ * Many queries share criteria (entry type, genre, rating and so on), so
+ * rather than evaluating each query separately, subscribed queries are
+ * broken down into single criteria that are shared between all
+ * subscriptions.  While an entry's change or add signal is being emitted,
+ * the result of each shared criterion is cached, so it is only evaluated
+ * once for all the query models that look at the entry.
+ */
+
+typedef struct {
+	char *key;
+	guint refcount;
+	RhythmDBQuery *query;
+	gint serial;
+	gboolean result;
+} RhythmDBQueryPredicate;
+
+typedef struct {
+	RhythmDBQueryPredicate *predicate;
+	RhythmDBQuerySubscription *subquery;
+} RhythmDBQueryTerm;
+
+struct _RhythmDBQuerySubscription {
+	RhythmDB *db;
+	GPtrArray *disjuncts;
+	gboolean all_props;
+	guint8 props[RHYTHMDB_NUM_PROPERTIES];
+};
+
+static char *
+predicate_key (RhythmDBQueryData *data)
+{
+	GType type;
+	char *value;
+	char *key;
+
+	type = G_VALUE_TYPE (data->val);
+	if (type == G_TYPE_STRV) {
+		char **words = g_value_get_boxed (data->val);
+		value = words ? g_strjoinv ("\x1f", words) : g_strdup ("");
+	} else if (type == G_TYPE_DOUBLE || type == G_TYPE_FLOAT) {
+		/* printed values can round nearly equal numbers to the same
+		 * string, so use the exact bits instead.
+		 */
+		union {
+			gdouble d;
+			guint64 bits;
+		} number;
+
+		if (type == G_TYPE_DOUBLE)
+			number.d = g_value_get_double (data->val);
+		else
+			number.d = g_value_get_float (data->val);
+		value = g_strdup_printf ("%s %" G_GINT64_MODIFIER "x", g_type_name (type), number.bits);
+	} else if (G_TYPE_IS_OBJECT (type) || (G_TYPE_IS_FUNDAMENTAL (type) && type != G_TYPE_POINTER)) {
+		/* for objects, this includes the address of the object,
+		 * which can't be reused while the predicate holds a reference.
+		 */
+		value = g_strdup_value_contents (data->val);
+	} else {
+		/* pointers and other boxed values can't be compared, so don't share them */
+		return NULL;
+	}
+
+	key = g_strdup_printf ("%u:%u:%s", data->type, data->propid, value);
+	g_free (value);
+	return key;
+}
+
+static RhythmDBQueryPredicate *
+predicate_get (RhythmDB *db, RhythmDBQueryData *data)
+{
+	RhythmDBQueryPredicate *predicate;
+	RhythmDBQueryData *copy;
+	char *key;
+
+	key = predicate_key (data);
+	if (key != NULL) {
+		predicate = g_hash_table_lookup (db->priv->query_predicates, key);
+		if (predicate != NULL) {
+			predicate->refcount++;
+			g_free (key);
+			return predicate;
+		}
+	}
+
+	predicate = g_new0 (RhythmDBQueryPredicate, 1);
+	predicate->key = key;
+	predicate->refcount = 1;
+	copy = g_new0 (RhythmDBQueryData, 1);
+	copy->type = data->type;
+	copy->propid = data->propid;
+	copy->val = g_new0 (GValue, 1);
+	g_value_init (copy->val, G_VALUE_TYPE (data->val));
+	g_value_copy (data->val, copy->val);
+
+	predicate->query = g_ptr_array_sized_new (1);
+	g_ptr_array_add (predicate->query, copy);
+	if (key != NULL) {
+		g_hash_table_insert (db->priv->query_predicates, key, predicate);
+	}
+	return predicate;
+}
+
+static void
+predicate_unref (RhythmDB *db, RhythmDBQueryPredicate *predicate)
+{
+	if (--predicate->refcount > 0)
+		return;
+
+	if (predicate->key != NULL) {
+		g_hash_table_remove (db->priv->query_predicates, predicate->key);
+		g_free (predicate->key);
+	}
+	rhythmdb_query_free (predicate->query);
+	g_free (predicate);
+}
+
+static gboolean
+predicate_evaluate (RhythmDB *db, RhythmDBQueryPredicate *predicate, RhythmDBEntry *entry)
+{
+	gint serial;
+
+	/* results are only cached while signals for the entry are being emitted */
+	if (entry != db->priv->query_eval_entry) {
+		return rhythmdb_evaluate_query (db, predicate->query, entry);
+	}
+
+	serial = g_atomic_int_get (&db->priv->query_eval_serial);
+	if (predicate->serial != serial) {
+		predicate->result = rhythmdb_evaluate_query (db, predicate->query, entry);
+		predicate->serial = serial;
+	}
+	return predicate->result;
+}
+
+static void
+subscription_add_prop (RhythmDBQuerySubscription *top, RhythmDBPropType propid)
+{
+	/* map derived properties to the properties they're derived from,
+	 * as only those appear in entry changes.
+	 */
+	switch (propid) {
+	case RHYTHMDB_PROP_TITLE_SORT_KEY:
+	case RHYTHMDB_PROP_TITLE_FOLDED:
+		propid = RHYTHMDB_PROP_TITLE;
+		break;
+	case RHYTHMDB_PROP_GENRE_SORT_KEY:
+	case RHYTHMDB_PROP_GENRE_FOLDED:
+		propid = RHYTHMDB_PROP_GENRE;
+		break;
+	case RHYTHMDB_PROP_ARTIST_SORT_KEY:
+	case RHYTHMDB_PROP_ARTIST_FOLDED:
+		propid = RHYTHMDB_PROP_ARTIST;
+		break;
+	case RHYTHMDB_PROP_ALBUM_SORT_KEY:
+	case RHYTHMDB_PROP_ALBUM_FOLDED:
+		propid = RHYTHMDB_PROP_ALBUM;
+		break;
+	case RHYTHMDB_PROP_ARTIST_SORTNAME_SORT_KEY:
+	case RHYTHMDB_PROP_ARTIST_SORTNAME_FOLDED:
+		propid = RHYTHMDB_PROP_ARTIST_SORTNAME;
+		break;
+	case RHYTHMDB_PROP_ALBUM_SORTNAME_SORT_KEY:
+	case RHYTHMDB_PROP_ALBUM_SORTNAME_FOLDED:
+		propid = RHYTHMDB_PROP_ALBUM_SORTNAME;
+		break;
+	case RHYTHMDB_PROP_ALBUM_ARTIST_SORT_KEY:
+	case RHYTHMDB_PROP_ALBUM_ARTIST_FOLDED:
+		propid = RHYTHMDB_PROP_ALBUM_ARTIST;
+		break;
+	case RHYTHMDB_PROP_ALBUM_ARTIST_SORTNAME_SORT_KEY:
+	case RHYTHMDB_PROP_ALBUM_ARTIST_SORTNAME_FOLDED:
+		propid = RHYTHMDB_PROP_ALBUM_ARTIST_SORTNAME;
+		break;
+	case RHYTHMDB_PROP_LAST_PLAYED_STR:
+		propid = RHYTHMDB_PROP_LAST_PLAYED;
+		break;
+	case RHYTHMDB_PROP_FIRST_SEEN_STR:
+		propid = RHYTHMDB_PROP_FIRST_SEEN;
+		break;
+	case RHYTHMDB_PROP_LAST_SEEN_STR:
+		propid = RHYTHMDB_PROP_LAST_SEEN;
+		break;
+	case RHYTHMDB_PROP_YEAR:
+		propid = RHYTHMDB_PROP_DATE;
+		break;
+	case RHYTHMDB_PROP_SEARCH_MATCH:
+	case RHYTHMDB_PROP_KEYWORD:
+		/* depends on several properties, or on things that aren't properties */
+		top->all_props = TRUE;
+		return;
+	default:
+		break;
+	}
+
+	if (propid >= RHYTHMDB_NUM_PROPERTIES) {
+		top->all_props = TRUE;
+	} else {
+		top->props[propid] = TRUE;
+	}
+}
+
+static RhythmDBQuerySubscription *
+subscription_compile (RhythmDB *db, RhythmDBQuery *query, RhythmDBQuerySubscription *top)
+{
+	RhythmDBQuerySubscription *sub;
+	GArray *terms;
+	guint i;
+
+	sub = g_new0 (RhythmDBQuerySubscription, 1);
+	sub->db = db;
+	sub->disjuncts = g_ptr_array_new ();
+	if (top == NULL)
+		top = sub;
+
+	terms = g_array_new (FALSE, FALSE, sizeof (RhythmDBQueryTerm));
+	g_ptr_array_add (sub->disjuncts, terms);
+
+	for (i = 0; i < query->len; i++) {
+		RhythmDBQueryData *data = g_ptr_array_index (query, i);
+		RhythmDBQueryTerm term = {0,};
+
+		switch (data->type) {
+		case RHYTHMDB_QUERY_DISJUNCTION:
+			terms = g_array_new (FALSE, FALSE, sizeof (RhythmDBQueryTerm));
+			g_ptr_array_add (sub->disjuncts, terms);
+			continue;
+		case RHYTHMDB_QUERY_SUBQUERY:
+			term.subquery = subscription_compile (db, data->subquery, top);
+			break;
+		case RHYTHMDB_QUERY_END:
+			g_assert_not_reached ();
+			break;
+		default:
+			term.predicate = predicate_get (db, data);
+			subscription_add_prop (top, data->propid);
+			break;
+		}
+		g_array_append_val (terms, term);
+	}
+
+	return sub;
+}
+
+static gboolean
+subscription_evaluate (RhythmDBQuerySubscription *sub, RhythmDBEntry *entry)
+{
+	guint i;
+	guint j;
+
+	for (i = 0; i < sub->disjuncts->len; i++) {
+		GArray *terms = g_ptr_array_index (sub->disjuncts, i);
+		gboolean match = TRUE;
+
+		for (j = 0; j < terms->len && match; j++) {
+			RhythmDBQueryTerm *term = &g_array_index (terms, RhythmDBQueryTerm, j);
+			if (term->predicate != NULL) {
+				match = predicate_evaluate (sub->db, term->predicate, entry);
+			} else {
+				match = subscription_evaluate (term->subquery, entry);
+			}
+		}
+
+		if (match)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * rhythmdb_query_subscribe:
+ * @db: the #RhythmDB
+ * @query: a preprocessed query
+ *
+ * Registers a query for evaluation against entries as they are added
+ * and changed.  Criteria are shared between all subscribed queries, so
+ * while an entry-added or entry-changed signal is being emitted, each
+ * distinct criterion is only evaluated once for the entry, however many
+ * queries include it.
+ *
+ * This must only be called from the main thread.
+ *
+ * Return value: the query subscription, to be freed with
+ * rhythmdb_query_unsubscribe()
+ */
+RhythmDBQuerySubscription *
+rhythmdb_query_subscribe (RhythmDB *db, RhythmDBQuery *query)
+{
+	g_return_val_if_fail (query != NULL, NULL);
+	return subscription_compile (db, query, NULL);
+}
+
+/**
+ * rhythmdb_query_unsubscribe:
+ * @sub: a #RhythmDBQuerySubscription
+ *
+ * Frees a query subscription, releasing the criteria it includes.
+ */
+void
+rhythmdb_query_unsubscribe (RhythmDBQuerySubscription *sub)
+{
+	guint i;
+	guint j;
+
+	if (sub == NULL)
+		return;
+
+	for (i = 0; i < sub->disjuncts->len; i++) {
+		GArray *terms = g_ptr_array_index (sub->disjuncts, i);
+
+		for (j = 0; j < terms->len; j++) {
+			RhythmDBQueryTerm *term = &g_array_index (terms, RhythmDBQueryTerm, j);
+			if (term->predicate != NULL) {
+				predicate_unref (sub->db, term->predicate);
+			} else {
+				rhythmdb_query_unsubscribe (term->subquery);
+			}
+		}
+		g_array_free (terms, TRUE);
+	}
+	g_ptr_array_free (sub->disjuncts, TRUE);
+	g_free (sub);
+}
+
+/**
+ * rhythmdb_query_subscription_evaluate:
+ * @sub: a #RhythmDBQuerySubscription
+ * @entry: a #RhythmDBEntry
+ *
+ * Evaluates the subscribed query against an entry.  This gives the same
+ * result as rhythmdb_evaluate_query(), but reuses results for criteria
+ * already evaluated by other subscriptions while signals for the entry
+ * are being emitted.
+ *
+ * Return value: %TRUE if the entry matches the query
+ */
+gboolean
+rhythmdb_query_subscription_evaluate (RhythmDBQuerySubscription *sub, RhythmDBEntry *entry)
+{
+	return subscription_evaluate (sub, entry);
+}
+
+/**
+ * rhythmdb_query_subscription_affected:
+ * @sub: a #RhythmDBQuerySubscription
+ * @changes: (element-type RB.RhythmDBEntryChange): a #GValueArray of #RhythmDBEntryChange
+ *   structures, as passed to the entry-changed signal
+ *
+ * Checks whether a set of changes to an entry could change the result
+ * of evaluating the subscribed query for the entry.
+ *
+ * Return value: %TRUE if any of the changed properties are used in the query
+ */
+gboolean
+rhythmdb_query_subscription_affected (RhythmDBQuerySubscription *sub, GValueArray *changes)
+{
+	guint i;
+
+	if (sub->all_props)
+		return TRUE;
+
+	for (i = 0; i < changes->n_values; i++) {
+		GValue *v = g_value_array_get_nth (changes, i);
+		RhythmDBEntryChange *change = g_value_get_boxed (v);
+
+		if (change->prop >= RHYTHMDB_NUM_PROPERTIES || sub->props[change->prop])
+			return TRUE;
+	}
+	return FALSE;
+}
+
+void
+rhythmdb_query_cache_begin_entry (RhythmDB *db, RhythmDBEntry *entry)
+{
+	db->priv->query_eval_entry = entry;
+	g_atomic_int_inc (&db->priv->query_eval_serial);
+}
+
+void
+rhythmdb_query_cache_end_entry (RhythmDB *db)
+{
+	db->priv->query_eval_entry = NULL;
+}
+
+void
+rhythmdb_query_cache_invalidate (RhythmDB *db)
+{
+	g_atomic_int_inc (&db->priv->query_eval_serial);
+}
+
 GType
 rhythmdb_query_get_type (void)
 {
@@ -75,6 +75,7 @@ static gboolean rhythmdb_tree_load (RhythmDB *rdb, GCancellable *cancel, GError
 static void rhythmdb_tree_save (RhythmDB *rdb);
 static void rhythmdb_tree_entry_new (RhythmDB *db, RhythmDBEntry *entry);
 static void rhythmdb_tree_entry_new_internal (RhythmDB *db, RhythmDBEntry *entry);
+static void rhythmdb_tree_entry_new_batch (RhythmDB *db, GList *entries);
 static gboolean rhythmdb_tree_entry_set (RhythmDB *db, RhythmDBEntry *entry,
 					 guint propid, const GValue *value);
 
@@ -163,6 +164,10 @@ typedef struct
 	GList *properties;
 } RhythmDBUnknownEntry;
 
+static void rhythmdb_tree_load_unknown_entry (RhythmDB *db,
+					      RhythmDBEntryType *entry_type,
+					      RhythmDBUnknownEntry *data);
+
 #define RHYTHMDB_TREE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), RHYTHMDB_TYPE_TREE, RhythmDBTreePrivate))
 
 enum
@@ -193,6 +198,7 @@ rhythmdb_tree_class_init (RhythmDBTreeClass *klass)
 	rhythmdb_class->impl_load = rhythmdb_tree_load;
 	rhythmdb_class->impl_save = rhythmdb_tree_save;
 	rhythmdb_class->impl_entry_new = rhythmdb_tree_entry_new;
+	rhythmdb_class->impl_entry_new_batch = rhythmdb_tree_entry_new_batch;
 	rhythmdb_class->impl_entry_set = rhythmdb_tree_entry_set;
 	rhythmdb_class->impl_entry_delete = rhythmdb_tree_entry_delete;
 	rhythmdb_class->impl_entry_delete_by_type = rhythmdb_tree_entry_delete_by_type;
@@ -632,15 +638,30 @@ rhythmdb_tree_parser_end_element (struct RhythmDBTreeLoadContext *ctx,
 	}
 	case RHYTHMDB_TREE_PARSER_STATE_UNKNOWN_ENTRY:
 	{
+		RhythmDBEntryType *type;
 		GList *entry_list;
 
 		rb_debug ("finished reading unknown entry");
 		ctx->unknown_entry->properties = g_list_reverse (ctx->unknown_entry->properties);
 
 		g_mutex_lock (ctx->db->priv->entries_lock);
-		entry_list = g_hash_table_lookup (ctx->db->priv->unknown_entry_types, ctx->unknown_entry->typename);
-		entry_list = g_list_prepend (entry_list, ctx->unknown_entry);
-		g_hash_table_insert (ctx->db->priv->unknown_entry_types, ctx->unknown_entry->typename, entry_list);
+
+		/* the database is loaded while plugins are being activated,
+		 * so the entry type may have been registered since we started
+		 * reading the entry.  rhythmdb_tree_entry_type_registered only
+		 * looks at the unknown entries once, so we have to check again here.
+		 */
+		type = rhythmdb_entry_type_get_by_name (RHYTHMDB (ctx->db), rb_refstring_get (ctx->unknown_entry->typename));
+		if (type != NULL) {
+			rb_debug ("entry type %s registered while reading entry", rb_refstring_get (ctx->unknown_entry->typename));
+			rhythmdb_tree_load_unknown_entry (RHYTHMDB (ctx->db), type, ctx->unknown_entry);
+			rhythmdb_commit (RHYTHMDB (ctx->db));
+			free_unknown_entries (NULL, g_list_prepend (NULL, ctx->unknown_entry), NULL);
+		} else {
+			entry_list = g_hash_table_lookup (ctx->db->priv->unknown_entry_types, ctx->unknown_entry->typename);
+			entry_list = g_list_prepend (entry_list, ctx->unknown_entry);
+			g_hash_table_insert (ctx->db->priv->unknown_entry_types, ctx->unknown_entry->typename, entry_list);
+		}
 		g_mutex_unlock (ctx->db->priv->entries_lock);
 
 		ctx->state = RHYTHMDB_TREE_PARSER_STATE_RHYTHMDB;
@@ -1092,16 +1113,24 @@ save_entry (RhythmDBTree *db,
 				save_entry_ulong (ctx, elt_name, podcast->status, FALSE);
 			break;
 		case RHYTHMDB_PROP_DESCRIPTION:
-			if (podcast && podcast->description)
-				save_entry_string(ctx, elt_name, rb_refstring_get (podcast->description));
+			if (podcast) {
+				char *text = rhythmdb_entry_dup_podcast_text (entry, RHYTHMDB_PROP_DESCRIPTION);
+				if (text != NULL)
+					save_entry_string(ctx, elt_name, text);
+				g_free (text);
+			}
 			break;
 		case RHYTHMDB_PROP_SUBTITLE:
 			if (podcast && podcast->subtitle)
 				save_entry_string(ctx, elt_name, rb_refstring_get (podcast->subtitle));
 			break;
 		case RHYTHMDB_PROP_SUMMARY:
-			if (podcast && podcast->summary)
-				save_entry_string(ctx, elt_name, rb_refstring_get (podcast->summary));
+			if (podcast) {
+				char *text = rhythmdb_entry_dup_podcast_text (entry, RHYTHMDB_PROP_SUMMARY);
+				if (text != NULL)
+					save_entry_string(ctx, elt_name, text);
+				g_free (text);
+			}
 			break;
 		case RHYTHMDB_PROP_LANG:
 			if (podcast && podcast->lang)
@@ -1323,6 +1352,27 @@ rhythmdb_tree_entry_new (RhythmDB *rdb,
 	g_mutex_unlock (RHYTHMDB_TREE(rdb)->priv->entries_lock);
 }
 
+static void
+rhythmdb_tree_entry_new_batch (RhythmDB *rdb,
+			       GList *entries)
+{
+	RhythmDBTree *db = RHYTHMDB_TREE (rdb);
+	GList *l;
+
+	g_mutex_lock (db->priv->entries_lock);
+	for (l = entries; l != NULL; l = l->next) {
+		RhythmDBEntry *entry = l->data;
+
+		/* entries that are already present stay pending */
+		if (g_hash_table_lookup (db->priv->entries, entry->location) != NULL)
+			continue;
+
+		entry->flags &= ~RHYTHMDB_ENTRY_PENDING;
+		rhythmdb_tree_entry_new_internal (rdb, entry);
+	}
+	g_mutex_unlock (db->priv->entries_lock);
+}
+
 /* must be called with the entry lock held */
 static void
 rhythmdb_tree_entry_new_internal (RhythmDB *rdb, RhythmDBEntry *entry)
@@ -1563,11 +1613,11 @@ rhythmdb_tree_entry_set (RhythmDB *adb,
 
 	type = entry->type;
 
-	/* don't process changes to entries we're loading, we'll get them
-	 * when the entry is complete.  don't process changes for entries that
-	 * have been removed either.
+	/* don't process changes to entries we're loading or that are waiting
+	 * to be inserted, we'll get them when the entry is complete.  don't
+	 * process changes for entries that have been removed either.
 	 */
-	if (entry->flags & (RHYTHMDB_ENTRY_TREE_LOADING | RHYTHMDB_ENTRY_TREE_REMOVED))
+	if (entry->flags & (RHYTHMDB_ENTRY_TREE_LOADING | RHYTHMDB_ENTRY_PENDING | RHYTHMDB_ENTRY_TREE_REMOVED))
 		return FALSE;
 
 	/* Handle special properties */
@@ -2714,6 +2764,33 @@ rhythmdb_hash_tree_foreach (RhythmDB *adb,
 	g_mutex_unlock (ctxt.db->priv->genres_lock);
 }
 
+/* called with the entries lock held */
+static void
+rhythmdb_tree_load_unknown_entry (RhythmDB *db,
+				  RhythmDBEntryType *entry_type,
+				  RhythmDBUnknownEntry *data)
+{
+	RhythmDBEntry *entry;
+	GList *p;
+
+	entry = rhythmdb_entry_allocate (db, entry_type);
+	entry->flags |= RHYTHMDB_ENTRY_TREE_LOADING;
+	for (p = data->properties; p != NULL; p = p->next) {
+		RhythmDBUnknownEntryProperty *prop;
+		RhythmDBPropType propid;
+		GValue value = {0,};
+
+		prop = (RhythmDBUnknownEntryProperty *) p->data;
+		propid = rhythmdb_propid_from_nice_elt_name (db, (const xmlChar *) rb_refstring_get (prop->name));
+
+		rhythmdb_read_encoded_property (db, rb_refstring_get (prop->value), propid, &value);
+		rhythmdb_entry_set_internal (db, entry, FALSE, propid, &value);
+		g_value_unset (&value);
+	}
+	rhythmdb_tree_entry_new_internal (db, entry);
+	rhythmdb_entry_insert (db, entry);
+}
+
 static void
 rhythmdb_tree_entry_type_registered (RhythmDB *db,
 				     RhythmDBEntryType *entry_type)
@@ -2744,27 +2821,7 @@ rhythmdb_tree_entry_type_registered (RhythmDB *db,
 	g_free (name);
 
 	for (e = entries; e != NULL; e = e->next) {
-		RhythmDBUnknownEntry *data;
-		RhythmDBEntry *entry;
-		GList *p;
-
-		data = (RhythmDBUnknownEntry *)e->data;
-		entry = rhythmdb_entry_allocate (db, entry_type);
-		entry->flags |= RHYTHMDB_ENTRY_TREE_LOADING;
-		for (p = data->properties; p != NULL; p = p->next) {
-			RhythmDBUnknownEntryProperty *prop;
-			RhythmDBPropType propid;
-			GValue value = {0,};
-
-			prop = (RhythmDBUnknownEntryProperty *) p->data;
-			propid = rhythmdb_propid_from_nice_elt_name (db, (const xmlChar *) rb_refstring_get (prop->name));
-
-			rhythmdb_read_encoded_property (db, rb_refstring_get (prop->value), propid, &value);
-			rhythmdb_entry_set_internal (db, entry, FALSE, propid, &value);
-			g_value_unset (&value);
-		}
-		rhythmdb_tree_entry_new_internal (db, entry);
-		rhythmdb_entry_insert (db, entry);
+		rhythmdb_tree_load_unknown_entry (db, entry_type, (RhythmDBUnknownEntry *)e->data);
 		count++;
 	}
 	rb_debug ("handled %d entries of newly registered type %s", count, name);
@@ -66,6 +66,7 @@
 #include "rb-dialog.h"
 #include "rb-string-value-map.h"
 #include "rb-async-queue-watch.h"
+#include "rb-text-store.h"
 #include "rb-podcast-entry-types.h"
 
 #define PROP_ENTRY(p,t,n) { RHYTHMDB_PROP_ ## p, "RHYTHMDB_PROP_" #p "", t, n }
@@ -225,9 +226,9 @@ typedef struct
 {
 	enum {
 		RHYTHMDB_ACTION_STAT,
+		RHYTHMDB_ACTION_STAT_LIST,
 		RHYTHMDB_ACTION_LOAD,
 		RHYTHMDB_ACTION_ENUM_DIR,
-		RHYTHMDB_ACTION_SYNC,
 		RHYTHMDB_ACTION_QUIT,
 	} type;
 	RBRefString *uri;
@@ -237,12 +238,25 @@ typedef struct
 			RhythmDBEntryType *ignore_type;
 			RhythmDBEntryType *error_type;
 		} types;
-		GSList *changes;
 	} data;
+	GList *uris;		/* STAT_LIST */
 } RhythmDBAction;
 
+/* metadata changes waiting to be written back to a file */
+typedef struct
+{
+	RBRefString *uri;
+	GSList *changes;
+	gboolean interactive;
+} RhythmDBSyncItem;
+
+/* commits changing this many files or fewer are treated as interactive edits */
+#define RHYTHMDB_SYNC_INTERACTIVE_LIMIT	10
+
 static void rhythmdb_dispose (GObject *object);
 static void rhythmdb_finalize (GObject *object);
+static void podcast_text_store_ref (void);
+static void podcast_text_store_unref (void);
 static void rhythmdb_set_property (GObject *object,
 					guint prop_id,
 					const GValue *value,
@@ -258,7 +272,9 @@ static void rhythmdb_thread_create (RhythmDB *db,
 static void rhythmdb_read_enter (RhythmDB *db);
 static void rhythmdb_read_leave (RhythmDB *db);
 static void rhythmdb_process_one_event (RhythmDBEvent *event, RhythmDB *db);
+static void rhythmdb_sync_item_free (RhythmDBSyncItem *item);
 static gpointer action_thread_main (RhythmDB *db);
+static gpointer sync_thread_main (RhythmDB *db);
 static gpointer query_thread_main (RhythmDBQueryThreadData *data);
 static void rhythmdb_entry_set_mount_point (RhythmDB *db,
  					    RhythmDBEntry *entry,
@@ -296,6 +312,7 @@ enum
 enum
 {
 	ENTRY_ADDED,
+	ENTRIES_ADDED,
 	ENTRY_CHANGED,
 	ENTRY_DELETED,
 	ENTRY_KEYWORD_ADDED,
@@ -377,6 +394,26 @@ rhythmdb_class_init (RhythmDBClass *klass)
 			      G_TYPE_NONE,
 			      1, RHYTHMDB_TYPE_ENTRY);
 
+	/**
+	 * RhythmDB::entries-added:
+	 * @db: the #RhythmDB
+	 * @entries: a #GPtrArray containing the newly added #RhythmDBEntry structures
+	 *
+	 * Emitted once for each set of entries added to the database together,
+	 * before #RhythmDB::entry-added is emitted for each of them.  This
+	 * allows handlers that can deal with many entries at once to avoid
+	 * doing it one entry at a time.
+	 */
+	rhythmdb_signals[ENTRIES_ADDED] =
+		g_signal_new ("entries_added",
+			      RHYTHMDB_TYPE,
+			      G_SIGNAL_RUN_LAST,
+			      G_STRUCT_OFFSET (RhythmDBClass, entries_added),
+			      NULL, NULL,
+			      g_cclosure_marshal_VOID__POINTER,
+			      G_TYPE_NONE,
+			      1, G_TYPE_POINTER);
+
 	/**
 	 * RhythmDB::entry-deleted:
 	 * @db: the #RhythmDB
@@ -684,6 +721,9 @@ rhythmdb_init (RhythmDB *db)
 
 	db->priv = RHYTHMDB_GET_PRIVATE (db);
 
+	/* the podcast text store is freed when the last database is finalized */
+	podcast_text_store_ref ();
+
 	db->priv->settings = g_settings_new ("org.gnome.rhythmbox.rhythmdb");
 	g_signal_connect_object (db->priv->settings, "changed", G_CALLBACK (db_settings_changed_cb), db, 0);
 
@@ -712,6 +752,7 @@ rhythmdb_init (RhythmDB *db)
 	g_type_class_unref (prop_class);
 
 	db->priv->propname_map = g_hash_table_new (g_str_hash, g_str_equal);
+	db->priv->query_predicates = g_hash_table_new (g_str_hash, g_str_equal);
 
 	for (i = 0; i < RHYTHMDB_NUM_PROPERTIES; i++) {
 		const xmlChar *name = rhythmdb_nice_elt_name_from_propid (db, i);
@@ -729,6 +770,14 @@ rhythmdb_init (RhythmDB *db)
 
 	db->priv->change_mutex = g_mutex_new ();
 
+	db->priv->metrics_mutex = g_mutex_new ();
+	db->priv->sync_mutex = g_mutex_new ();
+	db->priv->sync_cond = g_cond_new ();
+	db->priv->sync_queue = g_queue_new ();
+	db->priv->sync_urgent_queue = g_queue_new ();
+	db->priv->sync_pending = g_hash_table_new (rb_refstring_hash, rb_refstring_equal);
+	db->priv->sync_timer = g_timer_new ();
+
 	db->priv->changed_entries = g_hash_table_new_full (NULL,
 							   NULL,
 							   (GDestroyNotify) rhythmdb_entry_unref,
@@ -923,6 +972,7 @@ rhythmdb_start_action_thread (RhythmDB *db)
 	g_mutex_lock (db->priv->stat_mutex);
 	db->priv->action_thread_running = TRUE;
 	rhythmdb_thread_create (db, NULL, (GThreadFunc) action_thread_main, db);
+	rhythmdb_thread_create (db, NULL, (GThreadFunc) sync_thread_main, db);
 
 	if (db->priv->stat_list != NULL) {
 		RhythmDBStatThreadData *data;
@@ -945,9 +995,7 @@ rhythmdb_action_free (RhythmDB *db,
 		      RhythmDBAction *action)
 {
 	rb_refstring_unref (action->uri);
-	if (action->type == RHYTHMDB_ACTION_SYNC) {
-		free_entry_changes (action->data.changes);
-	}
+	rb_list_destroy_free (action->uris, (GDestroyNotify) rb_refstring_unref);
 	g_slice_free (RhythmDBAction, action);
 }
 
@@ -1016,6 +1064,11 @@ rhythmdb_shutdown (RhythmDB *db)
 	action->type = RHYTHMDB_ACTION_QUIT;
 	g_async_queue_push (db->priv->action_queue, action);
 
+	/* and the sync thread */
+	g_mutex_lock (db->priv->sync_mutex);
+	g_cond_broadcast (db->priv->sync_cond);
+	g_mutex_unlock (db->priv->sync_mutex);
+
 	g_strfreev (db->priv->library_locations);
 	db->priv->library_locations = NULL;
 
@@ -1127,7 +1180,18 @@ rhythmdb_finalize (GObject *object)
 
 	g_mutex_free (db->priv->change_mutex);
 
+	g_queue_foreach (db->priv->sync_queue, (GFunc) rhythmdb_sync_item_free, NULL);
+	g_queue_free (db->priv->sync_queue);
+	g_queue_foreach (db->priv->sync_urgent_queue, (GFunc) rhythmdb_sync_item_free, NULL);
+	g_queue_free (db->priv->sync_urgent_queue);
+	g_hash_table_destroy (db->priv->sync_pending);
+	g_timer_destroy (db->priv->sync_timer);
+	g_cond_free (db->priv->sync_cond);
+	g_mutex_free (db->priv->sync_mutex);
+	g_mutex_free (db->priv->metrics_mutex);
+
 	g_hash_table_destroy (db->priv->propname_map);
+	g_hash_table_destroy (db->priv->query_predicates);
 
 	g_hash_table_destroy (db->priv->added_entries);
 	g_hash_table_destroy (db->priv->deleted_entries);
@@ -1136,6 +1200,8 @@ rhythmdb_finalize (GObject *object)
 	rb_refstring_unref (db->priv->empty_string);
 	rb_refstring_unref (db->priv->octet_stream_str);
 
+	podcast_text_store_unref ();
+
 	g_hash_table_destroy (db->priv->entry_type_map);
 	g_mutex_free (db->priv->entry_type_map_mutex);
 	g_mutex_free (db->priv->entry_type_mutex);
@@ -1312,6 +1378,10 @@ rhythmdb_emit_entry_signals_idle (RhythmDB *db)
 	GHashTableIter iter;
 	RhythmDBEntry *entry;
 	GSList *entry_changes;
+	guint changed_count = 0;
+	gint64 start;
+
+	start = rhythmdb_metrics_time ();
 
 	/* get lists of entries to emit, reset source id value */
 	g_mutex_lock (db->priv->change_mutex);
@@ -1346,16 +1416,31 @@ rhythmdb_emit_entry_signals_idle (RhythmDB *db)
 				g_value_array_append (emit_changes, &v);
 				g_value_unset (&v);
 			}
+			rhythmdb_query_cache_begin_entry (db, entry);
 			g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_CHANGED], 0, entry, emit_changes);
+			rhythmdb_query_cache_end_entry (db);
 			g_value_array_free (emit_changes);
 			g_hash_table_iter_remove (&iter);
+			changed_count++;
 		}
 	}
 
-	/* emit added entries */
+	/* emit added entries, first as a set and then one at a time */
+	if (added_entries != NULL) {
+		GPtrArray *entries;
+
+		entries = g_ptr_array_sized_new (g_list_length (added_entries));
+		for (l = added_entries; l; l = g_list_next (l)) {
+			g_ptr_array_add (entries, l->data);
+		}
+		g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRIES_ADDED], 0, entries);
+		g_ptr_array_free (entries, TRUE);
+	}
 	for (l = added_entries; l; l = g_list_next (l)) {
 		entry = (RhythmDBEntry *)l->data;
+		rhythmdb_query_cache_begin_entry (db, entry);
 		g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_ADDED], 0, entry);
+		rhythmdb_query_cache_end_entry (db);
 		rhythmdb_entry_unref (entry);
 	}
 
@@ -1368,6 +1453,12 @@ rhythmdb_emit_entry_signals_idle (RhythmDB *db)
 
 	GDK_THREADS_LEAVE ();
 
+	rhythmdb_count_emitted (db,
+				g_list_length (added_entries),
+				changed_count,
+				g_list_length (deleted_entries));
+	rhythmdb_record_latency (db, RHYTHMDB_LATENCY_EMIT_SIGNALS, start);
+
 	if (changed_entries != NULL) {
 		g_hash_table_destroy (changed_entries);
 	}
@@ -1499,10 +1590,87 @@ process_changed_entries_cb (RhythmDBEntry *entry,
 	return TRUE;
 }
 
+static void
+rhythmdb_sync_item_free (RhythmDBSyncItem *item)
+{
+	rb_refstring_unref (item->uri);
+	free_entry_changes (item->changes);
+	g_slice_free (RhythmDBSyncItem, item);
+}
+
+static void
+merge_entry_changes (RhythmDBSyncItem *item, GSList *changes)
+{
+	GSList *t;
+
+	for (t = changes; t; t = t->next) {
+		RhythmDBEntryChange *change = t->data;
+		GSList *e;
+
+		for (e = item->changes; e; e = e->next) {
+			RhythmDBEntryChange *existing = e->data;
+			if (existing->prop == change->prop) {
+				g_value_unset (&existing->new);
+				g_value_init (&existing->new, G_VALUE_TYPE (&change->new));
+				g_value_copy (&change->new, &existing->new);
+				break;
+			}
+		}
+
+		if (e == NULL) {
+			item->changes = g_slist_append (item->changes, rhythmdb_entry_change_copy (change));
+		}
+	}
+}
+
+static void
+queue_entry_sync (RhythmDB *db,
+		  RhythmDBEntry *entry,
+		  GSList *changes,
+		  gboolean interactive)
+{
+	RhythmDBSyncItem *item;
+
+	g_mutex_lock (db->priv->sync_mutex);
+
+	/* if the file is already waiting to be written, merge the new changes in */
+	item = g_hash_table_lookup (db->priv->sync_pending, entry->location);
+	if (item != NULL) {
+		merge_entry_changes (item, changes);
+		if (interactive && item->interactive == FALSE) {
+			g_queue_remove (db->priv->sync_queue, item);
+			g_queue_push_tail (db->priv->sync_urgent_queue, item);
+			item->interactive = TRUE;
+		}
+		g_mutex_unlock (db->priv->sync_mutex);
+		return;
+	}
+
+	item = g_slice_new0 (RhythmDBSyncItem);
+	item->uri = rb_refstring_ref (entry->location);
+	item->changes = copy_entry_changes (changes);
+	item->interactive = interactive;
+	g_hash_table_insert (db->priv->sync_pending, item->uri, item);
+
+	if (interactive) {
+		g_queue_push_tail (db->priv->sync_urgent_queue, item);
+	} else {
+		g_queue_push_tail (db->priv->sync_queue, item);
+	}
+
+	if (db->priv->sync_count == 0) {
+		g_timer_start (db->priv->sync_timer);
+	}
+	db->priv->sync_count++;
+
+	g_cond_signal (db->priv->sync_cond);
+	g_mutex_unlock (db->priv->sync_mutex);
+}
+
 static void
 sync_entry_changed (RhythmDBEntry *entry,
 		    GSList *changes,
-		    RhythmDB *db)
+		    GList **to_sync)
 {
 	GSList *t;
 
@@ -1511,18 +1679,12 @@ sync_entry_changed (RhythmDBEntry *entry,
 		RhythmDBEntryChange *change = t->data;
 
 		if (metadata_field_from_prop (change->prop, &field)) {
-			RhythmDBAction *action;
-
 			if (!rhythmdb_entry_can_sync_metadata (entry)) {
 				g_warning ("trying to sync properties of non-editable file");
 				break;
 			}
 
-			action = g_slice_new0 (RhythmDBAction);
-			action->type = RHYTHMDB_ACTION_SYNC;
-			action->uri = rb_refstring_ref (entry->location);
-			action->data.changes = copy_entry_changes (changes);
-			g_async_queue_push (db->priv->action_queue, action);
+			*to_sync = g_list_prepend (*to_sync, entry);
 			break;
 		}
 	}
@@ -1534,10 +1696,25 @@ rhythmdb_commit_internal (RhythmDB *db,
 			  gboolean sync_changes,
 			  GThread *thread)
 {
+	gint64 start;
+
+	start = rhythmdb_metrics_time ();
 	g_mutex_lock (db->priv->change_mutex);
 
 	if (sync_changes) {
-		g_hash_table_foreach (db->priv->changed_entries, (GHFunc) sync_entry_changed, db);
+		GList *to_sync = NULL;
+		GList *l;
+		gboolean interactive;
+
+		g_hash_table_foreach (db->priv->changed_entries, (GHFunc) sync_entry_changed, &to_sync);
+
+		/* small edits jump ahead of any bulk edits still being written */
+		interactive = (g_list_length (to_sync) <= RHYTHMDB_SYNC_INTERACTIVE_LIMIT);
+		for (l = to_sync; l != NULL; l = l->next) {
+			RhythmDBEntry *entry = l->data;
+			queue_entry_sync (db, entry, g_hash_table_lookup (db->priv->changed_entries, entry), interactive);
+		}
+		g_list_free (to_sync);
 	}
 
 	/* update the sets of entry changed/added/deleted signals to emit */
@@ -1552,6 +1729,8 @@ rhythmdb_commit_internal (RhythmDB *db,
 	}
 
 	g_mutex_unlock (db->priv->change_mutex);
+
+	rhythmdb_record_latency (db, RHYTHMDB_LATENCY_COMMIT, start);
 }
 
 typedef struct {
@@ -1770,6 +1949,109 @@ rhythmdb_entry_new (RhythmDB *db,
 	return ret;
 }
 
+/**
+ * rhythmdb_entry_new_pending:
+ * @db: a #RhythmDB.
+ * @type: type of entry to create
+ * @uri: the location of the entry
+ *
+ * Creates a new entry of type @type and location @uri without adding it
+ * to the database.  The entry's properties can then be set with
+ * rhythmdb_entry_set() without any changes being recorded, and the entry
+ * added to the database along with others using rhythmdb_entry_insert_batch().
+ *
+ * Unlike rhythmdb_entry_new(), this may be called from any thread, so
+ * sources can build entries for a whole device or share before touching
+ * the database.
+ *
+ * Returns: the new #RhythmDBEntry
+ */
+RhythmDBEntry *
+rhythmdb_entry_new_pending (RhythmDB *db,
+			    RhythmDBEntryType *type,
+			    const char *uri)
+{
+	RhythmDBEntry *ret;
+
+	g_return_val_if_fail (uri != NULL, NULL);
+
+	ret = rhythmdb_entry_allocate (db, type);
+	ret->location = rb_refstring_new (uri);
+	ret->flags |= RHYTHMDB_ENTRY_PENDING;
+
+	return ret;
+}
+
+/**
+ * rhythmdb_entry_insert_batch:
+ * @db: a #RhythmDB.
+ * @entries: (element-type RhythmDBEntry): entries created with rhythmdb_entry_new_pending()
+ *
+ * Adds a set of entries created with rhythmdb_entry_new_pending() to the
+ * database, taking the database's locks once for the whole set rather than
+ * once per entry.  Entries with the same location as an existing entry are
+ * not added.
+ *
+ * This takes ownership of the caller's references to the entries, but not
+ * of the list itself.  As with rhythmdb_entry_new(), you must call
+ * rhythmdb_commit() from the same thread at some point after invoking this
+ * function; the entry-added signals for the whole set are then emitted
+ * together.
+ *
+ * Returns: (element-type RhythmDBEntry) (transfer container): the entries
+ * that were added, in the order they were given
+ */
+GList *
+rhythmdb_entry_insert_batch (RhythmDB *db,
+			     GList *entries)
+{
+	RhythmDBClass *klass = RHYTHMDB_GET_CLASS (db);
+	GList *added = NULL;
+	GList *l;
+
+	g_return_val_if_fail (RHYTHMDB_IS (db), NULL);
+
+	if (klass->impl_entry_new_batch != NULL) {
+		klass->impl_entry_new_batch (db, entries);
+	} else {
+		for (l = entries; l != NULL; l = l->next) {
+			RhythmDBEntry *entry = l->data;
+
+			if (klass->impl_lookup_by_location (db, entry->location) != NULL)
+				continue;
+
+			entry->flags &= ~RHYTHMDB_ENTRY_PENDING;
+			klass->impl_entry_new (db, entry);
+		}
+	}
+
+	g_mutex_lock (db->priv->change_mutex);
+	for (l = entries; l != NULL; l = l->next) {
+		RhythmDBEntry *entry = l->data;
+
+		if (entry->flags & RHYTHMDB_ENTRY_PENDING)
+			continue;
+
+		/* ref the entry before adding to hash, it is unreffed when removed */
+		rhythmdb_entry_ref (entry);
+		g_hash_table_insert (db->priv->added_entries, entry, g_thread_self ());
+		added = g_list_prepend (added, entry);
+	}
+	g_mutex_unlock (db->priv->change_mutex);
+
+	for (l = entries; l != NULL; l = l->next) {
+		RhythmDBEntry *entry = l->data;
+
+		if (entry->flags & RHYTHMDB_ENTRY_PENDING) {
+			rb_debug ("not adding entry that already exists: %s", rb_refstring_get (entry->location));
+			rhythmdb_entry_unref (entry);
+		}
+	}
+
+	rb_debug ("added %d of %d entries", g_list_length (added), g_list_length (entries));
+	return g_list_reverse (added);
+}
+
 /**
  * rhythmdb_entry_example_new:
  * @db: a #RhythmDB.
@@ -2482,6 +2764,8 @@ static void
 rhythmdb_process_one_event (RhythmDBEvent *event, RhythmDB *db)
 {
 	gboolean free = TRUE;
+	RhythmDBLatencyType latency;
+	gint64 start;
 
 	/* if the database is read-only, we can't process those events
 	 * since they call rhythmdb_entry_set. Doing it this way
@@ -2498,6 +2782,9 @@ rhythmdb_process_one_event (RhythmDBEvent *event, RhythmDB *db)
 		return;
 	}
 
+	start = rhythmdb_metrics_time ();
+	latency = RHYTHMDB_LATENCY_EVENT_STAT + event->type;
+
 	switch (event->type) {
 	case RHYTHMDB_EVENT_STAT:
 		rb_debug ("processing RHYTHMDB_EVENT_STAT");
@@ -2539,6 +2826,8 @@ rhythmdb_process_one_event (RhythmDBEvent *event, RhythmDB *db)
 	}
 	if (free)
 		rhythmdb_event_free (db, event);
+
+	rhythmdb_record_latency (db, latency, start);
 }
 
 
@@ -2829,6 +3118,179 @@ emit_save_error_idle (RhythmDBSaveErrorData *data)
 	return FALSE;
 }
 
+static void
+rhythmdb_execute_stat_action (RhythmDB *db, RhythmDBAction *action, RBRefString *uri)
+{
+	RhythmDBEvent *result;
+
+	result = g_slice_new0 (RhythmDBEvent);
+	result->db = db;
+	result->type = RHYTHMDB_EVENT_STAT;
+	result->entry_type = action->data.types.entry_type;
+	result->error_type = action->data.types.error_type;
+	result->ignore_type = action->data.types.ignore_type;
+
+	rhythmdb_execute_stat (db, rb_refstring_get (uri), result);
+}
+
+/*
+ * Checks one file from a STAT_LIST action.  New or changed files are
+ * loaded straight away, so they only cost one trip through the main
+ * thread rather than a stat event followed by a separately queued load.
+ */
+static void
+rhythmdb_execute_stat_list_item (RhythmDB *db, RhythmDBAction *action, RBRefString *uri)
+{
+	RhythmDBEvent *result;
+	RhythmDBEntry *entry;
+	GFileInfo *file_info;
+	GFileType file_type;
+	GFile *file;
+	gboolean load = FALSE;
+
+	file = g_file_new_for_uri (rb_refstring_get (uri));
+	file_info = g_file_query_info (file,
+				       RHYTHMDB_FILE_INFO_ATTRIBUTES,
+				       G_FILE_QUERY_INFO_NONE,
+				       db->priv->exiting,
+				       NULL);
+	g_object_unref (file);
+	if (file_info == NULL) {
+		/* let the normal stat code deal with mounting and errors */
+		rhythmdb_execute_stat_action (db, action, uri);
+		return;
+	}
+
+	file_type = g_file_info_get_attribute_uint32 (file_info, G_FILE_ATTRIBUTE_STANDARD_TYPE);
+	if (file_type == G_FILE_TYPE_REGULAR || file_type == G_FILE_TYPE_UNKNOWN) {
+		entry = rhythmdb_entry_lookup_by_location_refstring (db, uri);
+		if (entry == NULL) {
+			load = TRUE;
+		} else if (entry->type == action->data.types.entry_type ||
+			   entry->type == action->data.types.ignore_type ||
+			   entry->type == action->data.types.error_type) {
+			guint64 new_mtime;
+			guint64 new_size;
+
+			new_mtime = g_file_info_get_attribute_uint64 (file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+			new_size = g_file_info_get_attribute_uint64 (file_info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
+			load = (entry->mtime != new_mtime || (new_size != 0 && entry->file_size != new_size));
+		}
+	}
+
+	result = g_slice_new0 (RhythmDBEvent);
+	result->db = db;
+	result->entry_type = action->data.types.entry_type;
+	result->error_type = action->data.types.error_type;
+	result->ignore_type = action->data.types.ignore_type;
+
+	if (load) {
+		rb_debug ("loading new or changed file %s", rb_refstring_get (uri));
+		g_object_unref (file_info);
+		result->type = RHYTHMDB_EVENT_METADATA_LOAD;
+		rhythmdb_execute_load (db, rb_refstring_get (uri), result);
+	} else {
+		/* unchanged files, directories and entries of other types
+		 * are handled as usual.
+		 */
+		result->type = RHYTHMDB_EVENT_STAT;
+		result->real_uri = rb_refstring_ref (uri);
+		result->file_info = file_info;
+		rhythmdb_push_event (db, result);
+	}
+}
+
+static gpointer
+sync_thread_main (RhythmDB *db)
+{
+	RhythmDBEvent *result;
+
+	g_mutex_lock (db->priv->sync_mutex);
+	while (!g_cancellable_is_cancelled (db->priv->exiting)) {
+		RhythmDBSyncItem *item;
+		RhythmDBEntry *entry;
+		GError *error = NULL;
+
+		item = g_queue_pop_head (db->priv->sync_urgent_queue);
+		if (item == NULL) {
+			item = g_queue_pop_head (db->priv->sync_queue);
+		}
+		if (item == NULL) {
+			g_cond_wait (db->priv->sync_cond, db->priv->sync_mutex);
+			continue;
+		}
+
+		/* further changes to the file will need another write */
+		g_hash_table_remove (db->priv->sync_pending, item->uri);
+		g_mutex_unlock (db->priv->sync_mutex);
+
+		if (db->priv->dry_run) {
+			rb_debug ("dry run is enabled, not syncing metadata");
+		} else {
+			entry = rhythmdb_entry_lookup_by_location_refstring (db, item->uri);
+			if (entry != NULL) {
+				rb_debug ("syncing metadata for \"%s\"", rb_refstring_get (item->uri));
+				rb_trace_begin ("syncing metadata");
+				rhythmdb_entry_sync_metadata (entry, item->changes, &error);
+				rb_trace_end ("syncing metadata");
+			}
+		}
+
+		if (error != NULL) {
+			RhythmDBSaveErrorData *data;
+
+			data = g_new0 (RhythmDBSaveErrorData, 1);
+			g_object_ref (db);
+			data->db = db;
+			data->uri = g_strdup (rb_refstring_get (item->uri));
+			data->error = error;
+			g_idle_add ((GSourceFunc)emit_save_error_idle, data);
+		}
+		rhythmdb_sync_item_free (item);
+
+		g_mutex_lock (db->priv->sync_mutex);
+		db->priv->sync_done++;
+		if (g_queue_is_empty (db->priv->sync_queue) &&
+		    g_queue_is_empty (db->priv->sync_urgent_queue)) {
+			rb_debug ("synced metadata for %d files in %f seconds",
+				  db->priv->sync_done,
+				  g_timer_elapsed (db->priv->sync_timer, NULL));
+			db->priv->sync_count = 0;
+			db->priv->sync_done = 0;
+		}
+	}
+
+	/* files still waiting to be written won't be, so they
+	 * no longer count towards the database being busy.
+	 */
+	while (TRUE) {
+		RhythmDBSyncItem *item;
+
+		item = g_queue_pop_head (db->priv->sync_urgent_queue);
+		if (item == NULL) {
+			item = g_queue_pop_head (db->priv->sync_queue);
+		}
+		if (item == NULL)
+			break;
+
+		rb_debug ("not syncing metadata for \"%s\"", rb_refstring_get (item->uri));
+		g_hash_table_remove (db->priv->sync_pending, item->uri);
+		rhythmdb_sync_item_free (item);
+		db->priv->sync_count--;
+	}
+	db->priv->sync_count = MAX (db->priv->sync_count - db->priv->sync_done, 0);
+	db->priv->sync_done = 0;
+	g_mutex_unlock (db->priv->sync_mutex);
+
+	rb_debug ("exiting sync thread");
+	result = g_slice_new0 (RhythmDBEvent);
+	result->db = db;
+	result->type = RHYTHMDB_EVENT_THREAD_EXITED;
+	rhythmdb_push_event (db, result);
+
+	return NULL;
+}
+
 static gpointer
 action_thread_main (RhythmDB *db)
 {
@@ -2843,17 +3305,26 @@ action_thread_main (RhythmDB *db)
 		if (!g_cancellable_is_cancelled (db->priv->exiting)) {
 			switch (action->type) {
 			case RHYTHMDB_ACTION_STAT:
-				result = g_slice_new0 (RhythmDBEvent);
-				result->db = db;
-				result->type = RHYTHMDB_EVENT_STAT;
-				result->entry_type = action->data.types.entry_type;
-				result->error_type = action->data.types.error_type;
-				result->ignore_type = action->data.types.ignore_type;
-
 				rb_debug ("executing RHYTHMDB_ACTION_STAT for \"%s\"", rb_refstring_get (action->uri));
+				rb_trace_begin ("stat");
+				rhythmdb_execute_stat_action (db, action, action->uri);
+				rb_trace_end ("stat");
+				break;
 
-				rhythmdb_execute_stat (db, rb_refstring_get (action->uri), result);
+			case RHYTHMDB_ACTION_STAT_LIST:
+			{
+				GList *l;
+
+				rb_debug ("executing RHYTHMDB_ACTION_STAT_LIST for %d files", g_list_length (action->uris));
+				rb_trace_begin ("stat list");
+				for (l = action->uris; l != NULL; l = l->next) {
+					if (g_cancellable_is_cancelled (db->priv->exiting))
+						break;
+					rhythmdb_execute_stat_list_item (db, action, l->data);
+				}
+				rb_trace_end ("stat list");
 				break;
+			}
 
 			case RHYTHMDB_ACTION_LOAD:
 				result = g_slice_new0 (RhythmDBEvent);
@@ -2865,44 +3336,18 @@ action_thread_main (RhythmDB *db)
 
 				rb_debug ("executing RHYTHMDB_ACTION_LOAD for \"%s\"", rb_refstring_get (action->uri));
 
+				rb_trace_begin ("loading metadata");
 				rhythmdb_execute_load (db, rb_refstring_get (action->uri), result);
+				rb_trace_end ("loading metadata");
 				break;
 
 			case RHYTHMDB_ACTION_ENUM_DIR:
 				rb_debug ("executing RHYTHMDB_ACTION_ENUM_DIR for \"%s\"", rb_refstring_get (action->uri));
+				rb_trace_begin ("enumerating directory");
 				rhythmdb_execute_enum_dir (db, action);
+				rb_trace_end ("enumerating directory");
 				break;
 
-			case RHYTHMDB_ACTION_SYNC:
-			{
-				GError *error = NULL;
-				RhythmDBEntry *entry;
-
-				if (db->priv->dry_run) {
-					rb_debug ("dry run is enabled, not syncing metadata");
-					break;
-				}
-
-				entry = rhythmdb_entry_lookup_by_location_refstring (db, action->uri);
-				if (!entry)
-					break;
-
-				rhythmdb_entry_sync_metadata (entry, action->data.changes, &error);
-
-				if (error != NULL) {
-					RhythmDBSaveErrorData *data;
-
-					data = g_new0 (RhythmDBSaveErrorData, 1);
-					g_object_ref (db);
-					data->db = db;
-					data->uri = g_strdup (rb_refstring_get (action->uri));
-					data->error = error;
-					g_idle_add ((GSourceFunc)emit_save_error_idle, data);
-					break;
-				}
-				break;
-			}
-
 			case RHYTHMDB_ACTION_QUIT:
 				/* don't do any real work here, since we may not process it */
 				rb_debug ("received QUIT action");
@@ -2946,6 +3391,43 @@ rhythmdb_add_uri (RhythmDB *db,
 				     RHYTHMDB_ENTRY_TYPE_IMPORT_ERROR);
 }
 
+/*
+ * Adds a set of files (as #RBRefString URIs) to the database as songs,
+ * using a single action so a large number of changed files doesn't
+ * flood the action queue.  Files that are new or have changed are loaded
+ * by the action itself rather than through separate load actions.
+ */
+void
+rhythmdb_add_uri_list (RhythmDB *db, GList *uris)
+{
+	RhythmDBAction *action;
+	GList *l;
+
+	if (uris == NULL)
+		return;
+
+	g_mutex_lock (db->priv->stat_mutex);
+	if (db->priv->action_thread_running == FALSE) {
+		g_mutex_unlock (db->priv->stat_mutex);
+		for (l = uris; l != NULL; l = l->next) {
+			rhythmdb_add_uri (db, rb_refstring_get (l->data));
+		}
+		return;
+	}
+	g_mutex_unlock (db->priv->stat_mutex);
+
+	action = g_slice_new0 (RhythmDBAction);
+	action->type = RHYTHMDB_ACTION_STAT_LIST;
+	action->data.types.entry_type = RHYTHMDB_ENTRY_TYPE_SONG;
+	action->data.types.ignore_type = RHYTHMDB_ENTRY_TYPE_IGNORE;
+	action->data.types.error_type = RHYTHMDB_ENTRY_TYPE_IMPORT_ERROR;
+	for (l = uris; l != NULL; l = l->next) {
+		action->uris = g_list_prepend (action->uris, rb_refstring_ref (l->data));
+	}
+
+	g_async_queue_push (db->priv->action_queue, action);
+}
+
 static void
 rhythmdb_add_to_stat_list (RhythmDB *db,
 			   const char *uri,
@@ -3129,8 +3611,10 @@ rhythmdb_save_thread_main (RhythmDB *db)
 
 	rb_debug ("saving rhythmdb");
 
+	rb_trace_begin ("saving db");
 	klass = RHYTHMDB_GET_CLASS (db);
 	klass->impl_save (db);
+	rb_trace_end ("saving db");
 
 	db->priv->saving = FALSE;
 	db->priv->dirty = FALSE;
@@ -3282,6 +3766,169 @@ record_entry_change (RhythmDB *db,
 	g_mutex_unlock (db->priv->change_mutex);
 }
 
+/* podcast descriptions and summaries at least this long are kept out of memory */
+#define PODCAST_TEXT_STORE_MIN_LENGTH	128
+
+static GStaticMutex podcast_text_lock = G_STATIC_MUTEX_INIT;
+static RBTextStore *podcast_text_store = NULL;
+static gboolean podcast_text_store_failed = FALSE;
+static int podcast_text_store_users = 0;
+
+static void
+podcast_text_store_ref (void)
+{
+	g_static_mutex_lock (&podcast_text_lock);
+	podcast_text_store_users++;
+	g_static_mutex_unlock (&podcast_text_lock);
+}
+
+static void
+podcast_text_store_unref (void)
+{
+	g_static_mutex_lock (&podcast_text_lock);
+	podcast_text_store_users--;
+	if (podcast_text_store_users == 0 && podcast_text_store != NULL) {
+		rb_debug ("freeing podcast text store");
+		rb_text_store_free (podcast_text_store);
+		podcast_text_store = NULL;
+		podcast_text_store_failed = FALSE;
+	}
+	g_static_mutex_unlock (&podcast_text_lock);
+}
+
+/* called with podcast_text_lock held */
+static RBTextStore *
+get_podcast_text_store (void)
+{
+	GError *error = NULL;
+
+	if (podcast_text_store == NULL && podcast_text_store_failed == FALSE) {
+		podcast_text_store = rb_text_store_new (rb_user_cache_dir (), &error);
+		if (error != NULL) {
+			rb_debug ("unable to create podcast text store: %s", error->message);
+			g_clear_error (&error);
+			podcast_text_store_failed = TRUE;
+		}
+	}
+
+	return podcast_text_store;
+}
+
+/* called with podcast_text_lock held */
+static void
+podcast_text_release (guint64 key)
+{
+	if (key != 0 && podcast_text_store != NULL) {
+		rb_text_store_remove (podcast_text_store, key);
+	}
+}
+
+static void
+podcast_text_set (RBRefString **text, guint64 *key, const char *value)
+{
+	RBTextStore *store;
+	guint64 new_key = 0;
+
+	g_static_mutex_lock (&podcast_text_lock);
+	if (value != NULL && strlen (value) >= PODCAST_TEXT_STORE_MIN_LENGTH) {
+		store = get_podcast_text_store ();
+		if (store != NULL) {
+			new_key = rb_text_store_add (store, value);
+		}
+	}
+
+	/* the old text, wherever it is, is no longer needed */
+	podcast_text_release (*key);
+	if (*text != NULL) {
+		rb_refstring_unref (*text);
+	}
+
+	*key = new_key;
+	if (new_key != 0) {
+		*text = NULL;
+	} else {
+		*text = rb_refstring_new (value);
+	}
+	g_static_mutex_unlock (&podcast_text_lock);
+}
+
+static const char *
+podcast_text_get (RBRefString **text, guint64 key)
+{
+	char *value = NULL;
+
+	/* once read, the text stays in memory so the returned
+	 * string remains valid for as long as the entry does.
+	 */
+	g_static_mutex_lock (&podcast_text_lock);
+	if (*text == NULL && key != 0) {
+		if (podcast_text_store != NULL) {
+			value = rb_text_store_get (podcast_text_store, key);
+		}
+		if (value == NULL) {
+			/* don't replace the stored text with an empty string */
+			g_static_mutex_unlock (&podcast_text_lock);
+			return "";
+		}
+		*text = rb_refstring_new (value);
+		g_free (value);
+	}
+	g_static_mutex_unlock (&podcast_text_lock);
+
+	return rb_refstring_get (*text);
+}
+
+/*
+ * Returns a copy of a podcast description or summary without reading it
+ * into memory permanently, for saving the database and for comparing
+ * against new values.
+ */
+char *
+rhythmdb_entry_dup_podcast_text (RhythmDBEntry *entry, RhythmDBPropType propid)
+{
+	RhythmDBPodcastFields *podcast;
+	char *value = NULL;
+
+	podcast = RHYTHMDB_ENTRY_GET_TYPE_DATA (entry, RhythmDBPodcastFields);
+
+	g_static_mutex_lock (&podcast_text_lock);
+	if (propid == RHYTHMDB_PROP_DESCRIPTION) {
+		if (podcast->description != NULL) {
+			value = g_strdup (rb_refstring_get (podcast->description));
+		} else if (podcast->description_key != 0 && podcast_text_store != NULL) {
+			value = rb_text_store_get (podcast_text_store, podcast->description_key);
+		}
+	} else {
+		if (podcast->summary != NULL) {
+			value = g_strdup (rb_refstring_get (podcast->summary));
+		} else if (podcast->summary_key != 0 && podcast_text_store != NULL) {
+			value = rb_text_store_get (podcast_text_store, podcast->summary_key);
+		}
+	}
+	g_static_mutex_unlock (&podcast_text_lock);
+
+	return value;
+}
+
+/*
+ * Frees the space used by a podcast entry's description and summary
+ * in the text store, when the entry is destroyed.
+ */
+void
+rhythmdb_entry_free_podcast_text (RhythmDBEntry *entry)
+{
+	RhythmDBPodcastFields *podcast;
+
+	podcast = RHYTHMDB_ENTRY_GET_TYPE_DATA (entry, RhythmDBPodcastFields);
+
+	g_static_mutex_lock (&podcast_text_lock);
+	podcast_text_release (podcast->description_key);
+	podcast_text_release (podcast->summary_key);
+	podcast->description_key = 0;
+	podcast->summary_key = 0;
+	g_static_mutex_unlock (&podcast_text_lock);
+}
+
 void
 rhythmdb_entry_set_internal (RhythmDB *db,
 			     RhythmDBEntry *entry,
@@ -3311,9 +3958,17 @@ rhythmdb_entry_set_internal (RhythmDB *db,
 		value = &conv_value;
 	}
 
-	/* compare the value with what's already there */
+	/* compare the value with what's already there.  podcast text kept in
+	 * the text store is read without bringing it back into memory.
+	 */
 	g_value_init (&old_value, G_VALUE_TYPE (value));
-	rhythmdb_entry_get (db, entry, propid, &old_value);
+	if ((propid == RHYTHMDB_PROP_DESCRIPTION || propid == RHYTHMDB_PROP_SUMMARY) &&
+	    (entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_FEED ||
+	     entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_POST)) {
+		g_value_take_string (&old_value, rhythmdb_entry_dup_podcast_text (entry, propid));
+	} else {
+		rhythmdb_entry_get (db, entry, propid, &old_value);
+	}
 	switch (G_VALUE_TYPE (value)) {
 	case G_TYPE_STRING:
 #ifndef G_DISABLE_ASSERT
@@ -3356,6 +4011,12 @@ rhythmdb_entry_set_internal (RhythmDB *db,
 		return;
 	}
 
+	/* cached query results for the entry are no longer valid.  entries
+	 * that haven't been inserted yet can't have been evaluated.
+	 */
+	if (entry->flags & RHYTHMDB_ENTRY_INSERTED)
+		rhythmdb_query_cache_invalidate (db);
+
 	handled = klass->impl_entry_set (db, entry, propid, value);
 
 	if (!handled) {
@@ -3528,8 +4189,7 @@ rhythmdb_entry_set_internal (RhythmDB *db,
 			break;
 		case RHYTHMDB_PROP_DESCRIPTION:
 			g_assert (podcast);
-			rb_refstring_unref (podcast->description);
-			podcast->description = rb_refstring_new (g_value_get_string (value));
+			podcast_text_set (&podcast->description, &podcast->description_key, g_value_get_string (value));
 			break;
 		case RHYTHMDB_PROP_SUBTITLE:
 			g_assert (podcast);
@@ -3538,8 +4198,7 @@ rhythmdb_entry_set_internal (RhythmDB *db,
 			break;
 		case RHYTHMDB_PROP_SUMMARY:
 			g_assert (podcast);
-			rb_refstring_unref (podcast->summary);
-			podcast->summary = rb_refstring_new (g_value_get_string (value));
+			podcast_text_set (&podcast->summary, &podcast->summary_key, g_value_get_string (value));
 			break;
 		case RHYTHMDB_PROP_LANG:
 			g_assert (podcast);
@@ -4034,10 +4693,15 @@ static gpointer
 query_thread_main (RhythmDBQueryThreadData *data)
 {
 	RhythmDBEvent *result;
+	gint64 start;
 
 	rb_debug ("entering query thread");
 
+	start = rhythmdb_metrics_time ();
+	rb_trace_begin ("query");
 	rhythmdb_query_internal (data);
+	rb_trace_end ("query");
+	rhythmdb_record_latency (data->db, RHYTHMDB_LATENCY_QUERY, start);
 
 	result = g_slice_new0 (RhythmDBEvent);
 	result->db = data->db;
@@ -4439,7 +5103,8 @@ rhythmdb_is_busy (RhythmDB *db)
 		db->priv->stat_thread_running ||
 		!queue_is_empty (db->priv->event_queue) ||
 		!queue_is_empty (db->priv->action_queue) ||
-		(db->priv->outstanding_stats != NULL));
+		(db->priv->outstanding_stats != NULL) ||
+		(g_atomic_int_get (&db->priv->sync_count) > 0));
 }
 
 /**
@@ -4460,7 +5125,28 @@ rhythmdb_get_progress_info (RhythmDB *db, char **text, float *progress)
 					 db->priv->stat_thread_count);
 		*progress = ((float)db->priv->stat_thread_done /
 			     (float)db->priv->stat_thread_count);
+		return;
+	}
+
+	g_mutex_lock (db->priv->sync_mutex);
+	if (db->priv->sync_count > 0) {
+		double elapsed;
+		double rate = 0.0;
+
+		elapsed = g_timer_elapsed (db->priv->sync_timer, NULL);
+		if (elapsed > 0.0) {
+			rate = db->priv->sync_done / elapsed;
+		}
+
+		g_free (*text);
+		*text = g_strdup_printf (_("Saving tags (%d/%d, %.1f per second)"),
+					 db->priv->sync_done,
+					 db->priv->sync_count,
+					 rate);
+		*progress = ((float)db->priv->sync_done /
+			     (float)db->priv->sync_count);
 	}
+	g_mutex_unlock (db->priv->sync_mutex);
 }
 
 /**
@@ -4839,7 +5525,7 @@ rhythmdb_entry_get_string (RhythmDBEntry *entry,
 	/* Podcast properties */
 	case RHYTHMDB_PROP_DESCRIPTION:
 		if (podcast)
-			return rb_refstring_get (podcast->description);
+			return podcast_text_get (&podcast->description, podcast->description_key);
 		else
 			return NULL;
 	case RHYTHMDB_PROP_SUBTITLE:
@@ -4849,7 +5535,7 @@ rhythmdb_entry_get_string (RhythmDBEntry *entry,
 			return NULL;
 	case RHYTHMDB_PROP_SUMMARY:
 		if (podcast)
-			return rb_refstring_get (podcast->summary);
+			return podcast_text_get (&podcast->summary, podcast->summary_key);
 		else
 			return NULL;
 	case RHYTHMDB_PROP_LANG:
@@ -240,6 +240,7 @@ struct _RhythmDBClass
 
 	/* signals */
 	void	(*entry_added)		(RhythmDB *db, RhythmDBEntry *entry);
+	void	(*entries_added)	(RhythmDB *db, GPtrArray *entries);
 	void	(*entry_changed)	(RhythmDB *db, RhythmDBEntry *entry, GValueArray *changes); /* array of RhythmDBEntryChanges */
 	void	(*entry_deleted)	(RhythmDB *db, RhythmDBEntry *entry);
 	void	(*entry_keyword_added)	(RhythmDB *db, RhythmDBEntry *entry, RBRefString *keyword);
@@ -259,6 +260,7 @@ struct _RhythmDBClass
 	void		(*impl_save)		(RhythmDB *db);
 
 	void		(*impl_entry_new)	(RhythmDB *db, RhythmDBEntry *entry);
+	void		(*impl_entry_new_batch)	(RhythmDB *db, GList *entries);
 
 	gboolean	(*impl_entry_set)	(RhythmDB *db, RhythmDBEntry *entry,
 	                                 guint propid, const GValue *value);
@@ -319,6 +321,8 @@ void		rhythmdb_commit		(RhythmDB *db);
 
 RhythmDBEntry *	rhythmdb_entry_new	(RhythmDB *db, RhythmDBEntryType *type, const char *uri);
 RhythmDBEntry *	rhythmdb_entry_example_new	(RhythmDB *db, RhythmDBEntryType *type, const char *uri);
+RhythmDBEntry *	rhythmdb_entry_new_pending	(RhythmDB *db, RhythmDBEntryType *type, const char *uri);
+GList *		rhythmdb_entry_insert_batch	(RhythmDB *db, GList *entries);
 
 void		rhythmdb_add_uri	(RhythmDB *db, const char *uri);		/* <-- die */
 void		rhythmdb_add_uri_with_types (RhythmDB *db,
@@ -430,6 +434,13 @@ char *		rhythmdb_query_to_string		(RhythmDB *db, RhythmDBQuery *query);
 
 gboolean	rhythmdb_query_is_time_relative		(RhythmDB *db, RhythmDBQuery *query);
 
+typedef struct _RhythmDBQuerySubscription RhythmDBQuerySubscription;
+
+RhythmDBQuerySubscription *rhythmdb_query_subscribe	(RhythmDB *db, RhythmDBQuery *query);
+void		rhythmdb_query_unsubscribe		(RhythmDBQuerySubscription *sub);
+gboolean	rhythmdb_query_subscription_evaluate	(RhythmDBQuerySubscription *sub, RhythmDBEntry *entry);
+gboolean	rhythmdb_query_subscription_affected	(RhythmDBQuerySubscription *sub, GValueArray *changes);
+
 const xmlChar *	rhythmdb_nice_elt_name_from_propid	(RhythmDB *db, RhythmDBPropType propid);
 int		rhythmdb_propid_from_nice_elt_name	(RhythmDB *db, const xmlChar *name);
 
@@ -442,6 +453,10 @@ void		rhythmdb_emit_entry_extra_metadata_notify (RhythmDB *db, RhythmDBEntry *en
 
 gboolean	rhythmdb_is_busy			(RhythmDB *db);
 void		rhythmdb_get_progress_info		(RhythmDB *db, char **text, float *progress);
+
+GVariant *	rhythmdb_get_metrics			(RhythmDB *db);
+void		rhythmdb_reset_metrics			(RhythmDB *db);
+char *		rhythmdb_get_metrics_report		(RhythmDB *db);
 char *		rhythmdb_compute_status_normal		(gint n_songs, glong duration,
 							 guint64 size,
 							 const char *singular,
@@ -179,6 +179,7 @@ main (int argc, char **argv)
 	else
 		rb_debug_init (debug);
 	rb_debug ("initializing Rhythmbox %s", VERSION);
+	rb_trace_init ();
 
 #if defined(USE_UNINSTALLED_DIRS)
 	g_irepository_prepend_search_path (SHARE_UNINSTALLED_BUILDDIR "/../bindings/gi");
@@ -527,28 +527,61 @@ rb_playlist_manager_is_dirty (RBPlaylistManager *mgr)
 struct RBPlaylistManagerSaveData
 {
 	RBPlaylistManager *mgr;
-	xmlDocPtr doc;
+	GList *playlists;
 };
 
+static gboolean
+write_playlists (FILE *f, GList *playlists)
+{
+	GList *l;
+
+	if (fprintf (f, "<?xml version=\"%s\"?>\n<%s>\n",
+		     (const char *) RB_PLAYLIST_MGR_VERSION,
+		     (const char *) RB_PLAYLIST_MGR_PL) < 0)
+		return FALSE;
+
+	for (l = playlists; l != NULL; l = l->next) {
+		if (fprintf (f, "  %s\n", (const char *) l->data) < 0)
+			return FALSE;
+	}
+
+	if (fprintf (f, "</%s>\n", (const char *) RB_PLAYLIST_MGR_PL) < 0)
+		return FALSE;
+
+	return TRUE;
+}
+
 static gpointer
 rb_playlist_manager_save_data (struct RBPlaylistManagerSaveData *data)
 {
 	char *file;
 	char *tmpname;
+	FILE *f;
+	gboolean ok = FALSE;
 
 	g_mutex_lock (data->mgr->priv->saving_mutex);
 
 	file = g_strdup (data->mgr->priv->playlists_file);
 	tmpname = g_strconcat (file, ".tmp", NULL);
 
-	if (xmlSaveFormatFile (tmpname, data->doc, 1) != -1) {
+	/* the playlists have already been converted to XML, so all we
+	 * need to do here is write them out.
+	 */
+	f = fopen (tmpname, "w");
+	if (f != NULL) {
+		ok = write_playlists (f, data->playlists);
+		if (fclose (f) != 0)
+			ok = FALSE;
+	}
+
+	if (ok) {
 		rename (tmpname, file);
 	} else {
-		rb_debug ("error in xmlSaveFormatFile(), not saving");
+		rb_debug ("error writing playlists to %s, not saving", tmpname);
 		unlink (tmpname);
 		rb_playlist_manager_set_dirty (data->mgr, TRUE);
 	}
-	xmlFreeDoc (data->doc);
+	rb_list_deep_free (data->playlists);
 	g_free (tmpname);
 	g_free (file);
 
@@ -561,11 +594,17 @@ rb_playlist_manager_save_data (struct RBPlaylistManagerSaveData *data)
 	return NULL;
 }
 
+struct RBPlaylistManagerSaveCbData
+{
+	struct RBPlaylistManagerSaveData *data;
+	gboolean force;
+};
+
 static gboolean
 save_playlist_cb (GtkTreeModel *model,
 		  GtkTreePath  *path,
 		  GtkTreeIter  *iter,
-		  xmlNodePtr    root)
+		  struct RBPlaylistManagerSaveCbData *cbdata)
 {
 	RBDisplayPage *page;
 	gboolean  local;
@@ -583,7 +622,11 @@ save_playlist_cb (GtkTreeModel *model,
 
 	g_object_get (page, "is-local", &local, NULL);
 	if (local) {
-		rb_playlist_source_save_to_xml (RB_PLAYLIST_SOURCE (page), root);
+		char *xml;
+
+		/* only playlists that have changed are converted again */
+		xml = rb_playlist_source_save_to_string (RB_PLAYLIST_SOURCE (page), cbdata->force);
+		cbdata->data->playlists = g_list_prepend (cbdata->data->playlists, xml);
 	}
  out:
 	if (page != NULL) {
@@ -604,13 +647,17 @@ save_playlist_cb (GtkTreeModel *model,
  * since the last time the playlists were saved, and no save operation is
  * currently taking place.
  *
+ * Only playlists that have changed since the last save are converted
+ * to XML again; the file itself is written in another thread unless
+ * the force flag is TRUE.
+ *
  * Return value: TRUE if a playlist save operation has been started
  **/
 gboolean
 rb_playlist_manager_save_playlists (RBPlaylistManager *mgr, gboolean force)
 {
-	xmlNodePtr root;
 	struct RBPlaylistManagerSaveData *data;
+	struct RBPlaylistManagerSaveCbData cbdata;
 	RBSource *queue_source;
 
 	if (!force && !rb_playlist_manager_is_dirty (mgr)) {
@@ -625,21 +672,22 @@ rb_playlist_manager_save_playlists (RBPlaylistManager *mgr, gboolean force)
 
 	data = g_new0 (struct RBPlaylistManagerSaveData, 1);
 	data->mgr = mgr;
-	data->doc = xmlNewDoc (RB_PLAYLIST_MGR_VERSION);
 	g_object_ref (mgr);
 
-	root = xmlNewDocNode (data->doc, NULL, RB_PLAYLIST_MGR_PL, NULL);
-	xmlDocSetRootElement (data->doc, root);
-
+	cbdata.data = data;
+	cbdata.force = force;
 	gtk_tree_model_foreach (GTK_TREE_MODEL (mgr->priv->page_model),
 				(GtkTreeModelForeachFunc)save_playlist_cb,
-				root);
+				&cbdata);
 
 	/* also save the play queue */
 	g_object_get (mgr->priv->shell, "queue-source", &queue_source, NULL);
-	rb_playlist_source_save_to_xml (RB_PLAYLIST_SOURCE (queue_source), root);
+	data->playlists = g_list_prepend (data->playlists,
+					  rb_playlist_source_save_to_string (RB_PLAYLIST_SOURCE (queue_source), force));
 	g_object_unref (queue_source);
 
+	data->playlists = g_list_reverse (data->playlists);
+
 	/* mark clean here.  if the save fails, we'll mark it dirty again */
 	rb_playlist_manager_set_dirty (data->mgr, FALSE);
 
@@ -84,6 +84,7 @@
 #include "rb-podcast-manager.h"
 #include "rb-marshal.h"
 #include "rb-missing-plugins.h"
+#include "rb-track-prefetch.h"
 
 /* Play Orders */
 #include "rb-play-order-linear.h"
@@ -230,6 +231,7 @@ struct RBShellPlayerPrivate
 	gboolean handling_error;
 
 	RBPlayer *mmplayer;
+	RBTrackPrefetch *prefetch;
 
 	guint elapsed;
 	gint64 track_transition_time;
@@ -1017,6 +1019,14 @@ rb_shell_player_init (RBShellPlayer *player)
 		exit (1);
 	}
 
+	player->priv->prefetch = rb_track_prefetch_new ();
+	g_settings_bind (player->priv->settings, "prefetch-tracks",
+			 player->priv->prefetch, "max-tracks",
+			 G_SETTINGS_BIND_GET);
+	g_settings_bind (player->priv->settings, "prefetch-buffer-size",
+			 player->priv->prefetch, "buffer-size",
+			 G_SETTINGS_BIND_GET);
+
 	gtk_box_set_spacing (GTK_BOX (player), 12);
 	gtk_container_set_border_width (GTK_CONTAINER (player), 3);
 
@@ -1254,6 +1264,11 @@ rb_shell_player_dispose (GObject *object)
 		player->priv->mmplayer = NULL;
 	}
 
+	if (player->priv->prefetch != NULL) {
+		g_object_unref (player->priv->prefetch);
+		player->priv->prefetch = NULL;
+	}
+
 	if (player->priv->play_order != NULL) {
 		g_object_unref (player->priv->play_order);
 		player->priv->play_order = NULL;
@@ -1643,11 +1658,21 @@ rb_shell_player_open_location (RBShellPlayer *player,
 
 		g_thread_create ((GThreadFunc)open_location_thread, data, FALSE, NULL);
 	} else {
+		char *prefetched;
+
 		if (player->priv->parser_cancellable != NULL) {
 			g_object_unref (player->priv->parser_cancellable);
 			player->priv->parser_cancellable = NULL;
 		}
 
+		/* play the local copy if the track has already been fetched */
+		prefetched = rb_track_prefetch_get_uri (player->priv->prefetch, entry);
+		if (prefetched != NULL) {
+			rb_debug ("playing prefetched copy %s of %s", prefetched, location);
+			g_free (location);
+			location = prefetched;
+		}
+
 		rhythmdb_entry_ref (entry);
 		ret = ret && rb_player_open (player->priv->mmplayer, location, entry, (GDestroyNotify) rhythmdb_entry_unref, error);
 
@@ -3176,6 +3201,7 @@ rb_shell_player_stop (RBShellPlayer *player)
 
 	rb_shell_player_set_playing_source (player, NULL);
 	rb_shell_player_sync_with_source (player);
+	rb_track_prefetch_set_entries (player->priv->prefetch, NULL);
 	g_signal_emit (G_OBJECT (player),
 		       rb_shell_player_signals[PLAYING_SONG_CHANGED], 0,
 		       NULL);
@@ -3477,6 +3503,65 @@ rb_shell_player_error (RBShellPlayer *player,
 	}
 }
 
+static void
+rb_shell_player_update_prefetch (RBShellPlayer *player)
+{
+	GList *entries = NULL;
+	RhythmDBEntry *entry;
+	RBSource *source;
+	RBPlayOrder *porder = NULL;
+	guint count;
+
+	g_object_get (player->priv->prefetch, "max-tracks", &count, NULL);
+	if (count == 0)
+		return;
+
+	/* anything in the play queue will be played first */
+	if (player->priv->queue_source != NULL) {
+		RhythmDBQueryModel *model;
+		GtkTreeIter iter;
+		gboolean valid;
+
+		g_object_get (player->priv->queue_source, "query-model", &model, NULL);
+		valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter);
+		while (valid && g_list_length (entries) < count) {
+			entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+			if (entry != player->priv->playing_entry) {
+				entries = g_list_append (entries, entry);
+			} else {
+				rhythmdb_entry_unref (entry);
+			}
+			valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter);
+		}
+		g_object_unref (model);
+	}
+
+	/* then whatever the play order picks next */
+	source = player->priv->current_playing_source;
+	if (source == NULL || source == RB_SOURCE (player->priv->queue_source))
+		source = player->priv->source;
+	if (source != NULL && g_list_length (entries) < count) {
+		g_object_get (source, "play-order", &porder, NULL);
+		if (porder == NULL && player->priv->play_order != NULL)
+			porder = g_object_ref (player->priv->play_order);
+	}
+	if (porder != NULL) {
+		entry = rb_play_order_get_next (porder);
+		if (entry != NULL) {
+			/* only if the queue hasn't already used up the prefetch count */
+			if (g_list_length (entries) < count && g_list_find (entries, entry) == NULL) {
+				entries = g_list_append (entries, entry);
+			} else {
+				rhythmdb_entry_unref (entry);
+			}
+		}
+		g_object_unref (porder);
+	}
+
+	rb_track_prefetch_set_entries (player->priv->prefetch, entries);
+	rb_list_destroy_free (entries, (GDestroyNotify) rhythmdb_entry_unref);
+}
+
 static void
 playing_stream_cb (RBPlayer *mmplayer,
 		   RhythmDBEntry *entry,
@@ -3501,6 +3586,7 @@ playing_stream_cb (RBPlayer *mmplayer,
 
 		location = rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION);
 		rb_debug ("new playing stream: %s", location);
+		rb_shell_player_update_prefetch (player);
 		g_signal_emit (G_OBJECT (player),
 			       rb_shell_player_signals[PLAYING_SONG_CHANGED], 0,
 			       entry);
@@ -236,7 +236,8 @@ enum
 	PROP_VISIBILITY,
 	PROP_TRACK_TRANSFER_QUEUE,
 	PROP_AUTOSTARTED,
-	PROP_DISABLE_PLUGINS
+	PROP_DISABLE_PLUGINS,
+	PROP_LOAD_COMPLETE
 };
 
 enum
@@ -289,6 +290,10 @@ struct _RBShellPrivate
 	gboolean shutting_down;
 	gboolean load_complete;
 
+	GTimer *startup_timer;
+	GString *startup_report;
+	double db_load_start;
+
 	gboolean no_registration;
 	gboolean no_update;
 	gboolean dry_run;
@@ -703,6 +708,21 @@ rb_shell_class_init (RBShellClass *klass)
 							       FALSE,
 							       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
 
+	/**
+	 * RBShell:load-complete:
+	 *
+	 * Whether the database and playlists have finished loading.
+	 * The #RBShell::database-load-complete signal is emitted when this
+	 * becomes %TRUE.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_LOAD_COMPLETE,
+					 g_param_spec_boolean ("load-complete",
+							       "load-complete",
+							       "Whether the database has been loaded",
+							       FALSE,
+							       G_PARAM_READABLE));
+
 	/**
 	 * RBShell::visibility-changed:
 	 * @shell: the #RBShell
@@ -986,6 +1006,9 @@ rb_shell_get_property (GObject *object,
 	case PROP_DISABLE_PLUGINS:
 		g_value_set_boolean (value, shell->priv->disable_plugins);
 		break;
+	case PROP_LOAD_COMPLETE:
+		g_value_set_boolean (value, shell->priv->load_complete);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -1079,6 +1102,11 @@ rb_shell_finalize (GObject *object)
 
 	g_free (shell->priv->cached_title);
 
+	if (shell->priv->startup_timer != NULL) {
+		g_timer_destroy (shell->priv->startup_timer);
+	}
+	g_string_free (shell->priv->startup_report, TRUE);
+
 	if (shell->priv->save_playlist_id > 0) {
 		g_source_remove (shell->priv->save_playlist_id);
 		shell->priv->save_playlist_id = 0;
@@ -1657,11 +1685,53 @@ _scan_idle (RBShell *shell)
 	return FALSE;
 }
 
+static double
+startup_time (RBShell *shell)
+{
+	return g_timer_elapsed (shell->priv->startup_timer, NULL);
+}
+
+static void
+startup_phase_done (RBShell *shell, const char *phase, double start)
+{
+	double now = startup_time (shell);
+
+	g_string_append_printf (shell->priv->startup_report,
+				"\n  %-24s %8.1f ms (done at %.1f ms)",
+				phase,
+				(now - start) * 1000.0,
+				now * 1000.0);
+}
+
+static gboolean
+startup_interactive_idle_cb (RBShell *shell)
+{
+	GDK_THREADS_ENTER ();
+
+	/* the library is showing its contents and nothing else is waiting to run */
+	startup_phase_done (shell, "time to interactive", 0.0);
+	rb_debug ("%s", shell->priv->startup_report->str);
+	g_timer_destroy (shell->priv->startup_timer);
+	shell->priv->startup_timer = NULL;
+
+	GDK_THREADS_LEAVE ();
+	return FALSE;
+}
+
+static void
+startup_library_complete_cb (RhythmDBQueryModel *model, RBShell *shell)
+{
+	g_signal_handlers_disconnect_by_func (model, startup_library_complete_cb, shell);
+	g_idle_add_full (G_PRIORITY_LOW, (GSourceFunc) startup_interactive_idle_cb, shell, NULL);
+}
+
 static void
 rb_shell_constructed (GObject *object)
 {
 	RBShell *shell;
 	GtkAction *action;
+	RhythmDBQueryModel *model;
+	double start;
 
 	RB_CHAIN_GOBJECT_METHOD (rb_shell_parent_class, constructed, object);
 
@@ -1670,6 +1740,9 @@ rb_shell_constructed (GObject *object)
 	rb_debug ("Constructing shell");
 	rb_profile_start ("constructing shell");
 
+	shell->priv->startup_timer = g_timer_new ();
+	shell->priv->startup_report = g_string_new ("startup timing:");
+
 	shell->priv->settings = g_settings_new ("org.gnome.rhythmbox");
 
 	shell->priv->actiongroup = gtk_action_group_new ("MainActions");
@@ -1683,10 +1756,22 @@ rb_shell_constructed (GObject *object)
 					     rb_shell_n_toggle_entries,
 					     shell);
 
+	start = startup_time (shell);
 	construct_db (shell);
+	startup_phase_done (shell, "creating database", start);
+
+	/* start loading the database now, so it happens while we're building
+	 * the UI and activating plugins.  entries of types registered by plugins
+	 * are held back until the type is registered.
+	 */
+	rb_debug ("loading database");
+	shell->priv->db_load_start = startup_time (shell);
+	rhythmdb_load (shell->priv->db);
 
 	/* initialize shell services */
+	start = startup_time (shell);
 	construct_widgets (shell);
+	startup_phase_done (shell, "constructing widgets", start);
 
 	g_signal_connect_object (shell->priv->settings, "changed", G_CALLBACK (settings_changed_cb), shell, 0);
 
@@ -1709,11 +1794,19 @@ rb_shell_constructed (GObject *object)
 	g_signal_connect_object (G_OBJECT (shell->priv->db), "save-error",
 				 G_CALLBACK (rb_shell_db_save_error_cb), shell, 0);
 
+	start = startup_time (shell);
 	construct_sources (shell);
+	startup_phase_done (shell, "constructing sources", start);
 
+	start = startup_time (shell);
 	construct_load_ui (shell);
+	startup_phase_done (shell, "loading ui", start);
 
+	start = startup_time (shell);
 	construct_plugins (shell);
+	startup_phase_done (shell, "loading plugins", start);
+
+	start = startup_time (shell);
 
 	rb_shell_sync_window_state (shell, FALSE);
 	rb_shell_sync_smalldisplay (shell);
@@ -1722,6 +1815,13 @@ rb_shell_constructed (GObject *object)
 
 	rb_shell_select_page (shell, RB_DISPLAY_PAGE (shell->priv->library_source));
 
+	/* startup is over once the library's query has completed and the
+	 * main loop has caught up with everything else.
+	 */
+	g_object_get (shell->priv->library_source, "base-query-model", &model, NULL);
+	g_signal_connect_object (model, "complete", G_CALLBACK (startup_library_complete_cb), shell, 0);
+	g_object_unref (model);
+
 	/* by now we've added the built in sources and any sources from plugins,
 	 * so we can consider the fixed page groups loaded
 	 */
@@ -1732,10 +1832,6 @@ rb_shell_constructed (GObject *object)
 
 	g_idle_add ((GSourceFunc)_scan_idle, shell);
 
-	/* GO GO GO! */
-	rb_debug ("loading database");
-	rhythmdb_load (shell->priv->db);
-
 	rb_debug ("shell: syncing window state");
 	rb_shell_sync_paned (shell);
 
@@ -1743,6 +1839,7 @@ rb_shell_constructed (GObject *object)
 	rb_shell_set_visibility (shell, TRUE, TRUE);
 
 	gdk_notify_startup_complete ();
+	startup_phase_done (shell, "showing window", start);
 
 	/* focus play if small, the entry view if not */
 	if (g_settings_get_boolean (shell->priv->settings, "small-display")) {
@@ -2748,19 +2845,73 @@ rb_shell_quit (RBShell *shell,
 	return TRUE;
 }
 
+/**
+ * rb_shell_dump_trace:
+ * @shell: the #RBShell
+ * @filename: file to write the trace to
+ * @error: returns error information
+ *
+ * Writes the trace events recorded so far to @filename.
+ * See #rb_trace_dump.  This is part of the DBus interface.
+ *
+ * Return value: %TRUE if successful
+ */
+gboolean
+rb_shell_dump_trace (RBShell *shell,
+		     const char *filename,
+		     GError **error)
+{
+	return rb_trace_dump (filename, error);
+}
+
+/**
+ * rb_shell_get_database_metrics:
+ * @shell: the #RBShell
+ * @metrics: returns the database metrics report
+ * @error: not used
+ *
+ * Returns a report of the database's queue lengths and latencies,
+ * followed by the startup timing, including the time taken until the
+ * library was first shown.  See #rhythmdb_get_metrics_report.
+ * This is part of the DBus interface.
+ *
+ * Return value: %TRUE
+ */
+gboolean
+rb_shell_get_database_metrics (RBShell *shell,
+			       char **metrics,
+			       GError **error)
+{
+	char *report;
+
+	report = rhythmdb_get_metrics_report (shell->priv->db);
+	*metrics = g_strdup_printf ("%s\n%s\n", report, shell->priv->startup_report->str);
+	g_free (report);
+	return TRUE;
+}
+
 static gboolean
 idle_handle_load_complete (RBShell *shell)
 {
+	double start;
+
 	GDK_THREADS_ENTER ();
 
 	rb_debug ("load complete");
+	startup_phase_done (shell, "loading database", shell->priv->db_load_start);
 
+	start = startup_time (shell);
 	rb_playlist_manager_load_playlists (shell->priv->playlist_manager);
 	rb_display_page_group_loaded (RB_DISPLAY_PAGE_GROUP (RB_DISPLAY_PAGE_GROUP_PLAYLISTS));
 	shell->priv->load_complete = TRUE;
 	shell->priv->save_playlist_id = g_timeout_add_seconds (10, (GSourceFunc) idle_save_playlist_manager, shell);
+	startup_phase_done (shell, "loading playlists", start);
 
+	start = startup_time (shell);
 	g_signal_emit (shell, rb_shell_signals[DATABASE_LOAD_COMPLETE], 0);
+	g_object_notify (G_OBJECT (shell), "load-complete");
+	startup_phase_done (shell, "load complete handlers", start);
+	rb_debug ("%s", shell->priv->startup_report->str);
 
 	rhythmdb_start_action_thread (shell->priv->db);
 
@@ -156,6 +156,14 @@ gboolean	rb_shell_clear_queue (RBShell *shell,
 gboolean	rb_shell_quit (RBShell *shell,
 			       GError **error);
 
+gboolean	rb_shell_dump_trace (RBShell *shell,
+				     const char *filename,
+				     GError **error);
+
+gboolean	rb_shell_get_database_metrics (RBShell *shell,
+					       char **metrics,
+					       GError **error);
+
 gboolean	rb_shell_activate_source_by_uri (RBShell *shell,
 						 const char *source_uri,
 						 guint play,
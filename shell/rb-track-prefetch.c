@@ -0,0 +1,626 @@
+/*
+ *  Copyright (C) 2011 the Rhythmbox authors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gst/gst.h>
+
+#include "rb-track-prefetch.h"
+#include "rb-file-helpers.h"
+#include "rb-debug.h"
+#include "rb-util.h"
+
+/**
+ * SECTION:rb-track-prefetch
+ * @short_description: fetches upcoming tracks from slow sources ahead of time
+ *
+ * The shell player tells the prefetcher which entries are likely to be played
+ * next.  Entries located on network sources (DAAP shares, HTTP servers, remote
+ * file systems) are copied, one at a time, into a local cache directory.
+ * When the player opens one of those entries and the copy is complete, it plays
+ * the local copy instead, so the stream can start (and cross-fade or
+ * transition gaplessly) without waiting on the network.
+ *
+ * The total size of the copies is limited by the buffer-size property.
+ */
+
+/* URI schemes that are always worth fetching ahead of time */
+static const char *remote_schemes[] = {
+	"daap",
+	"http",
+	"https",
+	"ftp",
+	"smb",
+	"sftp",
+	"dav",
+	"davs",
+	"nfs",
+	NULL
+};
+
+typedef enum {
+	PREFETCH_WAITING,
+	PREFETCH_RUNNING,
+	PREFETCH_DONE,
+	PREFETCH_FAILED
+} RBPrefetchState;
+
+typedef struct {
+	RhythmDBEntry *entry;
+	char *uri;
+	char *path;
+	RBPrefetchState state;
+} RBPrefetchItem;
+
+struct _RBTrackPrefetchPrivate
+{
+	GList *items;
+	RBPrefetchItem *in_use;
+	RBPrefetchItem *current;
+
+	GstElement *pipeline;
+	guint bus_watch_id;
+	GCancellable *cancel;
+
+	char *cache_dir;
+	guint serial;
+
+	guint max_tracks;
+	guint buffer_size;
+};
+
+enum
+{
+	PROP_0,
+	PROP_MAX_TRACKS,
+	PROP_BUFFER_SIZE
+};
+
+static void start_next_fetch (RBTrackPrefetch *prefetch);
+
+G_DEFINE_TYPE (RBTrackPrefetch, rb_track_prefetch, G_TYPE_OBJECT)
+
+/**
+ * rb_track_prefetch_new:
+ *
+ * Creates a new track prefetcher.
+ *
+ * Return value: the #RBTrackPrefetch
+ */
+RBTrackPrefetch *
+rb_track_prefetch_new (void)
+{
+	return g_object_new (RB_TYPE_TRACK_PREFETCH, NULL);
+}
+
+static void
+free_item (RBPrefetchItem *item)
+{
+	/* if the player still has the file open, it can keep reading it */
+	if (item->path != NULL) {
+		g_unlink (item->path);
+		g_free (item->path);
+	}
+	rhythmdb_entry_unref (item->entry);
+	g_free (item->uri);
+	g_free (item);
+}
+
+static void
+stop_fetch (RBTrackPrefetch *prefetch)
+{
+	if (prefetch->priv->cancel != NULL) {
+		g_cancellable_cancel (prefetch->priv->cancel);
+		g_object_unref (prefetch->priv->cancel);
+		prefetch->priv->cancel = NULL;
+	}
+
+	if (prefetch->priv->bus_watch_id != 0) {
+		g_source_remove (prefetch->priv->bus_watch_id);
+		prefetch->priv->bus_watch_id = 0;
+	}
+
+	if (prefetch->priv->pipeline != NULL) {
+		gst_element_set_state (prefetch->priv->pipeline, GST_STATE_NULL);
+		gst_object_unref (prefetch->priv->pipeline);
+		prefetch->priv->pipeline = NULL;
+	}
+
+	prefetch->priv->current = NULL;
+}
+
+static void
+fetch_done (RBTrackPrefetch *prefetch, gboolean success)
+{
+	RBPrefetchItem *item;
+
+	item = prefetch->priv->current;
+	stop_fetch (prefetch);
+
+	if (success) {
+		rb_debug ("finished fetching %s", item->uri);
+		item->state = PREFETCH_DONE;
+	} else {
+		item->state = PREFETCH_FAILED;
+		if (item->path != NULL) {
+			g_unlink (item->path);
+			g_free (item->path);
+			item->path = NULL;
+		}
+	}
+
+	start_next_fetch (prefetch);
+}
+
+static gboolean
+bus_cb (GstBus *bus, GstMessage *message, RBTrackPrefetch *prefetch)
+{
+	switch (GST_MESSAGE_TYPE (message)) {
+	case GST_MESSAGE_EOS:
+		prefetch->priv->bus_watch_id = 0;
+		fetch_done (prefetch, TRUE);
+		return FALSE;
+
+	case GST_MESSAGE_ERROR:
+	{
+		GError *error = NULL;
+		char *debug = NULL;
+
+		gst_message_parse_error (message, &error, &debug);
+		rb_debug ("error fetching %s: %s (%s)",
+			  prefetch->priv->current->uri,
+			  error->message,
+			  debug);
+		g_error_free (error);
+		g_free (debug);
+
+		prefetch->priv->bus_watch_id = 0;
+		fetch_done (prefetch, FALSE);
+		return FALSE;
+	}
+
+	default:
+		return TRUE;
+	}
+}
+
+static void
+start_pipeline (RBTrackPrefetch *prefetch)
+{
+	RBPrefetchItem *item = prefetch->priv->current;
+	GstElement *src;
+	GstElement *sink;
+	GstBus *bus;
+	char *name;
+
+	src = gst_element_make_from_uri (GST_URI_SRC, item->uri, NULL);
+	if (src == NULL) {
+		rb_debug ("no source element for %s", item->uri);
+		fetch_done (prefetch, FALSE);
+		return;
+	}
+
+	name = g_strdup_printf ("%u", ++prefetch->priv->serial);
+	item->path = g_build_filename (prefetch->priv->cache_dir, name, NULL);
+	g_free (name);
+
+	sink = gst_element_factory_make ("filesink", NULL);
+	g_object_set (sink, "location", item->path, NULL);
+
+	prefetch->priv->pipeline = gst_pipeline_new ("prefetch");
+	gst_bin_add_many (GST_BIN (prefetch->priv->pipeline), src, sink, NULL);
+	if (gst_element_link (src, sink) == FALSE) {
+		rb_debug ("unable to link source element for %s", item->uri);
+		fetch_done (prefetch, FALSE);
+		return;
+	}
+
+	bus = gst_element_get_bus (prefetch->priv->pipeline);
+	prefetch->priv->bus_watch_id = gst_bus_add_watch (bus, (GstBusFunc) bus_cb, prefetch);
+	gst_object_unref (bus);
+
+	rb_debug ("fetching %s to %s", item->uri, item->path);
+	gst_element_set_state (prefetch->priv->pipeline, GST_STATE_PLAYING);
+}
+
+typedef struct {
+	RBTrackPrefetch *prefetch;
+	GCancellable *cancel;
+} FilesystemInfoData;
+
+static void
+filesystem_info_cb (GFile *file, GAsyncResult *result, FilesystemInfoData *data)
+{
+	RBTrackPrefetch *prefetch = data->prefetch;
+	GFileInfo *info;
+	GError *error = NULL;
+	gboolean remote = FALSE;
+
+	info = g_file_query_filesystem_info_finish (file, result, &error);
+	if (g_cancellable_is_cancelled (data->cancel)) {
+		/* the item (and maybe the prefetcher) is gone */
+		g_clear_error (&error);
+		if (info != NULL)
+			g_object_unref (info);
+		g_object_unref (data->cancel);
+		g_free (data);
+		return;
+	}
+	g_object_unref (data->cancel);
+	g_free (data);
+
+	if (error != NULL) {
+		rb_debug ("unable to query file system: %s", error->message);
+		g_error_free (error);
+	} else {
+		remote = g_file_info_get_attribute_boolean (info, G_FILE_ATTRIBUTE_FILESYSTEM_REMOTE);
+		g_object_unref (info);
+	}
+
+	g_object_unref (prefetch->priv->cancel);
+	prefetch->priv->cancel = NULL;
+
+	if (remote) {
+		start_pipeline (prefetch);
+	} else {
+		/* local files are fast enough already */
+		fetch_done (prefetch, FALSE);
+	}
+}
+
+static void
+start_next_fetch (RBTrackPrefetch *prefetch)
+{
+	RBPrefetchItem *item = NULL;
+	GList *l;
+	char *scheme;
+
+	if (prefetch->priv->current != NULL)
+		return;
+
+	for (l = prefetch->priv->items; l != NULL; l = l->next) {
+		item = l->data;
+		if (item->state == PREFETCH_WAITING)
+			break;
+	}
+	if (l == NULL)
+		return;
+
+	item->state = PREFETCH_RUNNING;
+	prefetch->priv->current = item;
+
+	scheme = g_uri_parse_scheme (item->uri);
+	if (g_strcmp0 (scheme, "file") == 0) {
+		FilesystemInfoData *data;
+		GFile *file;
+
+		/* only worth it if the file is on a network file system */
+		file = g_file_new_for_uri (item->uri);
+		prefetch->priv->cancel = g_cancellable_new ();
+
+		data = g_new0 (FilesystemInfoData, 1);
+		data->prefetch = prefetch;
+		data->cancel = g_object_ref (prefetch->priv->cancel);
+		g_file_query_filesystem_info_async (file,
+						    G_FILE_ATTRIBUTE_FILESYSTEM_REMOTE,
+						    G_PRIORITY_LOW,
+						    prefetch->priv->cancel,
+						    (GAsyncReadyCallback) filesystem_info_cb,
+						    data);
+		g_object_unref (file);
+	} else {
+		start_pipeline (prefetch);
+	}
+	g_free (scheme);
+}
+
+static gboolean
+should_prefetch (RhythmDBEntry *entry, const char *uri)
+{
+	RhythmDBEntryType *entry_type;
+	RhythmDBEntryCategory category;
+	char *scheme;
+	gboolean result;
+	int i;
+
+	/* streams never end, and we need to know how much space it'll take */
+	entry_type = rhythmdb_entry_get_entry_type (entry);
+	g_object_get (entry_type, "category", &category, NULL);
+	if (category == RHYTHMDB_ENTRY_STREAM)
+		return FALSE;
+	if (rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE) == 0)
+		return FALSE;
+
+	scheme = g_uri_parse_scheme (uri);
+	if (scheme == NULL)
+		return FALSE;
+
+	result = (strcmp (scheme, "file") == 0);
+	for (i = 0; remote_schemes[i] != NULL && result == FALSE; i++) {
+		result = (strcmp (scheme, remote_schemes[i]) == 0);
+	}
+	g_free (scheme);
+	return result;
+}
+
+static RBPrefetchItem *
+take_item (RBTrackPrefetch *prefetch, RhythmDBEntry *entry)
+{
+	GList *l;
+
+	for (l = prefetch->priv->items; l != NULL; l = l->next) {
+		RBPrefetchItem *item = l->data;
+		if (item->entry == entry) {
+			prefetch->priv->items = g_list_delete_link (prefetch->priv->items, l);
+			return item;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * rb_track_prefetch_set_entries:
+ * @prefetch: the #RBTrackPrefetch
+ * @entries: (element-type RhythmDBEntry): entries likely to be played next, in order
+ *
+ * Updates the set of entries to fetch.  Copies of entries that are no longer
+ * in the set are discarded, and entries beyond the track count or buffer size
+ * limits are ignored.
+ */
+void
+rb_track_prefetch_set_entries (RBTrackPrefetch *prefetch, GList *entries)
+{
+	GList *items = NULL;
+	GList *l;
+	guint64 budget;
+	guint count = 0;
+
+	budget = (guint64) prefetch->priv->buffer_size * 1024 * 1024;
+
+	for (l = entries; l != NULL && count < prefetch->priv->max_tracks; l = l->next) {
+		RhythmDBEntry *entry = l->data;
+		RBPrefetchItem *item;
+		guint64 size;
+
+		size = rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE);
+		if (size > budget)
+			break;
+
+		item = take_item (prefetch, entry);
+		if (item == NULL) {
+			char *uri;
+
+			uri = rhythmdb_entry_get_playback_uri (entry);
+			if (uri == NULL || should_prefetch (entry, uri) == FALSE) {
+				g_free (uri);
+				continue;
+			}
+
+			item = g_new0 (RBPrefetchItem, 1);
+			item->entry = rhythmdb_entry_ref (entry);
+			item->uri = uri;
+			item->state = PREFETCH_WAITING;
+		}
+
+		items = g_list_prepend (items, item);
+		budget -= size;
+		count++;
+	}
+
+	/* discard anything that's no longer wanted */
+	for (l = prefetch->priv->items; l != NULL; l = l->next) {
+		RBPrefetchItem *item = l->data;
+		if (item == prefetch->priv->current) {
+			rb_debug ("abandoning fetch of %s", item->uri);
+			stop_fetch (prefetch);
+		}
+		free_item (item);
+	}
+	g_list_free (prefetch->priv->items);
+	prefetch->priv->items = g_list_reverse (items);
+
+	start_next_fetch (prefetch);
+}
+
+/**
+ * rb_track_prefetch_get_uri:
+ * @prefetch: the #RBTrackPrefetch
+ * @entry: the entry about to be played
+ *
+ * If a complete local copy of @entry is available, returns its URI.
+ * The copy is kept until another copy is handed out.
+ *
+ * Return value: URI of the local copy, or NULL
+ */
+char *
+rb_track_prefetch_get_uri (RBTrackPrefetch *prefetch, RhythmDBEntry *entry)
+{
+	RBPrefetchItem *item;
+	GList *l;
+
+	for (l = prefetch->priv->items; l != NULL; l = l->next) {
+		item = l->data;
+		if (item->entry == entry && item->state == PREFETCH_DONE)
+			break;
+	}
+	if (l == NULL)
+		return NULL;
+
+	prefetch->priv->items = g_list_delete_link (prefetch->priv->items, l);
+	if (prefetch->priv->in_use != NULL) {
+		free_item (prefetch->priv->in_use);
+	}
+	prefetch->priv->in_use = item;
+
+	return g_filename_to_uri (item->path, NULL, NULL);
+}
+
+static void
+clear_cache_dir (const char *path)
+{
+	GDir *dir;
+	const char *name;
+
+	dir = g_dir_open (path, 0, NULL);
+	if (dir == NULL)
+		return;
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		char *filename;
+
+		filename = g_build_filename (path, name, NULL);
+		g_unlink (filename);
+		g_free (filename);
+	}
+	g_dir_close (dir);
+}
+
+static void
+rb_track_prefetch_init (RBTrackPrefetch *prefetch)
+{
+	prefetch->priv = G_TYPE_INSTANCE_GET_PRIVATE (prefetch,
+						      RB_TYPE_TRACK_PREFETCH,
+						      RBTrackPrefetchPrivate);
+
+	prefetch->priv->cache_dir = g_build_filename (rb_user_cache_dir (), "prefetch", NULL);
+	g_mkdir_with_parents (prefetch->priv->cache_dir, 0700);
+
+	/* copies left behind by a previous instance */
+	clear_cache_dir (prefetch->priv->cache_dir);
+}
+
+static void
+impl_dispose (GObject *object)
+{
+	RBTrackPrefetch *prefetch = RB_TRACK_PREFETCH (object);
+
+	stop_fetch (prefetch);
+
+	rb_list_destroy_free (prefetch->priv->items, (GDestroyNotify) free_item);
+	prefetch->priv->items = NULL;
+
+	if (prefetch->priv->in_use != NULL) {
+		free_item (prefetch->priv->in_use);
+		prefetch->priv->in_use = NULL;
+	}
+
+	G_OBJECT_CLASS (rb_track_prefetch_parent_class)->dispose (object);
+}
+
+static void
+impl_finalize (GObject *object)
+{
+	RBTrackPrefetch *prefetch = RB_TRACK_PREFETCH (object);
+
+	g_free (prefetch->priv->cache_dir);
+
+	G_OBJECT_CLASS (rb_track_prefetch_parent_class)->finalize (object);
+}
+
+static void
+impl_set_property (GObject *object,
+		   guint prop_id,
+		   const GValue *value,
+		   GParamSpec *pspec)
+{
+	RBTrackPrefetch *prefetch = RB_TRACK_PREFETCH (object);
+
+	switch (prop_id) {
+	case PROP_MAX_TRACKS:
+		prefetch->priv->max_tracks = g_value_get_uint (value);
+		break;
+	case PROP_BUFFER_SIZE:
+		prefetch->priv->buffer_size = g_value_get_uint (value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+impl_get_property (GObject *object,
+		   guint prop_id,
+		   GValue *value,
+		   GParamSpec *pspec)
+{
+	RBTrackPrefetch *prefetch = RB_TRACK_PREFETCH (object);
+
+	switch (prop_id) {
+	case PROP_MAX_TRACKS:
+		g_value_set_uint (value, prefetch->priv->max_tracks);
+		break;
+	case PROP_BUFFER_SIZE:
+		g_value_set_uint (value, prefetch->priv->buffer_size);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+rb_track_prefetch_class_init (RBTrackPrefetchClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->dispose = impl_dispose;
+	object_class->finalize = impl_finalize;
+	object_class->set_property = impl_set_property;
+	object_class->get_property = impl_get_property;
+
+	/**
+	 * RBTrackPrefetch:max-tracks:
+	 *
+	 * Maximum number of upcoming tracks to fetch.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_MAX_TRACKS,
+					 g_param_spec_uint ("max-tracks",
+							    "max tracks",
+							    "maximum number of tracks to fetch",
+							    0, G_MAXUINT, 2,
+							    G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+	/**
+	 * RBTrackPrefetch:buffer-size:
+	 *
+	 * Maximum total size of fetched tracks, in megabytes.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_BUFFER_SIZE,
+					 g_param_spec_uint ("buffer-size",
+							    "buffer size",
+							    "maximum size of fetched tracks in megabytes",
+							    0, G_MAXUINT, 256,
+							    G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+
+	g_type_class_add_private (klass, sizeof (RBTrackPrefetchPrivate));
+}
@@ -0,0 +1,71 @@
+/*
+ *  Copyright (C) 2011 the Rhythmbox authors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+#ifndef RB_TRACK_PREFETCH_H
+#define RB_TRACK_PREFETCH_H
+
+#include <glib-object.h>
+
+#include <rhythmdb/rhythmdb.h>
+
+G_BEGIN_DECLS
+
+typedef struct _RBTrackPrefetch RBTrackPrefetch;
+typedef struct _RBTrackPrefetchClass RBTrackPrefetchClass;
+typedef struct _RBTrackPrefetchPrivate RBTrackPrefetchPrivate;
+
+#define RB_TYPE_TRACK_PREFETCH         (rb_track_prefetch_get_type ())
+#define RB_TRACK_PREFETCH(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), RB_TYPE_TRACK_PREFETCH, RBTrackPrefetch))
+#define RB_TRACK_PREFETCH_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), RB_TYPE_TRACK_PREFETCH, RBTrackPrefetchClass))
+#define RB_IS_TRACK_PREFETCH(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), RB_TYPE_TRACK_PREFETCH))
+#define RB_IS_TRACK_PREFETCH_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), RB_TYPE_TRACK_PREFETCH))
+#define RB_TRACK_PREFETCH_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), RB_TYPE_TRACK_PREFETCH, RBTrackPrefetchClass))
+
+struct _RBTrackPrefetch
+{
+	GObject parent;
+
+	RBTrackPrefetchPrivate *priv;
+};
+
+struct _RBTrackPrefetchClass
+{
+	GObjectClass parent_class;
+};
+
+GType			rb_track_prefetch_get_type	(void);
+
+RBTrackPrefetch *	rb_track_prefetch_new		(void);
+
+void			rb_track_prefetch_set_entries	(RBTrackPrefetch *prefetch,
+							 GList *entries);
+char *			rb_track_prefetch_get_uri	(RBTrackPrefetch *prefetch,
+							 RhythmDBEntry *entry);
+
+G_END_DECLS
+
+#endif /* RB_TRACK_PREFETCH_H */
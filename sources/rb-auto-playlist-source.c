@@ -59,6 +59,12 @@
  * If the user has not set a sort order as part of the playlist definition,
  * the entry view columns are made clickable to allow the user to sort the
  * results.
+ *
+ * While the playlist is not selected or playing, and nothing else has held
+ * its base query model for a while, the query model hibernates, so database changes
+ * aren't checked against the playlist's query.  The base-query-model property
+ * provides a model chained to the playlist's query model, so the playlist can
+ * tell when nothing else is using it.
  */
 
 static void rb_auto_playlist_source_constructed (GObject *object);
@@ -74,6 +80,8 @@ static void rb_auto_playlist_source_get_property (GObject *object,
 						  GParamSpec *pspec);
 
 /* source methods */
+static void impl_selected (RBDisplayPage *page);
+static void impl_deselected (RBDisplayPage *page);
 static gboolean impl_show_popup (RBDisplayPage *page);
 static gboolean impl_receive_drag (RBDisplayPage *page, GtkSelectionData *data);
 static void impl_search (RBSource *source, RBSourceSearch *search, const char *cur_text, const char *new_text);
@@ -89,6 +97,7 @@ static void rb_auto_playlist_source_songs_sort_order_changed_cb (GObject *object
 								 RBAutoPlaylistSource *source);
 static void rb_auto_playlist_source_do_query (RBAutoPlaylistSource *source,
 					      gboolean subset);
+static void drop_observer_model (RBAutoPlaylistSource *source);
 
 /* browser stuff */
 static GList *impl_get_property_views (RBSource *source);
@@ -115,6 +124,9 @@ enum
 
 #define AUTO_PLAYLIST_SOURCE_POPUP_PATH "/AutoPlaylistSourcePopup"
 
+/* seconds to wait after the last observer goes away before hibernating */
+#define HIBERNATE_DELAY 30
+
 typedef struct _RBAutoPlaylistSourcePrivate RBAutoPlaylistSourcePrivate;
 
 struct _RBAutoPlaylistSourcePrivate
@@ -135,6 +147,13 @@ struct _RBAutoPlaylistSourcePrivate
 	RhythmDBQuery *search_query;
 
 	GtkActionGroup *action_group;
+
+	RhythmDBQueryModel *observer_model;
+
+	gboolean selected;
+	gboolean playing;
+	gboolean observed;
+	guint hibernate_id;
 };
 
 static gpointer playlist_pixbuf = NULL;
@@ -156,6 +175,8 @@ rb_auto_playlist_source_class_init (RBAutoPlaylistSourceClass *klass)
 	object_class->set_property = rb_auto_playlist_source_set_property;
 	object_class->get_property = rb_auto_playlist_source_get_property;
 
+	page_class->selected = impl_selected;
+	page_class->deselected = impl_deselected;
 	page_class->show_popup = impl_show_popup;
 	page_class->receive_drag = impl_receive_drag;
 
@@ -204,6 +225,8 @@ rb_auto_playlist_source_dispose (GObject *object)
 {
 	RBAutoPlaylistSourcePrivate *priv = GET_PRIVATE (object);
 
+	drop_observer_model (RB_AUTO_PLAYLIST_SOURCE (object));
+
 	if (priv->action_group != NULL) {
 		g_object_unref (priv->action_group);
 		priv->action_group = NULL;
@@ -242,6 +265,102 @@ rb_auto_playlist_source_finalize (GObject *object)
 	G_OBJECT_CLASS (rb_auto_playlist_source_parent_class)->finalize (object);
 }
 
+static void
+update_hibernation (RBAutoPlaylistSource *source)
+{
+	RBAutoPlaylistSourcePrivate *priv = GET_PRIVATE (source);
+
+	if (priv->cached_all_query == NULL)
+		return;
+
+	rhythmdb_query_model_hibernate (priv->cached_all_query,
+					!(priv->selected || priv->playing || priv->observed));
+}
+
+static gboolean
+hibernate_timeout_cb (RBAutoPlaylistSource *source)
+{
+	RBAutoPlaylistSourcePrivate *priv = GET_PRIVATE (source);
+
+	GDK_THREADS_ENTER ();
+	priv->hibernate_id = 0;
+	priv->observed = FALSE;
+	update_hibernation (source);
+	GDK_THREADS_LEAVE ();
+	return FALSE;
+}
+
+static void
+observer_model_toggle_cb (RBAutoPlaylistSource *source, GObject *model, gboolean is_last_ref)
+{
+	RBAutoPlaylistSourcePrivate *priv = GET_PRIVATE (source);
+
+	/* the toggle reference is ours, so any other reference is an observer.
+	 * property reads take and drop short-lived references all the time,
+	 * so wait a while before going back to sleep.
+	 */
+	if (is_last_ref) {
+		if (priv->hibernate_id == 0) {
+			priv->hibernate_id = g_timeout_add_seconds (HIBERNATE_DELAY,
+								    (GSourceFunc) hibernate_timeout_cb,
+								    source);
+		}
+	} else {
+		if (priv->hibernate_id != 0) {
+			g_source_remove (priv->hibernate_id);
+			priv->hibernate_id = 0;
+		}
+		priv->observed = TRUE;
+		update_hibernation (source);
+	}
+}
+
+static RhythmDBQueryModel *
+get_observer_model (RBAutoPlaylistSource *source)
+{
+	RBAutoPlaylistSourcePrivate *priv = GET_PRIVATE (source);
+
+	if (priv->observer_model == NULL && priv->cached_all_query != NULL) {
+		RhythmDB *db = rb_playlist_source_get_db (RB_PLAYLIST_SOURCE (source));
+
+		priv->observer_model = rhythmdb_query_model_new_empty (db);
+		rhythmdb_query_model_chain (priv->observer_model, priv->cached_all_query, TRUE);
+		g_object_add_toggle_ref (G_OBJECT (priv->observer_model),
+					 (GToggleNotify) observer_model_toggle_cb,
+					 source);
+		g_object_unref (priv->observer_model);
+	}
+	return priv->observer_model;
+}
+
+static void
+drop_observer_model (RBAutoPlaylistSource *source)
+{
+	RBAutoPlaylistSourcePrivate *priv = GET_PRIVATE (source);
+
+	if (priv->observer_model != NULL) {
+		/* anything still holding the model keeps it, chained to the old query model */
+		g_object_remove_toggle_ref (G_OBJECT (priv->observer_model),
+					    (GToggleNotify) observer_model_toggle_cb,
+					    source);
+		priv->observer_model = NULL;
+	}
+	if (priv->hibernate_id != 0) {
+		g_source_remove (priv->hibernate_id);
+		priv->hibernate_id = 0;
+	}
+	priv->observed = FALSE;
+}
+
+static void
+playing_source_changed_cb (GObject *player, RBSource *playing, RBAutoPlaylistSource *source)
+{
+	RBAutoPlaylistSourcePrivate *priv = GET_PRIVATE (source);
+
+	priv->playing = (playing == RB_SOURCE (source));
+	update_hibernation (source);
+}
+
 static void
 rb_auto_playlist_source_constructed (GObject *object)
 {
@@ -249,6 +368,7 @@ rb_auto_playlist_source_constructed (GObject *object)
 	RBAutoPlaylistSource *source;
 	RBAutoPlaylistSourcePrivate *priv;
 	RBShell *shell;
+	GObject *shell_player;
 	RhythmDBEntryType *entry_type;
 
 	RB_CHAIN_GOBJECT_METHOD (rb_auto_playlist_source_parent_class, constructed, object);
@@ -291,6 +411,13 @@ rb_auto_playlist_source_constructed (GObject *object)
 	}
 	priv->default_search = rb_source_search_basic_new (RHYTHMDB_PROP_SEARCH_MATCH);
 
+	g_object_get (shell, "shell-player", &shell_player, NULL);
+	g_signal_connect_object (shell_player,
+				 "playing-source-changed",
+				 G_CALLBACK (playing_source_changed_cb),
+				 source, 0);
+	g_object_unref (shell_player);
+
 	g_object_unref (shell);
 
 	/* reparent the entry view */
@@ -361,7 +488,7 @@ rb_auto_playlist_source_get_property (GObject *object,
 
 	switch (prop_id) {
 	case PROP_BASE_QUERY_MODEL:
-		g_value_set_object (value, priv->cached_all_query);
+		g_value_set_object (value, get_observer_model (RB_AUTO_PLAYLIST_SOURCE (object)));
 		break;
 	case PROP_SHOW_BROWSER:
 		g_value_set_boolean (value, gtk_widget_get_visible (GTK_WIDGET (priv->browser)));
@@ -475,6 +602,24 @@ rb_auto_playlist_source_new_from_xml (RBShell *shell, xmlNodePtr node)
 	return RB_SOURCE (source);
 }
 
+static void
+impl_selected (RBDisplayPage *page)
+{
+	RBAutoPlaylistSourcePrivate *priv = GET_PRIVATE (page);
+
+	priv->selected = TRUE;
+	update_hibernation (RB_AUTO_PLAYLIST_SOURCE (page));
+}
+
+static void
+impl_deselected (RBDisplayPage *page)
+{
+	RBAutoPlaylistSourcePrivate *priv = GET_PRIVATE (page);
+
+	priv->selected = FALSE;
+	update_hibernation (RB_AUTO_PLAYLIST_SOURCE (page));
+}
+
 static gboolean
 impl_show_popup (RBDisplayPage *page)
 {
@@ -825,6 +970,7 @@ rb_auto_playlist_source_set_query (RBAutoPlaylistSource *source,
 	if (priv->cached_all_query) {
 		g_object_unref (G_OBJECT (priv->cached_all_query));
 	}
+	drop_observer_model (source);
 
 	if (priv->limit_value) {
 		g_value_array_free (priv->limit_value);
@@ -847,8 +993,12 @@ rb_auto_playlist_source_set_query (RBAutoPlaylistSource *source,
 	rhythmdb_do_full_query_async_parsed (db,
 					     RHYTHMDB_QUERY_RESULTS (priv->cached_all_query),
 					     priv->query);
+	update_hibernation (source);
 
 	priv->query_resetting = FALSE;
+
+	rb_playlist_source_mark_dirty (RB_PLAYLIST_SOURCE (source));
+	g_object_notify (G_OBJECT (source), "base-query-model");
 }
 
 /**
@@ -105,6 +105,7 @@ static void songs_view_drag_data_received_cb (GtkWidget *widget,
 static void rb_browser_source_do_query (RBBrowserSource *source,
 					gboolean subset);
 static void rb_browser_source_populate (RBBrowserSource *source);
+static void impl_selected (RBDisplayPage *page);
 
 struct RBBrowserSourcePrivate
 {
@@ -119,6 +120,7 @@ struct RBBrowserSourcePrivate
 	RhythmDBQuery *search_query;
 	RhythmDBPropType search_prop;
 	gboolean populate;
+	gboolean populate_deferred;
 	gboolean query_active;
 	gboolean search_on_completion;
 	RBSourceSearch *default_search;
@@ -172,6 +174,7 @@ static void
 rb_browser_source_class_init (RBBrowserSourceClass *klass)
 {
 	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	RBDisplayPageClass *page_class = RB_DISPLAY_PAGE_CLASS (klass);
 	RBSourceClass *source_class = RB_SOURCE_CLASS (klass);
 
 	object_class->dispose = rb_browser_source_dispose;
@@ -181,6 +184,8 @@ rb_browser_source_class_init (RBBrowserSourceClass *klass)
 	object_class->set_property = rb_browser_source_set_property;
 	object_class->get_property = rb_browser_source_get_property;
 
+	page_class->selected = impl_selected;
+
 	source_class->impl_can_browse = (RBSourceFeatureFunc) rb_true_function;
 	source_class->impl_search = impl_search;
 	source_class->impl_get_entry_view = impl_get_entry_view;
@@ -423,7 +428,12 @@ rb_browser_source_constructed (GObject *object)
 				      FALSE);
 
 	source->priv->cached_all_query = rhythmdb_query_model_new_empty (source->priv->db);
-	rb_browser_source_populate (source);
+
+	/* wait until the source is selected or something asks for its
+	 * base query model before running the query, so sources that are
+	 * never looked at don't have to process every entry.
+	 */
+	source->priv->populate_deferred = TRUE;
 
 	g_object_unref (entry_type);
 	g_object_unref (shell_player);
@@ -441,8 +451,11 @@ rb_browser_source_set_property (GObject *object,
 	case PROP_POPULATE:
 		source->priv->populate = g_value_get_boolean (value);
 
-		/* if being set after construction, run the query now.  otherwise the constructor will do it. */
-		if (source->priv->songs != NULL) {
+		/* if being set after construction, run the query now, unless the
+		 * source is still waiting to be selected.  otherwise the constructor
+		 * will set things up.
+		 */
+		if (source->priv->songs != NULL && source->priv->populate_deferred == FALSE) {
 			rb_browser_source_populate (source);
 		}
 		break;
@@ -473,6 +486,10 @@ rb_browser_source_get_property (GObject *object,
 
 	switch (prop_id) {
 	case PROP_BASE_QUERY_MODEL:
+		if (source->priv->populate_deferred) {
+			rb_debug ("base query model requested, populating source now");
+			rb_browser_source_populate (source);
+		}
 		g_value_set_object (value, source->priv->cached_all_query);
 		break;
 	case PROP_POPULATE:
@@ -503,6 +520,8 @@ rb_browser_source_populate (RBBrowserSource *source)
 {
 	RhythmDBEntryType *entry_type;
 
+	/* the source is wanted now, so run the query as soon as it's allowed to */
+	source->priv->populate_deferred = FALSE;
 	if (source->priv->populate == FALSE)
 		return;
 
@@ -522,6 +541,17 @@ rb_browser_source_populate (RBBrowserSource *source)
 	g_object_unref (entry_type);
 }
 
+static void
+impl_selected (RBDisplayPage *page)
+{
+	RBBrowserSource *source = RB_BROWSER_SOURCE (page);
+
+	if (source->priv->populate_deferred) {
+		rb_debug ("source selected, populating now");
+		rb_browser_source_populate (source);
+	}
+}
+
 static void
 browse_property (RBBrowserSource *source, RhythmDBPropType prop)
 {
@@ -111,6 +111,9 @@ static void rb_playlist_source_track_cell_data_func (GtkTreeViewColumn *column,
 						     GtkTreeModel *tree_model, GtkTreeIter *iter,
 						     RBPlaylistSource *source);
 static void default_mark_dirty (RBPlaylistSource *source);
+static void rb_playlist_source_name_changed_cb (GObject *object,
+						GParamSpec *pspec,
+						RBPlaylistSource *source);
 static void rb_playlist_source_songs_sort_order_changed_cb (GObject *object,
 							    GParamSpec *pspec,
 							    RBPlaylistSource *source);
@@ -145,6 +148,7 @@ struct RBPlaylistSourcePrivate
 	gboolean dispose_has_run;
 
 	char *title;
+	char *saved_xml;
 };
 
 #define RB_PLAYLIST_SOURCE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), RB_TYPE_PLAYLIST_SOURCE, RBPlaylistSourcePrivate))
@@ -304,6 +308,11 @@ rb_playlist_source_constructed (GObject *object)
 				 G_CALLBACK (rb_playlist_source_songs_sort_order_changed_cb),
 				 source, 0);
 
+	g_signal_connect (source,
+			  "notify::name",
+			  G_CALLBACK (rb_playlist_source_name_changed_cb),
+			  source);
+
 	query_model = rhythmdb_query_model_new_empty (source->priv->db);
 	rb_playlist_source_set_query_model (source, query_model);
 	g_object_unref (query_model);
@@ -406,6 +415,7 @@ rb_playlist_source_finalize (GObject *object)
 	g_hash_table_destroy (source->priv->entries);
 
 	g_free (source->priv->title);
+	g_free (source->priv->saved_xml);
 	source->priv = NULL;
 
 	G_OBJECT_CLASS (rb_playlist_source_parent_class)->finalize (object);
@@ -832,6 +842,47 @@ rb_playlist_source_save_to_xml (RBPlaylistSource *source,
 	source->priv->dirty = FALSE;
 }
 
+/**
+ * rb_playlist_source_save_to_string:
+ * @source: the playlist source to save
+ * @force: if TRUE, always convert the playlist again
+ *
+ * Returns the XML representation of the playlist as created by
+ * #rb_playlist_source_save_to_xml, as a string.  The string is kept
+ * until the playlist is changed, so saving a playlist that hasn't
+ * changed since the last save doesn't require converting it again.
+ *
+ * Return value: XML representation of the playlist
+ */
+char *
+rb_playlist_source_save_to_string (RBPlaylistSource *source, gboolean force)
+{
+	g_return_val_if_fail (RB_IS_PLAYLIST_SOURCE (source), NULL);
+
+	if (force || source->priv->dirty || source->priv->saved_xml == NULL) {
+		xmlDocPtr doc;
+		xmlNodePtr root;
+		xmlBufferPtr buffer;
+
+		doc = xmlNewDoc ((xmlChar *) "1.0");
+		root = xmlNewDocNode (doc, NULL, (xmlChar *) "rhythmdb-playlists", NULL);
+		xmlDocSetRootElement (doc, root);
+
+		rb_playlist_source_save_to_xml (source, root);
+
+		buffer = xmlBufferCreate ();
+		xmlNodeDump (buffer, doc, root->children, 1, 1);
+
+		g_free (source->priv->saved_xml);
+		source->priv->saved_xml = g_strdup ((const char *) xmlBufferContent (buffer));
+
+		xmlBufferFree (buffer);
+		xmlFreeDoc (doc);
+	}
+
+	return g_strdup (source->priv->saved_xml);
+}
+
 static void
 rb_playlist_source_row_deleted (GtkTreeModel *model,
 				GtkTreePath *path,
@@ -1088,6 +1139,20 @@ rb_playlist_source_songs_sort_order_changed_cb (GObject *object,
 {
 	rb_debug ("sort order changed");
 	rb_entry_view_resort_model (RB_ENTRY_VIEW (object));
+
+	/* some playlists save their sort order */
+	g_free (source->priv->saved_xml);
+	source->priv->saved_xml = NULL;
+}
+
+static void
+rb_playlist_source_name_changed_cb (GObject *object,
+				    GParamSpec *pspec,
+				    RBPlaylistSource *source)
+{
+	/* the saved form of the playlist includes its name */
+	g_free (source->priv->saved_xml);
+	source->priv->saved_xml = NULL;
 }
 
 static void
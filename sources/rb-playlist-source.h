@@ -79,6 +79,8 @@ void		rb_playlist_source_save_playlist(RBPlaylistSource *source,
 
 void		rb_playlist_source_save_to_xml	(RBPlaylistSource *source,
 						 xmlNodePtr parent_node);
+char *		rb_playlist_source_save_to_string (RBPlaylistSource *source,
+						 gboolean force);
 
 /* methods for subclasses to call */
 
@@ -27,9 +27,13 @@
 
 #include "config.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "rb-sync-state.h"
 #include "rb-util.h"
 #include "rb-debug.h"
+#include "rb-file-helpers.h"
 
 #include "rhythmdb-query-model.h"
 #include "rb-podcast-manager.h"
@@ -42,6 +46,17 @@ struct _RBSyncStatePrivate
 	/* we don't own a reference on these */
 	RBMediaPlayerSource *source;
 	RBSyncSettings *sync_settings;
+
+	RhythmDB *db;
+	char *manifest_path;
+
+	/* entries contributed to the itinerary by each sync group, and the
+	 * entries on the device, kept between settings changes.
+	 * all map track uuids to entries.
+	 */
+	GHashTable *group_entries;
+	GHashTable *device_music;
+	GHashTable *device_podcasts;
 };
 
 enum {
@@ -85,23 +100,17 @@ _sum_entry_size (GHashTable *entries)
 	return sum;
 }
 
-static void
-_g_hash_table_transfer_all (GHashTable *target, GHashTable *source)
-{
-	GHashTableIter iter;
-	gpointer key, value;
-
-	g_hash_table_iter_init (&iter, source);
-	while (g_hash_table_iter_next (&iter, &key, &value)) {
-		g_hash_table_insert (target, key, value);
-		g_hash_table_iter_steal (&iter);
-	}
-}
+/* track uuids for entries, shared by all sync states.  these are
+ * dropped when the entry changes or is deleted, and the whole cache
+ * goes away with the last sync state.
+ */
+static GStaticMutex uuid_cache_lock = G_STATIC_MUTEX_INIT;
+static GHashTable *uuid_cache = NULL;
+static guint uuid_cache_users = 0;
 
-char *
-rb_sync_state_make_track_uuid  (RhythmDBEntry *entry)
+static char *
+compute_track_uuid (RhythmDBEntry *entry)
 {
-	/* This function is for hashing the two databases for syncing. */
 	GString *str = g_string_new ("");
 	char *result;
 
@@ -130,6 +139,181 @@ rb_sync_state_make_track_uuid  (RhythmDBEntry *entry)
 	return result;
 }
 
+static void
+uuid_cache_set (RhythmDBEntry *entry, const char *uuid)
+{
+	g_static_mutex_lock (&uuid_cache_lock);
+	if (uuid_cache != NULL) {
+		g_hash_table_insert (uuid_cache, rhythmdb_entry_ref (entry), g_strdup (uuid));
+	}
+	g_static_mutex_unlock (&uuid_cache_lock);
+}
+
+static void
+uuid_cache_entry_changed_cb (RhythmDB *db, RhythmDBEntry *entry, GValueArray *changes, gpointer data)
+{
+	int i;
+
+	for (i = 0; i < changes->n_values; i++) {
+		GValue *v = g_value_array_get_nth (changes, i);
+		RhythmDBEntryChange *change = g_value_get_boxed (v);
+
+		switch (change->prop) {
+		case RHYTHMDB_PROP_TITLE:
+		case RHYTHMDB_PROP_ARTIST:
+		case RHYTHMDB_PROP_GENRE:
+		case RHYTHMDB_PROP_ALBUM:
+		case RHYTHMDB_PROP_DURATION:
+		case RHYTHMDB_PROP_TRACK_NUMBER:
+		case RHYTHMDB_PROP_DISC_NUMBER:
+			g_static_mutex_lock (&uuid_cache_lock);
+			g_hash_table_remove (uuid_cache, entry);
+			g_static_mutex_unlock (&uuid_cache_lock);
+			return;
+		default:
+			break;
+		}
+	}
+}
+
+static void
+uuid_cache_entry_deleted_cb (RhythmDB *db, RhythmDBEntry *entry, gpointer data)
+{
+	g_static_mutex_lock (&uuid_cache_lock);
+	g_hash_table_remove (uuid_cache, entry);
+	g_static_mutex_unlock (&uuid_cache_lock);
+}
+
+static void
+uuid_cache_init (RhythmDB *db)
+{
+	g_static_mutex_lock (&uuid_cache_lock);
+	if (uuid_cache == NULL) {
+		uuid_cache = g_hash_table_new_full (g_direct_hash,
+						    g_direct_equal,
+						    (GDestroyNotify) rhythmdb_entry_unref,
+						    g_free);
+		g_signal_connect (db, "entry-changed", G_CALLBACK (uuid_cache_entry_changed_cb), NULL);
+		g_signal_connect (db, "entry-deleted", G_CALLBACK (uuid_cache_entry_deleted_cb), NULL);
+	}
+	uuid_cache_users++;
+	g_static_mutex_unlock (&uuid_cache_lock);
+}
+
+static void
+uuid_cache_release (RhythmDB *db)
+{
+	g_static_mutex_lock (&uuid_cache_lock);
+	if (--uuid_cache_users == 0) {
+		g_signal_handlers_disconnect_by_func (db, G_CALLBACK (uuid_cache_entry_changed_cb), NULL);
+		g_signal_handlers_disconnect_by_func (db, G_CALLBACK (uuid_cache_entry_deleted_cb), NULL);
+		g_hash_table_destroy (uuid_cache);
+		uuid_cache = NULL;
+	}
+	g_static_mutex_unlock (&uuid_cache_lock);
+}
+
+/**
+ * rb_sync_state_make_track_uuid:
+ * @entry: a #RhythmDBEntry
+ *
+ * Returns an identifier for the track, used to match tracks in the
+ * library with tracks on a device.  Identifiers are cached once a
+ * sync state has been created.
+ *
+ * Return value: (transfer full): track identifier
+ */
+char *
+rb_sync_state_make_track_uuid  (RhythmDBEntry *entry)
+{
+	char *uuid = NULL;
+
+	g_static_mutex_lock (&uuid_cache_lock);
+	if (uuid_cache != NULL) {
+		uuid = g_strdup (g_hash_table_lookup (uuid_cache, entry));
+	}
+	g_static_mutex_unlock (&uuid_cache_lock);
+
+	if (uuid == NULL) {
+		uuid = compute_track_uuid (entry);
+		uuid_cache_set (entry, uuid);
+	}
+	return uuid;
+}
+
+/*
+ * The manifest records the uuids of the tracks on a device, so the next
+ * time the device is connected they don't need to be calculated again.
+ * Each line holds the location, file size, modification time and uuid
+ * of a track.  Tracks whose size or modification time has changed are
+ * ignored.
+ */
+static void
+load_manifest (RBSyncState *state)
+{
+	char *contents;
+	char **lines;
+	int loaded = 0;
+	int i;
+
+	if (g_file_get_contents (state->priv->manifest_path, &contents, NULL, NULL) == FALSE) {
+		rb_debug ("no sync manifest at %s", state->priv->manifest_path);
+		return;
+	}
+
+	lines = g_strsplit (contents, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		RhythmDBEntry *entry;
+		char **bits;
+
+		bits = g_strsplit (lines[i], "\t", 4);
+		if (g_strv_length (bits) != 4) {
+			g_strfreev (bits);
+			continue;
+		}
+
+		entry = rhythmdb_entry_lookup_by_location (state->priv->db, bits[0]);
+		if (entry != NULL &&
+		    rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE) == g_ascii_strtoull (bits[1], NULL, 10) &&
+		    rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_MTIME) == strtoul (bits[2], NULL, 10)) {
+			uuid_cache_set (entry, bits[3]);
+			loaded++;
+		}
+		g_strfreev (bits);
+	}
+	g_strfreev (lines);
+	g_free (contents);
+
+	rb_debug ("loaded %d track ids from sync manifest", loaded);
+}
+
+static void
+add_to_manifest (const char *uuid, RhythmDBEntry *entry, GString *str)
+{
+	g_string_append_printf (str, "%s\t%" G_GUINT64_FORMAT "\t%lu\t%s\n",
+				rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION),
+				rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE),
+				rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_MTIME),
+				uuid);
+}
+
+static void
+save_manifest (RBSyncState *state)
+{
+	GString *str;
+	GError *error = NULL;
+
+	str = g_string_new (NULL);
+	g_hash_table_foreach (state->priv->device_music, (GHFunc) add_to_manifest, str);
+	g_hash_table_foreach (state->priv->device_podcasts, (GHFunc) add_to_manifest, str);
+
+	if (g_file_set_contents (state->priv->manifest_path, str->str, str->len, &error) == FALSE) {
+		rb_debug ("unable to save sync manifest: %s", error->message);
+		g_clear_error (&error);
+	}
+	g_string_free (str, TRUE);
+}
+
 static void
 free_sync_lists (RBSyncState *state)
 {
@@ -205,6 +389,64 @@ itinerary_insert_all_of_type (RhythmDB *db,
 				target);
 }
 
+static GHashTable *
+new_entry_map (void)
+{
+	return g_hash_table_new_full (g_str_hash,
+				      g_str_equal,
+				      g_free,
+				      (GDestroyNotify) rhythmdb_entry_unref);
+}
+
+/* returns the cached entries for a sync group, or creates an empty entry
+ * map for the group and sets *cached to FALSE so the caller fills it in.
+ */
+static GHashTable *
+get_group_entries (RBSyncState *state, const char *key, gboolean *cached)
+{
+	GHashTable *entries;
+
+	entries = g_hash_table_lookup (state->priv->group_entries, key);
+	if (entries != NULL) {
+		rb_debug ("reusing %d entries for sync group %s", g_hash_table_size (entries), key);
+		*cached = TRUE;
+		return entries;
+	}
+
+	entries = new_entry_map ();
+	g_hash_table_insert (state->priv->group_entries, g_strdup (key), entries);
+	*cached = FALSE;
+	return entries;
+}
+
+static void
+itinerary_add_group (GHashTable *group, GHashTable *itinerary)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init (&iter, group);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_hash_table_insert (itinerary, key, value);
+	}
+}
+
+static void
+itinerary_insert_all_of_type_cached (RBSyncState *state,
+				     const char *key,
+				     RhythmDBEntryType *entry_type,
+				     GHashTable *target)
+{
+	GHashTable *entries;
+	gboolean cached;
+
+	entries = get_group_entries (state, key, &cached);
+	if (cached == FALSE) {
+		itinerary_insert_all_of_type (state->priv->db, entry_type, entries);
+	}
+	itinerary_add_group (entries, target);
+}
+
 static void
 itinerary_insert_some_playlists (RBSyncState *state,
 				 GHashTable *target)
@@ -227,14 +469,24 @@ itinerary_insert_some_playlists (RBSyncState *state,
 
 		/* See if we should sync it */
 		if (rb_sync_settings_sync_group (state->priv->sync_settings, SYNC_CATEGORY_MUSIC, name)) {
-			GtkTreeModel *query_model;
+			GHashTable *entries;
+			gboolean cached;
+			char *key;
 
 			rb_debug ("adding entries from playlist %s to itinerary", name);
-			g_object_get (RB_SOURCE (list_iter->data), "base-query-model", &query_model, NULL);
-			gtk_tree_model_foreach (query_model,
-						(GtkTreeModelForeachFunc) hash_table_insert_from_tree_model_cb,
-						target);
-			g_object_unref (query_model);
+			key = g_strdup_printf ("music:playlist:%s", name);
+			entries = get_group_entries (state, key, &cached);
+			if (cached == FALSE) {
+				GtkTreeModel *query_model;
+
+				g_object_get (RB_SOURCE (list_iter->data), "base-query-model", &query_model, NULL);
+				gtk_tree_model_foreach (query_model,
+							(GtkTreeModelForeachFunc) hash_table_insert_from_tree_model_cb,
+							entries);
+				g_object_unref (query_model);
+			}
+			itinerary_add_group (entries, target);
+			g_free (key);
 		} else {
 			rb_debug ("not adding playlist %s to itinerary", name);
 		}
@@ -256,7 +508,19 @@ itinerary_insert_some_podcasts (RBSyncState *state,
 	podcasts = rb_sync_settings_get_enabled_groups (state->priv->sync_settings, SYNC_CATEGORY_PODCAST);
 	for (i = podcasts; i != NULL; i = i->next) {
 		GtkTreeModel *query_model;
+		GHashTable *entries;
+		gboolean cached;
+		char *key;
+
 		rb_debug ("adding entries from podcast %s to itinerary", (char *)i->data);
+		key = g_strdup_printf ("podcast:feed:%s", (char *)i->data);
+		entries = get_group_entries (state, key, &cached);
+		g_free (key);
+		if (cached) {
+			itinerary_add_group (entries, target);
+			continue;
+		}
+
 		query_model = GTK_TREE_MODEL (rhythmdb_query_model_new_empty (db));
 		rhythmdb_do_full_query (db, RHYTHMDB_QUERY_RESULTS (query_model),
 					RHYTHMDB_QUERY_PROP_EQUALS,
@@ -274,32 +538,29 @@ itinerary_insert_some_podcasts (RBSyncState *state,
 
 		gtk_tree_model_foreach (query_model,
 					(GtkTreeModelForeachFunc) hash_table_insert_from_tree_model_cb,
-					target);
+					entries);
 		g_object_unref (query_model);
+		itinerary_add_group (entries, target);
 	}
 }
 
+/* the itinerary doesn't own its keys or values; they belong to the
+ * sync group entry maps.
+ */
 static GHashTable *
 build_sync_itinerary (RBSyncState *state)
 {
-	RBShell *shell;
-	RhythmDB *db;
+	RhythmDB *db = state->priv->db;
 	GHashTable *itinerary;
 
 	rb_debug ("building itinerary hash");
 
-	g_object_get (state->priv->source, "shell", &shell, NULL);
-	g_object_get (shell, "db", &db, NULL);
-
-	itinerary = g_hash_table_new_full (g_str_hash,
-					   g_str_equal,
-					   g_free,
-					   (GDestroyNotify)rhythmdb_entry_unref);
+	itinerary = g_hash_table_new (g_str_hash, g_str_equal);
 
 	if (rb_sync_settings_sync_category (state->priv->sync_settings, SYNC_CATEGORY_MUSIC) ||
 	    rb_sync_settings_sync_group (state->priv->sync_settings, SYNC_CATEGORY_MUSIC, SYNC_GROUP_ALL_MUSIC)) {
 		rb_debug ("adding all music to the itinerary");
-		itinerary_insert_all_of_type (db, RHYTHMDB_ENTRY_TYPE_SONG, itinerary);
+		itinerary_insert_all_of_type_cached (state, "music:all", RHYTHMDB_ENTRY_TYPE_SONG, itinerary);
 	} else if (rb_sync_settings_has_enabled_groups (state->priv->sync_settings, SYNC_CATEGORY_MUSIC)) {
 		rb_debug ("adding selected playlists to the itinerary");
 		itinerary_insert_some_playlists (state, itinerary);
@@ -313,7 +574,7 @@ build_sync_itinerary (RBSyncState *state)
 		 * equivalent of insert_some_podcasts, iterating through all feeds
 		 * (use a query for all entries of type PODCAST_FEED to find them)
 		 */
-		itinerary_insert_all_of_type (db, RHYTHMDB_ENTRY_TYPE_PODCAST_POST, itinerary);
+		itinerary_insert_all_of_type_cached (state, "podcast:all", RHYTHMDB_ENTRY_TYPE_PODCAST_POST, itinerary);
 	} else if (rb_sync_settings_has_enabled_groups (state->priv->sync_settings, SYNC_CATEGORY_PODCAST)) {
 		rb_debug ("adding selected podcasts to the itinerary");
 		itinerary_insert_some_podcasts (state, db, itinerary);
@@ -321,9 +582,6 @@ build_sync_itinerary (RBSyncState *state)
 
 	state->sync_podcast_size = _sum_entry_size (itinerary) - state->sync_music_size;
 
-	g_object_unref (shell);
-	g_object_unref (db);
-
 	rb_debug ("finished building itinerary hash; has %d entries", g_hash_table_size (itinerary));
 	return itinerary;
 }
@@ -332,41 +590,55 @@ static GHashTable *
 build_device_state (RBSyncState *state)
 {
 	GHashTable *device;
-	GHashTable *entries;
 
 	rb_debug ("building device contents hash");
 
-	device = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)rhythmdb_entry_unref);
+	if (state->priv->device_music == NULL) {
+		rb_debug ("getting music entries from device");
+		state->priv->device_music = new_entry_map ();
+		rb_media_player_source_get_entries (state->priv->source, SYNC_CATEGORY_MUSIC, state->priv->device_music);
+		rb_debug ("done getting music entries from device");
+	}
+	if (state->priv->device_podcasts == NULL) {
+		rb_debug ("getting podcast entries from device");
+		state->priv->device_podcasts = new_entry_map ();
+		rb_media_player_source_get_entries (state->priv->source, SYNC_CATEGORY_PODCAST, state->priv->device_podcasts);
+		rb_debug ("done getting podcast entries from device");
+	}
 
-	rb_debug ("getting music entries from device");
-	entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) rhythmdb_entry_unref);
+	/* like the itinerary, this doesn't own its keys or values */
+	device = g_hash_table_new (g_str_hash, g_str_equal);
 
-	rb_media_player_source_get_entries (state->priv->source, SYNC_CATEGORY_MUSIC, entries);
-	/*klass->impl_get_entries (source, SYNC_CATEGORY_MUSIC, entries);*/
-	state->total_music_size = _sum_entry_size (entries);
+	state->total_music_size = _sum_entry_size (state->priv->device_music);
 	if (rb_sync_settings_has_enabled_groups (state->priv->sync_settings, SYNC_CATEGORY_MUSIC)) {
-		_g_hash_table_transfer_all (device, entries);
+		itinerary_add_group (state->priv->device_music, device);
 	}
-	g_hash_table_destroy (entries);
-	rb_debug ("done getting music entries from device");
 
-	rb_debug ("getting podcast entries from device");
-	entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) rhythmdb_entry_unref);
-	rb_media_player_source_get_entries (state->priv->source, SYNC_CATEGORY_PODCAST, entries);
-	/*klass->impl_get_entries (source, SYNC_CATEGORY_PODCAST, entries);*/
-	state->total_podcast_size = _sum_entry_size (entries);
+	state->total_podcast_size = _sum_entry_size (state->priv->device_podcasts);
 	if (rb_sync_settings_has_enabled_groups (state->priv->sync_settings, SYNC_CATEGORY_PODCAST)) {
-		_g_hash_table_transfer_all (device, entries);
+		itinerary_add_group (state->priv->device_podcasts, device);
 	}
-	g_hash_table_destroy (entries);
-	rb_debug ("done getting podcast entries from device");
 
 	rb_debug ("done building device contents hash; has %d entries", g_hash_table_size (device));
 	return device;
 }
 
-void
-rb_sync_state_update (RBSyncState *state)
+static void
+clear_cached_state (RBSyncState *state)
+{
+	g_hash_table_remove_all (state->priv->group_entries);
+	if (state->priv->device_music != NULL) {
+		g_hash_table_destroy (state->priv->device_music);
+		state->priv->device_music = NULL;
+	}
+	if (state->priv->device_podcasts != NULL) {
+		g_hash_table_destroy (state->priv->device_podcasts);
+		state->priv->device_podcasts = NULL;
+	}
+}
+
+static void
+update_state (RBSyncState *state)
 {
 	GHashTable *device;
 	GHashTable *itinerary;
@@ -433,11 +705,31 @@ rb_sync_state_update (RBSyncState *state)
 	g_signal_emit (state, signals[UPDATED], 0);
 }
 
+/**
+ * rb_sync_state_update:
+ * @state: the #RBSyncState
+ *
+ * Rebuilds the sync state from the current contents of the library and
+ * the device.  When only the sync settings change, the state is updated
+ * using the library and device contents gathered here, so this should be
+ * called before anything is actually transferred.
+ */
+void
+rb_sync_state_update (RBSyncState *state)
+{
+	clear_cached_state (state);
+	update_state (state);
+
+	if (state->priv->manifest_path != NULL) {
+		save_manifest (state);
+	}
+}
+
 static void
 sync_settings_updated (RBSyncSettings *settings, RBSyncState *state)
 {
 	rb_debug ("sync settings updated, updating state");
-	rb_sync_state_update (state);
+	update_state (state);
 }
 
 
@@ -457,12 +749,50 @@ static void
 rb_sync_state_init (RBSyncState *state)
 {
 	state->priv = G_TYPE_INSTANCE_GET_PRIVATE (state, RB_TYPE_SYNC_STATE, RBSyncStatePrivate);
+
+	state->priv->group_entries = g_hash_table_new_full (g_str_hash,
+							    g_str_equal,
+							    g_free,
+							    (GDestroyNotify) g_hash_table_destroy);
 }
 
 static void
 impl_constructed (GObject *object)
 {
 	RBSyncState *state = RB_SYNC_STATE (object);
+	RBShell *shell;
+	char *device_id;
+
+	g_object_get (state->priv->source, "shell", &shell, NULL);
+	g_object_get (shell, "db", &state->priv->db, NULL);
+	g_object_unref (shell);
+
+	uuid_cache_init (state->priv->db);
+
+	/* use the same device identifier as the sync settings */
+	g_object_get (state->priv->source, "serial", &device_id, NULL);
+	if (device_id == NULL) {
+		g_object_get (state->priv->source, "name", &device_id, NULL);
+	}
+	if (device_id != NULL) {
+		char *dir;
+		char *filename;
+		char *escaped;
+
+		dir = g_build_filename (rb_user_cache_dir (), "sync", NULL);
+		g_mkdir_with_parents (dir, 0700);
+
+		/* serials can contain anything, including path separators */
+		escaped = g_uri_escape_string (device_id, NULL, FALSE);
+		filename = g_strdup_printf ("device-%s.manifest", escaped);
+		state->priv->manifest_path = g_build_filename (dir, filename, NULL);
+		g_free (filename);
+		g_free (escaped);
+		g_free (dir);
+		g_free (device_id);
+
+		load_manifest (state);
+	}
 
 	rb_sync_state_update (state);
 
@@ -514,6 +844,13 @@ impl_finalize (GObject *object)
 	RBSyncState *state = RB_SYNC_STATE (object);
 
 	free_sync_lists (state);
+	clear_cached_state (state);
+	g_hash_table_destroy (state->priv->group_entries);
+	g_free (state->priv->manifest_path);
+	if (state->priv->db != NULL) {
+		uuid_cache_release (state->priv->db);
+		g_object_unref (state->priv->db);
+	}
 
 	G_OBJECT_CLASS (rb_sync_state_parent_class)->finalize (object);
 }
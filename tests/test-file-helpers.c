@@ -28,8 +28,12 @@
 #include "config.h"
 
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <utime.h>
 
 #include <check.h>
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
 #include <locale.h>
 #include "test-utils.h"
@@ -100,6 +104,233 @@ START_TEST (test_rb_check_dir_has_space)
 }
 END_TEST
 
+static const char *recurse_test_dirs[] = { "a", "a/b", "a/b/c", NULL };
+static const char *recurse_test_files[] = { "a/1.mp3", "a/b/2.mp3", "a/b/c/3.mp3", NULL };
+
+static char *
+make_recurse_test_tree (void)
+{
+	char *root;
+	char *path;
+	char *target;
+	int i;
+
+	root = g_strdup_printf ("%s/rb-test-recurse-%d", g_get_tmp_dir (), getpid ());
+	for (i = 0; recurse_test_dirs[i] != NULL; i++) {
+		path = g_build_filename (root, recurse_test_dirs[i], NULL);
+		g_mkdir_with_parents (path, 0700);
+		g_free (path);
+	}
+	for (i = 0; recurse_test_files[i] != NULL; i++) {
+		path = g_build_filename (root, recurse_test_files[i], NULL);
+		g_file_set_contents (path, "", 0, NULL);
+		g_free (path);
+	}
+
+	/* symlink loop back to the top */
+	path = g_build_filename (root, "a", "b", "loop", NULL);
+	target = g_build_filename (root, "a", NULL);
+	fail_unless (symlink (target, path) == 0);
+	g_free (target);
+	g_free (path);
+
+	return root;
+}
+
+static void
+remove_recurse_test_tree (char *root)
+{
+	char *path;
+	int i;
+
+	path = g_build_filename (root, "a", "b", "loop", NULL);
+	g_unlink (path);
+	g_free (path);
+
+	for (i = 0; recurse_test_files[i] != NULL; i++) {
+		path = g_build_filename (root, recurse_test_files[i], NULL);
+		g_unlink (path);
+		g_free (path);
+	}
+	for (i = G_N_ELEMENTS (recurse_test_dirs) - 2; i >= 0; i--) {
+		path = g_build_filename (root, recurse_test_dirs[i], NULL);
+		g_rmdir (path);
+		g_free (path);
+	}
+	g_rmdir (root);
+	g_free (root);
+}
+
+static gboolean
+count_recurse_cb (GFile *file, gboolean dir, int *counts)
+{
+	counts[dir ? 1 : 0]++;
+	return TRUE;
+}
+
+START_TEST (test_rb_uri_handle_recursively)
+{
+	char *root;
+	char *uri;
+	int counts[2] = { 0, 0 };
+
+	init_once (TRUE);
+
+	root = make_recurse_test_tree ();
+	uri = g_filename_to_uri (root, NULL, NULL);
+
+	rb_uri_handle_recursively (uri, NULL, (RBUriRecurseFunc) count_recurse_cb, counts);
+	fail_unless (counts[0] == 3, "found %d files", counts[0]);
+	fail_unless (counts[1] == 3, "found %d directories", counts[1]);
+
+	g_free (uri);
+	remove_recurse_test_tree (root);
+}
+END_TEST
+
+typedef struct {
+	int counts[2];
+	GMainLoop *loop;
+} RecurseAsyncData;
+
+static gboolean
+count_recurse_async_cb (GFile *file, gboolean dir, RecurseAsyncData *data)
+{
+	fail_unless (rb_is_main_thread ());
+	return count_recurse_cb (file, dir, data->counts);
+}
+
+static void
+recurse_async_done_cb (RecurseAsyncData *data)
+{
+	g_main_loop_quit (data->loop);
+}
+
+START_TEST (test_rb_uri_handle_recursively_async)
+{
+	RecurseAsyncData data = { { 0, 0 }, NULL };
+	char *root;
+	char *uri;
+
+	init_once (TRUE);
+
+	root = make_recurse_test_tree ();
+	uri = g_filename_to_uri (root, NULL, NULL);
+
+	data.loop = g_main_loop_new (NULL, FALSE);
+	rb_uri_handle_recursively_async (uri,
+					 NULL,
+					 (RBUriRecurseFunc) count_recurse_async_cb,
+					 &data,
+					 (GDestroyNotify) recurse_async_done_cb);
+	g_main_loop_run (data.loop);
+	g_main_loop_unref (data.loop);
+
+	fail_unless (data.counts[0] == 3, "found %d files", data.counts[0]);
+	fail_unless (data.counts[1] == 3, "found %d directories", data.counts[1]);
+
+	g_free (uri);
+	remove_recurse_test_tree (root);
+}
+END_TEST
+
+static void
+walk_cached (const char *uri, RBDirCache *cache, RecurseAsyncData *data)
+{
+	data->counts[0] = 0;
+	data->counts[1] = 0;
+	data->loop = g_main_loop_new (NULL, FALSE);
+	rb_uri_handle_recursively_cached_async (uri,
+						NULL,
+						cache,
+						(RBUriRecurseFunc) count_recurse_async_cb,
+						data,
+						(GDestroyNotify) recurse_async_done_cb);
+	g_main_loop_run (data->loop);
+	g_main_loop_unref (data->loop);
+}
+
+START_TEST (test_rb_uri_handle_recursively_cached)
+{
+	RecurseAsyncData data;
+	RBDirCache *cache;
+	struct utimbuf times;
+	GTimeVal mtime;
+	guint child_count;
+	char **subdirs;
+	char *root;
+	char *uri;
+	char *dir_uri;
+	char *cache_file;
+	char *path;
+	int i;
+
+	init_once (TRUE);
+
+	root = make_recurse_test_tree ();
+	uri = g_filename_to_uri (root, NULL, NULL);
+	cache_file = g_strdup_printf ("%s/rb-test-dir-cache-%d", g_get_tmp_dir (), getpid ());
+
+	/* directories modified very recently aren't cached */
+	times.actime = times.modtime = time (NULL) - 60;
+	g_utime (root, &times);
+	for (i = 0; recurse_test_dirs[i] != NULL; i++) {
+		path = g_build_filename (root, recurse_test_dirs[i], NULL);
+		g_utime (path, &times);
+		g_free (path);
+	}
+
+	/* first walk lists everything */
+	cache = rb_dir_cache_new (cache_file);
+	walk_cached (uri, cache, &data);
+	fail_unless (data.counts[0] == 3, "found %d files", data.counts[0]);
+	fail_unless (data.counts[1] == 3, "found %d directories", data.counts[1]);
+	fail_unless (rb_dir_cache_save (cache, NULL));
+	rb_dir_cache_free (cache);
+
+	/* second walk only finds the directories */
+	cache = rb_dir_cache_new (cache_file);
+	walk_cached (uri, cache, &data);
+	fail_unless (data.counts[0] == 0, "found %d files", data.counts[0]);
+	fail_unless (data.counts[1] == 3, "found %d directories", data.counts[1]);
+
+	/* changing a directory's modification time lists it again */
+	path = g_build_filename (root, "a", "b", NULL);
+	times.modtime++;
+	g_utime (path, &times);
+	g_free (path);
+	walk_cached (uri, cache, &data);
+	fail_unless (data.counts[0] == 1, "found %d files", data.counts[0]);
+	fail_unless (data.counts[1] == 3, "found %d directories", data.counts[1]);
+
+	/* a directory invalidated before it's updated is still listed next time */
+	path = g_build_filename (root, "a", "b", NULL);
+	dir_uri = g_filename_to_uri (path, NULL, NULL);
+	mtime.tv_sec = times.modtime;
+	mtime.tv_usec = 0;
+	subdirs = rb_dir_cache_lookup (cache, dir_uri, &mtime, &child_count);
+	fail_unless (subdirs != NULL, "directory not cached");
+	rb_dir_cache_invalidate (cache, dir_uri);
+	rb_dir_cache_update (cache, dir_uri, &mtime, child_count, subdirs);
+	fail_unless (rb_dir_cache_save (cache, NULL));
+	rb_dir_cache_free (cache);
+	g_strfreev (subdirs);
+	g_free (dir_uri);
+	g_free (path);
+
+	cache = rb_dir_cache_new (cache_file);
+	walk_cached (uri, cache, &data);
+	fail_unless (data.counts[0] == 1, "found %d files", data.counts[0]);
+	fail_unless (data.counts[1] == 3, "found %d directories", data.counts[1]);
+	rb_dir_cache_free (cache);
+
+	g_unlink (cache_file);
+	g_free (cache_file);
+	g_free (uri);
+	remove_recurse_test_tree (root);
+}
+END_TEST
+
 static Suite *
 rb_file_helpers_suite ()
 {
@@ -110,6 +341,9 @@ rb_file_helpers_suite ()
 
 	tcase_add_test (tc_chain, test_rb_uri_get_short_path_name);
 	tcase_add_test (tc_chain, test_rb_check_dir_has_space);
+	tcase_add_test (tc_chain, test_rb_uri_handle_recursively);
+	tcase_add_test (tc_chain, test_rb_uri_handle_recursively_async);
+	tcase_add_test (tc_chain, test_rb_uri_handle_recursively_cached);
 
 	return s;
 }
@@ -0,0 +1,166 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <check.h>
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+#include <string.h>
+
+#include "test-utils.h"
+#include "rb-shell.h"
+#include "rb-auto-playlist-source.h"
+#include "rb-playlist-source.h"
+#include "rb-entry-view.h"
+#include "rb-stock-icons.h"
+
+#include "rb-debug.h"
+#include "rb-file-helpers.h"
+#include "rb-util.h"
+
+static RBShell *shell = NULL;
+static char *rhythmdb_file = NULL;
+static char *playlists_file = NULL;
+
+static void
+test_shell_setup (void)
+{
+	init_once (TRUE);
+	rb_stock_icons_init ();
+
+	/* nothing is saved during the tests, so these don't need to exist */
+	rhythmdb_file = g_build_filename (g_get_tmp_dir (), "rb-test-rhythmdb.xml", NULL);
+	playlists_file = g_build_filename (g_get_tmp_dir (), "rb-test-playlists.xml", NULL);
+
+	shell = rb_shell_new (TRUE, TRUE, TRUE, FALSE, TRUE, rhythmdb_file, playlists_file);
+	fail_unless (shell != NULL, "failed to create shell");
+}
+
+static void
+test_shell_shutdown (void)
+{
+	/* the shell isn't torn down, as it expects to be running until the
+	 * process exits; each test runs in its own process anyway.
+	 */
+	shell = NULL;
+
+	g_free (rhythmdb_file);
+	g_free (playlists_file);
+	rhythmdb_file = NULL;
+	playlists_file = NULL;
+}
+
+static void
+set_genre_query (RBAutoPlaylistSource *source, RhythmDB *db, const char *genre)
+{
+	RhythmDBQuery *query;
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, genre,
+				      RHYTHMDB_QUERY_END);
+	rb_auto_playlist_source_set_query (source, query,
+					   RHYTHMDB_QUERY_MODEL_LIMIT_NONE, NULL,
+					   "Artist", GTK_SORT_ASCENDING);
+	rhythmdb_query_free (query);
+}
+
+START_TEST (test_auto_playlist_save_after_query_change)
+{
+	RhythmDB *shell_db;
+	RBSource *source;
+	char *xml;
+
+	g_object_get (shell, "db", &shell_db, NULL);
+	source = rb_auto_playlist_source_new (shell, "test", TRUE);
+
+	set_genre_query (RB_AUTO_PLAYLIST_SOURCE (source), shell_db, "Rock");
+	xml = rb_playlist_source_save_to_string (RB_PLAYLIST_SOURCE (source), FALSE);
+	fail_unless (strstr (xml, "Rock") != NULL, "saved playlist doesn't contain the query");
+	g_free (xml);
+
+	/* changing the query must replace the saved form of the playlist */
+	set_genre_query (RB_AUTO_PLAYLIST_SOURCE (source), shell_db, "Jazz");
+	xml = rb_playlist_source_save_to_string (RB_PLAYLIST_SOURCE (source), FALSE);
+	fail_unless (strstr (xml, "Jazz") != NULL, "saved playlist doesn't contain the new query");
+	fail_unless (strstr (xml, "Rock") == NULL, "saved playlist still contains the old query");
+	g_free (xml);
+
+	/* and so must changing the sort order */
+	rb_entry_view_set_sorting_order (rb_source_get_entry_view (source), "Title", GTK_SORT_DESCENDING);
+	xml = rb_playlist_source_save_to_string (RB_PLAYLIST_SOURCE (source), FALSE);
+	fail_unless (strstr (xml, "Title") != NULL, "saved playlist doesn't contain the new sort order");
+	g_free (xml);
+
+	g_object_unref (source);
+	g_object_unref (shell_db);
+}
+END_TEST
+
+static Suite *
+rb_playlist_source_suite (void)
+{
+	Suite *s = suite_create ("RBPlaylistSource");
+	TCase *tc_save = tcase_create ("save");
+
+	suite_add_tcase (s, tc_save);
+	tcase_add_checked_fixture (tc_save, test_shell_setup, test_shell_shutdown);
+	tcase_add_test (tc_save, test_auto_playlist_save_after_query_change);
+
+	return s;
+}
+
+int
+main (int argc, char **argv)
+{
+	int ret;
+	SRunner *sr;
+	Suite *s;
+
+	g_thread_init (NULL);
+	rb_threads_init ();
+	rb_debug_init (TRUE);
+	rb_refstring_system_init ();
+	rb_file_helpers_init (TRUE);
+	gst_init (&argc, &argv);
+
+	/* setup tests */
+	s = rb_playlist_source_suite ();
+	sr = srunner_create (s);
+
+	init_setup (sr, argc, argv);
+	init_once (FALSE);
+
+	srunner_run_all (sr, CK_NORMAL);
+	ret = srunner_ntests_failed (sr);
+	srunner_free (sr);
+
+	rb_file_helpers_shutdown ();
+	rb_refstring_system_shutdown ();
+
+	return ret;
+}
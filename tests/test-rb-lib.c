@@ -34,8 +34,12 @@
 #include "test-utils.h"
 #include "rb-util.h"
 #include "rb-string-value-map.h"
+#include "rb-text-store.h"
 #include "rb-debug.h"
 
+/* text store keys hold the offset of the string above its length */
+#define TEXT_KEY_OFFSET(key)	((key) >> 24)
+
 START_TEST (test_rb_string_value_map)
 {
 	RBStringValueMap *map;
@@ -82,6 +86,72 @@ START_TEST (test_rb_string_value_map)
 }
 END_TEST
 
+static void
+check_text (RBTextStore *store, guint64 key, const char *expected)
+{
+	char *text;
+
+	text = rb_text_store_get (store, key);
+	fail_unless (text != NULL, "couldn't read back \"%s\"", expected);
+	fail_unless (strcmp (text, expected) == 0, "read \"%s\", expected \"%s\"", text, expected);
+	g_free (text);
+}
+
+START_TEST (test_rb_text_store)
+{
+	RBTextStore *store;
+	GError *error = NULL;
+	guint64 hello, world, abc, xyz, long_key, qq, z;
+
+	store = rb_text_store_new (g_get_tmp_dir (), &error);
+	fail_unless (store != NULL, "couldn't create text store: %s", error ? error->message : "");
+
+	/* add, get */
+	fail_unless (rb_text_store_add (store, "") == 0, "empty strings shouldn't be stored");
+	hello = rb_text_store_add (store, "hello");
+	world = rb_text_store_add (store, "world!");
+	abc = rb_text_store_add (store, "abc");
+	fail_unless (hello != 0 && world != 0 && abc != 0, "couldn't add strings");
+	fail_unless (TEXT_KEY_OFFSET (hello) == 0, "first string should be at the start");
+	fail_unless (TEXT_KEY_OFFSET (world) == 5, "strings should be stored end to end");
+	fail_unless (TEXT_KEY_OFFSET (abc) == 11, "strings should be stored end to end");
+	check_text (store, hello, "hello");
+	check_text (store, world, "world!");
+	check_text (store, abc, "abc");
+
+	/* removed space is reused */
+	rb_text_store_remove (store, world);
+	xyz = rb_text_store_add (store, "xyz");
+	fail_unless (TEXT_KEY_OFFSET (xyz) == 5, "removed space should be reused");
+	check_text (store, hello, "hello");
+	check_text (store, xyz, "xyz");
+	check_text (store, abc, "abc");
+
+	/* free ranges either side of a removed string are merged with it */
+	rb_text_store_remove (store, hello);
+	rb_text_store_remove (store, xyz);
+	long_key = rb_text_store_add (store, "0123456789A");
+	fail_unless (TEXT_KEY_OFFSET (long_key) == 0, "adjacent free ranges should be merged");
+	check_text (store, long_key, "0123456789A");
+	check_text (store, abc, "abc");
+
+	/* free space at the end of the file is given back */
+	rb_text_store_remove (store, abc);
+	qq = rb_text_store_add (store, "qq");
+	fail_unless (TEXT_KEY_OFFSET (qq) == 11, "space at the end should be truncated");
+	check_text (store, qq, "qq");
+
+	/* removing everything empties the file */
+	rb_text_store_remove (store, long_key);
+	rb_text_store_remove (store, qq);
+	z = rb_text_store_add (store, "z");
+	fail_unless (TEXT_KEY_OFFSET (z) == 0, "empty store should start again at the beginning");
+	check_text (store, z, "z");
+
+	rb_text_store_free (store);
+}
+END_TEST
+
 static Suite *
 rb_file_helpers_suite ()
 {
@@ -91,6 +161,7 @@ rb_file_helpers_suite ()
 	suite_add_tcase (s, tc_chain);
 
 	tcase_add_test (tc_chain, test_rb_string_value_map);
+	tcase_add_test (tc_chain, test_rb_text_store);
 
 	return s;
 }
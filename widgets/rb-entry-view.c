@@ -140,6 +140,15 @@ static void rb_entry_view_row_inserted_cb (GtkTreeModel *model,
 static void rb_entry_view_row_deleted_cb (GtkTreeModel *model,
 					  GtkTreePath *path,
 					  RBEntryView *view);
+static void rb_entry_view_entry_prop_changed_cb (RhythmDBQueryModel *model,
+						RhythmDBEntry *entry,
+						RhythmDBPropType prop,
+						const GValue *old,
+						const GValue *new_value,
+						RBEntryView *view);
+static void rb_entry_view_uncache_entry (RBEntryView *view,
+					 RhythmDBEntry *entry);
+static void rb_entry_view_uncache_all (RBEntryView *view);
 static void rb_entry_view_rows_reordered_cb (GtkTreeModel *model,
 					     GtkTreePath *path,
 					     GtkTreeIter *iter,
@@ -201,6 +210,8 @@ struct RBEntryViewPrivate
 
 	GHashTable *propid_column_map;
 	GHashTable *column_sort_data_map;
+
+	GList *cached_columns;
 };
 
 
@@ -622,9 +633,14 @@ rb_entry_view_set_model_internal (RBEntryView        *view,
 		g_signal_handlers_disconnect_by_func (view->priv->model,
 						      G_CALLBACK (rb_entry_view_rows_reordered_cb),
 						      view);
+		g_signal_handlers_disconnect_by_func (view->priv->model,
+						      G_CALLBACK (rb_entry_view_entry_prop_changed_cb),
+						      view);
 		g_object_unref (view->priv->model);
 	}
 
+	rb_entry_view_uncache_all (view);
+
 	gtk_tree_selection_unselect_all (view->priv->selection);
 
 	view->priv->model = model;
@@ -645,6 +661,11 @@ rb_entry_view_set_model_internal (RBEntryView        *view,
 					 G_CALLBACK (rb_entry_view_rows_reordered_cb),
 					 view,
 					 0);
+		g_signal_connect_object (view->priv->model,
+					 "entry-prop-changed",
+					 G_CALLBACK (rb_entry_view_entry_prop_changed_cb),
+					 view,
+					 0);
 
 		if (view->priv->sorting_column != NULL) {
 			rb_entry_view_resort_model (view);
@@ -804,6 +825,8 @@ rb_entry_view_set_model (RBEntryView *view,
 struct RBEntryViewCellDataFuncData {
 	RBEntryView *view;
 	RhythmDBPropType propid;
+	char *(*format) (RhythmDBEntry *entry, RhythmDBPropType propid);
+	GHashTable *cache;
 };
 
 static void
@@ -863,179 +886,157 @@ rb_entry_view_rating_cell_data_func (GtkTreeViewColumn *column,
 	rhythmdb_entry_unref (entry);
 }
 
-static void
-rb_entry_view_bpm_cell_data_func (GtkTreeViewColumn *column,
-				   GtkCellRenderer *renderer,
-				   GtkTreeModel *tree_model,
-				   GtkTreeIter *iter,
-				   struct RBEntryViewCellDataFuncData *data)
+static char *
+rb_entry_view_format_bpm (RhythmDBEntry *entry, RhythmDBPropType propid)
 {
-	RhythmDBEntry *entry;
-	char *str;
 	gdouble val;
 
-	entry = rhythmdb_query_model_iter_to_entry (data->view->priv->model, iter);
-
-	val = rhythmdb_entry_get_double (entry, data->propid);
+	val = rhythmdb_entry_get_double (entry, propid);
 
 	if (val > 0.001)
-		str = g_strdup_printf ("%.2f", val);
+		return g_strdup_printf ("%.2f", val);
 	else
-		str = g_strdup ("");
-
-	g_object_set (renderer, "text", str, NULL);
-	g_free (str);
-	rhythmdb_entry_unref (entry);
+		return g_strdup ("");
 }
 
-static void
-rb_entry_view_long_cell_data_func (GtkTreeViewColumn *column,
-				   GtkCellRenderer *renderer,
-				   GtkTreeModel *tree_model,
-				   GtkTreeIter *iter,
-				   struct RBEntryViewCellDataFuncData *data)
+static char *
+rb_entry_view_format_long (RhythmDBEntry *entry, RhythmDBPropType propid)
 {
-	RhythmDBEntry *entry;
-	char *str;
 	gulong val;
 
-	entry = rhythmdb_query_model_iter_to_entry (data->view->priv->model, iter);
-
-	val = rhythmdb_entry_get_ulong (entry, data->propid);
+	val = rhythmdb_entry_get_ulong (entry, propid);
 
 	if (val > 0)
-		str = g_strdup_printf ("%lu", val);
+		return g_strdup_printf ("%lu", val);
 	else
-		str = g_strdup ("");
-
-	g_object_set (renderer, "text", str, NULL);
-	g_free (str);
-	rhythmdb_entry_unref (entry);
+		return g_strdup ("");
 }
 
-static void
-rb_entry_view_play_count_cell_data_func (GtkTreeViewColumn *column,
-					 GtkCellRenderer *renderer,
-					 GtkTreeModel *tree_model,
-					 GtkTreeIter * iter,
-					 struct RBEntryViewCellDataFuncData *data)
+static char *
+rb_entry_view_format_play_count (RhythmDBEntry *entry, RhythmDBPropType propid)
 {
-	RhythmDBEntry *entry;
 	gulong i;
-	char *str;
-
-	entry = rhythmdb_query_model_iter_to_entry (data->view->priv->model, iter);
 
-	i = rhythmdb_entry_get_ulong (entry, data->propid);
+	i = rhythmdb_entry_get_ulong (entry, propid);
 	if (i == 0)
-		str = _("Never");
+		return g_strdup (_("Never"));
 	else
-		str = g_strdup_printf ("%ld", i);
-
-	g_object_set (renderer, "text", str, NULL);
-	if (i != 0)
-		g_free (str);
-
-	rhythmdb_entry_unref (entry);
+		return g_strdup_printf ("%ld", i);
 }
 
-static void
-rb_entry_view_duration_cell_data_func (GtkTreeViewColumn *column,
-				       GtkCellRenderer *renderer,
-				       GtkTreeModel *tree_model,
-				       GtkTreeIter *iter,
-				       struct RBEntryViewCellDataFuncData *data)
+static char *
+rb_entry_view_format_duration (RhythmDBEntry *entry, RhythmDBPropType propid)
 {
-	RhythmDBEntry *entry;
 	gulong duration;
-	char *str;
 
-	entry = rhythmdb_query_model_iter_to_entry (data->view->priv->model, iter);
 	duration = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DURATION);
-
-	str = rb_make_duration_string (duration);
-	g_object_set (renderer, "text", str, NULL);
-	g_free (str);
-	rhythmdb_entry_unref (entry);
+	return rb_make_duration_string (duration);
 }
 
-static void
-rb_entry_view_year_cell_data_func (GtkTreeViewColumn *column,
-				   GtkCellRenderer *renderer,
-				   GtkTreeModel *tree_model,
-				   GtkTreeIter *iter,
-				   struct RBEntryViewCellDataFuncData *data)
+static char *
+rb_entry_view_format_year (RhythmDBEntry *entry, RhythmDBPropType propid)
 {
-	RhythmDBEntry *entry;
 	char str[255];
 	int julian;
 	GDate *date;
 
-	entry = rhythmdb_query_model_iter_to_entry (data->view->priv->model, iter);
 	julian = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DATE);
 
 	if (julian > 0) {
 		date = g_date_new_julian (julian);
 		g_date_strftime (str, sizeof (str), "%Y", date);
-		g_object_set (renderer, "text", str, NULL);
 		g_date_free (date);
+		return g_strdup (str);
 	} else {
-		g_object_set (renderer, "text", _("Unknown"), NULL);
+		return g_strdup (_("Unknown"));
 	}
-
-	rhythmdb_entry_unref (entry);
 }
 
-static void
-rb_entry_view_quality_cell_data_func (GtkTreeViewColumn *column,
-				      GtkCellRenderer *renderer,
-				      GtkTreeModel *tree_model,
-				      GtkTreeIter *iter,
-				      struct RBEntryViewCellDataFuncData *data)
+static char *
+rb_entry_view_format_quality (RhythmDBEntry *entry, RhythmDBPropType propid)
 {
-	RhythmDBEntry *entry;
 	gulong bitrate;
 
-	entry = rhythmdb_query_model_iter_to_entry (data->view->priv->model, iter);
 	bitrate = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_BITRATE);
 
 	if (rhythmdb_entry_is_lossless (entry)) {
-		g_object_set (renderer, "text", _("Lossless"), NULL);
+		return g_strdup (_("Lossless"));
 	} else if (bitrate == 0) {
-		g_object_set (renderer, "text", _("Unknown"), NULL);
+		return g_strdup (_("Unknown"));
 	} else {
-		char *s;
-	       
-		s = g_strdup_printf (_("%lu kbps"), bitrate);
-		g_object_set (renderer, "text", s, NULL);
-		g_free (s);
+		return g_strdup_printf (_("%lu kbps"), bitrate);
 	}
+}
 
-	rhythmdb_entry_unref (entry);
+static char *
+rb_entry_view_format_location (RhythmDBEntry *entry, RhythmDBPropType propid)
+{
+	const char *location;
+
+	location = rhythmdb_entry_get_string (entry, propid);
+	return g_uri_unescape_string (location, NULL);
 }
 
+/*
+ * Columns that display formatted values keep the strings they've
+ * rendered for each entry, so drawing a row while scrolling doesn't
+ * have to format them again.  Cached strings are dropped when the
+ * entry changes or is removed from the model.
+ */
 static void
-rb_entry_view_location_cell_data_func (GtkTreeViewColumn *column,
-				       GtkCellRenderer *renderer,
-				       GtkTreeModel *tree_model,
-				       GtkTreeIter *iter,
-				       struct RBEntryViewCellDataFuncData *data)
+rb_entry_view_cached_cell_data_func (GtkTreeViewColumn *column,
+				     GtkCellRenderer *renderer,
+				     GtkTreeModel *tree_model,
+				     GtkTreeIter *iter,
+				     struct RBEntryViewCellDataFuncData *data)
 {
 	RhythmDBEntry *entry;
-	const char *location;
 	char *str;
 
 	entry = rhythmdb_query_model_iter_to_entry (data->view->priv->model, iter);
 
-	location = rhythmdb_entry_get_string (entry, data->propid);
-	str = g_uri_unescape_string (location, NULL);
+	str = g_hash_table_lookup (data->cache, entry);
+	if (str == NULL) {
+		str = data->format (entry, data->propid);
+		g_hash_table_insert (data->cache, rhythmdb_entry_ref (entry), str);
+	}
 
 	g_object_set (renderer, "text", str, NULL);
-	g_free (str);
-
 	rhythmdb_entry_unref (entry);
 }
 
+static void
+rb_entry_view_cell_data_free (struct RBEntryViewCellDataFuncData *data)
+{
+	if (data->cache != NULL) {
+		data->view->priv->cached_columns = g_list_remove (data->view->priv->cached_columns, data);
+		g_hash_table_destroy (data->cache);
+	}
+	g_free (data);
+}
+
+static void
+rb_entry_view_uncache_entry (RBEntryView *view, RhythmDBEntry *entry)
+{
+	GList *l;
+
+	for (l = view->priv->cached_columns; l != NULL; l = l->next) {
+		struct RBEntryViewCellDataFuncData *data = l->data;
+		g_hash_table_remove (data->cache, entry);
+	}
+}
+
+static void
+rb_entry_view_uncache_all (RBEntryView *view)
+{
+	GList *l;
+
+	for (l = view->priv->cached_columns; l != NULL; l = l->next) {
+		struct RBEntryViewCellDataFuncData *data = l->data;
+		g_hash_table_remove_all (data->cache);
+	}
+}
+
 static void
 rb_entry_view_string_cell_data_func (GtkTreeViewColumn *column,
 				     GtkCellRenderer *renderer,
@@ -1411,7 +1412,7 @@ rb_entry_view_append_column (RBEntryView *view,
 	case RB_ENTRY_VIEW_COL_TRACK_NUMBER:
 		propid = RHYTHMDB_PROP_TRACK_NUMBER;
 		cell_data->propid = propid;
-		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_long_cell_data_func;
+		cell_data->format = rb_entry_view_format_long;
 		sort_func = (GCompareDataFunc) rhythmdb_query_model_track_sort_func;
 		title = _("Track");
 		key = "Track";
@@ -1471,7 +1472,7 @@ rb_entry_view_append_column (RBEntryView *view,
 	case RB_ENTRY_VIEW_COL_DURATION:
 		propid = RHYTHMDB_PROP_DURATION;
 		cell_data->propid = propid;
-		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_duration_cell_data_func;
+		cell_data->format = rb_entry_view_format_duration;
 		sort_propid = cell_data->propid;
 		sort_func = (GCompareDataFunc) rhythmdb_query_model_ulong_sort_func;
 		title = _("Time");
@@ -1483,7 +1484,7 @@ rb_entry_view_append_column (RBEntryView *view,
 	case RB_ENTRY_VIEW_COL_YEAR:
 		propid = RHYTHMDB_PROP_DATE;
 		cell_data->propid = propid;
-		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_year_cell_data_func;
+		cell_data->format = rb_entry_view_format_year;
 		sort_propid = cell_data->propid;
 		sort_func = (GCompareDataFunc) rhythmdb_query_model_date_sort_func;
 		title = _("Year");
@@ -1495,7 +1496,7 @@ rb_entry_view_append_column (RBEntryView *view,
 	case RB_ENTRY_VIEW_COL_QUALITY:
 		propid = RHYTHMDB_PROP_BITRATE;
 		cell_data->propid = propid;
-		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_quality_cell_data_func;
+		cell_data->format = rb_entry_view_format_quality;
 		sort_propid = cell_data->propid;
 		sort_func = (GCompareDataFunc) rhythmdb_query_model_bitrate_sort_func;
 		title = _("Quality");
@@ -1531,7 +1532,7 @@ rb_entry_view_append_column (RBEntryView *view,
 	case RB_ENTRY_VIEW_COL_PLAY_COUNT:
 		propid = RHYTHMDB_PROP_PLAY_COUNT;
 		cell_data->propid = propid;
-		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_play_count_cell_data_func;
+		cell_data->format = rb_entry_view_format_play_count;
 		sort_propid = cell_data->propid;
 		sort_func = (GCompareDataFunc) rhythmdb_query_model_ulong_sort_func;
 		title = _("Play Count");
@@ -1577,7 +1578,7 @@ rb_entry_view_append_column (RBEntryView *view,
 	case RB_ENTRY_VIEW_COL_LOCATION:
 		propid = RHYTHMDB_PROP_LOCATION;
 		cell_data->propid = RHYTHMDB_PROP_LOCATION;
-		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_location_cell_data_func;
+		cell_data->format = rb_entry_view_format_location;
 		sort_propid = RHYTHMDB_PROP_LOCATION;
 		sort_func = (GCompareDataFunc) rhythmdb_query_model_location_sort_func;
 		title = _("Location");
@@ -1587,7 +1588,7 @@ rb_entry_view_append_column (RBEntryView *view,
 	case RB_ENTRY_VIEW_COL_BPM:
 		propid = RHYTHMDB_PROP_BPM;
 		cell_data->propid = propid;
-		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_bpm_cell_data_func;
+		cell_data->format = rb_entry_view_format_bpm;
 		sort_func = (GCompareDataFunc) rhythmdb_query_model_double_ceiling_sort_func;
 		title = _("BPM");
 		key = "BPM";
@@ -1612,10 +1613,19 @@ rb_entry_view_append_column (RBEntryView *view,
 		sort_propid = propid;
 
 	if (renderer == NULL) {
+		if (cell_data->format != NULL) {
+			cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_cached_cell_data_func;
+			cell_data->cache = g_hash_table_new_full (NULL, NULL,
+								  (GDestroyNotify) rhythmdb_entry_unref,
+								  g_free);
+			view->priv->cached_columns = g_list_prepend (view->priv->cached_columns, cell_data);
+		}
+
 		renderer = gtk_cell_renderer_text_new ();
 		gtk_tree_view_column_pack_start (column, renderer, TRUE);
 		gtk_tree_view_column_set_cell_data_func (column, renderer,
-							 cell_data_func, cell_data, g_free);
+							 cell_data_func, cell_data,
+							 (GDestroyNotify) rb_entry_view_cell_data_free);
 
 		g_object_set_data (G_OBJECT (renderer), CELL_PROPID_ITEM, GINT_TO_POINTER (propid));
 		g_signal_connect_object (renderer, "edited",
@@ -2128,10 +2138,22 @@ rb_entry_view_row_deleted_cb (GtkTreeModel *model,
 	RhythmDBEntry *entry = rhythmdb_query_model_tree_path_to_entry (RHYTHMDB_QUERY_MODEL (model), path);
 
 	rb_debug ("row deleted");
+	rb_entry_view_uncache_entry (view, entry);
 	g_signal_emit (G_OBJECT (view), rb_entry_view_signals[ENTRY_DELETED], 0, entry);
 	rhythmdb_entry_unref (entry);
 }
 
+static void
+rb_entry_view_entry_prop_changed_cb (RhythmDBQueryModel *model,
+				     RhythmDBEntry *entry,
+				     RhythmDBPropType prop,
+				     const GValue *old,
+				     const GValue *new_value,
+				     RBEntryView *view)
+{
+	rb_entry_view_uncache_entry (view, entry);
+}
+
 static void
 rb_entry_view_rows_reordered_cb (GtkTreeModel *model,
 				 GtkTreePath *path,